@@ -61,7 +61,7 @@ impl Handler for BasicAuthMiddleware {
 			return next_handler.call(req, handlers);
 		}
 		if let Some(u) = self.ignore_uri.as_ref() {
-			if req.uri().path() == u {
+			if path_matches(req.uri().path(), u) {
 				return next_handler.call(req, handlers);
 			}
 		}
@@ -114,7 +114,7 @@ impl Handler for BasicAuthURIMiddleware {
 		if req.method().as_str() == "OPTIONS" {
 			return next_handler.call(req, handlers);
 		}
-		if req.uri().path() == self.target_uri {
+		if path_matches(req.uri().path(), &self.target_uri) {
 			if req.headers().contains_key(AUTHORIZATION)
 				&& verify_slices_are_equal(
 					req.headers()[AUTHORIZATION].as_bytes(),
@@ -133,6 +133,12 @@ impl Handler for BasicAuthURIMiddleware {
 	}
 }
 
+// Whether `path` is `uri` itself or one of its sub paths, so that endpoints
+// nested under an API (e.g. /v2/foreign/scan) share its credentials.
+fn path_matches(path: &str, uri: &str) -> bool {
+	path == uri || (path.starts_with(uri) && path[uri.len()..].starts_with('/'))
+}
+
 fn unauthorized_response(basic_realm: &HeaderValue) -> ResponseFuture {
 	let response = Response::builder()
 		.status(StatusCode::UNAUTHORIZED)
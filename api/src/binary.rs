@@ -0,0 +1,159 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Binary transport for the foreign JSON-RPC API.
+//!
+//! Requests are regular JSON-RPC calls but clients sending
+//! `Accept: application/octet-stream` get the result of the call in the
+//! consensus serialization (the one used on the p2p wire) instead of JSON.
+//! Blocks, outputs and kernels are then sent as raw bytes rather than hex
+//! strings, roughly halving the payload and skipping the hex and JSON
+//! encoding on both ends.
+//!
+//! Only methods whose result has a natural consensus encoding are served in
+//! binary:
+//!
+//! * `get_tip` - `chain::Tip`
+//! * `get_header` - `BlockHeader`
+//! * `get_block` - `Block`
+//! * `get_kernel` - `LocatedTxKernel`
+//! * `scan_unspent_outputs` - `UtxoScanPage`
+//!
+//! `scan_unspent_outputs` takes the same params as `get_unspent_outputs` but
+//! has no JSON counterpart: it returns the raw `UtxoScanPage` and caps `max`
+//! at `MAX_SCAN_PAGE`, like the `/v2/foreign/scan` route. Binary
+//! `get_unspent_outputs` calls are answered in JSON, with the same
+//! `OutputListing` as any other client gets.
+//!
+//! Other methods, and calls that fail, are answered with the usual JSON-RPC
+//! reply, so clients must look at the content type of the response.
+
+use crate::chain::Chain;
+use crate::core::core::hash::Hash;
+use crate::core::ser::{self, ProtocolVersion, Writeable};
+use crate::executor::BlockingPool;
+use crate::handlers::blocks_api::HeaderHandler;
+use crate::handlers::chain_api::{KernelHandler, UtxoScanHandler, MAX_SCAN_PAGE};
+use crate::handlers::utils::w;
+use crate::rest::{Error, ErrorKind};
+use hyper::header::ACCEPT;
+use hyper::{Body, Request};
+use serde_json::Value;
+use std::sync::{Arc, Weak};
+
+/// Content type of binary requests and replies.
+pub const BINARY_CONTENT_TYPE: &str = "application/octet-stream";
+
+/// Producer of the consensus serialization of a call result, run on the
+/// blocking pool.
+pub type BinaryProducer = Box<dyn FnOnce() -> Result<Vec<u8>, Error> + Send>;
+
+/// Whether the client asked for binary replies.
+pub fn accepts_binary(req: &Request<Body>) -> bool {
+	req.headers()
+		.get_all(ACCEPT)
+		.iter()
+		.filter_map(|v| v.to_str().ok())
+		.any(|v| v.contains(BINARY_CONTENT_TYPE))
+}
+
+fn ser_result<T: Writeable>(res: Result<T, Error>) -> Result<Vec<u8>, Error> {
+	let res = res?;
+	ser::ser_vec(&res, ProtocolVersion::local())
+		.map_err(|e| ErrorKind::Internal(format!("can't serialize binary reply: {}", e)).into())
+}
+
+/// Producer of the binary reply to the JSON-RPC request `req`, `None` if the
+/// method has no binary encoding (or the params are malformed, in which case
+/// the regular JSON-RPC handler reports the error).
+pub fn binary_request(
+	chain: &Weak<Chain>,
+	pool: &Arc<BlockingPool>,
+	req: &Value,
+) -> Option<BinaryProducer> {
+	req.get("id")?;
+	let params = req
+		.get("params")
+		.and_then(|p| p.as_array())
+		.cloned()
+		.unwrap_or_default();
+	let chain = chain.clone();
+	let opt_u64 = |v: Option<&Value>| match v {
+		None | Some(Value::Null) => Some(None),
+		Some(v) => v.as_u64().map(Some),
+	};
+	let opt_str = |v: Option<&Value>| match v {
+		None | Some(Value::Null) => Some(None),
+		Some(v) => v.as_str().map(|s| Some(s.to_owned())),
+	};
+
+	let producer: BinaryProducer = match req.get("method")?.as_str()? {
+		"get_tip" => Box::new(move || {
+			ser_result(w(&chain).and_then(|c| {
+				c.head()
+					.map_err(|e| ErrorKind::Internal(format!("{}", e)).into())
+			}))
+		}),
+		"get_header" | "get_block" => {
+			let height = opt_u64(params.get(0))?;
+			let hash = match opt_str(params.get(1))? {
+				Some(h) => Some(Hash::from_hex(&h).ok()?),
+				None => None,
+			};
+			let commit = opt_str(params.get(2))?;
+			let block = req.get("method")?.as_str()? == "get_block";
+			Box::new(move || {
+				let handler = HeaderHandler {
+					chain: chain.clone(),
+				};
+				let hash = handler.parse_inputs(height, hash, commit)?;
+				let chain = w(&chain)?;
+				if block {
+					ser_result(
+						chain
+							.get_block(&hash)
+							.map_err(|_| ErrorKind::NotFound.into()),
+					)
+				} else {
+					ser_result(
+						chain
+							.get_block_header(&hash)
+							.map_err(|_| ErrorKind::NotFound.into()),
+					)
+				}
+			})
+		}
+		"get_kernel" => {
+			let excess = params.get(0)?.as_str()?.to_owned();
+			let min_height = opt_u64(params.get(1))?;
+			let max_height = opt_u64(params.get(2))?;
+			Box::new(move || {
+				let handler = KernelHandler { chain };
+				ser_result(handler.get_kernel_v2(excess, min_height, max_height))
+			})
+		}
+		"scan_unspent_outputs" => {
+			let start_index = params.get(0)?.as_u64()?;
+			let end_index = opt_u64(params.get(1))?;
+			let max = params.get(2)?.as_u64()?.min(MAX_SCAN_PAGE);
+			let handler = UtxoScanHandler {
+				chain,
+				pool: pool.clone(),
+			};
+			Box::new(move || ser_result(handler.scan(start_index, end_index, max, false)))
+		}
+		_ => return None,
+	};
+	Some(producer)
+}
@@ -0,0 +1,384 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Response cache for the foreign JSON-RPC API.
+//!
+//! Wallets poll the same handful of read-only calls over and over between
+//! blocks. Replies are cached keyed by method, params and the chain head hash
+//! they were computed against, so a head change makes every entry stale
+//! without further bookkeeping. Headers requested by hash never change and
+//! blocks requested by hash below the reorg horizon change very rarely, those
+//! are kept in a second, longer lived, tier.
+
+use crate::core::core::hash::Hash;
+use crate::util::RwLock;
+use serde_json::Value;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// Depth below the head after which we consider a block settled.
+pub const REORG_HORIZON: u64 = 60;
+
+/// Number of blocks a settled block response is served from the long lived
+/// tier. The only field of a block that can still change is the `spent` flag
+/// of its outputs, so we bound how stale it can get.
+pub const IMMUTABLE_BLOCK_TTL: u64 = 60;
+
+/// Max number of entries cached for the current head.
+pub const MAX_TIP_ENTRIES: usize = 10_000;
+
+/// Max number of entries in the long lived tier.
+pub const MAX_IMMUTABLE_ENTRIES: usize = 10_000;
+
+/// Read-only methods whose replies only depend on the chain state.
+/// `get_unspent_outputs` is left out, its replies are streamed (see
+/// `handlers::stream_request`) and never go through the cache. So are
+/// `get_outputs` calls by height range, see `cache_key`.
+const CACHEABLE_METHODS: &[&str] = &[
+	"get_block",
+	"get_header",
+	"get_kernel",
+	"get_outputs",
+	"get_pmmr_indices",
+	"get_tip",
+	"get_version",
+];
+
+/// Cache counters, as returned by `ResponseCache::stats`.
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct CacheStats {
+	/// Requests served from the entries of the current head.
+	pub tip_hits: u64,
+	/// Requests served from the long lived tier.
+	pub immutable_hits: u64,
+	/// Cacheable requests that had to be computed.
+	pub misses: u64,
+	/// Requests that bypassed the cache.
+	pub uncacheable: u64,
+	/// Entries currently cached for the current head.
+	pub tip_entries: usize,
+	/// Entries currently in the long lived tier.
+	pub immutable_entries: usize,
+}
+
+impl CacheStats {
+	/// Ratio of cacheable requests served from the cache.
+	pub fn hit_rate(&self) -> f64 {
+		let hits = self.tip_hits + self.immutable_hits;
+		if hits + self.misses == 0 {
+			0.0
+		} else {
+			hits as f64 / (hits + self.misses) as f64
+		}
+	}
+}
+
+struct TipEntries {
+	head: Hash,
+	entries: HashMap<String, Value>,
+}
+
+struct ImmutableEntry {
+	result: Value,
+	// Head height from which the entry is no longer served, if any.
+	expires_at: Option<u64>,
+}
+
+/// Cache of foreign JSON-RPC results, see module documentation.
+pub struct ResponseCache {
+	tip: RwLock<TipEntries>,
+	immutable: RwLock<HashMap<String, ImmutableEntry>>,
+	tip_hits: AtomicU64,
+	immutable_hits: AtomicU64,
+	misses: AtomicU64,
+	uncacheable: AtomicU64,
+}
+
+impl ResponseCache {
+	/// Create an empty cache.
+	pub fn new() -> ResponseCache {
+		ResponseCache {
+			tip: RwLock::new(TipEntries {
+				head: Hash::default(),
+				entries: HashMap::new(),
+			}),
+			immutable: RwLock::new(HashMap::new()),
+			tip_hits: AtomicU64::new(0),
+			immutable_hits: AtomicU64::new(0),
+			misses: AtomicU64::new(0),
+			uncacheable: AtomicU64::new(0),
+		}
+	}
+
+	/// Serve the JSON-RPC request `req` from the cache if we have a reply
+	/// computed against chain head `head`, otherwise compute it with `f` and
+	/// cache successful results.
+	pub fn get_or_compute<F>(&self, req: &Value, head: Hash, head_height: u64, f: F) -> Value
+	where
+		F: FnOnce() -> Value,
+	{
+		let key = match cache_key(req) {
+			Some(key) => key,
+			None => {
+				self.uncacheable.fetch_add(1, Ordering::Relaxed);
+				return f();
+			}
+		};
+
+		if let Some(result) = self.lookup(&key, head, head_height) {
+			return reply(req, result);
+		}
+		self.misses.fetch_add(1, Ordering::Relaxed);
+
+		let res = f();
+		if let Some(result) = ok_result(&res) {
+			self.insert(key, req, result.clone(), head, head_height);
+		}
+		res
+	}
+
+	/// Drop all entries computed against the previous head. On a reorg
+	/// blocks cached in the long lived tier are dropped as well.
+	pub fn invalidate(&self, reorg: bool) {
+		self.tip.write().entries.clear();
+		if reorg {
+			self.immutable
+				.write()
+				.retain(|_, entry| entry.expires_at.is_none());
+		}
+	}
+
+	/// Current hit and size counters.
+	pub fn stats(&self) -> CacheStats {
+		CacheStats {
+			tip_hits: self.tip_hits.load(Ordering::Relaxed),
+			immutable_hits: self.immutable_hits.load(Ordering::Relaxed),
+			misses: self.misses.load(Ordering::Relaxed),
+			uncacheable: self.uncacheable.load(Ordering::Relaxed),
+			tip_entries: self.tip.read().entries.len(),
+			immutable_entries: self.immutable.read().len(),
+		}
+	}
+
+	fn lookup(&self, key: &str, head: Hash, head_height: u64) -> Option<Value> {
+		if let Some(entry) = self.immutable.read().get(key) {
+			if entry.expires_at.map_or(true, |h| head_height < h) {
+				self.immutable_hits.fetch_add(1, Ordering::Relaxed);
+				return Some(entry.result.clone());
+			}
+		}
+		let tip = self.tip.read();
+		if tip.head == head {
+			if let Some(result) = tip.entries.get(key) {
+				self.tip_hits.fetch_add(1, Ordering::Relaxed);
+				return Some(result.clone());
+			}
+		}
+		None
+	}
+
+	fn insert(&self, key: String, req: &Value, result: Value, head: Hash, head_height: u64) {
+		if let Some(expires_at) = immutable_expiry(req, &result, head_height) {
+			let mut immutable = self.immutable.write();
+			if immutable.len() >= MAX_IMMUTABLE_ENTRIES {
+				immutable.retain(|_, e| e.expires_at.map_or(true, |h| head_height < h));
+				if immutable.len() >= MAX_IMMUTABLE_ENTRIES {
+					immutable.clear();
+				}
+			}
+			immutable.insert(key, ImmutableEntry { result, expires_at });
+			return;
+		}
+
+		let mut tip = self.tip.write();
+		if tip.head != head {
+			tip.head = head;
+			tip.entries.clear();
+		}
+		if tip.entries.len() >= MAX_TIP_ENTRIES {
+			tip.entries.clear();
+		}
+		tip.entries.insert(key, result);
+	}
+}
+
+impl Default for ResponseCache {
+	fn default() -> ResponseCache {
+		ResponseCache::new()
+	}
+}
+
+// Cache key for a request, `None` if the request must not be cached.
+// Notifications (no id) expect no reply so they are never cached, nor are
+// `get_outputs` calls by height range (no commits), which are streamed.
+fn cache_key(req: &Value) -> Option<String> {
+	let method = req.get("method")?.as_str()?;
+	if req.get("id").is_none() || !CACHEABLE_METHODS.contains(&method) {
+		return None;
+	}
+	let params = req.get("params").unwrap_or(&Value::Null);
+	if method == "get_outputs" && params.get(0).map_or(true, |c| c.is_null()) {
+		return None;
+	}
+	Some(format!("{}:{}", method, params))
+}
+
+// The `result` of a reply, only if the call succeeded.
+fn ok_result(reply: &Value) -> Option<&Value> {
+	let result = reply.get("result")?;
+	result.get("Ok").map(|_| result)
+}
+
+fn reply(req: &Value, result: Value) -> Value {
+	serde_json::json!({
+		"id": req.get("id").cloned().unwrap_or(Value::Null),
+		"jsonrpc": "2.0",
+		"result": result,
+	})
+}
+
+// Headers and blocks requested by hash only (height and commit are null).
+fn by_hash(req: &Value) -> bool {
+	match req.get("params").and_then(|p| p.as_array()) {
+		Some(params) => {
+			params.len() == 3 && params[0].is_null() && params[1].is_string() && params[2].is_null()
+		}
+		None => false,
+	}
+}
+
+// Whether the result goes in the long lived tier: `Some(None)` forever,
+// `Some(Some(h))` until the head reaches height `h`.
+fn immutable_expiry(req: &Value, result: &Value, head_height: u64) -> Option<Option<u64>> {
+	if !by_hash(req) {
+		return None;
+	}
+	match req.get("method").and_then(|m| m.as_str()) {
+		Some("get_header") => Some(None),
+		Some("get_block") => {
+			let height = result.pointer("/Ok/header/height")?.as_u64()?;
+			if height.saturating_add(REORG_HORIZON) <= head_height {
+				Some(Some(head_height + IMMUTABLE_BLOCK_TTL))
+			} else {
+				None
+			}
+		}
+		_ => None,
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use crate::core::core::hash::Hashed;
+	use std::cell::Cell;
+
+	fn tip_req(id: u64) -> Value {
+		serde_json::json!({"jsonrpc": "2.0", "method": "get_tip", "params": [], "id": id})
+	}
+
+	fn ok_reply(req: &Value, result: Value) -> Value {
+		reply(req, serde_json::json!({ "Ok": result }))
+	}
+
+	#[test]
+	fn cache_tip_scoped() {
+		let cache = ResponseCache::new();
+		let head1 = 1u64.hash();
+		let head2 = 2u64.hash();
+		let computed = Cell::new(0);
+		let compute = |req: &Value| {
+			computed.set(computed.get() + 1);
+			ok_reply(req, serde_json::json!({"height": 1}))
+		};
+
+		let req = tip_req(1);
+		cache.get_or_compute(&req, head1, 1, || compute(&req));
+		let req = tip_req(2);
+		let res = cache.get_or_compute(&req, head1, 1, || compute(&req));
+		assert_eq!(computed.get(), 1);
+		assert_eq!(res["id"], 2);
+
+		// new head, recompute
+		cache.get_or_compute(&req, head2, 2, || compute(&req));
+		assert_eq!(computed.get(), 2);
+
+		cache.invalidate(false);
+		cache.get_or_compute(&req, head2, 2, || compute(&req));
+		assert_eq!(computed.get(), 3);
+
+		let stats = cache.stats();
+		assert_eq!(stats.tip_hits, 1);
+		assert_eq!(stats.misses, 3);
+	}
+
+	#[test]
+	fn cache_headers_by_hash() {
+		let cache = ResponseCache::new();
+		let req = serde_json::json!({
+			"jsonrpc": "2.0",
+			"method": "get_header",
+			"params": [null, "00aa", null],
+			"id": 1
+		});
+		cache.get_or_compute(&req, 1u64.hash(), 1, || {
+			ok_reply(&req, serde_json::json!({"height": 1}))
+		});
+		cache.invalidate(true);
+		let res = cache.get_or_compute(&req, 2u64.hash(), 2, || panic!("not cached"));
+		assert_eq!(res["result"]["Ok"]["height"], 1);
+		assert_eq!(cache.stats().immutable_hits, 1);
+	}
+
+	#[test]
+	fn errors_not_cached() {
+		let cache = ResponseCache::new();
+		let req = tip_req(1);
+		let head = 1u64.hash();
+		cache.get_or_compute(&req, head, 1, || {
+			reply(&req, serde_json::json!({"Err": "NotFound"}))
+		});
+		let computed = Cell::new(false);
+		cache.get_or_compute(&req, head, 1, || {
+			computed.set(true);
+			tip_req(1)
+		});
+		assert!(computed.get());
+	}
+
+	#[test]
+	fn streamed_calls_not_cached() {
+		let by_height = serde_json::json!({
+			"jsonrpc": "2.0",
+			"method": "get_outputs",
+			"params": [null, 1, 10, false, false],
+			"id": 1
+		});
+		let unspent = serde_json::json!({
+			"jsonrpc": "2.0",
+			"method": "get_unspent_outputs",
+			"params": [1, null, 100, false],
+			"id": 1
+		});
+		let by_commit = serde_json::json!({
+			"jsonrpc": "2.0",
+			"method": "get_outputs",
+			"params": [["08aa"], null, null, false, false],
+			"id": 1
+		});
+		assert!(cache_key(&by_height).is_none());
+		assert!(cache_key(&unspent).is_none());
+		assert!(cache_key(&by_commit).is_some());
+	}
+}
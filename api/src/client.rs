@@ -12,18 +12,22 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-//! High level JSON/HTTP client API
+//! High level JSON/HTTP client API, with an optional binary transport for
+//! node API results (see `post_binary`).
 
+use crate::binary::BINARY_CONTENT_TYPE;
+use crate::core::ser::{self, ProtocolVersion, Readable};
 use crate::rest::{Error, ErrorKind};
 use crate::util::to_base64;
+use bytes::Bytes;
 use failure::{Fail, ResultExt};
 use hyper::body;
-use hyper::header::{ACCEPT, AUTHORIZATION, CONTENT_TYPE, USER_AGENT};
+use hyper::header::{HeaderValue, ACCEPT, AUTHORIZATION, CONTENT_TYPE, USER_AGENT};
 use hyper::{Body, Client, Request};
 use hyper_timeout::TimeoutConnector;
 use serde::{Deserialize, Serialize};
 use std::time::Duration;
-use tokio::runtime::Builder;
+use tokio::runtime::{Builder, Runtime};
 
 /// Helper function to easily issue a HTTP GET request against a given URL that
 /// returns a JSON object. Handles request building, JSON deserialization and
@@ -114,6 +118,33 @@ where
 	Ok(())
 }
 
+/// Helper function to issue a HTTP POST request with the provided JSON-RPC
+/// request as body against a node API, asking for the binary (consensus
+/// serialization) encoding of the result. Methods without a binary encoding
+/// and failed calls are answered with a regular JSON-RPC reply, returned as
+/// an error.
+pub fn post_binary<IN, OUT>(url: &str, api_secret: Option<String>, input: &IN) -> Result<OUT, Error>
+where
+	IN: Serialize,
+	OUT: Readable,
+{
+	let req = create_binary_post_request(url, api_secret, input)?;
+	runtime()?.block_on(handle_binary_request_async(req))
+}
+
+/// Async version of `post_binary`.
+pub async fn post_binary_async<IN, OUT>(
+	url: &str,
+	input: &IN,
+	api_secret: Option<String>,
+) -> Result<OUT, Error>
+where
+	IN: Serialize,
+	OUT: Readable,
+{
+	handle_binary_request_async(create_binary_post_request(url, api_secret, input)?).await
+}
+
 fn build_request(
 	url: &str,
 	method: &str,
@@ -155,6 +186,20 @@ where
 	build_request(url, "POST", api_secret, Some(json))
 }
 
+fn create_binary_post_request<IN>(
+	url: &str,
+	api_secret: Option<String>,
+	input: &IN,
+) -> Result<Request<Body>, Error>
+where
+	IN: Serialize,
+{
+	let mut req = create_post_request(url, api_secret, input)?;
+	req.headers_mut()
+		.insert(ACCEPT, HeaderValue::from_static(BINARY_CONTENT_TYPE));
+	Ok(req)
+}
+
 fn handle_request<T>(req: Request<Body>) -> Result<T, Error>
 where
 	for<'de> T: Deserialize<'de>,
@@ -176,7 +221,34 @@ where
 	Ok(ser)
 }
 
+async fn handle_binary_request_async<T>(req: Request<Body>) -> Result<T, Error>
+where
+	T: Readable,
+{
+	let (binary, data) = send_request_bytes_async(req).await?;
+	if binary {
+		return ser::deserialize(&mut &data[..], ProtocolVersion::local()).map_err(|e| {
+			e.context(ErrorKind::ResponseError("Cannot parse response".to_owned()))
+				.into()
+		});
+	}
+	// Not binary, either the call failed or the method has no binary encoding.
+	let reply: serde_json::Value = serde_json::from_slice(&data)
+		.map_err(|e| e.context(ErrorKind::ResponseError("Cannot parse response".to_owned())))?;
+	match reply.pointer("/result/Err") {
+		Some(err) => Err(ErrorKind::ResponseError(format!("Call failed: {}", err)).into()),
+		None => Err(ErrorKind::ResponseError("No binary encoding for this call".to_owned()).into()),
+	}
+}
+
 async fn send_request_async(req: Request<Body>) -> Result<String, Error> {
+	let (_, raw) = send_request_bytes_async(req).await?;
+	Ok(String::from_utf8_lossy(&raw).to_string())
+}
+
+// Send the request, returns the body of the response and whether it is in
+// the binary encoding.
+async fn send_request_bytes_async(req: Request<Body>) -> Result<(bool, Bytes), Error> {
 	let https = hyper_rustls::HttpsConnector::new();
 	let mut connector = TimeoutConnector::new(https);
 	connector.set_connect_timeout(Some(Duration::from_secs(20)));
@@ -198,18 +270,25 @@ async fn send_request_async(req: Request<Body>) -> Result<String, Error> {
 		.into());
 	}
 
+	let binary = resp
+		.headers()
+		.get(CONTENT_TYPE)
+		.map_or(false, |v| v.as_bytes() == BINARY_CONTENT_TYPE.as_bytes());
 	let raw = body::to_bytes(resp)
 		.await
 		.map_err(|e| ErrorKind::RequestError(format!("Cannot read response body: {}", e)))?;
 
-	Ok(String::from_utf8_lossy(&raw).to_string())
+	Ok((binary, raw))
 }
 
 pub fn send_request(req: Request<Body>) -> Result<String, Error> {
-	let mut rt = Builder::new()
+	runtime()?.block_on(send_request_async(req))
+}
+
+fn runtime() -> Result<Runtime, Error> {
+	Builder::new()
 		.basic_scheduler()
 		.enable_all()
 		.build()
-		.map_err(|e| ErrorKind::RequestError(format!("{}", e)))?;
-	rt.block_on(send_request_async(req))
+		.map_err(|e| ErrorKind::RequestError(format!("{}", e)).into())
 }
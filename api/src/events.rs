@@ -0,0 +1,385 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Push-based chain and pool event subscriptions, as Server-Sent Events.
+//!
+//! Events are serialized once into an SSE frame and appended to a bounded
+//! ring buffer shared by all subscribers. A subscriber is only a cursor (the
+//! sequence number of the last event it has seen) woken up through a watch
+//! channel on new events, there is no per subscriber queue to fill. A slow
+//! subscriber simply stops pulling from its connection, if it falls behind
+//! the oldest buffered event it is told how many events it missed and
+//! carries on from there. Every event carries its sequence number as SSE
+//! `id`, so clients can resume after a reconnect through the standard
+//! `Last-Event-ID` header (or a `cursor` query param).
+
+use crate::rest::{Error, ErrorKind};
+use crate::router::{Handler, ResponseFuture};
+use crate::util::RwLock;
+use crate::web::*;
+use bytes::Bytes;
+use futures::stream;
+use hyper::{Body, Request, Response, StatusCode};
+use serde::Serialize;
+use std::collections::VecDeque;
+use std::io;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+use tokio::sync::watch;
+
+/// Number of recent events kept for subscribers catching up or resuming.
+pub const EVENT_BUFFER_SIZE: usize = 4_096;
+
+/// Max number of concurrent subscribers.
+pub const MAX_SUBSCRIBERS: usize = 10_000;
+
+/// Max number of events sent to a subscriber in a single chunk.
+const MAX_EVENTS_PER_CHUNK: usize = 256;
+
+/// A comment is sent to idle subscribers at this interval so proxies and
+/// clients don't time the connection out.
+const KEEPALIVE_INTERVAL: Duration = Duration::from_secs(15);
+
+/// Topics a client can subscribe to.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum EventTopic {
+	/// A new block extended the chain head.
+	Block,
+	/// A block caused a reorg.
+	Reorg,
+	/// A transaction was added to the txpool.
+	PoolAdd,
+	/// A transaction was dropped from the txpool without being mined.
+	PoolEvict,
+}
+
+impl EventTopic {
+	/// All the topics, subscribed to by default.
+	pub const ALL: [EventTopic; 4] = [
+		EventTopic::Block,
+		EventTopic::Reorg,
+		EventTopic::PoolAdd,
+		EventTopic::PoolEvict,
+	];
+
+	/// Name of the topic, used both in subscriptions and as SSE event type.
+	pub fn as_str(&self) -> &'static str {
+		match self {
+			EventTopic::Block => "block",
+			EventTopic::Reorg => "reorg",
+			EventTopic::PoolAdd => "pool_add",
+			EventTopic::PoolEvict => "pool_evict",
+		}
+	}
+
+	fn from_name(name: &str) -> Option<EventTopic> {
+		EventTopic::ALL.iter().cloned().find(|t| t.as_str() == name)
+	}
+}
+
+struct Event {
+	seq: u64,
+	topic: EventTopic,
+	frame: Bytes,
+}
+
+struct EventBuffer {
+	events: VecDeque<Arc<Event>>,
+	last_seq: u64,
+}
+
+/// Shared buffer of recent events, fanned out to all subscribers.
+pub struct EventBus {
+	buffer: RwLock<EventBuffer>,
+	notify: watch::Sender<u64>,
+	// Kept so notifying never fails, even without subscribers.
+	watch: watch::Receiver<u64>,
+	subscribers: AtomicUsize,
+}
+
+impl EventBus {
+	/// Create an empty event bus.
+	pub fn new() -> EventBus {
+		let (notify, watch) = watch::channel(0);
+		EventBus {
+			buffer: RwLock::new(EventBuffer {
+				events: VecDeque::with_capacity(EVENT_BUFFER_SIZE),
+				last_seq: 0,
+			}),
+			notify,
+			watch,
+			subscribers: AtomicUsize::new(0),
+		}
+	}
+
+	/// Publish an event on the given topic. The payload is serialized once,
+	/// whatever the number of subscribers.
+	pub fn publish<T: Serialize>(&self, topic: EventTopic, data: &T) {
+		let data = match serde_json::to_string(data) {
+			Ok(data) => data,
+			Err(e) => {
+				error!("Failed to serialize {} event: {}", topic.as_str(), e);
+				return;
+			}
+		};
+		let seq = {
+			let mut buffer = self.buffer.write();
+			buffer.last_seq += 1;
+			let seq = buffer.last_seq;
+			let frame = format!("id: {}\nevent: {}\ndata: {}\n\n", seq, topic.as_str(), data);
+			if buffer.events.len() >= EVENT_BUFFER_SIZE {
+				buffer.events.pop_front();
+			}
+			buffer.events.push_back(Arc::new(Event {
+				seq,
+				topic,
+				frame: Bytes::from(frame),
+			}));
+			seq
+		};
+		let _ = self.notify.broadcast(seq);
+	}
+
+	/// Sequence number of the last published event.
+	pub fn last_seq(&self) -> u64 {
+		self.buffer.read().last_seq
+	}
+
+	/// Number of connected subscribers.
+	pub fn subscriber_count(&self) -> usize {
+		self.subscribers.load(Ordering::Relaxed)
+	}
+
+	/// Subscribe to the provided topics, starting after event `cursor` (or
+	/// with the next published event if `None`). Returns the body of the
+	/// event stream.
+	pub fn subscribe(
+		self: &Arc<Self>,
+		cursor: Option<u64>,
+		topics: Vec<EventTopic>,
+	) -> Result<Body, Error> {
+		if self.subscribers.fetch_add(1, Ordering::SeqCst) >= MAX_SUBSCRIBERS {
+			self.subscribers.fetch_sub(1, Ordering::SeqCst);
+			return Err(ErrorKind::Busy("too many event subscribers".to_owned()).into());
+		}
+		let sub = Subscriber {
+			cursor: cursor.unwrap_or_else(|| self.last_seq()),
+			topics,
+			watch: self.watch.clone(),
+			bus: self.clone(),
+		};
+
+		let events = stream::unfold(sub, |mut sub| async move {
+			loop {
+				let chunk = sub.next_chunk();
+				if !chunk.is_empty() {
+					return Some((Ok::<_, io::Error>(Bytes::from(chunk)), sub));
+				}
+				match tokio::time::timeout(KEEPALIVE_INTERVAL, sub.watch.recv()).await {
+					Ok(Some(_)) => continue,
+					Ok(None) => return None,
+					Err(_) => return Some((Ok(Bytes::from_static(b": keepalive\n\n")), sub)),
+				}
+			}
+		});
+		Ok(Body::wrap_stream(events))
+	}
+
+	// Events after `cursor` on the provided topics, concatenated in a single
+	// chunk, along with the new cursor and the number of events that were
+	// dropped from the buffer before the subscriber could see them.
+	fn events_after(&self, cursor: u64, topics: &[EventTopic]) -> (Vec<u8>, u64, u64) {
+		let buffer = self.buffer.read();
+		// A cursor from the future (or from before a restart) resumes from now.
+		let cursor = cursor.min(buffer.last_seq);
+		let oldest = match buffer.events.front() {
+			Some(e) => e.seq,
+			None => return (vec![], cursor, 0),
+		};
+		let missed = oldest.saturating_sub(cursor + 1);
+		let cursor = cursor.max(oldest - 1);
+
+		let mut chunk = vec![];
+		let mut new_cursor = cursor;
+		let skip = (cursor + 1 - oldest) as usize;
+		for event in buffer.events.iter().skip(skip).take(MAX_EVENTS_PER_CHUNK) {
+			if topics.contains(&event.topic) {
+				chunk.extend_from_slice(&event.frame);
+			}
+			new_cursor = event.seq;
+		}
+		(chunk, new_cursor, missed)
+	}
+}
+
+impl Default for EventBus {
+	fn default() -> EventBus {
+		EventBus::new()
+	}
+}
+
+struct Subscriber {
+	cursor: u64,
+	topics: Vec<EventTopic>,
+	watch: watch::Receiver<u64>,
+	bus: Arc<EventBus>,
+}
+
+impl Subscriber {
+	// Next chunk of events for this subscriber, empty only once the cursor
+	// has caught up with the last published event. Windows of events on
+	// other topics are skipped over rather than waiting for a new event.
+	fn next_chunk(&mut self) -> Vec<u8> {
+		let mut lagged = 0;
+		loop {
+			let (mut chunk, cursor, missed) = self.bus.events_after(self.cursor, &self.topics);
+			lagged += missed;
+			let advanced = cursor != self.cursor;
+			self.cursor = cursor;
+			if chunk.is_empty() && advanced {
+				continue;
+			}
+			if lagged > 0 {
+				let frame = format!("event: lagged\ndata: {{\"missed\":{}}}\n\n", lagged);
+				chunk.splice(0..0, frame.into_bytes());
+			}
+			return chunk;
+		}
+	}
+}
+
+impl Drop for Subscriber {
+	fn drop(&mut self) {
+		self.bus.subscribers.fetch_sub(1, Ordering::SeqCst);
+	}
+}
+
+/// Event subscription endpoint.
+/// GET /v2/foreign/events?topics=block,reorg,pool_add,pool_evict&cursor=123
+/// All topics are sent if `topics` is omitted. Without a cursor (or a
+/// `Last-Event-ID` header) only new events are sent.
+pub struct EventsHandler {
+	pub bus: Arc<EventBus>,
+}
+
+impl EventsHandler {
+	fn subscribe(&self, req: &Request<Body>) -> Result<Body, Error> {
+		let params = QueryParams::from(req.uri().query());
+		let topics = match params.get("topics") {
+			None => EventTopic::ALL.to_vec(),
+			Some(names) => names
+				.split(',')
+				.map(|name| {
+					EventTopic::from_name(name).ok_or_else(|| {
+						ErrorKind::RequestError(format!("unknown topic {}", name)).into()
+					})
+				})
+				.collect::<Result<Vec<_>, Error>>()?,
+		};
+		let last_event_id = req
+			.headers()
+			.get("last-event-id")
+			.and_then(|v| v.to_str().ok())
+			.map(|v| v.to_owned());
+		let cursor = match params.get("cursor").cloned().or(last_event_id) {
+			Some(c) => Some(
+				c.parse::<u64>()
+					.map_err(|_| ErrorKind::RequestError(format!("invalid cursor {}", c)))?,
+			),
+			None => None,
+		};
+		self.bus.subscribe(cursor, topics)
+	}
+}
+
+impl Handler for EventsHandler {
+	fn get(&self, req: Request<Body>) -> ResponseFuture {
+		match self.subscribe(&req) {
+			Ok(body) => Box::pin(futures::future::ok(
+				Response::builder()
+					.status(StatusCode::OK)
+					.header("access-control-allow-origin", "*")
+					.header(hyper::header::CONTENT_TYPE, "text/event-stream")
+					.header(hyper::header::CACHE_CONTROL, "no-cache")
+					.body(body)
+					.unwrap(),
+			)),
+			Err(e) => result_to_response::<()>(Err(e)),
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn frames(bus: &EventBus, cursor: u64, topics: &[EventTopic]) -> (String, u64, u64) {
+		let (chunk, cursor, missed) = bus.events_after(cursor, topics);
+		(String::from_utf8(chunk).unwrap(), cursor, missed)
+	}
+
+	#[test]
+	fn events_after_cursor() {
+		let bus = EventBus::new();
+		bus.publish(EventTopic::Block, &1);
+		bus.publish(EventTopic::PoolAdd, &2);
+		bus.publish(EventTopic::Block, &3);
+
+		let (chunk, cursor, missed) = frames(&bus, 0, &EventTopic::ALL);
+		assert_eq!(cursor, 3);
+		assert_eq!(missed, 0);
+		assert_eq!(chunk.matches("event: ").count(), 3);
+
+		let (chunk, cursor, _) = frames(&bus, 1, &[EventTopic::Block]);
+		assert_eq!(cursor, 3);
+		assert_eq!(chunk, "id: 3\nevent: block\ndata: 3\n\n");
+
+		let (chunk, cursor, _) = frames(&bus, 3, &EventTopic::ALL);
+		assert_eq!((chunk.as_str(), cursor), ("", 3));
+	}
+
+	#[test]
+	fn lagging_subscriber() {
+		let bus = EventBus::new();
+		for i in 0..EVENT_BUFFER_SIZE + 10 {
+			bus.publish(EventTopic::PoolAdd, &i);
+		}
+		let (chunk, cursor, missed) = frames(&bus, 0, &EventTopic::ALL);
+		assert_eq!(missed, 10);
+		assert_eq!(cursor, 10 + MAX_EVENTS_PER_CHUNK as u64);
+		assert!(chunk.starts_with("id: 11\n"));
+	}
+
+	#[test]
+	fn skips_windows_on_other_topics() {
+		let bus = Arc::new(EventBus::new());
+		for i in 0..MAX_EVENTS_PER_CHUNK * 3 {
+			bus.publish(EventTopic::PoolAdd, &i);
+		}
+		bus.publish(EventTopic::Block, &1);
+
+		bus.subscribers.fetch_add(1, Ordering::SeqCst);
+		let mut sub = Subscriber {
+			cursor: 0,
+			topics: vec![EventTopic::Block],
+			watch: bus.watch.clone(),
+			bus: bus.clone(),
+		};
+		let chunk = String::from_utf8(sub.next_chunk()).unwrap();
+		assert_eq!(chunk.matches("event: block").count(), 1);
+		assert_eq!(sub.cursor, bus.last_seq());
+		assert!(sub.next_chunk().is_empty());
+	}
+}
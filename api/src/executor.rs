@@ -0,0 +1,278 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Bounded execution of blocking chain work for the API server.
+//!
+//! API handlers call into the chain synchronously (RwLocks, LMDB reads, MMR
+//! rewinds). Running those calls directly inside the hyper futures blocks the
+//! executor threads, so a handful of slow requests can starve cheap ones such
+//! as `get_tip`. The `BlockingPool` moves this work onto tokio's blocking
+//! threads and splits it into lanes, each with its own concurrency limit and
+//! bounded wait queue, so one expensive endpoint can only ever occupy its own
+//! lane.
+//!
+//! Only the v2 JSON-RPC endpoints are routed by `node_apis`. The v1 handlers
+//! in `handlers/*` are not served on their own anymore, they are called by
+//! the `Foreign` and `Owner` impls and so always run from within the pool.
+
+use crate::rest::{Error, ErrorKind};
+use futures::stream::{self, StreamExt};
+use serde_json::Value;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use tokio::sync::Semaphore;
+
+/// Concurrency of the lane shared by all calls without a dedicated lane.
+pub const DEFAULT_LANE_CONCURRENCY: usize = 16;
+
+/// Number of calls allowed to wait for a free slot in a lane before new
+/// calls are rejected as busy.
+pub const DEFAULT_LANE_QUEUE: usize = 256;
+
+/// Name of the lane used for calls without a dedicated lane.
+pub const DEFAULT_LANE: &str = "default";
+
+/// Max number of calls accepted in a single JSON-RPC batch, unless
+/// configured otherwise.
+pub const DEFAULT_MAX_BATCH_SIZE: usize = 1_000;
+
+/// Max number of calls of a single batch running at the same time, so that
+/// a large batch can't fill the wait queue of a lane on its own.
+pub const BATCH_CONCURRENCY: usize = 8;
+
+/// Snapshot of the state of a single lane.
+#[derive(Debug, Clone, PartialEq)]
+pub struct LaneStats {
+	/// Lane name (usually the API method name).
+	pub name: String,
+	/// Max number of calls running concurrently in this lane.
+	pub concurrency: usize,
+	/// Calls currently running.
+	pub running: usize,
+	/// Calls currently waiting for a free slot.
+	pub queued: usize,
+	/// Calls rejected because the wait queue was full.
+	pub rejected: usize,
+}
+
+struct Lane {
+	name: String,
+	concurrency: usize,
+	max_queued: usize,
+	permits: Arc<Semaphore>,
+	queued: AtomicUsize,
+	rejected: AtomicUsize,
+}
+
+impl Lane {
+	fn new(name: &str, concurrency: usize, max_queued: usize) -> Lane {
+		let concurrency = concurrency.max(1);
+		Lane {
+			name: name.to_string(),
+			concurrency,
+			max_queued,
+			permits: Arc::new(Semaphore::new(concurrency)),
+			queued: AtomicUsize::new(0),
+			rejected: AtomicUsize::new(0),
+		}
+	}
+
+	fn stats(&self) -> LaneStats {
+		LaneStats {
+			name: self.name.clone(),
+			concurrency: self.concurrency,
+			running: self
+				.concurrency
+				.saturating_sub(self.permits.available_permits()),
+			queued: self.queued.load(Ordering::Relaxed),
+			rejected: self.rejected.load(Ordering::Relaxed),
+		}
+	}
+}
+
+/// Decrements the queue counter of a lane when the waiting call either gets
+/// its slot or is dropped (client went away).
+struct QueueGuard<'a>(&'a AtomicUsize);
+
+impl<'a> Drop for QueueGuard<'a> {
+	fn drop(&mut self) {
+		self.0.fetch_sub(1, Ordering::SeqCst);
+	}
+}
+
+/// Pool of lanes running blocking closures on tokio's blocking threads.
+pub struct BlockingPool {
+	lanes: HashMap<String, Lane>,
+	default_lane: Lane,
+}
+
+impl BlockingPool {
+	/// Create a pool with only a default lane of the provided concurrency
+	/// and queue size.
+	pub fn new(concurrency: usize, max_queued: usize) -> BlockingPool {
+		BlockingPool {
+			lanes: HashMap::new(),
+			default_lane: Lane::new(DEFAULT_LANE, concurrency, max_queued),
+		}
+	}
+
+	/// Add a dedicated lane, calls run under this name will only compete
+	/// with each other.
+	pub fn with_lane(mut self, name: &str, concurrency: usize, max_queued: usize) -> BlockingPool {
+		self.lanes
+			.insert(name.to_string(), Lane::new(name, concurrency, max_queued));
+		self
+	}
+
+	/// Lanes used by the foreign API. Anything touching outputs, blocks or
+	/// kernels gets a small dedicated lane, cheap calls share the default one.
+	pub fn foreign() -> BlockingPool {
+		BlockingPool::new(DEFAULT_LANE_CONCURRENCY, DEFAULT_LANE_QUEUE)
+			.with_lane("get_block", 4, DEFAULT_LANE_QUEUE)
+			.with_lane("get_kernel", 4, DEFAULT_LANE_QUEUE)
+			.with_lane("get_outputs", 4, DEFAULT_LANE_QUEUE)
+			.with_lane("get_unspent_outputs", 4, DEFAULT_LANE_QUEUE)
+			.with_lane("get_pmmr_indices", 2, DEFAULT_LANE_QUEUE)
+			.with_lane("push_transaction", 4, DEFAULT_LANE_QUEUE)
+			.with_lane("scan_unspent_outputs", 4, DEFAULT_LANE_QUEUE)
+			.with_lane("scan_utxos", 2, DEFAULT_LANE_QUEUE)
+	}
+
+	/// Lanes used by the owner API. Full validation and compaction run one at
+	/// a time.
+	pub fn owner() -> BlockingPool {
+		BlockingPool::new(DEFAULT_LANE_CONCURRENCY, DEFAULT_LANE_QUEUE)
+			.with_lane("validate_chain", 1, 4)
+			.with_lane("compact_chain", 1, 4)
+	}
+
+	/// Run the blocking closure `f` in the lane `name` (or the default lane
+	/// if there is no dedicated one). Waits for a free slot if the lane is at
+	/// capacity and returns `ErrorKind::Busy` if its queue is full.
+	/// The slot is held by the blocking closure itself, so it stays taken
+	/// until `f` returns even if the caller stops waiting for the result.
+	pub async fn run<F, T>(&self, name: &str, f: F) -> Result<T, Error>
+	where
+		F: FnOnce() -> T + Send + 'static,
+		T: Send + 'static,
+	{
+		let lane = self.lanes.get(name).unwrap_or(&self.default_lane);
+		let permit = match lane.permits.clone().try_acquire_owned() {
+			Ok(permit) => permit,
+			Err(_) => {
+				if lane.queued.fetch_add(1, Ordering::SeqCst) >= lane.max_queued {
+					lane.queued.fetch_sub(1, Ordering::SeqCst);
+					lane.rejected.fetch_add(1, Ordering::Relaxed);
+					return Err(ErrorKind::Busy(format!(
+						"too many pending requests in lane {}",
+						lane.name
+					))
+					.into());
+				}
+				let _guard = QueueGuard(&lane.queued);
+				lane.permits.clone().acquire_owned().await
+			}
+		};
+
+		tokio::task::spawn_blocking(move || {
+			let _permit = permit;
+			f()
+		})
+		.await
+		.map_err(|e| {
+			let err: Error = ErrorKind::Internal(format!("blocking task failed: {}", e)).into();
+			err
+		})
+	}
+
+	/// Run the calls of a JSON-RPC batch, each in the lane of its method and
+	/// up to `BATCH_CONCURRENCY` of them at a time. Returns the array of
+	/// replies in the order of the calls, without replies to notifications.
+	pub async fn run_batch<F>(&self, calls: Vec<Value>, max_batch_size: usize, handle: F) -> Value
+	where
+		F: Fn(Value) -> Value + Clone + Send + 'static,
+	{
+		if calls.is_empty() {
+			return rpc_error(
+				Value::Null,
+				-32600,
+				"Invalid Request: empty batch".to_owned(),
+			);
+		}
+		if calls.len() > max_batch_size {
+			return rpc_error(
+				Value::Null,
+				-32600,
+				format!(
+					"Invalid Request: batch of {} calls, max is {}",
+					calls.len(),
+					max_batch_size
+				),
+			);
+		}
+
+		let replies: Vec<Option<Value>> = stream::iter(calls)
+			.map(|call| {
+				let handle = handle.clone();
+				async move {
+					let id = call.get("id").cloned();
+					let method = rpc_method(&call);
+					let res = self.run(&method, move || handle(call)).await;
+					// Notifications get no reply.
+					id.map(|id| match res {
+						Ok(reply) => reply,
+						Err(e) => rpc_error(id, -32000, e.to_string()),
+					})
+				}
+			})
+			.buffered(BATCH_CONCURRENCY)
+			.collect()
+			.await;
+		Value::Array(replies.into_iter().flatten().collect())
+	}
+
+	/// Current state of all the lanes, default lane first.
+	pub fn stats(&self) -> Vec<LaneStats> {
+		let mut stats = vec![self.default_lane.stats()];
+		let mut lanes: Vec<LaneStats> = self.lanes.values().map(|l| l.stats()).collect();
+		lanes.sort_by(|a, b| a.name.cmp(&b.name));
+		stats.extend(lanes);
+		stats
+	}
+}
+
+impl Default for BlockingPool {
+	fn default() -> BlockingPool {
+		BlockingPool::new(DEFAULT_LANE_CONCURRENCY, DEFAULT_LANE_QUEUE)
+	}
+}
+
+// JSON-RPC error reply, for failures happening before the call reaches its
+// handler.
+fn rpc_error(id: Value, code: i64, message: String) -> Value {
+	serde_json::json!({
+		"id": id,
+		"jsonrpc": "2.0",
+		"error": { "code": code, "message": message },
+	})
+}
+
+/// Method name of a JSON-RPC request, used to pick the lane it runs in.
+pub fn rpc_method(req: &serde_json::Value) -> String {
+	req.get("method")
+		.and_then(|m| m.as_str())
+		.unwrap_or(DEFAULT_LANE)
+		.to_string()
+}
@@ -24,24 +24,31 @@ pub mod version_api;
 use crate::auth::{
 	BasicAuthMiddleware, BasicAuthURIMiddleware, GRIN_BASIC_REALM, GRIN_FOREIGN_BASIC_REALM,
 };
+use crate::binary::{accepts_binary, binary_request, BINARY_CONTENT_TYPE};
+use crate::cache::ResponseCache;
 use crate::chain;
-use crate::chain::{Chain, SyncState};
+use crate::chain::{Chain, SyncState, Tip};
+use crate::events::{EventBus, EventsHandler};
+use crate::executor::{rpc_method, BlockingPool};
 use crate::foreign::Foreign;
 use crate::foreign_rpc::ForeignRpc;
+use crate::handlers::chain_api::{OutputHandler, UtxoScanHandler};
 use crate::owner::Owner;
 use crate::owner_rpc::OwnerRpc;
 use crate::p2p;
 use crate::pool;
 use crate::pool::{BlockChain, PoolAdapter};
-use crate::rest::{ApiServer, Error, TLSConfig};
+use crate::rest::{ApiServer, Error, ErrorKind, TLSConfig};
 use crate::router::ResponseFuture;
 use crate::router::Router;
+use crate::stream::{stream_response, JsonStreamWriter};
 use crate::util::to_base64;
 use crate::util::RwLock;
 use crate::web::*;
 use easy_jsonrpc_mw::{Handler, MaybeReply};
 use hyper::{Body, Request, Response, StatusCode};
 use serde::Serialize;
+use serde_json::Value;
 use std::net::SocketAddr;
 use std::sync::{Arc, Weak};
 
@@ -56,6 +63,9 @@ pub fn node_apis<B, P>(
 	api_secret: Option<String>,
 	foreign_api_secret: Option<String>,
 	tls_config: Option<TLSConfig>,
+	cache: Arc<ResponseCache>,
+	events: Arc<EventBus>,
+	max_batch_size: usize,
 ) -> Result<(), Error>
 where
 	B: BlockChain + 'static,
@@ -79,6 +89,8 @@ where
 		Arc::downgrade(&chain),
 		Arc::downgrade(&peers),
 		Arc::downgrade(&sync_state),
+		Arc::new(BlockingPool::owner()),
+		max_batch_size,
 	);
 	router.add_route("/v2/owner", Arc::new(api_handler))?;
 
@@ -94,13 +106,27 @@ where
 		router.add_middleware(basic_auth_middleware);
 	}
 
+	let foreign_pool = Arc::new(BlockingPool::foreign());
 	let api_handler = ForeignAPIHandlerV2::new(
 		Arc::downgrade(&chain),
 		Arc::downgrade(&tx_pool),
 		Arc::downgrade(&sync_state),
+		foreign_pool.clone(),
+		cache,
+		max_batch_size,
 	);
 	router.add_route("/v2/foreign", Arc::new(api_handler))?;
 
+	let scan_handler = UtxoScanHandler {
+		chain: Arc::downgrade(&chain),
+		pool: foreign_pool,
+	};
+	router.add_route("/v2/foreign/scan", Arc::new(scan_handler))?;
+	router.add_route(
+		"/v2/foreign/events",
+		Arc::new(EventsHandler { bus: events }),
+	)?;
+
 	let mut apis = ApiServer::new();
 	warn!("Starting HTTP Node APIs server at {}.", addr);
 	let socket_addr: SocketAddr = addr.parse().expect("unable to parse socket address");
@@ -122,41 +148,55 @@ pub struct OwnerAPIHandlerV2 {
 	pub chain: Weak<Chain>,
 	pub peers: Weak<p2p::Peers>,
 	pub sync_state: Weak<SyncState>,
+	pub pool: Arc<BlockingPool>,
+	pub max_batch_size: usize,
 }
 
 impl OwnerAPIHandlerV2 {
 	/// Create a new owner API handler for GET methods
-	pub fn new(chain: Weak<Chain>, peers: Weak<p2p::Peers>, sync_state: Weak<SyncState>) -> Self {
+	pub fn new(
+		chain: Weak<Chain>,
+		peers: Weak<p2p::Peers>,
+		sync_state: Weak<SyncState>,
+		pool: Arc<BlockingPool>,
+		max_batch_size: usize,
+	) -> Self {
 		OwnerAPIHandlerV2 {
 			chain,
 			peers,
 			sync_state,
+			pool,
+			max_batch_size,
 		}
 	}
 }
 
 impl crate::router::Handler for OwnerAPIHandlerV2 {
 	fn post(&self, req: Request<Body>) -> ResponseFuture {
-		let api = Owner::new(
+		let api = Arc::new(Owner::new(
 			self.chain.clone(),
 			self.peers.clone(),
 			self.sync_state.clone(),
-		);
+		));
 
+		let pool = self.pool.clone();
+		let max_batch_size = self.max_batch_size;
 		Box::pin(async move {
-			match parse_body(req).await {
-				Ok(val) => {
-					let owner_api = &api as &dyn OwnerRpc;
-					let res = match owner_api.handle_request(val) {
-						MaybeReply::Reply(r) => r,
-						MaybeReply::DontReply => {
-							// Since it's http, we need to return something. We return [] because jsonrpc
-							// clients will parse it as an empty batch response.
-							serde_json::json!([])
-						}
-					};
+			match parse_body::<serde_json::Value>(req).await {
+				Ok(Value::Array(calls)) => {
+					let res = pool
+						.run_batch(calls, max_batch_size, move |call| owner_call(&api, call))
+						.await;
 					Ok(json_response_pretty(&res))
 				}
+				Ok(val) => {
+					let method = rpc_method(&val);
+					let res = pool.run(&method, move || owner_call(&api, val)).await;
+					match res {
+						Ok(res) => Ok(json_response_pretty(&res)),
+						Err(e) => Ok(create_error_response(e)),
+					}
+				}
 				Err(e) => {
 					error!("Request Error: {:?}", e);
 					Ok(create_error_response(e))
@@ -179,6 +219,9 @@ where
 	pub chain: Weak<Chain>,
 	pub tx_pool: Weak<RwLock<pool::TransactionPool<B, P>>>,
 	pub sync_state: Weak<SyncState>,
+	pub pool: Arc<BlockingPool>,
+	pub cache: Arc<ResponseCache>,
+	pub max_batch_size: usize,
 }
 
 impl<B, P> ForeignAPIHandlerV2<B, P>
@@ -191,11 +234,17 @@ where
 		chain: Weak<Chain>,
 		tx_pool: Weak<RwLock<pool::TransactionPool<B, P>>>,
 		sync_state: Weak<SyncState>,
+		pool: Arc<BlockingPool>,
+		cache: Arc<ResponseCache>,
+		max_batch_size: usize,
 	) -> Self {
 		ForeignAPIHandlerV2 {
 			chain,
 			tx_pool,
 			sync_state,
+			pool,
+			cache,
+			max_batch_size,
 		}
 	}
 }
@@ -206,25 +255,70 @@ where
 	P: PoolAdapter + 'static,
 {
 	fn post(&self, req: Request<Body>) -> ResponseFuture {
-		let api = Foreign::new(
+		let api = Arc::new(Foreign::new(
 			self.chain.clone(),
 			self.tx_pool.clone(),
 			self.sync_state.clone(),
-		);
+		));
 
+		let pool = self.pool.clone();
+		let cache = self.cache.clone();
+		let max_batch_size = self.max_batch_size;
+		let binary = accepts_binary(&req);
 		Box::pin(async move {
-			match parse_body(req).await {
+			match parse_body::<serde_json::Value>(req).await {
+				Ok(Value::Array(calls)) => {
+					// All the calls of a batch are served against the same head.
+					let chain = api.chain.clone();
+					let head = pool
+						.run("get_tip", move || {
+							chain.upgrade().and_then(|c| c.head().ok())
+						})
+						.await
+						.ok()
+						.and_then(|head| head);
+					let res = pool
+						.run_batch(calls, max_batch_size, move |call| {
+							foreign_call(&api, &cache, head.as_ref(), call)
+						})
+						.await;
+					Ok(json_response_pretty(&res))
+				}
 				Ok(val) => {
-					let foreign_api = &api as &dyn ForeignRpc;
-					let res = match foreign_api.handle_request(val) {
-						MaybeReply::Reply(r) => r,
-						MaybeReply::DontReply => {
-							// Since it's http, we need to return something. We return [] because jsonrpc
-							// clients will parse it as an empty batch response.
-							serde_json::json!([])
-						}
+					let method = rpc_method(&val);
+					let producer = if binary {
+						binary_request(&api.chain, &pool, &val)
+					} else {
+						None
 					};
-					Ok(json_response_pretty(&res))
+					if let Some(producer) = producer {
+						let res = match pool.run(&method, producer).await {
+							Ok(res) => res,
+							Err(e) => return Ok(create_error_response(e)),
+						};
+						return Ok(match res {
+							Ok(bytes) => create_binary_response(bytes),
+							Err(e) => json_response_pretty(&serde_json::json!({
+								"id": val.get("id").cloned().unwrap_or(Value::Null),
+								"jsonrpc": "2.0",
+								"result": { "Err": e.kind() },
+							})),
+						});
+					}
+					if let Some(producer) = stream_request(&api.chain, &val) {
+						let id = val.get("id").cloned().unwrap_or(Value::Null);
+						return Ok(stream_response(pool, method, id, producer));
+					}
+					let res = pool
+						.run(&method, move || {
+							let head = api.chain.upgrade().and_then(|c| c.head().ok());
+							foreign_call(&api, &cache, head.as_ref(), val)
+						})
+						.await;
+					match res {
+						Ok(res) => Ok(json_response_pretty(&res)),
+						Err(e) => Ok(create_error_response(e)),
+					}
 				}
 				Err(e) => {
 					error!("Request Error: {:?}", e);
@@ -239,6 +333,96 @@ where
 	}
 }
 
+fn owner_call(api: &Owner, req: Value) -> Value {
+	let owner_api = api as &dyn OwnerRpc;
+	match owner_api.handle_request(req) {
+		MaybeReply::Reply(r) => r,
+		MaybeReply::DontReply => {
+			// Since it's http, we need to return something. We return [] because jsonrpc
+			// clients will parse it as an empty batch response.
+			serde_json::json!([])
+		}
+	}
+}
+
+// Foreign calls are served from the response cache when we have a reply
+// computed against the chain head `head`.
+fn foreign_call<B, P>(
+	api: &Foreign<B, P>,
+	cache: &ResponseCache,
+	head: Option<&Tip>,
+	req: Value,
+) -> Value
+where
+	B: BlockChain,
+	P: PoolAdapter,
+{
+	let foreign_api = api as &dyn ForeignRpc;
+	let compute = || match foreign_api.handle_request(req.clone()) {
+		MaybeReply::Reply(r) => r,
+		MaybeReply::DontReply => {
+			// Since it's http, we need to return something. We return [] because jsonrpc
+			// clients will parse it as an empty batch response.
+			serde_json::json!([])
+		}
+	};
+	match head {
+		Some(head) => cache.get_or_compute(&req, head.last_block_h, head.height, compute),
+		None => compute(),
+	}
+}
+
+type StreamProducer = Box<dyn FnOnce(&mut JsonStreamWriter) -> Result<(), Error> + Send>;
+
+/// Foreign API calls returning potentially large lists of outputs are
+/// streamed rather than collected and serialized in one go. Returns `None`
+/// for anything else (including malformed params, left to the regular
+/// JSON-RPC handler to report).
+fn stream_request(chain: &Weak<Chain>, req: &Value) -> Option<StreamProducer> {
+	req.get("id")?;
+	let params = req.get("params")?.as_array()?;
+	let handler = OutputHandler {
+		chain: chain.clone(),
+	};
+	let opt_u64 = |v: &Value| match v {
+		Value::Null => Some(None),
+		v => v.as_u64().map(Some),
+	};
+	let opt_bool = |v: &Value| match v {
+		Value::Null => Some(None),
+		v => v.as_bool().map(Some),
+	};
+
+	let producer: StreamProducer = match req.get("method")?.as_str()? {
+		"get_outputs" if params.len() == 5 && params[0].is_null() => {
+			let start_height = params[1].as_u64()?;
+			let end_height = params[2].as_u64()?;
+			let include_proof = opt_bool(&params[3])?.unwrap_or(false);
+			let include_merkle_proof = opt_bool(&params[4])?.unwrap_or(false);
+			Box::new(move |w: &mut JsonStreamWriter| {
+				handler.stream_outputs_v2(
+					start_height,
+					end_height,
+					include_proof,
+					include_merkle_proof,
+					w,
+				)
+			})
+		}
+		"get_unspent_outputs" if params.len() == 4 => {
+			let start_index = params[0].as_u64()?;
+			let end_index = opt_u64(&params[1])?;
+			let max = params[2].as_u64()?;
+			let include_proof = opt_bool(&params[3])?;
+			Box::new(move |w: &mut JsonStreamWriter| {
+				handler.stream_unspent_outputs(start_index, end_index, max, include_proof, w)
+			})
+		}
+		_ => return None,
+	};
+	Some(producer)
+}
+
 // pretty-printed version of above
 fn json_response_pretty<T>(s: &T) -> Response<Body>
 where
@@ -251,8 +435,12 @@ where
 }
 
 fn create_error_response(e: Error) -> Response<Body> {
+	let status = match e.kind() {
+		ErrorKind::Busy(_) => StatusCode::SERVICE_UNAVAILABLE,
+		_ => StatusCode::INTERNAL_SERVER_ERROR,
+	};
 	Response::builder()
-		.status(StatusCode::INTERNAL_SERVER_ERROR)
+		.status(status)
 		.header("access-control-allow-origin", "*")
 		.header(
 			"access-control-allow-headers",
@@ -275,6 +463,19 @@ fn create_ok_response(json: &str) -> Response<Body> {
 		.unwrap()
 }
 
+fn create_binary_response(bytes: Vec<u8>) -> Response<Body> {
+	Response::builder()
+		.status(StatusCode::OK)
+		.header("access-control-allow-origin", "*")
+		.header(
+			"access-control-allow-headers",
+			"Content-Type, Authorization",
+		)
+		.header(hyper::header::CONTENT_TYPE, BINARY_CONTENT_TYPE)
+		.body(bytes.into())
+		.unwrap()
+}
+
 /// Build a new hyper Response with the status code and body provided.
 ///
 /// Whenever the status code is `StatusCode::OK` the text parameter should be
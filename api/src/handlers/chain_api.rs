@@ -15,15 +15,18 @@
 use super::utils::{get_output, get_output_v2, w};
 use crate::chain;
 use crate::core::core::hash::{Hash, Hashed};
+use crate::core::ser::{self, ProtocolVersion};
+use crate::executor::BlockingPool;
 use crate::rest::*;
 use crate::router::{Handler, ResponseFuture};
+use crate::stream::JsonStreamWriter;
 use crate::types::*;
 use crate::util;
 use crate::util::secp::pedersen::Commitment;
 use crate::web::*;
 use failure::ResultExt;
 use hyper::{Body, Request, StatusCode};
-use std::sync::Weak;
+use std::sync::{Arc, Weak};
 
 /// Chain handler. Get the head details.
 /// GET /v1/chain
@@ -122,6 +125,12 @@ impl Handler for ChainCompactHandler {
 	}
 }
 
+/// Number of outputs read from the UTXO set at a time when streaming.
+const UNSPENT_STREAM_PAGE: u64 = 500;
+
+/// Max number of outputs returned by a single page of a bulk UTXO scan.
+pub const MAX_SCAN_PAGE: u64 = 10_000;
+
 // Supports retrieval of multiple outputs in a single request -
 // GET /v1/chain/outputs/byids?id=xxx,yyy,zzz
 // GET /v1/chain/outputs/byids?id=xxx&id=yyy&id=zzz
@@ -181,7 +190,7 @@ impl OutputHandler {
 					include_proof.unwrap_or(false),
 					include_merkle_proof.unwrap_or(false),
 				)?;
-				outputs = [&outputs[..], &block_output_batch[..]].concat();
+				outputs.extend(block_output_batch);
 			}
 		}
 		Ok(outputs)
@@ -224,6 +233,79 @@ impl OutputHandler {
 		Ok(out)
 	}
 
+	/// Streaming version of `get_outputs_v2` for a range of blocks. Outputs
+	/// are serialized one block at a time instead of being collected first.
+	pub fn stream_outputs_v2(
+		&self,
+		start_height: u64,
+		end_height: u64,
+		include_rproof: bool,
+		include_merkle_proof: bool,
+		writer: &mut JsonStreamWriter,
+	) -> Result<(), Error> {
+		writer.begin_list()?;
+		for i in (start_height..=end_height).rev() {
+			if let Ok(res) =
+				self.outputs_at_height_v2(i, vec![], include_rproof, include_merkle_proof)
+			{
+				for output in &res {
+					writer.item(output)?;
+				}
+			}
+		}
+		writer.end_list()
+	}
+
+	/// Streaming version of `get_unspent_outputs`. The UTXO set is traversed
+	/// in pages of `UNSPENT_STREAM_PAGE` outputs, no lock is held while
+	/// writing to the client.
+	pub fn stream_unspent_outputs(
+		&self,
+		start_index: u64,
+		end_index: Option<u64>,
+		max: u64,
+		include_proof: Option<bool>,
+		writer: &mut JsonStreamWriter,
+	) -> Result<(), Error> {
+		let mut remaining = max.min(10_000);
+		let chain = w(&self.chain)?;
+		let mut start = start_index;
+		let mut highest_index = None;
+		let mut last_retrieved_index;
+
+		writer.raw(r#"{"outputs":"#)?;
+		writer.begin_list()?;
+		loop {
+			let (last, highest, outputs) = chain
+				.unspent_outputs_by_pmmr_index(start, remaining.min(UNSPENT_STREAM_PAGE), end_index)
+				.context(ErrorKind::NotFound)?;
+			let highest = *highest_index.get_or_insert(highest);
+			last_retrieved_index = last;
+			for x in &outputs {
+				let output = OutputPrintable::from_output(
+					x,
+					&chain,
+					None,
+					include_proof.unwrap_or(false),
+					false,
+				)
+				.context(ErrorKind::Internal("chain error".to_owned()))?;
+				writer.item(&output)?;
+			}
+			remaining = remaining.saturating_sub(outputs.len() as u64);
+			if outputs.is_empty() || remaining == 0 || last >= highest {
+				break;
+			}
+			start = last + 1;
+		}
+		writer.end_list()?;
+		writer.raw(&format!(
+			r#","highest_index":{},"last_retrieved_index":{}}}"#,
+			highest_index.unwrap_or(0),
+			last_retrieved_index
+		))
+	}
+
 	fn outputs_by_ids(&self, req: &Request<Body>) -> Result<Vec<Output>, Error> {
 		let mut commitments: Vec<String> = vec![];
 
@@ -373,9 +455,7 @@ impl OutputHandler {
 				include_rproof,
 				include_merkle_proof,
 			) {
-				if !res.is_empty() {
-					return_vec = [&return_vec[..], &res[..]].concat();
-				}
+				return_vec.extend(res);
 			}
 		}
 
@@ -393,6 +473,125 @@ impl Handler for OutputHandler {
 	}
 }
 
+#[derive(Clone, Copy)]
+struct ScanQuery {
+	start_index: u64,
+	end_index: Option<u64>,
+	max: u64,
+	include_proof: bool,
+	include_merkle_proof: bool,
+	binary: bool,
+}
+
+impl ScanQuery {
+	fn from_request(req: &Request<Body>) -> Result<ScanQuery, Error> {
+		let params = QueryParams::from(req.uri().query());
+		let end_index = match params.get("end_index") {
+			Some(val) => Some(val.parse().map_err(|_| {
+				ErrorKind::RequestError("invalid value of parameter end_index".to_owned())
+			})?),
+			None => None,
+		};
+		let binary = match params.get("format").map(|f| f.as_str()) {
+			None | Some("json") => false,
+			Some("binary") => true,
+			Some(f) => {
+				return Err(ErrorKind::RequestError(format!("unknown format {}", f)).into());
+			}
+		};
+		Ok(ScanQuery {
+			start_index: parse_param!(params, "start_index", 1),
+			end_index,
+			max: parse_param!(params, "max", MAX_SCAN_PAGE),
+			include_proof: params.get("include_proof").is_some(),
+			include_merkle_proof: params.get("include_merkle_proof").is_some(),
+			binary,
+		})
+	}
+}
+
+/// Bulk scan of the UTXO set for wallet restore. Each page is read under a
+/// single chain read lock and every output comes with its MMR position and
+/// block height, so wallets don't need a lookup per output. Coinbase Merkle
+/// proofs (`head_merkle_proof`) are against the output PMMR root at the
+/// returned head, not at the block that created the output. With
+/// `format=binary` the page is returned in the compact consensus
+/// serialization (see `UtxoScanPage`) rather than as JSON.
+/// GET /v2/foreign/scan?start_index=1&end_index=100000&max=1000&include_proof&include_merkle_proof&format=binary
+#[derive(Clone)]
+pub struct UtxoScanHandler {
+	pub chain: Weak<chain::Chain>,
+	pub pool: Arc<BlockingPool>,
+}
+
+impl UtxoScanHandler {
+	pub fn scan(
+		&self,
+		start_index: u64,
+		end_index: Option<u64>,
+		max: u64,
+		include_merkle_proof: bool,
+	) -> Result<UtxoScanPage, Error> {
+		let chain = w(&self.chain)?;
+		let (head, last_retrieved_index, highest_index, outputs) = chain
+			.scan_unspent_outputs(
+				start_index,
+				max.min(MAX_SCAN_PAGE),
+				end_index,
+				include_merkle_proof,
+			)
+			.context(ErrorKind::NotFound)?;
+		Ok(UtxoScanPage {
+			head_hash: head.last_block_h,
+			head_height: head.height,
+			highest_index,
+			last_retrieved_index,
+			outputs,
+		})
+	}
+}
+
+impl Handler for UtxoScanHandler {
+	fn get(&self, req: Request<Body>) -> ResponseFuture {
+		let query = match ScanQuery::from_request(&req) {
+			Ok(query) => query,
+			Err(e) => return result_to_response::<()>(Err(e)),
+		};
+		let handler = self.clone();
+		Box::pin(async move {
+			let res = handler
+				.pool
+				.clone()
+				.run("scan_utxos", move || {
+					handler.scan(
+						query.start_index,
+						query.end_index,
+						query.max,
+						query.include_merkle_proof,
+					)
+				})
+				.await
+				.and_then(|res| res);
+			let page = match res {
+				Ok(page) => page,
+				Err(e) => return result_to_response::<()>(Err(e)).await,
+			};
+			if query.binary {
+				match ser::ser_vec(&page, ProtocolVersion::local()) {
+					Ok(bytes) => binary_response(bytes).await,
+					Err(e) => {
+						let e = ErrorKind::Internal(format!("can't serialize scan page: {}", e));
+						result_to_response::<()>(Err(e.into())).await
+					}
+				}
+			} else {
+				let listing = UtxoScanListing::from_page(&page, query.include_proof);
+				json_response(&listing).await
+			}
+		})
+	}
+}
+
 /// Kernel handler, search for a kernel by excess commitment
 /// GET /v1/chain/kernels/XXX?min_height=YYY&max_height=ZZZ
 /// The `min_height` and `max_height` parameters are optional
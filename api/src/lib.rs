@@ -33,7 +33,11 @@ extern crate log;
 #[macro_use]
 mod web;
 pub mod auth;
+mod binary;
+mod cache;
 pub mod client;
+mod events;
+mod executor;
 mod foreign;
 mod foreign_rpc;
 mod handlers;
@@ -42,11 +46,16 @@ mod owner;
 mod owner_rpc;
 mod rest;
 mod router;
+mod stream;
 pub mod types;
 
 pub use crate::auth::{
 	BasicAuthMiddleware, BasicAuthURIMiddleware, GRIN_BASIC_REALM, GRIN_FOREIGN_BASIC_REALM,
 };
+pub use crate::binary::BINARY_CONTENT_TYPE;
+pub use crate::cache::{CacheStats, ResponseCache};
+pub use crate::events::{EventBus, EventTopic};
+pub use crate::executor::{BlockingPool, LaneStats, DEFAULT_MAX_BATCH_SIZE};
 pub use crate::foreign::Foreign;
 pub use crate::foreign_rpc::ForeignRpc;
 pub use crate::handlers::node_apis;
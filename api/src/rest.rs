@@ -58,6 +58,8 @@ pub enum ErrorKind {
 	ResponseError(String),
 	#[fail(display = "Router error: {}", _0)]
 	Router(RouterError),
+	#[fail(display = "Server busy: {}", _0)]
+	Busy(String),
 }
 
 impl Fail for Error {
@@ -0,0 +1,302 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Streaming (chunked) JSON responses for large result sets.
+//!
+//! The producer runs on a blocking thread and serializes items one at a time
+//! into a small buffer, which is handed over to hyper in chunks through a
+//! bounded channel. Memory use is bounded by the channel capacity times the
+//! chunk size, whatever the size of the full response.
+
+use crate::executor::BlockingPool;
+use crate::rest::{Error, ErrorKind};
+use bytes::Bytes;
+use futures::channel::mpsc;
+use futures::executor::block_on;
+use futures::SinkExt;
+use hyper::{Body, Response, StatusCode};
+use serde::Serialize;
+use serde_json::Value;
+use std::io;
+use std::mem;
+use std::sync::Arc;
+
+/// Buffered JSON is sent to the client once it reaches this size.
+pub const STREAM_CHUNK_SIZE: usize = 64 * 1024;
+
+/// Number of chunks that can be waiting to be written to the connection
+/// before the producer blocks.
+pub const STREAM_CHANNEL_CAP: usize = 4;
+
+type Chunk = Result<Bytes, io::Error>;
+
+/// Incremental writer for a JSON-RPC reply whose result is (or contains) a
+/// potentially very long list.
+pub struct JsonStreamWriter {
+	id: Value,
+	buf: Vec<u8>,
+	tx: mpsc::Sender<Chunk>,
+	// Whether the envelope has been written.
+	started: bool,
+	// Whether anything has been handed to the connection yet.
+	sent: bool,
+	// Whether the next list item needs a leading comma.
+	first_item: bool,
+	bytes_sent: usize,
+}
+
+impl JsonStreamWriter {
+	fn new(id: Value, tx: mpsc::Sender<Chunk>) -> JsonStreamWriter {
+		JsonStreamWriter {
+			id,
+			buf: Vec::with_capacity(STREAM_CHUNK_SIZE),
+			tx,
+			started: false,
+			sent: false,
+			first_item: true,
+			bytes_sent: 0,
+		}
+	}
+
+	/// Write raw JSON. The caller is responsible for producing a valid
+	/// document, typically `{"field":` or `]`.
+	pub fn raw(&mut self, s: &str) -> Result<(), Error> {
+		self.start();
+		self.buf.extend_from_slice(s.as_bytes());
+		self.flush_if_full()
+	}
+
+	/// Start a list, items are then added with `item`.
+	pub fn begin_list(&mut self) -> Result<(), Error> {
+		self.first_item = true;
+		self.raw("[")
+	}
+
+	/// Close the current list.
+	pub fn end_list(&mut self) -> Result<(), Error> {
+		self.raw("]")
+	}
+
+	/// Serialize and append a list item.
+	pub fn item<T: Serialize>(&mut self, item: &T) -> Result<(), Error> {
+		self.start();
+		if !self.first_item {
+			self.buf.push(b',');
+		}
+		self.first_item = false;
+		serde_json::to_writer(&mut self.buf, item)
+			.map_err(|e| ErrorKind::Internal(format!("can't serialize item: {}", e)))?;
+		self.flush_if_full()
+	}
+
+	/// Total number of bytes handed to the connection so far.
+	pub fn bytes_sent(&self) -> usize {
+		self.bytes_sent
+	}
+
+	// Writes the JSON-RPC envelope on first use.
+	fn start(&mut self) {
+		if !self.started {
+			self.started = true;
+			let prefix = format!(r#"{{"id":{},"jsonrpc":"2.0","result":{{"Ok":"#, self.id);
+			self.buf.extend_from_slice(prefix.as_bytes());
+		}
+	}
+
+	fn flush_if_full(&mut self) -> Result<(), Error> {
+		if self.buf.len() >= STREAM_CHUNK_SIZE {
+			self.flush()
+		} else {
+			Ok(())
+		}
+	}
+
+	fn flush(&mut self) -> Result<(), Error> {
+		if self.buf.is_empty() {
+			return Ok(());
+		}
+		let chunk = mem::replace(&mut self.buf, Vec::with_capacity(STREAM_CHUNK_SIZE));
+		self.sent = true;
+		self.bytes_sent += chunk.len();
+		block_on(self.tx.send(Ok(Bytes::from(chunk))))
+			.map_err(|_| ErrorKind::ResponseError("client went away".to_owned()).into())
+	}
+
+	// Close the envelope and flush whatever is left.
+	fn finish(mut self) -> Result<(), Error> {
+		self.start();
+		self.buf.extend_from_slice(b"}}");
+		self.flush()
+	}
+
+	// If nothing went out yet we can still reply with a regular JSON-RPC
+	// error, otherwise the only option left is to abort the body.
+	fn fail(mut self, e: Error) {
+		if self.sent {
+			let _ = block_on(
+				self.tx
+					.send(Err(io::Error::new(io::ErrorKind::Other, e.to_string()))),
+			);
+			return;
+		}
+		let reply = serde_json::json!({
+			"id": self.id,
+			"jsonrpc": "2.0",
+			"result": { "Err": e.kind() },
+		});
+		self.buf = reply.to_string().into_bytes();
+		let _ = self.flush();
+	}
+}
+
+/// Run `producer` in lane `lane` of the blocking pool and stream everything
+/// it writes as the body of the response to JSON-RPC request `id`.
+pub fn stream_response<F>(
+	pool: Arc<BlockingPool>,
+	lane: String,
+	id: Value,
+	producer: F,
+) -> Response<Body>
+where
+	F: FnOnce(&mut JsonStreamWriter) -> Result<(), Error> + Send + 'static,
+{
+	let (tx, rx) = mpsc::channel::<Chunk>(STREAM_CHANNEL_CAP);
+	let err_tx = tx.clone();
+	let err_id = id.clone();
+	tokio::spawn(async move {
+		let res = pool
+			.run(&lane, move || {
+				let mut writer = JsonStreamWriter::new(id, tx);
+				match producer(&mut writer) {
+					Ok(()) => {
+						let _ = writer.finish();
+					}
+					Err(e) => writer.fail(e),
+				}
+			})
+			.await;
+		// Lane busy, the producer never ran.
+		if let Err(e) = res {
+			let writer = JsonStreamWriter::new(err_id, err_tx);
+			let _ = tokio::task::spawn_blocking(move || writer.fail(e)).await;
+		}
+	});
+
+	Response::builder()
+		.status(StatusCode::OK)
+		.header("access-control-allow-origin", "*")
+		.header(
+			"access-control-allow-headers",
+			"Content-Type, Authorization",
+		)
+		.header(hyper::header::CONTENT_TYPE, "application/json")
+		.body(Body::wrap_stream(rx))
+		.unwrap()
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use hyper::body;
+	use std::time::Instant;
+	use tokio::runtime::Runtime;
+
+	fn collect(resp: Response<Body>) -> Result<Value, String> {
+		let mut rt = Runtime::new().unwrap();
+		let raw = rt
+			.block_on(body::to_bytes(resp.into_body()))
+			.map_err(|e| e.to_string())?;
+		serde_json::from_slice(&raw).map_err(|e| e.to_string())
+	}
+
+	#[test]
+	fn stream_list() {
+		let rt = Runtime::new().unwrap();
+		let pool = Arc::new(BlockingPool::default());
+		let resp = rt.enter(|| {
+			stream_response(pool, "test".to_owned(), Value::from(7), |w| {
+				w.begin_list()?;
+				for i in 0..100_000u64 {
+					w.item(&i)?;
+				}
+				w.end_list()
+			})
+		});
+		let res = collect(resp).unwrap();
+		assert_eq!(res["id"], 7);
+		assert_eq!(res["result"]["Ok"].as_array().unwrap().len(), 100_000);
+		drop(rt);
+	}
+
+	#[test]
+	fn stream_error_before_first_chunk() {
+		let rt = Runtime::new().unwrap();
+		let pool = Arc::new(BlockingPool::default());
+		let resp = rt.enter(|| {
+			stream_response(pool, "test".to_owned(), Value::from(1), |w| {
+				w.begin_list()?;
+				Err(ErrorKind::NotFound.into())
+			})
+		});
+		let res = collect(resp).unwrap();
+		assert_eq!(res["result"]["Err"], "NotFound");
+		drop(rt);
+	}
+
+	// Time to first byte and bytes buffered for a range of 10k blocks with a
+	// couple of outputs (commit and hex encoded proof) each.
+	#[test]
+	fn stream_block_range_ttfb() {
+		let rt = Runtime::new().unwrap();
+		let pool = Arc::new(BlockingPool::default());
+		let proof = "00".repeat(675);
+		let start = Instant::now();
+		let resp = rt.enter(|| {
+			stream_response(pool, "test".to_owned(), Value::from(1), move |w| {
+				w.begin_list()?;
+				for height in 0..10_000u64 {
+					for i in 0..2u64 {
+						w.item(&serde_json::json!({
+							"commit": format!("{:066x}", height * 2 + i),
+							"proof": proof,
+							"block_height": height,
+						}))?;
+					}
+				}
+				w.end_list()
+			})
+		});
+		let mut body = resp.into_body();
+		let mut rt2 = Runtime::new().unwrap();
+		let first = rt2
+			.block_on(body::HttpBody::data(&mut body))
+			.unwrap()
+			.unwrap();
+		let ttfb = start.elapsed();
+		let mut total = first.len();
+		while let Some(chunk) = rt2.block_on(body::HttpBody::data(&mut body)) {
+			let chunk = chunk.unwrap();
+			assert!(chunk.len() < 2 * STREAM_CHUNK_SIZE);
+			total += chunk.len();
+		}
+		println!(
+			"10k blocks: ttfb {:?}, total {:?}, {} bytes",
+			ttfb,
+			start.elapsed(),
+			total
+		);
+		assert!(first.len() < 2 * STREAM_CHUNK_SIZE);
+		drop(rt);
+	}
+}
@@ -333,6 +333,34 @@ impl OutputPrintable {
 		})
 	}
 
+	/// Printable version of an output from a bulk UTXO scan. Everything is
+	/// already known from the scan so no chain lookup is needed.
+	/// Note: `merkle_proof` is left empty, scan Merkle proofs are against a
+	/// different root (see `ScannedOutputPrintable`).
+	pub fn from_scanned(scanned: &chain::ScannedOutput, include_proof: bool) -> OutputPrintable {
+		let output = &scanned.output;
+		let output_type = if output.is_coinbase() {
+			OutputType::Coinbase
+		} else {
+			OutputType::Transaction
+		};
+		let proof = if include_proof {
+			Some(output.proof_bytes().to_hex())
+		} else {
+			None
+		};
+		OutputPrintable {
+			output_type,
+			commit: output.commitment(),
+			spent: false,
+			proof,
+			proof_hash: output.proof.hash().to_hex(),
+			block_height: Some(scanned.height),
+			merkle_proof: None,
+			mmr_index: scanned.pos,
+		}
+	}
+
 	pub fn commit(&self) -> Result<pedersen::Commitment, ser::Error> {
 		Ok(self.commit)
 	}
@@ -722,6 +750,112 @@ pub struct OutputListing {
 	pub outputs: Vec<OutputPrintable>,
 }
 
+/// Unspent output from a bulk UTXO scan. If requested, coinbase outputs
+/// come with a Merkle proof against the output PMMR root at the head the
+/// scan was done at (`UtxoScanListing::head_hash`), rather than at the block
+/// that created the output as for `OutputPrintable::merkle_proof`.
+#[derive(Debug, Serialize, Deserialize, Clone)]
+pub struct ScannedOutputPrintable {
+	/// The output, as for any other output listing
+	#[serde(flatten)]
+	pub output: OutputPrintable,
+	/// Merkle proof against the output PMMR root at the scan head (as hex
+	/// string)
+	pub head_merkle_proof: Option<String>,
+}
+
+impl ScannedOutputPrintable {
+	pub fn from_scanned(
+		scanned: &chain::ScannedOutput,
+		include_proof: bool,
+	) -> ScannedOutputPrintable {
+		ScannedOutputPrintable {
+			output: OutputPrintable::from_scanned(scanned, include_proof),
+			head_merkle_proof: scanned.head_merkle_proof.as_ref().map(|p| p.to_hex()),
+		}
+	}
+}
+
+/// JSON version of a page of a bulk UTXO scan.
+#[derive(Debug, Serialize, Deserialize, Clone)]
+pub struct UtxoScanListing {
+	/// Hash of the chain head the scan was done at
+	pub head_hash: String,
+	/// Height of the chain head the scan was done at
+	pub head_height: u64,
+	/// The last available output index
+	pub highest_index: u64,
+	/// The last insertion index retrieved
+	pub last_retrieved_index: u64,
+	/// The outputs with their pos, height and optional Merkle proof
+	pub outputs: Vec<ScannedOutputPrintable>,
+}
+
+impl UtxoScanListing {
+	pub fn from_page(page: &UtxoScanPage, include_proof: bool) -> UtxoScanListing {
+		UtxoScanListing {
+			head_hash: page.head_hash.to_hex(),
+			head_height: page.head_height,
+			highest_index: page.highest_index,
+			last_retrieved_index: page.last_retrieved_index,
+			outputs: page
+				.outputs
+				.iter()
+				.map(|x| ScannedOutputPrintable::from_scanned(x, include_proof))
+				.collect(),
+		}
+	}
+}
+
+/// A page of a bulk UTXO scan, in the compact binary encoding served to
+/// wallets (see `UtxoScanListing` for the JSON equivalent).
+#[derive(Debug, Clone, PartialEq)]
+pub struct UtxoScanPage {
+	/// Hash of the chain head the scan was done at, Merkle proofs verify
+	/// against the output PMMR root at this head
+	pub head_hash: core::hash::Hash,
+	/// Height of the chain head the scan was done at
+	pub head_height: u64,
+	/// The last available output index
+	pub highest_index: u64,
+	/// The last insertion index retrieved
+	pub last_retrieved_index: u64,
+	/// The outputs with their pos, height and optional Merkle proof
+	pub outputs: Vec<chain::ScannedOutput>,
+}
+
+impl ser::Writeable for UtxoScanPage {
+	fn write<W: ser::Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		ser::Writeable::write(&self.head_hash, writer)?;
+		writer.write_u64(self.head_height)?;
+		writer.write_u64(self.highest_index)?;
+		writer.write_u64(self.last_retrieved_index)?;
+		writer.write_u64(self.outputs.len() as u64)?;
+		for output in &self.outputs {
+			ser::Writeable::write(output, writer)?;
+		}
+		Ok(())
+	}
+}
+
+impl ser::Readable for UtxoScanPage {
+	fn read<R: ser::Reader>(reader: &mut R) -> Result<UtxoScanPage, ser::Error> {
+		let head_hash: core::hash::Hash = ser::Readable::read(reader)?;
+		let head_height = reader.read_u64()?;
+		let highest_index = reader.read_u64()?;
+		let last_retrieved_index = reader.read_u64()?;
+		let count = reader.read_u64()?;
+		let outputs = ser::read_multi(reader, count)?;
+		Ok(UtxoScanPage {
+			head_hash,
+			head_height,
+			highest_index,
+			last_retrieved_index,
+			outputs,
+		})
+	}
+}
+
 #[derive(Debug, Serialize, Deserialize, Clone)]
 pub struct LocatedTxKernel {
 	pub tx_kernel: TxKernel,
@@ -729,6 +863,27 @@ pub struct LocatedTxKernel {
 	pub mmr_index: u64,
 }
 
+impl ser::Writeable for LocatedTxKernel {
+	fn write<W: ser::Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		ser::Writeable::write(&self.tx_kernel, writer)?;
+		writer.write_u64(self.height)?;
+		writer.write_u64(self.mmr_index)
+	}
+}
+
+impl ser::Readable for LocatedTxKernel {
+	fn read<R: ser::Reader>(reader: &mut R) -> Result<LocatedTxKernel, ser::Error> {
+		let tx_kernel: TxKernel = ser::Readable::read(reader)?;
+		let height = reader.read_u64()?;
+		let mmr_index = reader.read_u64()?;
+		Ok(LocatedTxKernel {
+			tx_kernel,
+			height,
+			mmr_index,
+		})
+	}
+}
+
 #[derive(Serialize, Deserialize)]
 pub struct PoolInfo {
 	/// Size of the pool
@@ -39,6 +39,7 @@ where
 			}
 			// place holder
 			ErrorKind::Router(_) => response(StatusCode::INTERNAL_SERVER_ERROR, ""),
+			ErrorKind::Busy(msg) => response(StatusCode::SERVICE_UNAVAILABLE, msg.clone()),
 		},
 	}
 }
@@ -69,6 +70,22 @@ where
 	}
 }
 
+/// Binary response, for endpoints serving the consensus serialization of
+/// their results.
+pub fn binary_response(bytes: Vec<u8>) -> ResponseFuture {
+	let resp = Response::builder()
+		.status(StatusCode::OK)
+		.header(hyper::header::CONTENT_TYPE, "application/octet-stream")
+		.body(bytes.into());
+	match resp {
+		Ok(resp) => Box::pin(ok(resp)),
+		Err(e) => response(
+			StatusCode::INTERNAL_SERVER_ERROR,
+			format!("can't create binary response: {}", e),
+		),
+	}
+}
+
 /// Text response as HTTP response
 pub fn just_response<T: Into<Body> + Debug>(status: StatusCode, text: T) -> Response<Body> {
 	let mut resp = Response::new(text.into());
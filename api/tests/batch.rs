@@ -0,0 +1,108 @@
+use grin_api as api;
+use grin_util as util;
+
+use crate::api::*;
+use hyper::{Body, Request};
+use serde_json::{json, Value};
+use std::net::SocketAddr;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use std::{thread, time};
+
+const MAX_BATCH_SIZE: usize = 1_000;
+
+// Stands in for a chain lookup such as get_kernel.
+fn call(req: Value) -> Value {
+	thread::sleep(Duration::from_millis(1));
+	json!({
+		"id": req["id"],
+		"jsonrpc": "2.0",
+		"result": { "Ok": req["params"][0] },
+	})
+}
+
+struct RpcHandler {
+	pool: Arc<BlockingPool>,
+}
+
+impl Handler for RpcHandler {
+	fn post(&self, req: Request<Body>) -> ResponseFuture {
+		let pool = self.pool.clone();
+		Box::pin(async move {
+			let res = match parse_body::<Value>(req).await.unwrap() {
+				Value::Array(calls) => Ok(pool.run_batch(calls, MAX_BATCH_SIZE, call).await),
+				val => pool.run(&rpc_method(&val), move || call(val)).await,
+			};
+			result_to_response(res).await
+		})
+	}
+}
+
+fn rpc_method(req: &Value) -> String {
+	req["method"].as_str().unwrap_or("default").to_owned()
+}
+
+fn kernel_req(id: usize) -> Value {
+	json!({
+		"jsonrpc": "2.0",
+		"method": "get_kernel",
+		"params": [id, null, null],
+		"id": id,
+	})
+}
+
+// Benchmark of 1,000 sequential calls against a single batch of the same
+// calls.
+#[test]
+fn test_batch_requests() {
+	util::init_test_logger();
+	let pool = Arc::new(BlockingPool::new(8, 256).with_lane("get_kernel", 4, 256));
+	let mut router = Router::new();
+	router
+		.add_route("/v2/foreign", Arc::new(RpcHandler { pool: pool.clone() }))
+		.unwrap();
+	let server_addr = "127.0.0.1:14437";
+	let addr: SocketAddr = server_addr.parse().unwrap();
+	let mut server = ApiServer::new();
+	assert!(server.start(addr, router, None).is_ok());
+	thread::sleep(time::Duration::from_millis(500));
+	let url = format!("http://{}/v2/foreign", server_addr);
+
+	let start = Instant::now();
+	for id in 0..1_000 {
+		let reply: Value = api::client::post(&url, None, &kernel_req(id)).unwrap();
+		assert_eq!(reply["result"]["Ok"], id);
+	}
+	let sequential = start.elapsed();
+
+	let batch: Vec<Value> = (0..1_000).map(kernel_req).collect();
+	let start = Instant::now();
+	let replies: Vec<Value> = api::client::post(&url, None, &batch).unwrap();
+	let batched = start.elapsed();
+	println!(
+		"1000 get_kernel calls: sequential {:?}, single batch {:?}",
+		sequential, batched
+	);
+	assert_eq!(replies.len(), 1_000);
+	for (id, reply) in replies.iter().enumerate() {
+		assert_eq!(reply["id"], id);
+		assert_eq!(reply["result"]["Ok"], id);
+	}
+	assert!(batched < sequential);
+
+	// notifications get no reply
+	let mut notification = kernel_req(1);
+	notification.as_object_mut().unwrap().remove("id");
+	let replies: Vec<Value> =
+		api::client::post(&url, None, &vec![kernel_req(0), notification]).unwrap();
+	assert_eq!(replies.len(), 1);
+
+	// batches over the limit are rejected as a whole
+	let batch: Vec<Value> = (0..MAX_BATCH_SIZE + 1).map(kernel_req).collect();
+	let reply: Value = api::client::post(&url, None, &batch).unwrap();
+	assert_eq!(reply["error"]["code"], -32600);
+	let reply: Value = api::client::post(&url, None, &Vec::<Value>::new()).unwrap();
+	assert_eq!(reply["error"]["code"], -32600);
+
+	assert!(server.stop());
+}
@@ -0,0 +1,158 @@
+use grin_api as api;
+use grin_chain as chain;
+use grin_core as core;
+use grin_util as util;
+
+use crate::api::*;
+use crate::core::core::hash::ZERO_HASH;
+use crate::core::core::{Output, OutputFeatures};
+use crate::core::ser::{self, ProtocolVersion};
+use crate::util::secp::constants::MAX_PROOF_SIZE;
+use crate::util::secp::pedersen::{Commitment, RangeProof};
+use hyper::header::ACCEPT;
+use hyper::{Body, Request};
+use serde_json::{json, Value};
+use std::net::SocketAddr;
+use std::time::{Duration, Instant};
+use std::{thread, time};
+
+const PAGE_SIZE: u64 = 1_000;
+const ROUNDS: usize = 20;
+
+// Serves the same page of unspent outputs as a get_unspent_outputs call
+// would in JSON, or a scan_unspent_outputs call in binary.
+struct ScanPageHandler {
+	page: UtxoScanPage,
+}
+
+impl Handler for ScanPageHandler {
+	fn post(&self, req: Request<Body>) -> ResponseFuture {
+		let binary = req
+			.headers()
+			.get(ACCEPT)
+			.map_or(false, |v| v.as_bytes() == BINARY_CONTENT_TYPE.as_bytes());
+		if binary {
+			binary_response(ser::ser_vec(&self.page, ProtocolVersion::local()).unwrap())
+		} else {
+			let listing = OutputListing {
+				highest_index: self.page.highest_index,
+				last_retrieved_index: self.page.last_retrieved_index,
+				outputs: self
+					.page
+					.outputs
+					.iter()
+					.map(|x| OutputPrintable::from_scanned(x, true))
+					.collect(),
+			};
+			json_response(&json!({
+				"id": 1,
+				"jsonrpc": "2.0",
+				"result": { "Ok": listing },
+			}))
+		}
+	}
+}
+
+fn scan_page() -> UtxoScanPage {
+	let outputs = (0..PAGE_SIZE)
+		.map(|i| {
+			let mut commit = vec![8; 33];
+			commit[1..9].copy_from_slice(&i.to_be_bytes());
+			// Typical bulletproof size, the rest of the buffer is padding.
+			let mut proof = [0; MAX_PROOF_SIZE];
+			proof[..675].copy_from_slice(&[7; 675]);
+			chain::ScannedOutput {
+				output: Output::new(
+					OutputFeatures::Plain,
+					Commitment::from_vec(commit),
+					RangeProof { proof, plen: 675 },
+				),
+				pos: i * 2 + 1,
+				height: i,
+				head_merkle_proof: None,
+			}
+		})
+		.collect();
+	UtxoScanPage {
+		head_hash: ZERO_HASH,
+		head_height: PAGE_SIZE,
+		highest_index: PAGE_SIZE * 2,
+		last_retrieved_index: PAGE_SIZE * 2 - 1,
+		outputs,
+	}
+}
+
+// Throughput and bytes on the wire of a page of outputs in JSON and binary.
+#[test]
+fn test_binary_transport() {
+	util::init_test_logger();
+	let page = scan_page();
+	let json_bytes = serde_json::to_vec(&OutputListing {
+		highest_index: page.highest_index,
+		last_retrieved_index: page.last_retrieved_index,
+		outputs: page
+			.outputs
+			.iter()
+			.map(|x| OutputPrintable::from_scanned(x, true))
+			.collect(),
+	})
+	.unwrap()
+	.len();
+	let binary_bytes = ser::ser_vec(&page, ProtocolVersion::local()).unwrap().len();
+
+	let mut router = Router::new();
+	router
+		.add_route(
+			"/v2/foreign",
+			std::sync::Arc::new(ScanPageHandler { page: page.clone() }),
+		)
+		.unwrap();
+	let server_addr = "127.0.0.1:14436";
+	let addr: SocketAddr = server_addr.parse().unwrap();
+	let mut server = ApiServer::new();
+	assert!(server.start(addr, router, None).is_ok());
+	thread::sleep(time::Duration::from_millis(500));
+
+	let url = format!("http://{}/v2/foreign", server_addr);
+	let req = json!({
+		"jsonrpc": "2.0",
+		"method": "get_unspent_outputs",
+		"params": [1, null, PAGE_SIZE, true],
+		"id": 1
+	});
+	let scan_req = json!({
+		"jsonrpc": "2.0",
+		"method": "scan_unspent_outputs",
+		"params": [1, null, PAGE_SIZE, true],
+		"id": 1
+	});
+
+	let start = Instant::now();
+	for _ in 0..ROUNDS {
+		let reply: Value = api::client::post(&url, None, &req).unwrap();
+		let listing: OutputListing = serde_json::from_value(reply["result"]["Ok"].clone()).unwrap();
+		assert_eq!(listing.outputs.len() as u64, PAGE_SIZE);
+	}
+	let json_time = start.elapsed();
+
+	let start = Instant::now();
+	for _ in 0..ROUNDS {
+		let res: UtxoScanPage = api::client::post_binary(&url, None, &scan_req).unwrap();
+		assert_eq!(res, page);
+	}
+	let binary_time = start.elapsed();
+
+	let per_sec = |d: Duration| (ROUNDS as u64 * PAGE_SIZE) as f64 / d.as_secs_f64();
+	println!(
+		"{} outputs per page: json {} bytes, {:.0} outputs/s; binary {} bytes, {:.0} outputs/s",
+		PAGE_SIZE,
+		json_bytes,
+		per_sec(json_time),
+		binary_bytes,
+		per_sec(binary_time)
+	);
+
+	// Rangeproofs dominate, hex encoding doubles them.
+	assert!(binary_bytes * 3 < json_bytes * 2);
+	assert!(server.stop());
+}
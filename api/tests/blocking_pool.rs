@@ -0,0 +1,249 @@
+use grin_api as api;
+use grin_util as util;
+
+use crate::api::*;
+use hyper::{Body, Request};
+use std::net::SocketAddr;
+use std::sync::{Arc, Condvar, Mutex};
+use std::time::Duration;
+use std::{thread, time};
+
+/// Held shut by the test, blocking calls wait on it until it is opened.
+struct Gate {
+	open: Mutex<bool>,
+	cond: Condvar,
+}
+
+impl Gate {
+	fn new() -> Arc<Gate> {
+		Arc::new(Gate {
+			open: Mutex::new(false),
+			cond: Condvar::new(),
+		})
+	}
+
+	fn wait(&self) {
+		let mut open = self.open.lock().unwrap();
+		while !*open {
+			open = self.cond.wait(open).unwrap();
+		}
+	}
+
+	fn open(&self) {
+		*self.open.lock().unwrap() = true;
+		self.cond.notify_all();
+	}
+}
+
+/// Stands in for a chain call: blocks on the gate (if any) on the blocking
+/// thread.
+struct PooledHandler {
+	pool: Arc<BlockingPool>,
+	lane: &'static str,
+	gate: Option<Arc<Gate>>,
+}
+
+impl Handler for PooledHandler {
+	fn get(&self, _req: Request<Body>) -> ResponseFuture {
+		let pool = self.pool.clone();
+		let lane = self.lane;
+		let gate = self.gate.clone();
+		Box::pin(async move {
+			let res = pool
+				.run(lane, move || {
+					if let Some(gate) = gate {
+						gate.wait();
+					}
+					vec!["ok".to_string()]
+				})
+				.await;
+			result_to_response(res).await
+		})
+	}
+}
+
+fn lane_stats(pool: &BlockingPool, name: &str) -> LaneStats {
+	pool.stats().into_iter().find(|l| l.name == name).unwrap()
+}
+
+// Waits (up to 10s) for the lane to reach the expected number of running
+// and queued calls.
+fn wait_for_lane(pool: &BlockingPool, name: &str, running: usize, queued: usize) {
+	for _ in 0..1_000 {
+		let stats = lane_stats(pool, name);
+		if stats.running == running && stats.queued == queued {
+			return;
+		}
+		thread::sleep(time::Duration::from_millis(10));
+	}
+	panic!("lane {}: {:?}", name, lane_stats(pool, name));
+}
+
+// get_tip keeps being served while get_outputs calls fill their own lane.
+#[test]
+fn test_fast_lane_not_starved() {
+	util::init_test_logger();
+	let gate = Gate::new();
+	let pool = Arc::new(
+		BlockingPool::new(8, 1_000)
+			.with_lane("get_outputs", 2, 1_000)
+			.with_lane("get_tip", 4, 1_000),
+	);
+	let mut router = Router::new();
+	router
+		.add_route(
+			"/v1/outputs",
+			Arc::new(PooledHandler {
+				pool: pool.clone(),
+				lane: "get_outputs",
+				gate: Some(gate.clone()),
+			}),
+		)
+		.unwrap();
+	router
+		.add_route(
+			"/v1/tip",
+			Arc::new(PooledHandler {
+				pool: pool.clone(),
+				lane: "get_tip",
+				gate: None,
+			}),
+		)
+		.unwrap();
+
+	let server_addr = "127.0.0.1:14435";
+	let addr: SocketAddr = server_addr.parse().unwrap();
+	let mut server = ApiServer::new();
+	assert!(server.start(addr, router, None).is_ok());
+	thread::sleep(time::Duration::from_millis(500));
+
+	let outputs_url = format!("http://{}/v1/outputs", server_addr);
+	let heavy: Vec<_> = (0..32)
+		.map(|_| {
+			let url = outputs_url.clone();
+			thread::spawn(move || {
+				let _ = api::client::get::<Vec<String>>(&url, None);
+			})
+		})
+		.collect();
+	wait_for_lane(&pool, "get_outputs", 2, 30);
+
+	// Every get_tip call completes while the get_outputs lane is still full.
+	let tip_url = format!("http://{}/v1/tip", server_addr);
+	for _ in 0..100 {
+		api::client::get::<Vec<String>>(&tip_url, None).unwrap();
+	}
+	let stats = lane_stats(&pool, "get_outputs");
+	assert_eq!((stats.running, stats.queued), (2, 30));
+	assert_eq!(lane_stats(&pool, "get_tip").running, 0);
+
+	gate.open();
+	for h in heavy {
+		h.join().unwrap();
+	}
+	wait_for_lane(&pool, "get_outputs", 0, 0);
+	assert!(server.stop());
+}
+
+// Load-test harness: p50/p99 latency of get_tip while the get_outputs lane is
+// saturated by calls that do not complete until the measurement is over.
+#[test]
+fn test_tip_latency_under_load() {
+	util::init_test_logger();
+	let gate = Gate::new();
+	let pool = Arc::new(
+		BlockingPool::new(8, 1_000)
+			.with_lane("get_outputs", 2, 1_000)
+			.with_lane("get_tip", 4, 1_000),
+	);
+	let mut router = Router::new();
+	router
+		.add_route(
+			"/v1/outputs",
+			Arc::new(PooledHandler {
+				pool: pool.clone(),
+				lane: "get_outputs",
+				gate: Some(gate.clone()),
+			}),
+		)
+		.unwrap();
+	router
+		.add_route(
+			"/v1/tip",
+			Arc::new(PooledHandler {
+				pool: pool.clone(),
+				lane: "get_tip",
+				gate: None,
+			}),
+		)
+		.unwrap();
+
+	let server_addr = "127.0.0.1:14438";
+	let addr: SocketAddr = server_addr.parse().unwrap();
+	let mut server = ApiServer::new();
+	assert!(server.start(addr, router, None).is_ok());
+	thread::sleep(time::Duration::from_millis(500));
+
+	let outputs_url = format!("http://{}/v1/outputs", server_addr);
+	let heavy: Vec<_> = (0..64)
+		.map(|_| {
+			let url = outputs_url.clone();
+			thread::spawn(move || {
+				let _ = api::client::get::<Vec<String>>(&url, None);
+			})
+		})
+		.collect();
+	wait_for_lane(&pool, "get_outputs", 2, 62);
+
+	let tip_url = format!("http://{}/v1/tip", server_addr);
+	let mut latencies: Vec<Duration> = (0..500)
+		.map(|_| {
+			let start = time::Instant::now();
+			api::client::get::<Vec<String>>(&tip_url, None).unwrap();
+			start.elapsed()
+		})
+		.collect();
+	latencies.sort();
+	let p50 = latencies[latencies.len() / 2];
+	let p99 = latencies[latencies.len() * 99 / 100];
+	println!(
+		"get_tip under get_outputs load: p50 {:?}, p99 {:?}, max {:?}",
+		p50,
+		p99,
+		latencies.last().unwrap()
+	);
+
+	// The heavy calls never complete while we measure, get_tip stays fast.
+	let stats = lane_stats(&pool, "get_outputs");
+	assert_eq!((stats.running, stats.queued), (2, 62));
+	assert!(p99 < Duration::from_secs(1), "p99 {:?}", p99);
+
+	gate.open();
+	for h in heavy {
+		h.join().unwrap();
+	}
+	wait_for_lane(&pool, "get_outputs", 0, 0);
+	assert!(server.stop());
+}
+
+// A call keeps its slot until the blocking closure returns, even if the
+// caller stops waiting for it.
+#[test]
+fn test_slot_held_after_caller_dropped() {
+	let gate = Gate::new();
+	let pool = BlockingPool::new(1, 10);
+	let mut rt = tokio::runtime::Runtime::new().unwrap();
+
+	let waiting = {
+		let gate = gate.clone();
+		rt.block_on(tokio::time::timeout(
+			Duration::from_millis(50),
+			pool.run("default", move || gate.wait()),
+		))
+	};
+	assert!(waiting.is_err());
+	assert_eq!(lane_stats(&pool, "default").running, 1);
+
+	gate.open();
+	wait_for_lane(&pool, "default", 0, 0);
+}
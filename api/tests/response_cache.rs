@@ -0,0 +1,142 @@
+use grin_api as api;
+use grin_core as core;
+
+use crate::api::ResponseCache;
+use crate::core::core::hash::Hashed;
+use serde_json::{json, Value};
+use std::cell::Cell;
+use std::env;
+use std::fs;
+
+// A single recorded request: chain height at the time it was received and
+// the JSON-RPC body.
+struct TraceEntry {
+	height: u64,
+	req: Value,
+}
+
+// Reads a trace file of JSON lines `{"height": 123, "req": {...}}`.
+fn read_trace(path: &str) -> Vec<TraceEntry> {
+	let data = fs::read_to_string(path).expect("failed to read trace");
+	data.lines()
+		.filter_map(|l| serde_json::from_str::<Value>(l).ok())
+		.map(|v| TraceEntry {
+			height: v["height"].as_u64().unwrap_or(0),
+			req: v["req"].clone(),
+		})
+		.collect()
+}
+
+// Synthetic trace shaped like a fleet of wallets polling between blocks:
+// every wallet checks the tip, then its outputs and a header.
+fn synthetic_trace() -> Vec<TraceEntry> {
+	let mut trace = vec![];
+	let mut id = 0;
+	for height in 1_000..1_010 {
+		for _poll in 0..6 {
+			for wallet in 0..50u64 {
+				id += 1;
+				trace.push(TraceEntry {
+					height,
+					req: json!({"jsonrpc": "2.0", "method": "get_tip", "params": [], "id": id}),
+				});
+				trace.push(TraceEntry {
+					height,
+					req: json!({
+						"jsonrpc": "2.0",
+						"method": "get_outputs",
+						"params": [[format!("08{:064x}", wallet % 5)], null, null, true, true],
+						"id": id
+					}),
+				});
+				trace.push(TraceEntry {
+					height,
+					req: json!({
+						"jsonrpc": "2.0",
+						"method": "get_header",
+						"params": [null, format!("{:064x}", wallet % 10), null],
+						"id": id
+					}),
+				});
+			}
+		}
+	}
+	trace
+}
+
+// Stand in for the chain lookup and serialization cost of a real call.
+fn compute(req: &Value) -> Value {
+	let outputs: Vec<Value> = (0..20)
+		.map(|i| json!({"commit": format!("{:066x}", i), "proof": "00".repeat(675)}))
+		.collect();
+	let result = json!({ "Ok": outputs });
+	let body = serde_json::to_string(&result).unwrap();
+	json!({
+		"id": req["id"],
+		"jsonrpc": "2.0",
+		"result": serde_json::from_str::<Value>(&body).unwrap()
+	})
+}
+
+// Replays a trace through a fresh cache, returning the number of calls
+// reaching the underlying handler and the cache stats.
+fn replay(trace: &[TraceEntry]) -> (u64, api::CacheStats) {
+	let cache = ResponseCache::new();
+	let computed = Cell::new(0);
+	for entry in trace {
+		let head = entry.height.hash();
+		let res = cache.get_or_compute(&entry.req, head, entry.height, || {
+			computed.set(computed.get() + 1);
+			compute(&entry.req)
+		});
+		// Hits are replies to this request, not to the one that was cached.
+		assert_eq!(res["id"], entry.req["id"]);
+	}
+
+	let stats = cache.stats();
+	println!(
+		"replayed {} requests: {} computed, hit rate {:.3}, {:?}",
+		trace.len(),
+		computed.get(),
+		stats.hit_rate(),
+		stats
+	);
+	assert_eq!(computed.get(), stats.misses + stats.uncacheable);
+	assert_eq!(
+		trace.len() as u64,
+		stats.tip_hits + stats.immutable_hits + stats.misses + stats.uncacheable
+	);
+	(computed.get(), stats)
+}
+
+#[test]
+fn replay_synthetic_traffic() {
+	let trace = synthetic_trace();
+	let (computed, stats) = replay(&trace);
+	assert!(stats.hit_rate() > 0.9);
+	assert!(computed < trace.len() as u64 / 10);
+}
+
+// Checked-in trace of a dozen wallets updating over 8 blocks: tip and own
+// outputs every poll, kernel lookups, the odd header and tx push.
+#[test]
+fn replay_wallet_trace() {
+	let trace = read_trace(concat!(
+		env!("CARGO_MANIFEST_DIR"),
+		"/tests/data/wallet_trace.jsonl"
+	));
+	assert_eq!(trace.len(), 712);
+	let (computed, stats) = replay(&trace);
+	assert_eq!(stats.uncacheable, 16);
+	assert!(stats.hit_rate() > 0.75);
+	assert!(computed < trace.len() as u64 / 3);
+}
+
+// Recorded traffic can be replayed by pointing GRIN_API_TRACE at a trace
+// file in the same format.
+#[test]
+fn replay_recorded_traffic() {
+	if let Ok(path) = env::var("GRIN_API_TRACE") {
+		replay(&read_trace(&path));
+	}
+}
@@ -17,8 +17,8 @@
 
 use crate::core::core::merkle_proof::MerkleProof;
 use crate::core::core::{
-	Block, BlockHeader, BlockSums, Committed, Inputs, KernelFeatures, Output, OutputIdentifier,
-	SegmentIdentifier, Transaction, TxKernel,
+	Block, BlockHeader, BlockSums, Committed, Input, Inputs, KernelFeatures, Output,
+	OutputIdentifier, SegmentIdentifier, Transaction, TxKernel,
 };
 use crate::core::global;
 use crate::core::pow;
@@ -29,58 +29,113 @@ use crate::store;
 use crate::txhashset;
 use crate::txhashset::{PMMRHandle, Segmenter, TxHashSet};
 use crate::types::{
-	BlockStatus, ChainAdapter, CommitPos, NoStatus, Options, Tip, TxHashsetWriteStatus,
+	BlockLockStats, BlockStatus, ChainAdapter, CommitPos, NoStatus, Options, ScannedOutput, Tip,
+	TxHashsetWriteStatus,
 };
 use crate::util::secp::pedersen::{Commitment, RangeProof};
-use crate::util::RwLock;
+use crate::util::{Mutex, RwLock};
 use crate::{
 	core::core::hash::{Hash, Hashed},
 	store::Batch,
 	txhashset::{ExtensionPair, HeaderExtension},
 };
 use grin_store::Error::NotFoundErr;
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::fs::{self, File};
+use std::mem;
 use std::path::{Path, PathBuf};
 use std::sync::atomic::{AtomicUsize, Ordering};
-use std::sync::Arc;
+use std::sync::{mpsc, Arc, Weak};
+use std::thread;
 use std::time::{Duration, Instant};
 
-/// Orphan pool size is limited by MAX_ORPHAN_SIZE
-pub const MAX_ORPHAN_SIZE: usize = 200;
+/// Orphan pool size is limited by MAX_ORPHAN_BYTES, the approximate memory
+/// used by the orphan blocks.
+pub const MAX_ORPHAN_BYTES: usize = 128 * 1024 * 1024;
 
 /// When evicting, very old orphans are evicted first
 const MAX_ORPHAN_AGE_SECS: u64 = 300;
 
+/// Number of threads validating orphans in the background.
+const ORPHAN_VALIDATION_THREADS: usize = 2;
+
 #[derive(Debug, Clone)]
 struct Orphan {
-	block: Block,
+	block: Arc<Block>,
 	opts: Options,
 	added: Instant,
+	// Approximate memory used by the block.
+	size: usize,
+	// Context-free validation (see pipe::validate_block_body) already done.
+	validated: bool,
 }
 
-pub struct OrphanBlockPool {
+impl Orphan {
+	fn new(block: Block, opts: Options) -> Orphan {
+		let size = mem::size_of::<Block>()
+			+ block.inputs().len() * mem::size_of::<Input>()
+			+ block.outputs().len() * mem::size_of::<Output>()
+			+ block.kernels().len() * mem::size_of::<TxKernel>();
+		Orphan {
+			block: Arc::new(block),
+			opts,
+			added: Instant::now(),
+			size,
+			validated: false,
+		}
+	}
+
+	fn into_block(self) -> Block {
+		Arc::try_unwrap(self.block).unwrap_or_else(|b| (*b).clone())
+	}
+}
+
+#[derive(Default)]
+struct OrphanSet {
 	// blocks indexed by their hash
-	orphans: RwLock<HashMap<Hash, Orphan>>,
-	// additional index of height -> hash
-	// so we can efficiently identify a child block (ex-orphan) after processing a block
-	height_idx: RwLock<HashMap<u64, Vec<Hash>>>,
-	// accumulated number of evicted block because of MAX_ORPHAN_SIZE limitation
+	orphans: HashMap<Hash, Orphan>,
+	// additional index of previous hash -> hashes so we can efficiently
+	// identify the children (ex-orphans) of a block after processing it
+	prev_idx: HashMap<Hash, Vec<Hash>>,
+	// approximate memory used by all the orphans
+	size: usize,
+}
+
+impl OrphanSet {
+	fn remove(&mut self, hash: &Hash) -> Option<Orphan> {
+		let orphan = self.orphans.remove(hash)?;
+		self.size -= orphan.size;
+		let prev = orphan.block.header.prev_hash;
+		if let Some(hs) = self.prev_idx.get_mut(&prev) {
+			hs.retain(|h| h != hash);
+			if hs.is_empty() {
+				self.prev_idx.remove(&prev);
+			}
+		}
+		Some(orphan)
+	}
+}
+
+pub struct OrphanBlockPool {
+	set: RwLock<OrphanSet>,
+	// accumulated number of evicted block because of MAX_ORPHAN_BYTES limitation
 	evicted: AtomicUsize,
 }
 
 impl OrphanBlockPool {
 	fn new() -> OrphanBlockPool {
 		OrphanBlockPool {
-			orphans: RwLock::new(HashMap::new()),
-			height_idx: RwLock::new(HashMap::new()),
+			set: RwLock::new(OrphanSet::default()),
 			evicted: AtomicUsize::new(0),
 		}
 	}
 
 	fn len(&self) -> usize {
-		let orphans = self.orphans.read();
-		orphans.len()
+		self.set.read().orphans.len()
+	}
+
+	fn size(&self) -> usize {
+		self.set.read().size
 	}
 
 	fn len_evicted(&self) -> usize {
@@ -88,58 +143,130 @@ impl OrphanBlockPool {
 	}
 
 	fn add(&self, orphan: Orphan) {
-		let mut orphans = self.orphans.write();
-		let mut height_idx = self.height_idx.write();
-		{
-			let height_hashes = height_idx
-				.entry(orphan.block.header.height)
-				.or_insert_with(|| vec![]);
-			height_hashes.push(orphan.block.hash());
-			orphans.insert(orphan.block.hash(), orphan);
+		let mut set = self.set.write();
+		let hash = orphan.block.hash();
+		if set.orphans.contains_key(&hash) {
+			return;
 		}
-
-		if orphans.len() > MAX_ORPHAN_SIZE {
-			let old_len = orphans.len();
-
-			// evict too old
-			orphans.retain(|_, ref mut x| {
-				x.added.elapsed() < Duration::from_secs(MAX_ORPHAN_AGE_SECS)
-			});
-			// evict too far ahead
-			let mut heights = height_idx.keys().cloned().collect::<Vec<u64>>();
-			heights.sort_unstable();
-			for h in heights.iter().rev() {
-				if let Some(hs) = height_idx.remove(h) {
-					for h in hs {
-						let _ = orphans.remove(&h);
-					}
-				}
-				if orphans.len() < MAX_ORPHAN_SIZE {
+		set.size += orphan.size;
+		set.prev_idx
+			.entry(orphan.block.header.prev_hash)
+			.or_insert_with(|| vec![])
+			.push(hash);
+		set.orphans.insert(hash, orphan);
+
+		if set.size > MAX_ORPHAN_BYTES {
+			let old_len = set.orphans.len();
+
+			// evict too old, then too far ahead
+			let mut hashes: Vec<_> = set
+				.orphans
+				.values()
+				.map(|x| {
+					let too_old = x.added.elapsed() >= Duration::from_secs(MAX_ORPHAN_AGE_SECS);
+					(too_old, x.block.header.height, x.block.hash())
+				})
+				.collect();
+			hashes.sort_unstable();
+			for (too_old, _, h) in hashes.into_iter().rev() {
+				if !too_old && set.size <= MAX_ORPHAN_BYTES {
 					break;
 				}
+				set.remove(&h);
 			}
-			// cleanup index
-			height_idx.retain(|_, ref mut xs| xs.iter().any(|x| orphans.contains_key(&x)));
 
 			self.evicted
-				.fetch_add(old_len - orphans.len(), Ordering::Relaxed);
+				.fetch_add(old_len - set.orphans.len(), Ordering::Relaxed);
+		}
+	}
+
+	fn get_block(&self, hash: &Hash) -> Option<Arc<Block>> {
+		self.set.read().orphans.get(hash).map(|x| x.block.clone())
+	}
+
+	/// Record the outcome of the background validation of an orphan, invalid
+	/// orphans are dropped.
+	fn set_validated(&self, hash: &Hash, valid: bool) {
+		let mut set = self.set.write();
+		if valid {
+			if let Some(orphan) = set.orphans.get_mut(hash) {
+				orphan.validated = true;
+			}
+		} else {
+			set.remove(hash);
 		}
 	}
 
-	/// Get an orphan from the pool indexed by the hash of its parent, removing
-	/// it at the same time, preventing clone
-	fn remove_by_height(&self, height: u64) -> Option<Vec<Orphan>> {
-		let mut orphans = self.orphans.write();
-		let mut height_idx = self.height_idx.write();
-		height_idx
-			.remove(&height)
-			.map(|hs| hs.iter().filter_map(|h| orphans.remove(h)).collect())
+	/// Remove all the orphans descending from the provided block, parents
+	/// always coming before their children.
+	fn remove_descendants(&self, hash: &Hash) -> Vec<Orphan> {
+		let mut set = self.set.write();
+		let mut res: Vec<Orphan> = vec![];
+		let mut next = 0;
+		let mut prev = *hash;
+		loop {
+			let children = set.prev_idx.remove(&prev).unwrap_or_else(|| vec![]);
+			for h in children {
+				if let Some(orphan) = set.orphans.remove(&h) {
+					set.size -= orphan.size;
+					res.push(orphan);
+				}
+			}
+			if next >= res.len() {
+				break;
+			}
+			prev = res[next].block.hash();
+			next += 1;
+		}
+		res
 	}
 
 	pub fn contains(&self, hash: &Hash) -> bool {
-		let orphans = self.orphans.read();
-		orphans.contains_key(hash)
+		self.set.read().orphans.contains_key(hash)
+	}
+}
+
+// Context-free validation of orphans as they arrive, by a few background
+// threads, so they are ready to be applied as soon as their parent is.
+fn spawn_orphan_validation(
+	orphans: Arc<OrphanBlockPool>,
+	store: Weak<store::ChainStore>,
+) -> Result<mpsc::Sender<Hash>, Error> {
+	let (tx, rx) = mpsc::channel::<Hash>();
+	let rx = Arc::new(Mutex::new(rx));
+	for i in 0..ORPHAN_VALIDATION_THREADS {
+		let rx = rx.clone();
+		let orphans = orphans.clone();
+		let store = store.clone();
+		thread::Builder::new()
+			.name(format!("orphan_validation_{}", i))
+			.spawn(move || loop {
+				// Stops once the chain (the sender) is gone.
+				let hash = match rx.lock().recv() {
+					Ok(hash) => hash,
+					Err(_) => break,
+				};
+				let block = match orphans.get_block(&hash) {
+					Some(block) => block,
+					None => continue,
+				};
+				let store = match store.upgrade() {
+					Some(store) => store,
+					None => break,
+				};
+				let prev = match store.get_previous_header(&block.header) {
+					Ok(prev) => prev,
+					Err(_) => continue,
+				};
+				let res = pipe::validate_block_body(&block, &prev);
+				if let Err(ref e) = res {
+					info!("orphan_validation: dropping invalid orphan {}: {}", hash, e);
+				}
+				orphans.set_validated(&hash, res.is_ok());
+			})
+			.map_err(|e| ErrorKind::Other(format!("failed to spawn orphan validation: {}", e)))?;
 	}
+	Ok(tx)
 }
 
 /// Facade to the blockchain block processing pipeline and storage. Provides
@@ -150,6 +277,7 @@ pub struct Chain {
 	store: Arc<store::ChainStore>,
 	adapter: Arc<dyn ChainAdapter + Send + Sync>,
 	orphans: Arc<OrphanBlockPool>,
+	orphan_validation: Mutex<mpsc::Sender<Hash>>,
 	txhashset: Arc<RwLock<txhashset::TxHashSet>>,
 	header_pmmr: Arc<RwLock<txhashset::PMMRHandle<BlockHeader>>>,
 	pibd_segmenter: Arc<RwLock<Option<Segmenter>>>,
@@ -158,6 +286,11 @@ pub struct Chain {
 	denylist: Arc<RwLock<Vec<Hash>>>,
 	archive_mode: bool,
 	genesis: BlockHeader,
+	// Last fork point found, along with the body head and header head it was found for.
+	fork_point_cache: Mutex<Option<(Hash, Hash, BlockHeader)>>,
+	// Last locator built, along with the sync head and heights it was built for.
+	locator_cache: Mutex<Option<(Hash, Vec<u64>, Vec<Hash>)>>,
+	block_lock_stats: Mutex<BlockLockStats>,
 }
 
 impl Chain {
@@ -186,19 +319,24 @@ impl Chain {
 		setup_head(&genesis, &store, &mut header_pmmr, &mut txhashset)?;
 
 		// Initialize the output_pos index based on UTXO set
-		// and NRD kernel_pos index based recent kernel history.
+		// and check NRD kernel_pos index against its last checkpoint.
 		{
 			let batch = store.batch()?;
 			txhashset.init_output_pos_index(&header_pmmr, &batch)?;
-			txhashset.init_recent_kernel_pos_index(&header_pmmr, &batch)?;
+			txhashset.resume_recent_kernel_pos_index(&header_pmmr, &batch)?;
+			batch.init_block_height_index()?;
 			batch.commit()?;
 		}
 
+		let orphans = Arc::new(OrphanBlockPool::new());
+		let orphan_validation = spawn_orphan_validation(orphans.clone(), Arc::downgrade(&store))?;
+
 		let chain = Chain {
 			db_root,
 			store,
 			adapter,
-			orphans: Arc::new(OrphanBlockPool::new()),
+			orphans,
+			orphan_validation: Mutex::new(orphan_validation),
 			txhashset: Arc::new(RwLock::new(txhashset)),
 			header_pmmr: Arc::new(RwLock::new(header_pmmr)),
 			pibd_segmenter: Arc::new(RwLock::new(None)),
@@ -206,6 +344,9 @@ impl Chain {
 			denylist: Arc::new(RwLock::new(vec![])),
 			archive_mode,
 			genesis: genesis.header,
+			fork_point_cache: Mutex::new(None),
+			locator_cache: Mutex::new(None),
+			block_lock_stats: Mutex::new(BlockLockStats::default()),
 		};
 
 		chain.log_heads()?;
@@ -311,10 +452,10 @@ impl Chain {
 	/// Processes a single block, then checks for orphans, processing
 	/// those as well if they're found
 	pub fn process_block(&self, b: Block, opts: Options) -> Result<Option<Tip>, Error> {
-		let height = b.header.height;
+		let hash = b.hash();
 		let res = self.process_block_single(b, opts);
 		if res.is_ok() {
-			self.check_orphans(height + 1);
+			self.check_orphans(hash);
 		}
 		res
 	}
@@ -374,12 +515,8 @@ impl Chain {
 		}
 
 		let block_hash = block.hash();
-		let orphan = Orphan {
-			block: block.clone(),
-			opts,
-			added: Instant::now(),
-		};
-		self.orphans.add(orphan);
+		self.orphans.add(Orphan::new(block.clone(), opts));
+		let _ = self.orphan_validation.lock().send(block_hash);
 
 		debug!(
 			"is_orphan: {:?}, # orphans {}{}",
@@ -411,22 +548,47 @@ impl Chain {
 		// Only do this once we know the header PoW is valid.
 		self.check_orphan(&b, opts)?;
 
-		let (head, fork_point, prev_head) = {
+		// Context-free validation (rangeproofs, kernel signatures, sums) before
+		// taking the chain locks. Blocks received concurrently from several peers
+		// are validated in parallel and do not hold up readers of the chain.
+		// Only the contextual validation against the UTXO set is left to the pipe.
+		let start = Instant::now();
+		let prev = self.get_previous_header(&b.header)?;
+		pipe::validate_block_body(&b, &prev)?;
+		let validation_time = start.elapsed();
+
+		let start = Instant::now();
+		let (res, lock_wait) = {
 			let mut header_pmmr = self.header_pmmr.write();
 			let mut txhashset = self.txhashset.write();
-			let batch = self.store.batch()?;
-			let prev_head = batch.head()?;
-			let mut ctx = self.new_ctx(opts, batch, &mut header_pmmr, &mut txhashset)?;
+			let lock_wait = start.elapsed();
+			let res = self.store.batch().map_err(Error::from).and_then(|batch| {
+				let prev_head = batch.head()?;
+				let mut ctx = self.new_ctx(opts, batch, &mut header_pmmr, &mut txhashset)?;
+				ctx.validated_block = Some(b.hash());
 
-			let (head, fork_point) = pipe::process_block(&b, &mut ctx)?;
+				let (head, fork_point) = pipe::process_block(&b, &mut ctx)?;
 
-			ctx.batch.commit()?;
+				ctx.batch.commit()?;
+				Ok((head, fork_point, prev_head))
+			});
 
 			// release the lock and let the batch go before post-processing
-			(head, fork_point, prev_head)
+			(res, lock_wait)
 		};
+		let lock_held = start.elapsed() - lock_wait;
+		self.record_block_lock(1, lock_wait, lock_held);
+		let (head, fork_point, prev_head) = res?;
+
+		debug!(
+			"process_block_single: {} at {}, validated in {}ms, chain lock wait {}ms, held {}ms",
+			b.hash(),
+			b.header.height,
+			validation_time.as_millis(),
+			lock_wait.as_millis(),
+			lock_held.as_millis(),
+		);
 
-		let prev = self.get_previous_header(&b.header)?;
 		let status = self.determine_status(
 			head,
 			Tip::from_header(&prev),
@@ -440,6 +602,20 @@ impl Chain {
 		Ok(head)
 	}
 
+	// Add a hold of the chain locks, to process `blocks` blocks, to the stats.
+	fn record_block_lock(&self, blocks: usize, wait: Duration, held: Duration) {
+		let mut stats = self.block_lock_stats.lock();
+		stats.acquisitions += 1;
+		stats.blocks += blocks as u64;
+		stats.wait_us += wait.as_micros() as u64;
+		stats.held_us += held.as_micros() as u64;
+	}
+
+	/// Time spent by block processing waiting on and holding the chain locks.
+	pub fn block_lock_stats(&self) -> BlockLockStats {
+		*self.block_lock_stats.lock()
+	}
+
 	/// Process a block header received during "header first" propagation.
 	/// Note: This will update header MMR and corresponding header_head
 	/// if total work increases (on the header chain).
@@ -493,6 +669,7 @@ impl Chain {
 			header_pmmr,
 			txhashset,
 			batch,
+			validated_block: None,
 		})
 	}
 
@@ -506,61 +683,150 @@ impl Chain {
 		self.orphans.len_evicted()
 	}
 
-	/// Check for orphans, once a block is successfully added
-	fn check_orphans(&self, mut height: u64) {
-		let initial_height = height;
+	/// Check for orphans, once a block is successfully added.
+	/// The whole chain of orphans descending from the block is applied at once,
+	/// under a single acquisition of the chain locks.
+	fn check_orphans(&self, hash: Hash) {
+		let initial_len = self.orphans.len();
+		let mut accepted = 0;
+		let mut parents = vec![hash];
 
-		// Is there an orphan in our orphans that we can now process?
-		loop {
+		while let Some(parent) = parents.pop() {
+			let orphans = self.orphans.remove_descendants(&parent);
+			if orphans.is_empty() {
+				continue;
+			}
 			trace!(
-				"check_orphans: at {}, # orphans {}",
-				height,
+				"check_orphans: {} orphans descending from {}, # orphans {}",
+				orphans.len(),
+				parent,
 				self.orphans.len(),
 			);
 
-			let mut orphan_accepted = false;
-			let mut height_accepted = height;
-
-			if let Some(orphans) = self.orphans.remove_by_height(height) {
-				let orphans_len = orphans.len();
-				for (i, orphan) in orphans.into_iter().enumerate() {
-					debug!(
-						"check_orphans: get block {} at {}{}",
-						orphan.block.hash(),
-						height,
-						if orphans_len > 1 {
-							format!(", no.{} of {} orphans", i, orphans_len)
-						} else {
-							String::new()
-						},
-					);
-					let height = orphan.block.header.height;
-					let res = self.process_block_single(orphan.block, orphan.opts);
-					if res.is_ok() {
-						orphan_accepted = true;
-						height_accepted = height;
+			// Orphans not yet validated in the background are validated now,
+			// still outside of the chain locks.
+			let orphans: Vec<_> = orphans
+				.into_iter()
+				.filter(|orphan| {
+					if orphan.validated {
+						return true;
 					}
-				}
+					let res = self
+						.get_previous_header(&orphan.block.header)
+						.and_then(|prev| pipe::validate_block_body(&orphan.block, &prev));
+					if let Err(ref e) = res {
+						debug!(
+							"check_orphans: invalid block {}: {}",
+							orphan.block.hash(),
+							e
+						);
+					}
+					res.is_ok()
+				})
+				.collect();
 
-				if orphan_accepted {
-					// We accepted a block, so see if we can accept any orphans
-					height = height_accepted + 1;
-					continue;
+			let (processed, unlinked) = self.process_orphans(&parent, orphans);
+			// Descendants of a refused block go back to the pool, they may
+			// still link up with a different version of their parent.
+			for orphan in unlinked {
+				self.orphans.add(orphan);
+			}
+			for (b, opts, res) in processed {
+				match res {
+					Ok((head, prev_head, fork_point)) => {
+						accepted += 1;
+						// Children of this block may have shown up since.
+						parents.push(b.hash());
+
+						let status = match self.get_previous_header(&b.header) {
+							Ok(prev) => self.determine_status(
+								head,
+								Tip::from_header(&prev),
+								prev_head,
+								Tip::from_header(&fork_point),
+							),
+							Err(_) => continue,
+						};
+						self.adapter.block_accepted(&b, status, opts);
+					}
+					Err(e) => debug!("check_orphans: block {} refused: {}", b.hash(), e),
 				}
 			}
-			break;
 		}
 
-		if initial_height != height {
+		if accepted > 0 {
 			debug!(
-				"check_orphans: {} blocks accepted since height {}, remaining # orphans {}",
-				height - initial_height,
-				initial_height,
+				"check_orphans: {} blocks accepted, # orphans {} -> {}",
+				accepted,
+				initial_len,
 				self.orphans.len(),
 			);
 		}
 	}
 
+	// Apply a chain of (context-free validated) orphans descending from
+	// `parent`, parents first, holding the chain locks once for all of them.
+	// Each block is committed in its own batch so a bad block does not take the
+	// others with it. Orphans whose own parent was not accepted here are
+	// returned untouched.
+	fn process_orphans(
+		&self,
+		parent: &Hash,
+		orphans: Vec<Orphan>,
+	) -> (
+		Vec<(
+			Block,
+			Options,
+			Result<(Option<Tip>, Tip, BlockHeader), Error>,
+		)>,
+		Vec<Orphan>,
+	) {
+		if orphans.is_empty() {
+			return (vec![], vec![]);
+		}
+		let start = Instant::now();
+		let mut header_pmmr = self.header_pmmr.write();
+		let mut txhashset = self.txhashset.write();
+		let lock_wait = start.elapsed();
+
+		let count = orphans.len();
+		let mut linked: HashSet<Hash> = HashSet::new();
+		linked.insert(*parent);
+		let mut processed = vec![];
+		let mut unlinked = vec![];
+		for orphan in orphans {
+			if !linked.contains(&orphan.block.header.prev_hash) {
+				unlinked.push(orphan);
+				continue;
+			}
+			let opts = orphan.opts;
+			let b = orphan.into_block();
+			let res = self.store.batch().map_err(Error::from).and_then(|batch| {
+				let prev_head = batch.head()?;
+				let mut ctx = self.new_ctx(opts, batch, &mut header_pmmr, &mut txhashset)?;
+				ctx.validated_block = Some(b.hash());
+				let (head, fork_point) = pipe::process_block(&b, &mut ctx)?;
+				ctx.batch.commit()?;
+				Ok((head, prev_head, fork_point))
+			});
+			if res.is_ok() {
+				linked.insert(b.hash());
+			}
+			processed.push((b, opts, res));
+		}
+
+		let lock_held = start.elapsed() - lock_wait;
+		self.record_block_lock(processed.len(), lock_wait, lock_held);
+		debug!(
+			"process_orphans: {} blocks ({} unlinked), chain lock wait {}ms, held {}ms",
+			count,
+			unlinked.len(),
+			lock_wait.as_millis(),
+			lock_held.as_millis(),
+		);
+		(processed, unlinked)
+	}
+
 	/// Returns Ok(Some((out, pos))) if output is unspent.
 	/// Returns Ok(None) if output is spent.
 	/// Returns Err if something went wrong beyond not finding the output.
@@ -793,7 +1059,8 @@ impl Chain {
 		let denylist = self.denylist.read().clone();
 		pipe::rewind_and_apply_header_fork(header, ext, batch, &|header| {
 			pipe::validate_header_denylist(header, &denylist)
-		})
+		})?;
+		Ok(())
 	}
 
 	/// Provides a reading view into the current txhashset state as well as
@@ -900,8 +1167,9 @@ impl Chain {
 	}
 
 	// Special handling to make sure the whole kernel set matches each of its
-	// roots in each block header, without truncation. We go back header by
-	// header, rewind and check each root. This fixes a potential weakness in
+	// roots in each block header, without truncation. We collect the kernel
+	// roots of all headers back to genesis, then check them all in a single
+	// forward pass over the kernel MMR. This fixes a potential weakness in
 	// fast sync where a reorg past the horizon could allow a whole rewrite of
 	// the kernel set.
 	fn validate_kernel_history(
@@ -909,23 +1177,26 @@ impl Chain {
 		header: &BlockHeader,
 		txhashset: &txhashset::TxHashSet,
 	) -> Result<(), Error> {
-		debug!("validate_kernel_history: rewinding and validating kernel history (readonly)");
+		debug!("validate_kernel_history: validating kernel history (readonly)");
 
-		let mut count = 0;
-		let mut current = header.clone();
+		let now = Instant::now();
 		txhashset::rewindable_kernel_view(&txhashset, |view, batch| {
+			let mut roots = Vec::with_capacity(header.height as usize);
+			let mut current = header.clone();
 			while current.height > 0 {
-				view.rewind(&current)?;
-				view.validate_root()?;
+				roots.push(txhashset::KernelRoot::from(&current));
 				current = batch.get_previous_header(&current)?;
-				count += 1;
 			}
-			Ok(())
+			roots.reverse();
+
+			view.rewind(header)?;
+			view.validate_roots(&roots)
 		})?;
 
 		debug!(
-			"validate_kernel_history: validated kernel root on {} headers",
-			count,
+			"validate_kernel_history: validated kernel root on {} headers in {}ms",
+			header.height,
+			now.elapsed().as_millis(),
 		);
 
 		Ok(())
@@ -935,13 +1206,37 @@ impl Chain {
 	/// If we are syncing this will correspond to the last full block where
 	/// the next header is known but we do not yet have the full block.
 	/// i.e. This is the last known full block and all subsequent blocks are missing.
+	/// Note: Takes a read lock on the header_pmmr for the duration of the search,
+	/// the result is cached until either head changes.
 	pub fn fork_point(&self) -> Result<BlockHeader, Error> {
+		let header_pmmr = self.header_pmmr.read();
 		let body_head = self.head()?;
-		let mut current = self.get_block_header(&body_head.hash())?;
-		while !self.is_on_current_chain(&current, body_head).is_ok() {
-			current = self.get_previous_header(&current)?;
+		let header_head = self.header_head()?;
+
+		if let Some((body_hash, header_hash, fork_point)) = self.fork_point_cache.lock().clone() {
+			if body_hash == body_head.hash() && header_hash == header_head.hash() {
+				return Ok(fork_point);
+			}
 		}
-		Ok(current)
+
+		// In the common case the body head is on the header chain and is the fork point,
+		// otherwise bisect the heights below it using the block height index.
+		let fork_point = pipe::body_fork_point(
+			&self.get_block_header(&body_head.hash())?,
+			self.store.tail().map(|tail| tail.height).unwrap_or(0),
+			|height| {
+				if height > header_head.height {
+					return None;
+				}
+				header_pmmr.get_header_hash_by_height(height).ok()
+			},
+			|height| Ok(self.store.get_block_hashes_at_height(height)?),
+			|hash| self.get_block_header(hash),
+		)?;
+
+		*self.fork_point_cache.lock() =
+			Some((body_head.hash(), header_head.hash(), fork_point.clone()));
+		Ok(fork_point)
 	}
 
 	/// Compare fork point to our horizon.
@@ -1162,17 +1457,11 @@ impl Chain {
 			return Ok(());
 		}
 
-		let mut count = 0;
 		let tail_hash = header_pmmr.get_header_hash_by_height(head.height - horizon)?;
 		let tail = batch.get_block_header(&tail_hash)?;
 
 		// Remove old blocks (including short lived fork blocks) which height < tail.height
-		for block in batch.blocks_iter()? {
-			if block.header.height < tail.height {
-				let _ = batch.delete_block(&block.hash());
-				count += 1;
-			}
-		}
+		let count = batch.delete_blocks_below(tail.height)?;
 
 		batch.save_body_tail(&Tip::from_header(&tail))?;
 
@@ -1290,6 +1579,78 @@ impl Chain {
 		Ok((outputs.0, last_index, output_vec))
 	}
 
+	/// Bulk scan of the UTXO set for wallet restore. Returns the same page as
+	/// `unspent_outputs_by_pmmr_index` but every output comes with its pos and
+	/// block height, and optionally (for coinbase outputs) a Merkle proof. The
+	/// whole page is read under a single read lock of the txhashset, heights are
+	/// resolved by walking the headers forward from the first output rather
+	/// than via the output pos index.
+	/// Merkle proofs are all computed against the output MMR as of the
+	/// returned head, without any rewind, so they verify against the output
+	/// PMMR root at that head. This differs from `get_merkle_proof`, which
+	/// proves the output against the output MMR of the block that created it.
+	pub fn scan_unspent_outputs(
+		&self,
+		start_index: u64,
+		max_count: u64,
+		max_pmmr_index: Option<u64>,
+		include_merkle_proof: bool,
+	) -> Result<(Tip, u64, u64, Vec<ScannedOutput>), Error> {
+		let header_pmmr = self.header_pmmr.read();
+		let txhashset = self.txhashset.read();
+		// The head can only move on with the txhashset write lock held.
+		let head = self.head()?;
+		let last_index = match max_pmmr_index {
+			Some(i) => i,
+			None => txhashset.highest_output_insertion_index(),
+		};
+		let (last_retrieved, outputs) =
+			txhashset.unspent_outputs_with_pos(start_index, max_count, max_pmmr_index);
+
+		let header_at = |height: u64| -> Result<BlockHeader, Error> {
+			let hash = header_pmmr.get_header_hash_by_height(height)?;
+			self.get_block_header(&hash)
+		};
+
+		let mut scanned = Vec::with_capacity(outputs.len());
+		let mut header: Option<BlockHeader> = None;
+		for (pos, output) in outputs {
+			let mut current = match header.take() {
+				Some(h) => h,
+				None => {
+					// Binary search for the first block including this pos.
+					let mut low = 0;
+					let mut high = head.height;
+					while low < high {
+						let mid = low + (high - low) / 2;
+						if header_at(mid)?.output_mmr_size < pos {
+							low = mid + 1;
+						} else {
+							high = mid;
+						}
+					}
+					header_at(low)?
+				}
+			};
+			while current.output_mmr_size < pos {
+				current = header_at(current.height + 1)?;
+			}
+			let head_merkle_proof = if include_merkle_proof && output.is_coinbase() {
+				Some(txhashset.merkle_proof_at(pos)?)
+			} else {
+				None
+			};
+			scanned.push(ScannedOutput {
+				output,
+				pos,
+				height: current.height,
+				head_merkle_proof,
+			});
+			header = Some(current);
+		}
+		Ok((head, last_retrieved, last_index, scanned))
+	}
+
 	/// Return unspent outputs as above, but bounded between a particular range of blocks
 	pub fn block_height_range_to_pmmr_indices(
 		&self,
@@ -1315,6 +1676,16 @@ impl Chain {
 		self.orphans.len()
 	}
 
+	/// Approximate number of blocks (of the average orphan size) that can still
+	/// be added to the orphan pool before it starts evicting.
+	pub fn orphans_room(&self) -> usize {
+		let (len, size) = (self.orphans.len(), self.orphans.size());
+		if len == 0 {
+			return usize::MAX;
+		}
+		MAX_ORPHAN_BYTES.saturating_sub(size) / (size / len).max(1)
+	}
+
 	/// Tip (head) of the block chain.
 	pub fn head(&self) -> Result<Tip, Error> {
 		self.store
@@ -1504,7 +1875,36 @@ impl Chain {
 
 	/// Gets multiple headers at the provided heights.
 	/// Note: This is based on the provided sync_head to support syncing against a fork.
+	/// The hashes at the provided heights never change for a given sync_head so the
+	/// last locator is cached and reused while the sync_head does not move.
 	pub fn get_locator_hashes(&self, sync_head: Tip, heights: &[u64]) -> Result<Vec<Hash>, Error> {
+		if let Some((hash, cached_heights, hashes)) = self.locator_cache.lock().as_ref() {
+			if *hash == sync_head.hash() && cached_heights[..] == heights[..] {
+				return Ok(hashes.clone());
+			}
+		}
+
+		let hashes = self.locator_hashes(sync_head, heights)?;
+		*self.locator_cache.lock() = Some((sync_head.hash(), heights.to_vec(), hashes.clone()));
+		Ok(hashes)
+	}
+
+	fn locator_hashes(&self, sync_head: Tip, heights: &[u64]) -> Result<Vec<Hash>, Error> {
+		// If the sync_head is on our header chain (the usual case) then read the
+		// hashes directly from the header MMR without rewinding it.
+		{
+			let header_pmmr = self.header_pmmr.read();
+			if let Ok(hash) = header_pmmr.get_header_hash_by_height(sync_head.height) {
+				if hash == sync_head.hash() {
+					return Ok(heights
+						.iter()
+						.filter(|h| **h <= sync_head.height)
+						.filter_map(|h| header_pmmr.get_header_hash_by_height(*h).ok())
+						.collect());
+				}
+			}
+		}
+
 		let mut header_pmmr = self.header_pmmr.write();
 		txhashset::header_extending_readonly(&mut header_pmmr, &self.store(), |ext, batch| {
 			let header = batch.get_block_header(&sync_head.hash())?;
@@ -1519,6 +1919,72 @@ impl Chain {
 		})
 	}
 
+	/// Finds the first hash in the provided locator that refers to a header on our
+	/// header chain and returns up to max headers following it.
+	/// Note: Takes a single read lock on the header_pmmr and reads each set of
+	/// headers from the db in a single read transaction.
+	pub fn locate_headers(&self, locator: &[Hash], max: u64) -> Result<Vec<BlockHeader>, Error> {
+		let header_pmmr = self.header_pmmr.read();
+		let header_head = self.header_head()?;
+
+		let common = self
+			.store
+			.get_block_headers(locator)?
+			.into_iter()
+			.flatten()
+			.find(|header| {
+				header.height <= header_head.height
+					&& header_pmmr
+						.get_header_hash_by_height(header.height)
+						.map(|h| h == header.hash())
+						.unwrap_or(false)
+			});
+		let common = match common {
+			Some(header) => header,
+			None => return Ok(vec![]),
+		};
+
+		let max_height = header_head.height.min(common.height + max);
+		self.headers_by_height(&header_pmmr, common.height + 1, max_height)
+	}
+
+	/// Returns up to max headers of our header chain, starting at the provided
+	/// height. Empty if the height is beyond our header head.
+	pub fn headers_from_height(&self, height: u64, max: u64) -> Result<Vec<BlockHeader>, Error> {
+		let header_pmmr = self.header_pmmr.read();
+		let header_head = self.header_head()?;
+		if height == 0 || height > header_head.height || max == 0 {
+			return Ok(vec![]);
+		}
+		let max_height = header_head.height.min(height + max - 1);
+		self.headers_by_height(&header_pmmr, height, max_height)
+	}
+
+	// Reads the headers at heights from..=to on the header chain from the db
+	// in a single read transaction.
+	fn headers_by_height(
+		&self,
+		header_pmmr: &txhashset::PMMRHandle<BlockHeader>,
+		from: u64,
+		to: u64,
+	) -> Result<Vec<BlockHeader>, Error> {
+		let hashes = (from..=to)
+			.map(|h| header_pmmr.get_header_hash_by_height(h))
+			.collect::<Result<Vec<_>, _>>()?;
+
+		let mut headers = vec![];
+		for header in self.store.get_block_headers(&hashes)? {
+			match header {
+				Some(header) => headers.push(header),
+				None => {
+					error!("headers_by_height: failed to locate headers successfully.");
+					break;
+				}
+			}
+		}
+		Ok(headers)
+	}
+
 	/// Builds an iterator on blocks starting from the current chain head and
 	/// running backward. Specialized to return information pertaining to block
 	/// difficulty calculation (timestamp and previous difficulties).
@@ -1536,6 +2002,41 @@ impl Chain {
 	}
 }
 
+/// Rebuild missing block sums up to the provided header, starting from the
+/// last block we have block sums for and verifying the kernel sums of each
+/// full block since. Returns the number of blocks verified, or None if we do
+/// not have all the full blocks back to such a block.
+fn roll_block_sums_forward(
+	header: &BlockHeader,
+	batch: &store::Batch<'_>,
+) -> Result<Option<u64>, Error> {
+	let mut hashes = vec![];
+	let mut current = header.clone();
+	let mut sums = loop {
+		if let Ok(sums) = batch.get_block_sums(&current.hash()) {
+			break sums;
+		}
+		if current.height == 0 || !batch.block_exists(&current.hash())? {
+			return Ok(None);
+		}
+		hashes.push(current.hash());
+		current = batch.get_previous_header(&current)?;
+	};
+
+	for hash in hashes.iter().rev() {
+		let block = batch.get_block(hash)?;
+		let (utxo_sum, kernel_sum) = (sums, &block as &dyn Committed)
+			.verify_kernel_sums(block.header.overage(), block.header.total_kernel_offset())?;
+		sums = BlockSums {
+			utxo_sum,
+			kernel_sum,
+		};
+		batch.save_block_sums(hash, sums.clone())?;
+	}
+
+	Ok(Some(hashes.len() as u64))
+}
+
 fn setup_head(
 	genesis: &Block,
 	store: &store::ChainStore,
@@ -1592,8 +2093,19 @@ fn setup_head(
 					extension.validate_roots(&header)?;
 
 					// now check we have the "block sums" for the block in question
-					// if we have no sums (migrating an existing node) we need to go
-					// back to the txhashset and sum the outputs and kernels
+					// if we have no sums (migrating an existing node) we roll them
+					// forward from the last block we have sums for, or failing that
+					// we need to go back to the txhashset and sum the outputs and kernels
+					if header.height > 0 && batch.get_block_sums(&header.hash()).is_err() {
+						if let Some(count) = roll_block_sums_forward(&header, batch)? {
+							debug!(
+								"init: verified block sums of {} blocks up to {} @ {}",
+								count,
+								header.hash(),
+								header.height
+							);
+						}
+					}
 					if header.height > 0 && batch.get_block_sums(&header.hash()).is_err() {
 						debug!(
 							"init: building (missing) block sums for {} @ {}",
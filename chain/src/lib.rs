@@ -45,10 +45,10 @@ pub mod types;
 
 // Re-export the base interface
 
-pub use crate::chain::{Chain, MAX_ORPHAN_SIZE};
+pub use crate::chain::{Chain, MAX_ORPHAN_BYTES};
 pub use crate::error::{Error, ErrorKind};
 pub use crate::store::ChainStore;
 pub use crate::types::{
-	BlockStatus, ChainAdapter, Options, SyncState, SyncStatus, Tip, TxHashsetDownloadStats,
-	TxHashsetWriteStatus,
+	BlockLockStats, BlockStatus, ChainAdapter, Options, ScannedOutput, SyncState, SyncStatus, Tip,
+	TxHashsetDownloadStats, TxHashsetWriteStatus,
 };
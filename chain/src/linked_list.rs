@@ -226,6 +226,38 @@ impl<T> MultiIndex<T> {
 	}
 }
 
+impl<T: PosEntry> MultiIndex<T> {
+	/// All the entries in the index, along with their commitment, in no
+	/// particular order. Reads the committed state of the db.
+	pub fn entries(&self, batch: &Batch<'_>) -> Result<Vec<(Commitment, T)>, Error> {
+		let version = batch.db.protocol_version();
+		let mut entries = vec![];
+
+		// Lists with a single entry embed it, the others reference their
+		// entries, each under its own key.
+		let prefix = to_key(self.list_prefix, "");
+		let lists = batch.db.iter(&prefix, move |k, mut v| {
+			let list: ListWrapper<T> = ser::deserialize(&mut v, version)?;
+			Ok((Commitment::from_vec(k[2..].to_vec()), list))
+		})?;
+		for (commit, list) in lists {
+			if let ListWrapper::Single { pos } = list {
+				entries.push((commit, pos));
+			}
+		}
+
+		let prefix = to_key(self.entry_prefix, "");
+		let list_entries = batch.db.iter(&prefix, move |k, mut v| {
+			let entry: ListEntry<T> = ser::deserialize(&mut v, version)?;
+			Ok((Commitment::from_vec(k[2..k.len() - 8].to_vec()), entry))
+		})?;
+		for (commit, entry) in list_entries {
+			entries.push((commit, entry.get_pos()));
+		}
+		Ok(entries)
+	}
+}
+
 impl<T> ListIndex for MultiIndex<T>
 where
 	T: PosEntry,
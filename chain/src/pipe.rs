@@ -25,7 +25,7 @@ use crate::core::pow;
 use crate::error::{Error, ErrorKind};
 use crate::store;
 use crate::txhashset;
-use crate::types::{CommitPos, Options, Tip};
+use crate::types::{CommitPos, ForkCache, Options, Tip};
 
 /// Contextual information required to process a new block and either reject or
 /// accept it.
@@ -42,6 +42,9 @@ pub struct BlockContext<'a> {
 	pub header_pmmr: &'a mut txhashset::PMMRHandle<BlockHeader>,
 	/// The active batch to use for block processing.
 	pub batch: store::Batch<'a>,
+	/// Hash of a block already validated by `validate_block_body` before
+	/// this context was created (and its locks taken), not validated again.
+	pub validated_block: Option<Hash>,
 }
 
 // If this block has greater total difficulty than treat as unknown in current context.
@@ -122,8 +125,15 @@ pub fn process_block(
 	let txhashset = &mut ctx.txhashset;
 	let batch = &mut ctx.batch;
 	let ctx_specific_validation = &ctx.header_allowed;
-	let fork_point = txhashset::extending(header_pmmr, txhashset, batch, |ext, batch| {
-		let fork_point = rewind_and_apply_fork(&prev, ext, batch, ctx_specific_validation)?;
+	let mut fork_cache = txhashset.take_fork_cache();
+	let res = txhashset::extending(header_pmmr, txhashset, batch, |ext, batch| {
+		let fork_point = rewind_and_apply_fork_cached(
+			&prev,
+			ext,
+			batch,
+			ctx_specific_validation,
+			&mut fork_cache,
+		)?;
 
 		// Check any coinbase being spent have matured sufficiently.
 		// This needs to be done within the context of a potentially
@@ -138,7 +148,7 @@ pub fn process_block(
 		// we can verify_kernel_sums across the full UTXO sum and full kernel sum
 		// accounting for inputs/outputs/kernels in this new block.
 		// We know there are no double-spends etc. if this verifies successfully.
-		verify_block_sums(b, batch)?;
+		let block_sums = verify_block_sums(b, batch)?;
 
 		// Apply the block to the txhashset state.
 		// Validate the txhashset roots and sizes against the block header.
@@ -149,13 +159,19 @@ pub fn process_block(
 		// we know we have not yet updated the chain to produce a new chain head.
 		// We discard the "child" batch used in this extension (original ctx batch still active).
 		// We discard any MMR modifications applied in this extension.
+		// The block is now a validated fork block, cache it for the next block on this fork.
 		let head = batch.head()?;
-		if !has_more_work(&b.header, &head) {
+		if has_more_work(&b.header, &head) {
+			fork_cache.head_extended(&b.header);
+		} else {
 			ext.extension.force_rollback();
+			fork_cache.blocks.push((b.hash(), block_sums));
 		}
 
 		Ok(fork_point)
-	})?;
+	});
+	txhashset.set_fork_cache(fork_cache);
+	let fork_point = res?;
 
 	// Add the validated block to the db.
 	// Note we do this in the outer batch, not the child batch from the extension
@@ -455,7 +471,18 @@ fn validate_header(header: &BlockHeader, ctx: &mut BlockContext<'_>) -> Result<(
 }
 
 fn validate_block(block: &Block, ctx: &mut BlockContext<'_>) -> Result<(), Error> {
+	if ctx.validated_block == Some(block.hash()) {
+		return Ok(());
+	}
 	let prev = ctx.batch.get_previous_header(&block.header)?;
+	validate_block_body(block, &prev)
+}
+
+/// Validate a block on its own, against its previous header only: the tx body
+/// (rangeproofs, kernel signatures), coinbase and kernel sums. This is the
+/// expensive part of block validation and does not depend on the chain state,
+/// so it does not need to be done under the chain locks.
+pub fn validate_block_body(block: &Block, prev: &BlockHeader) -> Result<(), Error> {
 	block
 		.validate(&prev.total_kernel_offset)
 		.map_err(ErrorKind::InvalidBlockProof)?;
@@ -478,7 +505,7 @@ fn verify_coinbase_maturity(
 /// Verify kernel sums across the full utxo and kernel sets based on block_sums
 /// of previous block accounting for the inputs|outputs|kernels of the new block.
 /// Saves the new block_sums to the db via the current batch if successful.
-fn verify_block_sums(b: &Block, batch: &store::Batch<'_>) -> Result<(), Error> {
+fn verify_block_sums(b: &Block, batch: &store::Batch<'_>) -> Result<BlockSums, Error> {
 	// Retrieve the block_sums for the previous block.
 	let block_sums = batch.get_block_sums(&b.header.prev_hash)?;
 
@@ -493,15 +520,13 @@ fn verify_block_sums(b: &Block, batch: &store::Batch<'_>) -> Result<(), Error> {
 	let (utxo_sum, kernel_sum) =
 		(block_sums, b as &dyn Committed).verify_kernel_sums(overage, offset)?;
 
-	batch.save_block_sums(
-		&b.hash(),
-		BlockSums {
-			utxo_sum,
-			kernel_sum,
-		},
-	)?;
+	let block_sums = BlockSums {
+		utxo_sum,
+		kernel_sum,
+	};
+	batch.save_block_sums(&b.hash(), block_sums.clone())?;
 
-	Ok(())
+	Ok(block_sums)
 }
 
 /// Fully validate the block by applying it to the txhashset extension.
@@ -572,12 +597,13 @@ fn has_more_work(header: &BlockHeader, head: &Tip) -> bool {
 }
 
 /// Rewind the header chain and reapply headers on a fork.
+/// Returns the header the fork left the header chain at.
 pub fn rewind_and_apply_header_fork(
 	header: &BlockHeader,
 	ext: &mut txhashset::HeaderExtension<'_>,
 	batch: &store::Batch<'_>,
 	ctx_specific_validation: &dyn Fn(&BlockHeader) -> Result<(), Error>,
-) -> Result<(), Error> {
+) -> Result<BlockHeader, Error> {
 	let mut fork_hashes = vec![];
 	let mut current = header.clone();
 	while current.height > 0 && !ext.is_on_current_chain(&current, batch)? {
@@ -586,15 +612,68 @@ pub fn rewind_and_apply_header_fork(
 	}
 	fork_hashes.reverse();
 
-	let forked_header = current;
+	rewind_and_apply_headers(current, &fork_hashes, ext, batch, ctx_specific_validation)
+}
+
+/// As rewind_and_apply_header_fork, for a fork whose headers from `fork_point`
+/// up to `header` are already known. Rather than walking the fork back, the
+/// header chain is bisected for where the fork leaves it.
+fn rewind_and_apply_known_header_fork(
+	header: &BlockHeader,
+	fork_point: &BlockHeader,
+	fork_hashes: &[Hash],
+	ext: &mut txhashset::HeaderExtension<'_>,
+	batch: &store::Batch<'_>,
+	ctx_specific_validation: &dyn Fn(&BlockHeader) -> Result<(), Error>,
+) -> Result<BlockHeader, Error> {
+	if ext.get_header_hash_by_height(fork_point.height) != Some(fork_point.hash()) {
+		return rewind_and_apply_header_fork(header, ext, batch, ctx_specific_validation);
+	}
 
+	// Fork headers are consecutive, once one is off the header chain so are all
+	// the ones above it.
+	let on_header_chain = |idx: usize| {
+		ext.get_header_hash_by_height(fork_point.height + 1 + idx as u64) == Some(fork_hashes[idx])
+	};
+	let (mut low, mut high) = (0, fork_hashes.len());
+	while low < high {
+		let mid = low + (high - low) / 2;
+		if on_header_chain(mid) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	let forked_header = match low {
+		0 => fork_point.clone(),
+		n => batch.get_block_header(&fork_hashes[n - 1])?,
+	};
+	rewind_and_apply_headers(
+		forked_header,
+		&fork_hashes[low..],
+		ext,
+		batch,
+		ctx_specific_validation,
+	)
+}
+
+// Rewind the header MMR to the header the fork left it at and apply the fork
+// headers on top of it.
+fn rewind_and_apply_headers(
+	forked_header: BlockHeader,
+	fork_hashes: &[Hash],
+	ext: &mut txhashset::HeaderExtension<'_>,
+	batch: &store::Batch<'_>,
+	ctx_specific_validation: &dyn Fn(&BlockHeader) -> Result<(), Error>,
+) -> Result<BlockHeader, Error> {
 	// Rewind the txhashset state back to the block where we forked from the most work chain.
 	ext.rewind(&forked_header)?;
 
 	// Re-apply all headers on this fork.
 	for h in fork_hashes {
 		let header = batch
-			.get_block_header(&h)
+			.get_block_header(h)
 			.map_err(|e| ErrorKind::StoreErr(e, "getting forked headers".to_string()))?;
 
 		// Re-validate every header being re-applied.
@@ -605,7 +684,73 @@ pub fn rewind_and_apply_header_fork(
 		ext.apply_header(&header)?;
 	}
 
-	Ok(())
+	Ok(forked_header)
+}
+
+/// Last block on both the body chain ending at `head` and the header chain,
+/// whose hashes by height are given by `header_hash_at`.
+/// The body chain has no index by height of its own. But from the body tail
+/// up, a height with a single full block in the block height index can only
+/// hold the body chain block, so heights are bisected on that. A height with
+/// several full blocks (fork blocks) is ambiguous, we then walk back from
+/// `head` one block at a time.
+pub fn body_fork_point<H, B, G>(
+	head: &BlockHeader,
+	tail_height: u64,
+	header_hash_at: H,
+	block_hashes_at: B,
+	get_header: G,
+) -> Result<BlockHeader, Error>
+where
+	H: Fn(u64) -> Option<Hash>,
+	B: Fn(u64) -> Result<Vec<Hash>, Error>,
+	G: Fn(&Hash) -> Result<BlockHeader, Error>,
+{
+	let on_header_chain =
+		|header: &BlockHeader| header_hash_at(header.height) == Some(header.hash());
+	if on_header_chain(head) {
+		return Ok(head.clone());
+	}
+
+	// Whether the body chain block at this height is on the header chain, if
+	// the block height index can tell.
+	let shared = |height: u64| -> Result<Option<bool>, Error> {
+		let header_hash = match header_hash_at(height) {
+			Some(hash) => hash,
+			None => return Ok(Some(false)),
+		};
+		let hashes = block_hashes_at(height)?;
+		if hashes.contains(&header_hash) {
+			Ok(if hashes.len() == 1 { Some(true) } else { None })
+		} else {
+			Ok(if hashes.is_empty() { None } else { Some(false) })
+		}
+	};
+
+	// The body chain block at `low` is on the header chain, the one at `high`
+	// is not.
+	let mut low = tail_height.min(head.height);
+	let mut high = head.height;
+	let mut bisected = shared(low)? == Some(true);
+	while bisected && high - low > 1 {
+		let mid = low + (high - low) / 2;
+		match shared(mid)? {
+			Some(true) => low = mid,
+			Some(false) => high = mid,
+			None => bisected = false,
+		}
+	}
+	if bisected {
+		if let Some(hash) = header_hash_at(low) {
+			return get_header(&hash);
+		}
+	}
+
+	let mut current = head.clone();
+	while current.height > 0 && !on_header_chain(&current) {
+		current = get_header(&current.prev_hash)?;
+	}
+	Ok(current)
 }
 
 /// Utility function to handle forks. From the forked block, jump backward
@@ -619,43 +764,118 @@ pub fn rewind_and_apply_fork(
 	batch: &store::Batch<'_>,
 	ctx_specific_validation: &dyn Fn(&BlockHeader) -> Result<(), Error>,
 ) -> Result<BlockHeader, Error> {
-	let extension = &mut ext.extension;
-	let header_extension = &mut ext.header_extension;
+	let mut fork_cache = ForkCache::default();
+	rewind_and_apply_fork_cached(header, ext, batch, ctx_specific_validation, &mut fork_cache)
+}
 
-	// Prepare the header MMR.
-	rewind_and_apply_header_fork(header, header_extension, batch, ctx_specific_validation)?;
+/// As rewind_and_apply_fork, reusing the fork point and the validation of fork
+/// blocks found in the provided cache, which is then updated with this fork.
+/// Blocks already validated on this fork are only applied to the txhashset,
+/// which still means reading and applying every block of the fork.
+pub fn rewind_and_apply_fork_cached(
+	header: &BlockHeader,
+	ext: &mut txhashset::ExtensionPair<'_>,
+	batch: &store::Batch<'_>,
+	ctx_specific_validation: &dyn Fn(&BlockHeader) -> Result<(), Error>,
+	fork_cache: &mut ForkCache,
+) -> Result<BlockHeader, Error> {
+	let head = batch.head()?;
+
+	// If the body head is on the header chain then the fork point is where the
+	// fork leaves the header chain, or the body head itself if that is below it.
+	let head_on_header_chain = ext.header_extension.is_on_current_chain(head, batch)?;
+
+	// Prepare the header MMR. The headers of a cached fork are known, no need
+	// to walk the fork back.
+	let cached_fork_point = fork_cache.fork_point_of(header, &head);
+	let header_fork_point = match cached_fork_point {
+		Some(ref fork_point) => rewind_and_apply_known_header_fork(
+			header,
+			fork_point,
+			&fork_cache.hashes_to(header.height),
+			ext.header_extension,
+			batch,
+			ctx_specific_validation,
+		)?,
+		None => rewind_and_apply_header_fork(
+			header,
+			ext.header_extension,
+			batch,
+			ctx_specific_validation,
+		)?,
+	};
+
+	// Find the common ancestor of the body head and this fork, without walking
+	// back the body head chain if we can avoid it.
+	let fork_point = if let Some(fork_point) = cached_fork_point {
+		fork_point
+	} else if head_on_header_chain && header_fork_point.height < head.height {
+		header_fork_point
+	} else if head_on_header_chain {
+		batch.get_block_header(&head.last_block_h)?
+	} else {
+		let header_extension = &ext.header_extension;
+		body_fork_point(
+			&batch.head_header()?,
+			batch.tail().map(|tail| tail.height).unwrap_or(0),
+			|height| header_extension.get_header_hash_by_height(height),
+			|height| Ok(batch.get_block_hashes_at_height(height)?),
+			|hash| Ok(batch.get_block_header(hash)?),
+		)?
+	};
 
 	// Rewind the txhashset extension back to common ancestor based on header MMR.
-	let mut current = batch.head_header()?;
-	while current.height > 0 && !header_extension.is_on_current_chain(&current, batch)? {
-		current = batch.get_previous_header(&current)?;
-	}
-	let fork_point = current;
-	extension.rewind(&fork_point, batch)?;
+	ext.extension.rewind(&fork_point, batch)?;
 
 	// Then apply all full blocks since this common ancestor
 	// to put txhashet extension in a state to accept the new block.
-	let mut fork_hashes = vec![];
-	let mut current = header.clone();
-	while current.height > fork_point.height {
-		fork_hashes.push(current.hash());
-		current = batch.get_previous_header(&current)?;
-	}
-	fork_hashes.reverse();
-
-	for h in fork_hashes {
+	// The header MMR is now on this fork, look the fork blocks up by height.
+	let fork_hashes = (fork_point.height + 1..=header.height)
+		.map(|height| {
+			ext.header_extension
+				.get_header_hash_by_height(height)
+				.ok_or_else(|| ErrorKind::Other("getting forked headers".to_string()).into())
+		})
+		.collect::<Result<Vec<Hash>, Error>>()?;
+
+	let fork_point_hash = fork_point.hash();
+	let mut blocks = Vec::with_capacity(fork_hashes.len());
+	for (h, height) in fork_hashes.into_iter().zip(fork_point.height + 1..) {
 		let fb = batch
 			.get_block(&h)
 			.map_err(|e| ErrorKind::StoreErr(e, "getting forked blocks".to_string()))?;
 
-		// Re-verify coinbase maturity along this fork.
-		verify_coinbase_maturity(&fb, ext, batch)?;
-		// Validate the block against the UTXO set.
-		validate_utxo(&fb, ext, batch)?;
-		// Re-verify block_sums to set the block_sums up on this fork correctly.
-		verify_block_sums(&fb, batch)?;
-		// Re-apply the blocks.
-		apply_block_to_txhashset(&fb, ext, batch)?;
+		let block_sums = match fork_cache.block_sums(height, &h, &head, &fork_point_hash) {
+			Some(block_sums) => {
+				// Already validated on this fork, only the block_sums need saving
+				// again and the block applied.
+				batch.save_block_sums(&h, block_sums.clone())?;
+				ext.extension
+					.apply_block(&fb, ext.header_extension, batch)?;
+				block_sums
+			}
+			None => {
+				// Re-verify coinbase maturity along this fork.
+				verify_coinbase_maturity(&fb, ext, batch)?;
+				// Validate the block against the UTXO set.
+				validate_utxo(&fb, ext, batch)?;
+				// Re-verify block_sums to set the block_sums up on this fork correctly.
+				let block_sums = verify_block_sums(&fb, batch)?;
+				// Re-apply the blocks.
+				apply_block_to_txhashset(&fb, ext, batch)?;
+				block_sums
+			}
+		};
+		blocks.push((h, block_sums));
+	}
+
+	// Extending the body head is no fork, leave whatever fork is cached alone.
+	if fork_point.hash() != head.last_block_h {
+		*fork_cache = ForkCache {
+			head: head.last_block_h,
+			fork_point: fork_point.clone(),
+			blocks,
+		};
 	}
 
 	Ok(fork_point)
@@ -20,12 +20,12 @@ use crate::core::core::{Block, BlockHeader, BlockSums};
 use crate::core::pow::Difficulty;
 use crate::core::ser::{ProtocolVersion, Readable, Writeable};
 use crate::linked_list::MultiIndex;
-use crate::types::{CommitPos, Tip};
+use crate::types::{CommitPos, NRDIndexCheckpoint, Tip};
 use crate::util::secp::pedersen::Commitment;
 use croaring::Bitmap;
 use grin_core::ser;
 use grin_store as store;
-use grin_store::{option_to_not_found, to_key, Error};
+use grin_store::{option_to_not_found, to_key, u64_to_key, Error};
 use std::convert::TryInto;
 use std::sync::Arc;
 
@@ -33,6 +33,7 @@ const STORE_SUBPATH: &str = "chain";
 
 const BLOCK_HEADER_PREFIX: u8 = b'h';
 const BLOCK_PREFIX: u8 = b'b';
+const BLOCK_HEIGHT_PREFIX: u8 = b'B';
 const HEAD_PREFIX: u8 = b'H';
 const TAIL_PREFIX: u8 = b'T';
 const HEADER_HEAD_PREFIX: u8 = b'G';
@@ -42,6 +43,7 @@ const OUTPUT_POS_PREFIX: u8 = b'p';
 pub const NRD_KERNEL_LIST_PREFIX: u8 = b'K';
 /// Prefix for NRD kernel pos index entries.
 pub const NRD_KERNEL_ENTRY_PREFIX: u8 = b'k';
+const NRD_CHECKPOINT_PREFIX: u8 = b'n';
 
 const BLOCK_SUMS_PREFIX: u8 = b'M';
 const BLOCK_SPENT_PREFIX: u8 = b'S';
@@ -99,6 +101,18 @@ impl ChainStore {
 		})
 	}
 
+	/// Hashes of the full blocks we have at the given height (fork blocks
+	/// included), from the block height index.
+	pub fn get_block_hashes_at_height(&self, height: u64) -> Result<Vec<Hash>, Error> {
+		let hashes = self
+			.db
+			.iter(&u64_to_key(BLOCK_HEIGHT_PREFIX, height), |k, _| {
+				Ok(Hash::from_vec(&k[10..]))
+			})?
+			.collect();
+		Ok(hashes)
+	}
+
 	/// Get previous header.
 	pub fn get_previous_header(&self, header: &BlockHeader) -> Result<BlockHeader, Error> {
 		self.get_block_header(&header.prev_hash)
@@ -111,6 +125,16 @@ impl ChainStore {
 		})
 	}
 
+	/// Get multiple block headers, read within a single read transaction.
+	/// Returns None for any header we do not have.
+	pub fn get_block_headers(&self, hashes: &[Hash]) -> Result<Vec<Option<BlockHeader>>, Error> {
+		let keys: Vec<_> = hashes
+			.iter()
+			.map(|h| to_key(BLOCK_HEADER_PREFIX, h))
+			.collect();
+		self.db.get_ser_many(&keys)
+	}
+
 	/// Get PMMR pos for the given output commitment.
 	pub fn get_output_pos(&self, commit: &Commitment) -> Result<u64, Error> {
 		match self.get_output_pos_height(commit)? {
@@ -165,6 +189,18 @@ impl<'a> Batch<'a> {
 		self.get_block_header(&self.head()?.last_block_h)
 	}
 
+	/// Save the NRD kernel index checkpoint.
+	pub fn save_nrd_index_checkpoint(&self, cp: &NRDIndexCheckpoint) -> Result<(), Error> {
+		self.db.put_ser(&[NRD_CHECKPOINT_PREFIX], cp)
+	}
+
+	/// Get the NRD kernel index checkpoint, if any.
+	pub fn get_nrd_index_checkpoint(&self) -> Result<NRDIndexCheckpoint, Error> {
+		option_to_not_found(self.db.get_ser(&[NRD_CHECKPOINT_PREFIX]), || {
+			"NRD INDEX CHECKPOINT".to_owned()
+		})
+	}
+
 	/// Save body head to db.
 	pub fn save_body_head(&self, t: &Tip) -> Result<(), Error> {
 		self.db.put_ser(&[HEAD_PREFIX], t)
@@ -192,6 +228,18 @@ impl<'a> Batch<'a> {
 		self.db.exists(&to_key(BLOCK_PREFIX, h))
 	}
 
+	/// Hashes of the full blocks we have at the given height (fork blocks
+	/// included), from the block height index.
+	pub fn get_block_hashes_at_height(&self, height: u64) -> Result<Vec<Hash>, Error> {
+		let hashes = self
+			.db
+			.iter(&u64_to_key(BLOCK_HEIGHT_PREFIX, height), |k, _| {
+				Ok(Hash::from_vec(&k[10..]))
+			})?
+			.collect();
+		Ok(hashes)
+	}
+
 	/// Save the block to the db.
 	/// Note: the block header is not saved to the db here, assumes this has already been done.
 	pub fn save_block(&self, b: &Block) -> Result<(), Error> {
@@ -203,6 +251,8 @@ impl<'a> Batch<'a> {
 			self.db.protocol_version(),
 		);
 		self.db.put_ser(&to_key(BLOCK_PREFIX, b.hash())[..], b)?;
+		self.db
+			.put(&block_height_key(b.header.height, &b.hash())[..], &[])?;
 		Ok(())
 	}
 
@@ -229,11 +279,69 @@ impl<'a> Batch<'a> {
 		{
 			let _ = self.delete_block_sums(bh);
 			let _ = self.delete_spent_index(bh);
+			if let Ok(header) = self.get_block_header(bh) {
+				let _ = self.db.delete(&block_height_key(header.height, bh)[..]);
+			}
 		}
 
 		Ok(())
 	}
 
+	/// Delete all full blocks (fork blocks included) below the provided height,
+	/// along with their spent index and block sums. Walks the block height
+	/// index, blocks themselves are never read. Returns the number of blocks
+	/// deleted.
+	pub fn delete_blocks_below(&self, height: u64) -> Result<usize, Error> {
+		let keys: Vec<Vec<u8>> = self
+			.db
+			.iter(&to_key(BLOCK_HEIGHT_PREFIX, ""), |k, _| Ok(k.to_vec()))?
+			.take_while(|k| block_height_from_key(k) < height)
+			.collect();
+
+		for key in &keys {
+			let bh = Hash::from_vec(&key[10..]);
+			// Best effort, as in delete_block.
+			let _ = self.db.delete(&to_key(BLOCK_PREFIX, bh)[..]);
+			let _ = self.delete_block_sums(&bh);
+			let _ = self.delete_spent_index(&bh);
+			self.db.delete(key)?;
+		}
+		Ok(keys.len())
+	}
+
+	/// Build the block height index for a db predating it, from the keys of the
+	/// full blocks and their headers. Nothing to do if the index already exists.
+	pub fn init_block_height_index(&self) -> Result<(), Error> {
+		let indexed = self
+			.db
+			.iter(&to_key(BLOCK_HEIGHT_PREFIX, ""), |_, _| Ok(()))?
+			.next()
+			.is_some();
+		if indexed {
+			return Ok(());
+		}
+
+		let hashes: Vec<Hash> = self
+			.db
+			.iter(&to_key(BLOCK_PREFIX, ""), |k, _| {
+				Ok(Hash::from_vec(&k[2..]))
+			})?
+			.collect();
+		let mut count = 0;
+		for bh in hashes {
+			match self.get_block_header(&bh) {
+				Ok(header) => {
+					self.db
+						.put(&block_height_key(header.height, &bh)[..], &[])?;
+					count += 1;
+				}
+				Err(_) => warn!("init_block_height_index: no header for block {}", bh),
+			}
+		}
+		debug!("init_block_height_index: indexed {} blocks", count);
+		Ok(())
+	}
+
 	/// Save block header to db.
 	pub fn save_block_header(&self, header: &BlockHeader) -> Result<(), Error> {
 		let hash = header.hash();
@@ -381,6 +489,19 @@ impl<'a> Batch<'a> {
 	}
 }
 
+// Block height index key, sorted by height then hash.
+fn block_height_key(height: u64, bh: &Hash) -> Vec<u8> {
+	let mut key = u64_to_key(BLOCK_HEIGHT_PREFIX, height);
+	key.extend_from_slice(bh.as_ref());
+	key
+}
+
+fn block_height_from_key(key: &[u8]) -> u64 {
+	let mut height = [0; 8];
+	height.copy_from_slice(&key[2..10]);
+	u64::from_be_bytes(height)
+}
+
 /// An iterator on blocks, from latest to earliest, specialized to return
 /// information pertaining to block difficulty calculation (timestamp and
 /// previous difficulties). Mostly used by the consensus next difficulty
@@ -14,11 +14,33 @@
 
 //! Lightweight readonly view into kernel MMR for convenience.
 
-use crate::core::core::pmmr::{ReadablePMMR, ReadonlyPMMR, RewindablePMMR};
+use crate::core::core::hash::{Hash, Hashed, ZERO_HASH};
+use crate::core::core::pmmr::{self, ReadablePMMR, ReadonlyPMMR, RewindablePMMR};
 use crate::core::core::{BlockHeader, TxKernel};
 use crate::error::{Error, ErrorKind};
 use grin_store::pmmr::PMMRBackend;
 
+/// Kernel MMR size and root committed to by a block header.
+#[derive(Debug, Clone, Copy)]
+pub struct KernelRoot {
+	/// Height of the header.
+	pub height: u64,
+	/// Kernel MMR size as of this header.
+	pub size: u64,
+	/// Kernel MMR root as of this header.
+	pub root: Hash,
+}
+
+impl From<&BlockHeader> for KernelRoot {
+	fn from(header: &BlockHeader) -> KernelRoot {
+		KernelRoot {
+			height: header.height,
+			size: header.kernel_mmr_size,
+			root: header.kernel_root,
+		}
+	}
+}
+
 /// Rewindable (but readonly) view of the kernel set (based on kernel MMR).
 pub struct RewindableKernelView<'a> {
 	pmmr: RewindablePMMR<'a, TxKernel, PMMRBackend<TxKernel>>,
@@ -72,4 +94,80 @@ impl<'a> RewindableKernelView<'a> {
 	pub fn readonly_pmmr(&self) -> ReadonlyPMMR<TxKernel, PMMRBackend<TxKernel>> {
 		self.pmmr.as_readonly()
 	}
+
+	/// Validate the kernel roots of a sequence of headers (by increasing
+	/// height) in a single forward pass over the kernel MMR, up to the size of
+	/// this view. Only the peaks of the MMR are kept, rebuilt from the kernels
+	/// themselves, and bagged into a root each time the MMR reaches the size of
+	/// the next header. Linear in the size of the MMR, where rewinding and
+	/// checking the root of each header is linear in the number of headers
+	/// times the number of peaks.
+	pub fn validate_roots(&self, roots: &[KernelRoot]) -> Result<(), Error> {
+		let pmmr = self.readonly_pmmr();
+		let last_pos = pmmr.unpruned_size();
+		let mut peaks: Vec<Hash> = vec![];
+		let mut size = 0;
+		let mut roots = roots.iter().peekable();
+
+		loop {
+			// Check all the headers at the current MMR size.
+			while let Some(next) = roots.peek() {
+				if next.size > size {
+					break;
+				}
+				if next.size < size || bag_peaks(&peaks, size) != next.root {
+					return Err(ErrorKind::InvalidTxHashSet(format!(
+						"Kernel root at {} does not match",
+						next.height
+					))
+					.into());
+				}
+				roots.next();
+			}
+			if roots.peek().is_none() || size >= last_pos {
+				break;
+			}
+
+			// Append the next kernel, merging the peaks it completes, as in
+			// PMMR::push.
+			let mut pos = size + 1;
+			let kernel = pmmr
+				.get_data_from_file(pos)
+				.ok_or_else(|| ErrorKind::TxHashSetErr(format!("missing kernel at {}", pos)))?;
+			let mut hash = kernel.hash_with_index(pos - 1);
+			let (peak_map, _) = pmmr::peak_map_height(pos - 1);
+			let mut peak = 1;
+			while (peak_map & peak) != 0 {
+				let left = peaks
+					.pop()
+					.ok_or_else(|| ErrorKind::TxHashSetErr("invalid kernel mmr".to_owned()))?;
+				peak *= 2;
+				pos += 1;
+				hash = (left, hash).hash_with_index(pos - 1);
+			}
+			peaks.push(hash);
+			size = pos;
+		}
+
+		if let Some(next) = roots.next() {
+			return Err(ErrorKind::InvalidTxHashSet(format!(
+				"Kernel mmr too short for header at {}",
+				next.height
+			))
+			.into());
+		}
+		Ok(())
+	}
+}
+
+// Root of an MMR of the provided size from its peaks, see ReadablePMMR::root.
+fn bag_peaks(peaks: &[Hash], size: u64) -> Hash {
+	let mut res = None;
+	for peak in peaks.iter().rev() {
+		res = match res {
+			None => Some(*peak),
+			Some(rhash) => Some((*peak, rhash).hash_with_index(size)),
+		}
+	}
+	res.unwrap_or(ZERO_HASH)
 }
@@ -17,25 +17,30 @@
 
 use crate::core::consensus::WEEK_HEIGHT;
 use crate::core::core::committed::Committed;
-use crate::core::core::hash::{Hash, Hashed};
+use crate::core::core::hash::{Hash, HashWriter, Hashed};
 use crate::core::core::merkle_proof::MerkleProof;
 use crate::core::core::pmmr::{
 	self, Backend, ReadablePMMR, ReadonlyPMMR, RewindablePMMR, VecBackend, PMMR,
 };
 use crate::core::core::{Block, BlockHeader, KernelFeatures, Output, OutputIdentifier, TxKernel};
 use crate::core::global;
-use crate::core::ser::{PMMRable, ProtocolVersion};
+use crate::core::ser::{PMMRable, ProtocolVersion, Writeable, Writer};
 use crate::error::{Error, ErrorKind};
 use crate::linked_list::{ListIndex, PruneableListIndex, RewindableListIndex};
 use crate::store::{self, Batch, ChainStore};
 use crate::txhashset::bitmap_accumulator::{BitmapAccumulator, BitmapChunk};
 use crate::txhashset::{RewindableKernelView, UTXOView};
-use crate::types::{CommitPos, OutputRoots, Tip, TxHashSetRoots, TxHashsetWriteStatus};
+use crate::types::{
+	CommitPos, ForkCache, NRDIndexCheckpoint, OutputRoots, Tip, TxHashSetRoots,
+	TxHashsetWriteStatus,
+};
 use crate::util::secp::pedersen::{Commitment, RangeProof};
 use crate::util::{file, secp_static, zip};
 use croaring::Bitmap;
 use grin_store::pmmr::{clean_files_by_prefix, PMMRBackend};
+use std::collections::HashMap;
 use std::fs::{self, File};
+use std::mem;
 use std::path::{Path, PathBuf};
 use std::sync::Arc;
 use std::time::Instant;
@@ -153,6 +158,9 @@ pub struct TxHashSet {
 
 	// chain store used as index of commitments to MMR positions
 	commit_index: Arc<ChainStore>,
+
+	// fork blocks already validated against this txhashset
+	fork_cache: ForkCache,
 }
 
 impl TxHashSet {
@@ -231,6 +239,7 @@ impl TxHashSet {
 				kernel_pmmr_h,
 				bitmap_accumulator,
 				commit_index,
+				fork_cache: ForkCache::default(),
 			})
 		} else {
 			Err(ErrorKind::TxHashSetErr("failed to open kernel PMMR".to_string()).into())
@@ -255,6 +264,21 @@ impl TxHashSet {
 		self.kernel_pmmr_h.backend.release_files();
 	}
 
+	/// Blocks of the last fork processed, see `ForkCache`.
+	pub fn fork_cache(&self) -> &ForkCache {
+		&self.fork_cache
+	}
+
+	/// Take the cached fork blocks out, to be used (and updated) while extending.
+	pub fn take_fork_cache(&mut self) -> ForkCache {
+		mem::take(&mut self.fork_cache)
+	}
+
+	/// Put the cached fork blocks back once done extending.
+	pub fn set_fork_cache(&mut self, fork_cache: ForkCache) {
+		self.fork_cache = fork_cache;
+	}
+
 	/// Check if an output is unspent.
 	/// We look in the index to find the output MMR pos.
 	/// Then we check the entry in the output MMR and confirm the hash matches.
@@ -344,6 +368,53 @@ impl TxHashSet {
 			.elements_from_pmmr_index(start_index, max_count, max_index)
 	}
 
+	/// Unspent outputs (with their rangeproofs and MMR positions) from the
+	/// given pmmr index up to the specified limit. Walks the output leaf set
+	/// once and reads both MMRs at each leaf pos, rather than probing every
+	/// pos of both MMRs independently. Also returns the last index considered.
+	pub fn unspent_outputs_with_pos(
+		&self,
+		start_index: u64,
+		max_count: u64,
+		max_index: Option<u64>,
+	) -> (u64, Vec<(u64, Output)>) {
+		let output_pmmr =
+			ReadonlyPMMR::at(&self.output_pmmr_h.backend, self.output_pmmr_h.last_pos);
+		let rproof_pmmr =
+			ReadonlyPMMR::at(&self.rproof_pmmr_h.backend, self.rproof_pmmr_h.last_pos);
+		let last_pos = max_index.unwrap_or(self.output_pmmr_h.last_pos);
+		let start_index = start_index.max(1);
+
+		let mut last_index = start_index.saturating_sub(1);
+		let mut outputs = vec![];
+		for pos in output_pmmr
+			.leaf_pos_iter()
+			.skip_while(|pos| *pos < start_index)
+		{
+			if pos > last_pos || outputs.len() as u64 >= max_count {
+				break;
+			}
+			if let (Some(out), Some(proof)) = (output_pmmr.get_data(pos), rproof_pmmr.get_data(pos))
+			{
+				outputs.push((pos, Output::new(out.features, out.commitment(), proof)));
+			}
+			last_index = pos;
+		}
+		if (outputs.len() as u64) < max_count {
+			// We ran out of leaves, everything up to last_pos was considered.
+			last_index = last_pos.max(last_index);
+		}
+		(last_index, outputs)
+	}
+
+	/// Merkle proof for the output at the given pos, against the current
+	/// state of the output MMR (the output PMMR root at our head).
+	pub fn merkle_proof_at(&self, pos: u64) -> Result<MerkleProof, Error> {
+		ReadonlyPMMR::at(&self.output_pmmr_h.backend, self.output_pmmr_h.last_pos)
+			.merkle_proof(pos)
+			.map_err(|_| ErrorKind::MerkleProof.into())
+	}
+
 	/// highest output insertion index available
 	pub fn highest_output_insertion_index(&self) -> u64 {
 		self.output_pmmr_h.last_pos
@@ -455,7 +526,95 @@ impl TxHashSet {
 		self.verify_kernel_pos_index(&cutoff_header, header_pmmr, batch)
 	}
 
+	/// Check the NRD kernel_pos index against its last checkpoint, only going
+	/// through the kernels added since. Falls back to a rebuild of the recent
+	/// kernel history if there is no usable checkpoint or the index does not
+	/// match it.
+	pub fn resume_recent_kernel_pos_index(
+		&self,
+		header_pmmr: &PMMRHandle<BlockHeader>,
+		batch: &Batch<'_>,
+	) -> Result<(), Error> {
+		if !global::is_nrd_enabled() {
+			return Ok(());
+		}
+		let now = Instant::now();
+		match self.check_kernel_pos_index(header_pmmr, batch) {
+			Ok(count) => {
+				debug!(
+					"resume_recent_kernel_pos_index: {} kernels checked since checkpoint, took {}ms",
+					count,
+					now.elapsed().as_millis(),
+				);
+				Ok(())
+			}
+			Err(e) => {
+				debug!("resume_recent_kernel_pos_index: rebuilding, {}", e);
+				self.init_recent_kernel_pos_index(header_pmmr, batch)
+			}
+		}
+	}
+
+	// Check the kernel_pos index against its checkpoint: same digest up to the
+	// checkpoint and exactly one entry per NRD kernel since. Saves a new
+	// checkpoint at the current head if successful.
+	// Returns the number of kernels checked since the checkpoint.
+	fn check_kernel_pos_index(
+		&self,
+		header_pmmr: &PMMRHandle<BlockHeader>,
+		batch: &Batch<'_>,
+	) -> Result<usize, Error> {
+		let cp = batch.get_nrd_index_checkpoint()?;
+		let head = batch.head_header()?;
+		let last_pos = self.kernel_pmmr_h.last_pos;
+		if cp.height > head.height
+			|| head.kernel_mmr_size != last_pos
+			|| cp.kernel_mmr_size > last_pos
+			|| header_pmmr.get_header_hash_by_height(cp.height)? != cp.hash
+		{
+			return Err(ErrorKind::Other("checkpoint not on current chain".into()).into());
+		}
+
+		let entries = store::nrd_recent_kernel_index().entries(batch)?;
+		let (before, mut since): (Vec<_>, Vec<_>) = entries
+			.iter()
+			.cloned()
+			.partition(|(_, pos)| pos.pos <= cp.kernel_mmr_size);
+		if kernel_pos_digest(&before) != cp.digest {
+			return Err(ErrorKind::Other("index does not match checkpoint".into()).into());
+		}
+
+		let kernel_pmmr = ReadonlyPMMR::at(&self.kernel_pmmr_h.backend, last_pos);
+		let mut expected = vec![];
+		let mut checked = 0;
+		for pos in (cp.kernel_mmr_size + 1)..=last_pos {
+			if !pmmr::is_leaf(pos) {
+				continue;
+			}
+			checked += 1;
+			if let Some(kernel) = kernel_pmmr.get_data(pos) {
+				if let KernelFeatures::NoRecentDuplicate { .. } = kernel.features {
+					expected.push((kernel.excess(), pos));
+				}
+			}
+		}
+		since.sort_unstable_by_key(|(_, pos)| pos.pos);
+		let found: Vec<_> = since.iter().map(|(c, pos)| (*c, pos.pos)).collect();
+		if found != expected {
+			return Err(ErrorKind::Other("index does not match kernels".into()).into());
+		}
+
+		batch.save_nrd_index_checkpoint(&NRDIndexCheckpoint {
+			height: head.height,
+			hash: head.hash(),
+			kernel_mmr_size: head.kernel_mmr_size,
+			digest: kernel_pos_digest(&entries),
+		})?;
+		Ok(checked)
+	}
+
 	/// Verify and (re)build the NRD kernel_pos index from the provided header onwards.
+	/// Saves a checkpoint of the rebuilt index at the current head.
 	pub fn verify_kernel_pos_index(
 		&self,
 		from_header: &BlockHeader,
@@ -484,39 +643,64 @@ impl TxHashSet {
 			prev_size,
 		);
 
+		let header_head = batch.get_block_header(&header_pmmr.head_hash()?)?;
 		let kernel_pmmr =
 			ReadonlyPMMR::at(&self.kernel_pmmr_h.backend, self.kernel_pmmr_h.last_pos);
 
-		let mut current_pos = prev_size + 1;
-		let mut current_header = from_header.clone();
-		let mut count = 0;
-		while current_pos <= self.kernel_pmmr_h.last_pos {
-			if pmmr::is_leaf(current_pos) {
-				if let Some(kernel) = kernel_pmmr.get_data(current_pos) {
-					match kernel.features {
-						KernelFeatures::NoRecentDuplicate { .. } => {
-							while current_pos > current_header.kernel_mmr_size {
-								let hash = header_pmmr
-									.get_header_hash_by_height(current_header.height + 1)?;
-								current_header = batch.get_block_header(&hash)?;
-							}
-							let new_pos = CommitPos {
-								pos: current_pos,
-								height: current_header.height,
-							};
-							apply_kernel_rules(&kernel, new_pos, batch)?;
-							count += 1;
-						}
-						_ => {}
+		// Collect the NRD kernels first, mapping their pos to the height of
+		// their block by binary search over the header kernel MMR sizes.
+		let mut kernels = vec![];
+		let mut height = from_header.height;
+		for pos in (prev_size + 1)..=self.kernel_pmmr_h.last_pos {
+			if !pmmr::is_leaf(pos) {
+				continue;
+			}
+			if let Some(kernel) = kernel_pmmr.get_data(pos) {
+				if let KernelFeatures::NoRecentDuplicate { .. } = kernel.features {
+					height =
+						kernel_pos_height(pos, height, header_head.height, header_pmmr, batch)?;
+					kernels.push((kernel, CommitPos { pos, height }));
+				}
+			}
+		}
+
+		// Then check the relative height rules in memory and push all the
+		// entries in a row.
+		let mut latest: HashMap<Commitment, CommitPos> = HashMap::new();
+		for (kernel, pos) in &kernels {
+			if let KernelFeatures::NoRecentDuplicate {
+				relative_height, ..
+			} = kernel.features
+			{
+				if let Some(prev) = latest.insert(kernel.excess(), *pos) {
+					if pos.height.saturating_sub(prev.height) < relative_height.into() {
+						return Err(ErrorKind::NRDRelativeHeight.into());
 					}
 				}
 			}
-			current_pos += 1;
+		}
+		let entries: Vec<_> = kernels
+			.into_iter()
+			.map(|(kernel, pos)| (kernel.excess(), pos))
+			.collect();
+		for (excess, pos) in &entries {
+			kernel_index.push_pos(batch, *excess, *pos)?;
+		}
+
+		// Checkpoint the index, if our kernel MMR is the one of the chain head.
+		let head = batch.head_header()?;
+		if head.kernel_mmr_size == self.kernel_pmmr_h.last_pos {
+			batch.save_nrd_index_checkpoint(&NRDIndexCheckpoint {
+				height: head.height,
+				hash: head.hash(),
+				kernel_mmr_size: head.kernel_mmr_size,
+				digest: kernel_pos_digest(&entries),
+			})?;
 		}
 
 		debug!(
 			"verify_kernel_pos_index: pushed {} entries to the index, took {}s",
-			count,
+			entries.len(),
 			now.elapsed().as_secs(),
 		);
 		Ok(())
@@ -1893,6 +2077,39 @@ fn input_pos_to_rewind(
 	Ok(bitmap)
 }
 
+// Height of the block that added the kernel at the provided pos: the lowest
+// height in [low, high] with a kernel MMR covering it.
+fn kernel_pos_height(
+	pos: u64,
+	mut low: u64,
+	mut high: u64,
+	header_pmmr: &PMMRHandle<BlockHeader>,
+	batch: &Batch<'_>,
+) -> Result<u64, Error> {
+	while low < high {
+		let mid = low + (high - low) / 2;
+		let hash = header_pmmr.get_header_hash_by_height(mid)?;
+		if batch.get_block_header(&hash)?.kernel_mmr_size < pos {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	Ok(low)
+}
+
+// Digest of a set of kernel_pos index entries, whatever their order.
+fn kernel_pos_digest(entries: &[(Commitment, CommitPos)]) -> Hash {
+	let mut entries = entries.to_vec();
+	entries.sort_unstable_by_key(|(_, pos)| pos.pos);
+	let mut hasher = HashWriter::default();
+	for (commit, pos) in entries {
+		let _ = hasher.write_fixed_bytes(&commit);
+		let _ = pos.write(&mut hasher);
+	}
+	hasher.into_hash()
+}
+
 /// If NRD enabled then enforce NRD relative height rules.
 fn apply_kernel_rules(kernel: &TxKernel, pos: CommitPos, batch: &Batch<'_>) -> Result<(), Error> {
 	if !global::is_nrd_enabled() {
@@ -17,7 +17,8 @@
 use chrono::prelude::{DateTime, Utc};
 
 use crate::core::core::hash::{Hash, Hashed, ZERO_HASH};
-use crate::core::core::{Block, BlockHeader, HeaderVersion};
+use crate::core::core::merkle_proof::MerkleProof;
+use crate::core::core::{Block, BlockHeader, BlockSums, HeaderVersion, Output};
 use crate::core::pow::Difficulty;
 use crate::core::ser::{self, PMMRIndexHashable, Readable, Reader, Writeable, Writer};
 use crate::error::{Error, ErrorKind};
@@ -119,6 +120,21 @@ impl Default for TxHashsetDownloadStats {
 	}
 }
 
+/// Time spent by block processing waiting on and holding the chain locks
+/// (header MMR and txhashset), since startup. Context-free block validation
+/// is done before the locks are taken and not counted here.
+#[derive(Debug, Clone, Copy, Default, Eq, PartialEq, Deserialize, Serialize)]
+pub struct BlockLockStats {
+	/// Number of times the locks were taken to process blocks
+	pub acquisitions: u64,
+	/// Number of blocks processed under them
+	pub blocks: u64,
+	/// Total time spent waiting for the locks, in microseconds
+	pub wait_us: u64,
+	/// Total time the locks were held, in microseconds
+	pub held_us: u64,
+}
+
 /// Current sync state. Encapsulates the current SyncStatus.
 pub struct SyncState {
 	current: RwLock<SyncStatus>,
@@ -346,6 +362,176 @@ impl Writeable for CommitPos {
 	}
 }
 
+/// Chain state the NRD kernel index was last verified against, along with a
+/// digest of the index at that point. Lets us check the index on restart by
+/// only going through the kernels added since, rather than rebuilding it.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct NRDIndexCheckpoint {
+	/// Height of the block the index was verified at.
+	pub height: u64,
+	/// Hash of the block the index was verified at.
+	pub hash: Hash,
+	/// Kernel MMR size as of this block.
+	pub kernel_mmr_size: u64,
+	/// Digest of the index entries up to kernel_mmr_size.
+	pub digest: Hash,
+}
+
+impl Readable for NRDIndexCheckpoint {
+	fn read<R: Reader>(reader: &mut R) -> Result<NRDIndexCheckpoint, ser::Error> {
+		let height = reader.read_u64()?;
+		let hash = Hash::read(reader)?;
+		let kernel_mmr_size = reader.read_u64()?;
+		let digest = Hash::read(reader)?;
+		Ok(NRDIndexCheckpoint {
+			height,
+			hash,
+			kernel_mmr_size,
+			digest,
+		})
+	}
+}
+
+impl Writeable for NRDIndexCheckpoint {
+	fn write<W: Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		writer.write_u64(self.height)?;
+		writer.write_fixed_bytes(&self.hash)?;
+		writer.write_u64(self.kernel_mmr_size)?;
+		writer.write_fixed_bytes(&self.digest)?;
+		Ok(())
+	}
+}
+
+/// Block validation cache for the last fork processed: its blocks, already
+/// validated against the chain state at the fork point, with their block
+/// sums. This is not the MMR state of the fork, extending the fork still
+/// applies every one of its blocks to the txhashset extension again (the
+/// extension is rolled back after each losing fork block), only their
+/// validation is skipped.
+#[derive(Debug, Clone, Default)]
+pub struct ForkCache {
+	/// Body head the fork blocks were validated against.
+	pub head: Hash,
+	/// Last block shared by the fork and the body head chain.
+	pub fork_point: BlockHeader,
+	/// Fork blocks from the fork point up, with their block sums.
+	pub blocks: Vec<(Hash, BlockSums)>,
+}
+
+impl ForkCache {
+	/// Fork point of the provided fork header, if it is one of our cached
+	/// blocks and the body head is still the one they were validated against.
+	pub fn fork_point_of(&self, header: &BlockHeader, head: &Tip) -> Option<BlockHeader> {
+		if self.head == head.last_block_h && self.contains(header.height, &header.hash()) {
+			Some(self.fork_point.clone())
+		} else {
+			None
+		}
+	}
+
+	/// Hashes of the cached fork blocks from the fork point up to the given
+	/// height.
+	pub fn hashes_to(&self, height: u64) -> Vec<Hash> {
+		let len = self.index_of(height).map(|idx| idx + 1).unwrap_or(0);
+		self.blocks.iter().take(len).map(|(h, _)| *h).collect()
+	}
+
+	/// Block sums of the fork block at the given height, if cached and still
+	/// valid for the provided head and fork point.
+	pub fn block_sums(
+		&self,
+		height: u64,
+		hash: &Hash,
+		head: &Tip,
+		fork_point: &Hash,
+	) -> Option<BlockSums> {
+		if self.fork_point.hash() != *fork_point || self.head != head.last_block_h {
+			return None;
+		}
+		self.index_of(height)
+			.and_then(|idx| self.blocks.get(idx))
+			.filter(|(h, _)| h == hash)
+			.map(|(_, sums)| sums.clone())
+	}
+
+	/// The body head moved to the provided header. If it extends the head our
+	/// blocks were validated against, away from them, the fork point and the
+	/// fork blocks are unchanged and stay valid. Otherwise the cache is reset.
+	pub fn head_extended(&mut self, header: &BlockHeader) {
+		if header.prev_hash == self.head && !self.contains(header.height, &header.hash()) {
+			self.head = header.hash();
+		} else {
+			*self = ForkCache::default();
+		}
+	}
+
+	fn contains(&self, height: u64, hash: &Hash) -> bool {
+		self.index_of(height)
+			.and_then(|idx| self.blocks.get(idx))
+			.map(|(h, _)| h == hash)
+			.unwrap_or(false)
+	}
+
+	fn index_of(&self, height: u64) -> Option<usize> {
+		if height > self.fork_point.height {
+			Some((height - self.fork_point.height - 1) as usize)
+		} else {
+			None
+		}
+	}
+}
+
+/// Unspent output as returned by a bulk scan of the UTXO set, with its MMR
+/// position, the height of the block that created it and, for coinbase
+/// outputs if requested, a Merkle proof against the output MMR of the chain
+/// head the scan was done at.
+#[derive(Debug, Clone, PartialEq)]
+pub struct ScannedOutput {
+	/// The output (features, commitment and rangeproof)
+	pub output: Output,
+	/// MMR position
+	pub pos: u64,
+	/// Block height
+	pub height: u64,
+	/// Merkle proof of the output, verifying against the output PMMR root at
+	/// the head the scan was done at (not at the block that created it).
+	pub head_merkle_proof: Option<MerkleProof>,
+}
+
+impl Readable for ScannedOutput {
+	fn read<R: Reader>(reader: &mut R) -> Result<ScannedOutput, ser::Error> {
+		let output = Output::read(reader)?;
+		let pos = reader.read_u64()?;
+		let height = reader.read_u64()?;
+		let head_merkle_proof = match reader.read_u8()? {
+			0 => None,
+			1 => Some(MerkleProof::read(reader)?),
+			_ => return Err(ser::Error::CorruptedData),
+		};
+		Ok(ScannedOutput {
+			output,
+			pos,
+			height,
+			head_merkle_proof,
+		})
+	}
+}
+
+impl Writeable for ScannedOutput {
+	fn write<W: Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		self.output.write(writer)?;
+		writer.write_u64(self.pos)?;
+		writer.write_u64(self.height)?;
+		match self.head_merkle_proof {
+			None => writer.write_u8(0),
+			Some(ref proof) => {
+				writer.write_u8(1)?;
+				proof.write(writer)
+			}
+		}
+	}
+}
+
 /// The tip of a fork. A handle to the fork ancestry from its leaf in the
 /// blockchain tree. References the max height and the latest and previous
 /// blocks
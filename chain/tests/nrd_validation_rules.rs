@@ -20,6 +20,9 @@ use grin_keychain as keychain;
 use grin_util as util;
 
 use self::chain_test_helper::{clean_output_dir, genesis_block, init_chain};
+use crate::chain::linked_list::ListIndex;
+use crate::chain::store;
+use crate::chain::types::CommitPos;
 use crate::chain::{Chain, Error, Options};
 use crate::core::core::{
 	Block, BlockHeader, KernelFeatures, NRDRelativeHeight, Transaction, TxKernel,
@@ -27,6 +30,7 @@ use crate::core::core::{
 use crate::core::libtx::{aggsig, build, reward, ProofBuilder};
 use crate::core::{consensus, global, pow};
 use crate::keychain::{BlindingFactor, ExtKeychain, ExtKeychainPath, Identifier, Keychain};
+use crate::util::secp::pedersen::Commitment;
 use chrono::Duration;
 
 fn build_block<K>(
@@ -188,6 +192,42 @@ fn process_block_nrd_validation() -> Result<(), Error> {
 	let block_valid_11 = build_block(&chain, &keychain, &key_id11, vec![tx2.clone()])?;
 	chain.process_block(block_valid_11, Options::NONE)?;
 
+	// On restart the index is checked against its checkpoint, only going through
+	// the kernels since, and checkpointed again at the chain head.
+	let index = store::nrd_recent_kernel_index();
+	let entries = {
+		let batch = chain.store().batch()?;
+		let mut entries = index.entries(&batch)?;
+		entries.sort_unstable_by_key(|(_, pos)| pos.pos);
+		assert_eq!(entries.len(), 2);
+		entries
+	};
+	drop(chain);
+	let chain = init_chain(chain_dir, genesis.clone());
+	{
+		let batch = chain.store().batch()?;
+		assert_eq!(batch.get_nrd_index_checkpoint()?.height, 11);
+		let mut resumed = index.entries(&batch)?;
+		resumed.sort_unstable_by_key(|(_, pos)| pos.pos);
+		assert_eq!(resumed, entries);
+
+		// Tamper with the index.
+		let bogus = Commitment::from_vec(vec![9; 33]);
+		index.push_pos(&batch, bogus, CommitPos { pos: 1, height: 0 })?;
+		batch.commit()?;
+	}
+
+	// Index no longer matching its checkpoint is rebuilt.
+	drop(chain);
+	let chain = init_chain(chain_dir, genesis.clone());
+	{
+		let batch = chain.store().batch()?;
+		let mut rebuilt = index.entries(&batch)?;
+		rebuilt.sort_unstable_by_key(|(_, pos)| pos.pos);
+		assert_eq!(rebuilt, entries);
+	}
+	drop(chain);
+
 	clean_output_dir(chain_dir);
 	Ok(())
 }
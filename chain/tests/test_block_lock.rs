@@ -0,0 +1,152 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+mod chain_test_helper;
+
+use grin_chain as chain;
+use grin_core as core;
+use grin_keychain as keychain;
+use grin_util as util;
+
+use self::chain_test_helper::{clean_output_dir, genesis_block, init_chain};
+use crate::chain::{pipe, Chain, ErrorKind, Options};
+use crate::core::core::hash::Hashed;
+use crate::core::core::Block;
+use crate::core::libtx::{reward, ProofBuilder};
+use crate::core::{consensus, global, pow};
+use crate::keychain::{ExtKeychain, ExtKeychainPath};
+use chrono::Duration;
+
+fn build_block(chain: &Chain, keychain: &ExtKeychain, key_idx: u32) -> Block {
+	let prev = chain.head_header().unwrap();
+	let next_header_info = consensus::next_difficulty(1, chain.difficulty_iter().unwrap());
+	let key_id = ExtKeychainPath::new(1, key_idx, 0, 0, 0).to_identifier();
+	let reward = reward::output(keychain, &ProofBuilder::new(keychain), &key_id, 0, false).unwrap();
+
+	let mut block = Block::new(&prev, &[], next_header_info.clone().difficulty, reward).unwrap();
+	block.header.timestamp = prev.timestamp + Duration::seconds(60);
+	block.header.pow.secondary_scaling = next_header_info.secondary_scaling;
+	chain.set_txhashset_roots(&mut block).unwrap();
+
+	let edge_bits = global::min_edge_bits();
+	block.header.pow.proof.edge_bits = edge_bits;
+	pow::pow_size(
+		&mut block.header,
+		next_header_info.difficulty,
+		global::proofsize(),
+		edge_bits,
+	)
+	.unwrap();
+	block
+}
+
+// A block with a valid header but a bad rangeproof. Its header goes on the
+// header chain but the body is rejected.
+fn build_invalid_block(chain: &Chain, keychain: &ExtKeychain, key_idx: u32) -> Block {
+	let mut block = build_block(chain, keychain, key_idx);
+	let other = build_block(chain, keychain, key_idx + 1);
+	block.body.outputs[0].proof = other.body.outputs[0].proof;
+	block
+}
+
+// Blocks are validated on their own before the chain locks are taken, an
+// invalid one never holds them.
+#[test]
+fn invalid_block_rejected_before_locks() {
+	let chain_dir = ".grin.block_lock";
+	global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+	util::init_test_logger();
+	clean_output_dir(chain_dir);
+
+	let keychain = ExtKeychain::from_random_seed(false).unwrap();
+	let chain = init_chain(chain_dir, genesis_block(&keychain));
+
+	for n in 1..4 {
+		let block = build_block(&chain, &keychain, n);
+		chain.process_block(block, Options::MINE).unwrap();
+	}
+	let stats = chain.block_lock_stats();
+	assert_eq!(stats.acquisitions, 3);
+	assert_eq!(stats.blocks, 3);
+
+	let bad = build_invalid_block(&chain, &keychain, 10);
+	let res = chain.process_block(bad.clone(), Options::MINE);
+	match res.map_err(|e| e.kind()) {
+		Err(ErrorKind::InvalidBlockProof(_)) => {}
+		res => panic!("invalid block not rejected: {:?}", res),
+	}
+	assert_eq!(chain.block_lock_stats(), stats);
+	assert!(!chain.block_exists(bad.hash()).unwrap());
+
+	let good = build_block(&chain, &keychain, 20);
+	chain.process_block(good.clone(), Options::MINE).unwrap();
+	assert_eq!(chain.head().unwrap().last_block_h, good.hash());
+	let stats = chain.block_lock_stats();
+	assert_eq!(stats.acquisitions, 4);
+	assert_eq!(stats.blocks, 4);
+
+	clean_output_dir(chain_dir);
+}
+
+// The pipe only skips the body validation of the block the context says was
+// already validated, any other block is validated as usual.
+#[test]
+fn validated_block_only_skips_same_hash() {
+	let chain_dir = ".grin.validated_block";
+	global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+	util::init_test_logger();
+	clean_output_dir(chain_dir);
+
+	let keychain = ExtKeychain::from_random_seed(false).unwrap();
+	let chain = init_chain(chain_dir, genesis_block(&keychain));
+	let block = build_block(&chain, &keychain, 1);
+	chain.process_block(block, Options::MINE).unwrap();
+
+	let bad = build_invalid_block(&chain, &keychain, 10);
+	let store = chain.store();
+	let header_pmmr = chain.header_pmmr();
+	let txhashset = chain.txhashset();
+	let mut header_pmmr = header_pmmr.write();
+	let mut txhashset = txhashset.write();
+
+	// Some other block was validated, this one still is.
+	{
+		let batch = store.batch().unwrap();
+		let mut ctx = chain
+			.new_ctx(Options::MINE, batch, &mut header_pmmr, &mut txhashset)
+			.unwrap();
+		ctx.validated_block = Some(chain.head().unwrap().last_block_h);
+		match pipe::process_block(&bad, &mut ctx).map_err(|e| e.kind()) {
+			Err(ErrorKind::InvalidBlockProof(_)) => {}
+			res => panic!("block not validated: {:?}", res),
+		}
+	}
+
+	// Marked as validated, the body checks are skipped and the bad proof is
+	// only caught against the rangeproof root of the header.
+	{
+		let batch = store.batch().unwrap();
+		let mut ctx = chain
+			.new_ctx(Options::MINE, batch, &mut header_pmmr, &mut txhashset)
+			.unwrap();
+		ctx.validated_block = Some(bad.hash());
+		match pipe::process_block(&bad, &mut ctx).map_err(|e| e.kind()) {
+			Err(ErrorKind::InvalidBlockProof(_)) => panic!("block validated again"),
+			Err(_) => {}
+			Ok(_) => panic!("block with a bad proof accepted"),
+		}
+	}
+
+	clean_output_dir(chain_dir);
+}
@@ -0,0 +1,172 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use grin_chain as chain;
+use grin_core as core;
+use grin_util as util;
+
+use self::chain::types::CommitPos;
+use self::chain::ChainStore;
+use self::core::core::hash::{Hash, Hashed};
+use self::core::core::{Block, BlockHeader, BlockSums, Inputs, Output, OutputFeatures};
+use self::core::core::{TransactionBody, ZERO_HASH};
+use self::core::global::{self, ChainTypes};
+use self::util::secp::constants::MAX_PROOF_SIZE;
+use self::util::secp::pedersen::{Commitment, RangeProof};
+use chrono::{Duration, TimeZone, Utc};
+use std::time::Instant;
+
+mod chain_test_helper;
+
+use self::chain_test_helper::clean_output_dir;
+
+// A day of blocks to prune, below a week of retained blocks.
+const PRUNED: u64 = 1_440;
+const RETAINED: u64 = 10_080;
+// A short lived fork block every FORK_INTERVAL heights.
+const FORK_INTERVAL: u64 = 100;
+
+fn block(height: u64, prev_hash: Hash, nonce: u64) -> Block {
+	let mut header = BlockHeader::default();
+	header.height = height;
+	header.prev_hash = prev_hash;
+	header.timestamp = Utc.timestamp(1_600_000_000, 0) + Duration::seconds(height as i64 * 60);
+	// A header hashes to its proof of work.
+	header.pow.proof.edge_bits = 32;
+	header.pow.proof.nonces[0] = height;
+	header.pow.proof.nonces[1] = nonce;
+
+	let outputs: Vec<Output> = (0..2u64)
+		.map(|i| {
+			let mut commit = vec![8; 33];
+			commit[1..9].copy_from_slice(&height.to_be_bytes());
+			commit[9..17].copy_from_slice(&(nonce * 2 + i).to_be_bytes());
+			let mut proof = [0; MAX_PROOF_SIZE];
+			proof[..675].copy_from_slice(&[7; 675]);
+			Output::new(
+				OutputFeatures::Plain,
+				Commitment::from_vec(commit),
+				RangeProof { proof, plen: 675 },
+			)
+		})
+		.collect();
+
+	let mut block = Block::with_header(header);
+	block.body = TransactionBody::init(Inputs::default(), &outputs, &[], false).unwrap();
+	block
+}
+
+fn save(store: &ChainStore, block: &Block) {
+	let batch = store.batch().unwrap();
+	batch.save_block_header(&block.header).unwrap();
+	batch.save_block(block).unwrap();
+	batch
+		.save_block_sums(&block.hash(), BlockSums::default())
+		.unwrap();
+	batch
+		.save_spent_index(
+			&block.hash(),
+			&[CommitPos {
+				pos: block.header.height * 2 + 1,
+				height: block.header.height,
+			}],
+		)
+		.unwrap();
+	batch.commit().unwrap();
+}
+
+// Historical pruning of a day worth of blocks below a week of retained blocks,
+// scanning all full blocks against a range scan of the block height index.
+#[test]
+fn test_block_pruning() {
+	util::init_test_logger();
+	global::set_local_chain_type(ChainTypes::AutomatedTesting);
+
+	let db_root = ".grin_block_pruning";
+	clean_output_dir(db_root);
+
+	let store = ChainStore::new(db_root).unwrap();
+	let mut pruned = vec![];
+	let mut retained = vec![];
+	let mut prev_hash = ZERO_HASH;
+	for height in 0..PRUNED + RETAINED {
+		let b = block(height, prev_hash, 0);
+		save(&store, &b);
+		prev_hash = b.hash();
+		let mut hashes = vec![b.hash()];
+		if height % FORK_INTERVAL == 0 {
+			let fork = block(height, b.header.prev_hash, 1);
+			save(&store, &fork);
+			hashes.push(fork.hash());
+		}
+		if height < PRUNED {
+			pruned.extend(hashes);
+		} else {
+			retained.extend(hashes);
+		}
+	}
+
+	// What remove_historical_blocks used to do, every block is read.
+	let legacy = {
+		let batch = store.batch().unwrap();
+		let start = Instant::now();
+		let mut count = 0;
+		for block in batch.blocks_iter().unwrap() {
+			if block.header.height < PRUNED {
+				let _ = batch.delete_block(&block.hash());
+				count += 1;
+			}
+		}
+		assert_eq!(count, pruned.len());
+		start.elapsed()
+	};
+
+	let batch = store.batch().unwrap();
+	let start = Instant::now();
+	assert_eq!(batch.delete_blocks_below(PRUNED).unwrap(), pruned.len());
+	let indexed = start.elapsed();
+	batch.commit().unwrap();
+
+	println!(
+		"pruning {} of {} blocks: scanning all blocks {:?}, height index {:?}",
+		pruned.len(),
+		pruned.len() + retained.len(),
+		legacy,
+		indexed
+	);
+
+	for h in &pruned {
+		assert!(!store.block_exists(h).unwrap());
+		assert!(store.get_block_sums(h).is_err());
+		assert!(store.batch().unwrap().get_spent_index(h).is_err());
+	}
+	for h in &retained {
+		assert!(store.block_exists(h).unwrap());
+		assert!(store.get_block_sums(h).is_ok());
+		assert!(store.batch().unwrap().get_spent_index(h).is_ok());
+	}
+
+	// Nothing left below the cutoff, a second pass is a no-op.
+	let batch = store.batch().unwrap();
+	assert_eq!(batch.delete_blocks_below(PRUNED).unwrap(), 0);
+
+	// Deleting a single block also drops it from the index.
+	batch.delete_block(&retained[0]).unwrap();
+	batch.commit().unwrap();
+	let batch = store.batch().unwrap();
+	assert_eq!(batch.delete_blocks_below(PRUNED + 1).unwrap(), 0);
+	drop(batch);
+
+	clean_output_dir(db_root);
+}
@@ -0,0 +1,91 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use self::chain::txhashset::{self, KernelRoot};
+use self::core::core::hash::Hash;
+use grin_chain as chain;
+use grin_core as core;
+use grin_util as util;
+
+mod chain_test_helper;
+
+use self::chain_test_helper::{clean_output_dir, mine_chain};
+use std::time::Instant;
+
+// Kernel root of every header checked by rewinding the kernel MMR header by
+// header, against a single forward pass over the kernel MMR.
+#[test]
+fn test_kernel_history() {
+	util::init_test_logger();
+
+	let chain_dir = ".grin_kernel_history";
+	clean_output_dir(chain_dir);
+
+	let chain = mine_chain(chain_dir, 50);
+	let head = chain.head_header().unwrap();
+	let txhashset = chain.txhashset();
+	let txhashset = txhashset.read();
+
+	let start = Instant::now();
+	txhashset::rewindable_kernel_view(&txhashset, |view, batch| {
+		let mut current = head.clone();
+		while current.height > 0 {
+			view.rewind(&current)?;
+			view.validate_root()?;
+			current = batch.get_previous_header(&current)?;
+		}
+		Ok(())
+	})
+	.unwrap();
+	let rewinding = start.elapsed();
+
+	let start = Instant::now();
+	let mut roots = vec![];
+	txhashset::rewindable_kernel_view(&txhashset, |view, batch| {
+		let mut current = head.clone();
+		while current.height > 0 {
+			roots.push(KernelRoot::from(&current));
+			current = batch.get_previous_header(&current)?;
+		}
+		roots.reverse();
+		view.validate_roots(&roots)
+	})
+	.unwrap();
+	println!(
+		"kernel history of {} headers: rewinding {:?}, forward pass {:?}",
+		head.height,
+		rewinding,
+		start.elapsed()
+	);
+
+	// A single bad root anywhere in the history is caught.
+	let mut bad_roots = roots.clone();
+	bad_roots[20].root = Hash::from_vec(&[1; 32]);
+	let res =
+		txhashset::rewindable_kernel_view(&txhashset, |view, _| view.validate_roots(&bad_roots));
+	assert!(res.is_err());
+
+	// As is a header past the end of the kernel MMR.
+	let mut long_roots = roots.clone();
+	let mut last = *roots.last().unwrap();
+	last.height += 1;
+	last.size += 1;
+	long_roots.push(last);
+	let res =
+		txhashset::rewindable_kernel_view(&txhashset, |view, _| view.validate_roots(&long_roots));
+	assert!(res.is_err());
+
+	drop(txhashset);
+	clean_output_dir(chain_dir);
+}
@@ -0,0 +1,73 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use self::chain::types::Options;
+use self::chain::ErrorKind;
+use self::core::core::hash::Hashed;
+use grin_chain as chain;
+use grin_core as core;
+use grin_util as util;
+
+mod chain_test_helper;
+
+use self::chain_test_helper::{clean_output_dir, init_chain, mine_chain};
+
+// Blocks received in reverse order are held as orphans, then applied all at
+// once when the first missing block shows up.
+#[test]
+fn test_orphans_chain() {
+	util::init_test_logger();
+
+	let chain_dir = ".grin_orphans_1";
+	let chain_dir_2 = ".grin_orphans_2";
+	clean_output_dir(chain_dir);
+	clean_output_dir(chain_dir_2);
+
+	let chain = mine_chain(chain_dir, 11);
+	let blocks: Vec<_> = (0..11)
+		.map(|h| {
+			let header = chain.get_header_by_height(h).unwrap();
+			chain.get_block(&header.hash()).unwrap()
+		})
+		.collect();
+
+	{
+		let chain_2 = init_chain(chain_dir_2, blocks[0].clone());
+
+		// Headers first, as during body sync.
+		for b in &blocks[1..] {
+			chain_2
+				.process_block_header(&b.header, Options::NONE)
+				.unwrap();
+		}
+
+		for b in blocks[2..].iter().rev() {
+			let res = chain_2.process_block(b.clone(), Options::NONE);
+			assert_eq!(res.map_err(|e| e.kind()), Err(ErrorKind::Orphan));
+			assert!(chain_2.is_orphan(&b.hash()));
+		}
+		assert_eq!(chain_2.orphans_len(), 9);
+		assert_eq!(chain_2.head().unwrap().height, 0);
+
+		chain_2
+			.process_block(blocks[1].clone(), Options::NONE)
+			.unwrap();
+		assert_eq!(chain_2.orphans_len(), 0);
+		assert_eq!(chain_2.head().unwrap().last_block_h, blocks[10].hash());
+		chain_2.validate(false).unwrap();
+	}
+
+	clean_output_dir(chain_dir);
+	clean_output_dir(chain_dir_2);
+}
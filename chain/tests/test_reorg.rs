@@ -0,0 +1,318 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use self::chain::{Chain, Options};
+use self::core::core::hash::Hashed;
+use self::core::core::{Block, BlockHeader};
+use self::core::global::{self, ChainTypes};
+use self::core::libtx;
+use self::core::pow::{self, Difficulty};
+use self::keychain::{ExtKeychain, ExtKeychainPath, Keychain};
+use chrono::Duration;
+use grin_chain as chain;
+use grin_core as core;
+use grin_keychain as keychain;
+use grin_util as util;
+use std::time::Instant;
+
+mod chain_test_helper;
+
+use self::chain_test_helper::{clean_output_dir, init_chain};
+
+fn prepare_block<K>(kc: &K, prev: &BlockHeader, chain: &Chain, key_idx: u32) -> Block
+where
+	K: Keychain,
+{
+	let key_id = ExtKeychainPath::new(1, key_idx, 0, 0, 0).to_identifier();
+	let reward =
+		libtx::reward::output(kc, &libtx::ProofBuilder::new(kc), &key_id, 0, false).unwrap();
+	let mut b = Block::new(prev, &[], Difficulty::from_num(2), reward).unwrap();
+	b.header.timestamp = prev.timestamp + Duration::seconds(60);
+	b.header.pow.total_difficulty = prev.total_difficulty() + Difficulty::from_num(2);
+	b.header.pow.proof = pow::Proof::random(global::proofsize());
+	chain.set_txhashset_roots(&mut b).unwrap();
+	b
+}
+
+// Mine `len` blocks on a chain and `len + 1` blocks on a fork of it from
+// genesis, then feed the fork (headers first, as during sync) to the chain.
+// Every fork block but the last extends the losing fork, the last one reorgs.
+fn reorg(len: u64) {
+	let chain_dir = format!(".grin_reorg_{}", len);
+	let fork_dir = format!(".grin_reorg_{}_fork", len);
+	clean_output_dir(&chain_dir);
+	clean_output_dir(&fork_dir);
+
+	global::set_local_chain_type(ChainTypes::AutomatedTesting);
+	let kc = ExtKeychain::from_random_seed(false).unwrap();
+	let genesis = pow::mine_genesis_block().unwrap();
+	let genesis_hash = genesis.hash();
+	{
+		let chain = init_chain(&chain_dir, genesis.clone());
+		let fork_chain = init_chain(&fork_dir, genesis);
+
+		for n in 0..len {
+			let prev = chain.head_header().unwrap();
+			let b = prepare_block(&kc, &prev, &chain, n as u32 + 1);
+			chain.process_block(b, Options::SKIP_POW).unwrap();
+		}
+		let main_head = chain.head().unwrap();
+		let mut fork = vec![];
+		for n in 0..len + 1 {
+			let prev = fork_chain.head_header().unwrap();
+			let b = prepare_block(&kc, &prev, &fork_chain, n as u32 + 1_000_000);
+			fork_chain
+				.process_block(b.clone(), Options::SKIP_POW)
+				.unwrap();
+			fork.push(b);
+		}
+
+		for b in &fork {
+			chain
+				.process_block_header(&b.header, Options::SKIP_POW)
+				.unwrap();
+		}
+
+		// The header chain is now the fork, our body chain diverges from it at genesis.
+		assert_eq!(chain.fork_point().unwrap().hash(), genesis_hash);
+		let header_head = chain.header_head().unwrap();
+		let locator = chain
+			.get_locator_hashes(header_head, &[header_head.height, 1, 0])
+			.unwrap();
+		assert_eq!(
+			locator,
+			vec![fork.last().unwrap().hash(), fork[0].hash(), genesis_hash]
+		);
+
+		// A peer still on our original chain is given the fork headers from genesis.
+		let fork_hashes: Vec<_> = fork[..5].iter().map(|b| b.hash()).collect();
+		let headers = chain
+			.locate_headers(&[main_head.last_block_h, genesis_hash], 5)
+			.unwrap();
+		assert_eq!(
+			headers.iter().map(|h| h.hash()).collect::<Vec<_>>(),
+			fork_hashes
+		);
+
+		// Headers by height come from the header chain, the fork.
+		let hashes =
+			|headers: Vec<BlockHeader>| headers.iter().map(|h| h.hash()).collect::<Vec<_>>();
+		let headers = chain.headers_from_height(2, 3).unwrap();
+		assert_eq!(hashes(headers), fork_hashes[1..4].to_vec());
+		let headers = chain.headers_from_height(len, 10).unwrap();
+		assert_eq!(
+			hashes(headers),
+			vec![fork[len as usize - 1].hash(), fork[len as usize].hash()]
+		);
+		assert!(chain.headers_from_height(0, 5).unwrap().is_empty());
+		assert!(chain.headers_from_height(len + 2, 5).unwrap().is_empty());
+		assert!(chain.headers_from_height(1, 0).unwrap().is_empty());
+
+		let start = Instant::now();
+		let mut slowest = std::time::Duration::default();
+		for b in &fork[..fork.len() - 1] {
+			let block_start = Instant::now();
+			chain.process_block(b.clone(), Options::SKIP_POW).unwrap();
+			slowest = slowest.max(block_start.elapsed());
+		}
+		let extending = start.elapsed();
+		assert_eq!(chain.head().unwrap(), main_head);
+
+		// Every fork block so far is cached as validated against our head.
+		let fork_cache = chain.txhashset().read().fork_cache().clone();
+		assert_eq!(fork_cache.head, main_head.last_block_h);
+		assert_eq!(fork_cache.fork_point.hash(), genesis_hash);
+		assert_eq!(fork_cache.blocks.len() as u64, len);
+		assert_eq!(
+			fork_cache.blocks.last().unwrap().0,
+			fork[len as usize - 1].hash()
+		);
+
+		let start = Instant::now();
+		let last = fork.last().unwrap();
+		chain
+			.process_block(last.clone(), Options::SKIP_POW)
+			.unwrap();
+		let reorg = start.elapsed();
+
+		println!(
+			"fork of {} blocks: extending the fork {:?} (slowest block {:?}), reorg {:?}",
+			len + 1,
+			extending,
+			slowest,
+			reorg
+		);
+
+		let head = chain.head().unwrap();
+		assert_eq!(head.height, len + 1);
+		assert_eq!(head.last_block_h, last.hash());
+		assert_eq!(chain.fork_point().unwrap().hash(), last.hash());
+		assert_eq!(
+			chain.get_header_by_height(1).unwrap().hash(),
+			fork[0].hash()
+		);
+		chain.validate(true).unwrap();
+	}
+
+	clean_output_dir(&chain_dir);
+	clean_output_dir(&fork_dir);
+}
+
+#[test]
+fn test_reorg_10() {
+	util::init_test_logger();
+	reorg(10);
+}
+
+#[test]
+fn test_reorg_100() {
+	util::init_test_logger();
+	reorg(100);
+}
+
+#[test]
+fn test_reorg_1000() {
+	util::init_test_logger();
+	reorg(1_000);
+}
+
+// The main chain moving on does not invalidate a cached fork, the next blocks
+// on the fork still find their fork point and the validated blocks below them
+// in the cache.
+#[test]
+fn test_fork_cache_head_extended() {
+	util::init_test_logger();
+	let chain_dir = ".grin_reorg_head_extended";
+	let fork_dir = ".grin_reorg_head_extended_fork";
+	clean_output_dir(chain_dir);
+	clean_output_dir(fork_dir);
+
+	global::set_local_chain_type(ChainTypes::AutomatedTesting);
+	let kc = ExtKeychain::from_random_seed(false).unwrap();
+	let genesis = pow::mine_genesis_block().unwrap();
+	let genesis_hash = genesis.hash();
+	{
+		let chain = init_chain(chain_dir, genesis.clone());
+		let fork_chain = init_chain(fork_dir, genesis);
+		let mine = |chain: &Chain, key_idx: u32| {
+			let prev = chain.head_header().unwrap();
+			let b = prepare_block(&kc, &prev, chain, key_idx);
+			chain.process_block(b.clone(), Options::SKIP_POW).unwrap();
+			b
+		};
+		let fork_cache = |chain: &Chain| chain.txhashset().read().fork_cache().clone();
+
+		for n in 0..5 {
+			mine(&chain, n + 1);
+		}
+		let fork: Vec<Block> = (0..7).map(|n| mine(&fork_chain, n + 1_000)).collect();
+
+		for b in &fork[..3] {
+			chain.process_block(b.clone(), Options::SKIP_POW).unwrap();
+		}
+		let cache = fork_cache(&chain);
+		assert_eq!(cache.head, chain.head().unwrap().last_block_h);
+		assert_eq!(cache.fork_point.hash(), genesis_hash);
+		assert_eq!(cache.blocks.len(), 3);
+
+		// The main chain moves on, away from the fork.
+		let b = mine(&chain, 6);
+		let cache = fork_cache(&chain);
+		assert_eq!(cache.head, b.hash());
+		assert_eq!(cache.blocks.len(), 3);
+
+		// The fork carries on from the cached blocks.
+		for b in &fork[3..6] {
+			chain.process_block(b.clone(), Options::SKIP_POW).unwrap();
+		}
+		let cache = fork_cache(&chain);
+		assert_eq!(cache.head, b.hash());
+		assert_eq!(cache.fork_point.hash(), genesis_hash);
+		assert_eq!(cache.blocks.len(), 6);
+		assert_eq!(chain.head().unwrap().last_block_h, b.hash());
+
+		// And finally takes over.
+		let last = &fork[6];
+		chain
+			.process_block(last.clone(), Options::SKIP_POW)
+			.unwrap();
+		assert_eq!(chain.head().unwrap().last_block_h, last.hash());
+		assert!(fork_cache(&chain).blocks.is_empty());
+		chain.validate(true).unwrap();
+	}
+
+	clean_output_dir(chain_dir);
+	clean_output_dir(fork_dir);
+}
+
+// Fork point of the body chain and of a header chain forking off it half way,
+// first with only body chain blocks at each height, then with fork blocks too
+// (where the block height index alone can't tell which block is on the body
+// chain).
+#[test]
+fn test_fork_point() {
+	util::init_test_logger();
+	let chain_dir = ".grin_reorg_fork_point";
+	let fork_dir = ".grin_reorg_fork_point_fork";
+	clean_output_dir(chain_dir);
+	clean_output_dir(fork_dir);
+
+	global::set_local_chain_type(ChainTypes::AutomatedTesting);
+	let kc = ExtKeychain::from_random_seed(false).unwrap();
+	let genesis = pow::mine_genesis_block().unwrap();
+	{
+		let chain = init_chain(chain_dir, genesis.clone());
+		let fork_chain = init_chain(fork_dir, genesis);
+		let mine = |chain: &Chain, key_idx: u32| {
+			let prev = chain.head_header().unwrap();
+			let b = prepare_block(&kc, &prev, chain, key_idx);
+			chain.process_block(b.clone(), Options::SKIP_POW).unwrap();
+			b
+		};
+
+		let shared: Vec<Block> = (0..10).map(|n| mine(&chain, n + 1)).collect();
+		for b in &shared {
+			fork_chain
+				.process_block(b.clone(), Options::SKIP_POW)
+				.unwrap();
+		}
+		for n in 10..20 {
+			mine(&chain, n + 1);
+		}
+		let fork: Vec<Block> = (0..15).map(|n| mine(&fork_chain, n + 1_000)).collect();
+		let fork_point = shared.last().unwrap().hash();
+
+		for b in &fork {
+			chain
+				.process_block_header(&b.header, Options::SKIP_POW)
+				.unwrap();
+		}
+		assert_eq!(
+			chain.header_head().unwrap().last_block_h,
+			fork.last().unwrap().hash()
+		);
+		assert_eq!(chain.fork_point().unwrap().hash(), fork_point);
+
+		// A few fork blocks, not enough to reorg, and a new body head.
+		for b in &fork[..3] {
+			chain.process_block(b.clone(), Options::SKIP_POW).unwrap();
+		}
+		mine(&chain, 21);
+		assert_eq!(chain.head().unwrap().height, 21);
+		assert_eq!(chain.fork_point().unwrap().hash(), fork_point);
+	}
+
+	clean_output_dir(chain_dir);
+	clean_output_dir(fork_dir);
+}
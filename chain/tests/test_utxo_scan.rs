@@ -0,0 +1,95 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use grin_util as util;
+
+mod chain_test_helper;
+
+use self::chain_test_helper::{clean_output_dir, mine_chain};
+use std::time::Instant;
+
+#[test]
+fn test_utxo_scan() {
+	util::init_test_logger();
+	let chain_dir = ".grin.utxo_scan";
+	clean_output_dir(chain_dir);
+	let chain = mine_chain(chain_dir, 50);
+	let page_size = 7;
+
+	// Full UTXO scan the way wallets currently do it, a lookup per output.
+	let start = Instant::now();
+	let mut expected = vec![];
+	let mut start_index = 1;
+	loop {
+		let (last, highest, outputs) = chain
+			.unspent_outputs_by_pmmr_index(start_index, page_size, None)
+			.unwrap();
+		for output in outputs {
+			let (_, pos) = chain.get_unspent(output.commitment()).unwrap().unwrap();
+			expected.push((output, pos.pos, pos.height));
+		}
+		if last >= highest {
+			break;
+		}
+		start_index = last + 1;
+	}
+	let per_output = start.elapsed();
+
+	// Same scan through the bulk API, with Merkle proofs.
+	let start = Instant::now();
+	let mut scanned = vec![];
+	let mut start_index = 1;
+	loop {
+		let (head, last, highest, outputs) = chain
+			.scan_unspent_outputs(start_index, page_size, None, true)
+			.unwrap();
+		assert_eq!(head, chain.head().unwrap());
+		scanned.extend(outputs);
+		if last >= highest {
+			break;
+		}
+		start_index = last + 1;
+	}
+	let bulk = start.elapsed();
+	println!(
+		"full utxo scan of {} outputs: per output lookups {:?}, bulk {:?}",
+		scanned.len(),
+		per_output,
+		bulk
+	);
+
+	assert_eq!(scanned.len(), expected.len());
+	for (s, (output, pos, height)) in scanned.iter().zip(expected.iter()) {
+		assert_eq!(&s.output, output);
+		assert_eq!(s.pos, *pos);
+		assert_eq!(s.height, *height);
+		let proof = chain.get_merkle_proof_for_pos(output.commitment()).unwrap();
+		assert_eq!(s.head_merkle_proof, Some(proof.clone()));
+
+		// Proofs verify against the output PMMR root as of the head.
+		let root = chain.txhashset().read().roots().output_roots.pmmr_root;
+		assert!(proof.verify(root, &s.output.identifier(), s.pos).is_ok());
+	}
+
+	// Bounded by max pmmr index.
+	let max_index = expected[10].1;
+	let (_, last, _, outputs) = chain
+		.scan_unspent_outputs(1, 1_000, Some(max_index), false)
+		.unwrap();
+	assert_eq!(last, max_index);
+	assert_eq!(outputs.len(), 11);
+	assert!(outputs.iter().all(|o| o.head_merkle_proof.is_none()));
+
+	clean_output_dir(chain_dir);
+}
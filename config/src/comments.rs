@@ -77,6 +77,14 @@ fn comments() -> HashMap<String, String> {
 		.to_string(),
 	);
 
+	retval.insert(
+		"api_max_batch_size".to_string(),
+		"
+#max number of calls accepted in a single JSON-RPC batch request
+"
+		.to_string(),
+	);
+
 	retval.insert(
 		"db_root".to_string(),
 		"
@@ -131,6 +139,15 @@ fn comments() -> HashMap<String, String> {
 		.to_string(),
 	);
 
+	retval.insert(
+		"tx_reconciliation".to_string(),
+		"
+#reconcile relayed txs with peers supporting it (rather than announcing every
+#tx to every peer), lowering tx relay bandwidth
+"
+		.to_string(),
+	);
+
 	retval.insert(
 		"skip_sync_wait".to_string(),
 		"
@@ -195,6 +212,41 @@ fn comments() -> HashMap<String, String> {
 		.to_string(),
 	);
 
+	retval.insert(
+		"queue_size".to_string(),
+		"
+#The max number of events waiting to be delivered to each url. Events are
+#dropped when a receiver can't keep up, as set by drop_policy.
+"
+		.to_string(),
+	);
+
+	retval.insert(
+		"batch_size".to_string(),
+		"
+#The max number of events sent in a single POST request, as a JSON array.
+#With 1 every event is sent in its own request, as a JSON object.
+"
+		.to_string(),
+	);
+
+	retval.insert(
+		"max_retries".to_string(),
+		"
+#The number of times a failed request is retried, with exponential backoff.
+"
+		.to_string(),
+	);
+
+	retval.insert(
+		"drop_policy".to_string(),
+		"
+#Events to drop when the queue of a url is full, either \"DropOldest\" or
+#\"DropNewest\".
+"
+		.to_string(),
+	);
+
 	retval.insert(
 		"[server.dandelion_config]".to_string(),
 		"
@@ -500,6 +552,23 @@ fn comments() -> HashMap<String, String> {
 		.to_string(),
 	);
 
+	retval.insert(
+		"log_file_async".to_string(),
+		"
+#whether to write the log file on a dedicated thread, so logging never waits
+#on the disk (records are dropped, and counted, if the disk can't keep up)
+"
+		.to_string(),
+	);
+
+	retval.insert(
+		"log_file_format".to_string(),
+		"
+#format of the log file: Text or Json (one JSON object per line)
+"
+		.to_string(),
+	);
+
 	retval
 }
 
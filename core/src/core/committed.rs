@@ -16,9 +16,48 @@
 
 use failure::Fail;
 use keychain::BlindingFactor;
+use std::cmp;
+use std::ops::Range;
+use std::sync::{mpsc, Arc};
+use std::thread;
 use util::secp::key::SecretKey;
 use util::secp::pedersen::Commitment;
-use util::{secp, secp_static, static_secp_instance};
+use util::{secp, secp_static, static_secp_instance, Mutex};
+
+/// Sums of more commitments than this are split across threads.
+const PARALLEL_SUM_MIN: usize = 10_000;
+
+/// Number of threads summing commitments in parallel.
+const PARALLEL_SUM_THREADS: usize = 4;
+
+/// A chunk of commitments to sum, and where to send the sum (None if the
+/// chunk sums to the point at infinity).
+type SumJob = (
+	Arc<Vec<Commitment>>,
+	Range<usize>,
+	mpsc::SyncSender<Option<Commitment>>,
+);
+
+lazy_static! {
+	/// Threads summing chunks of large commitment sets, started on the first
+	/// large sum and shared by every caller after that. Each keeps its own
+	/// secp context for its whole life.
+	static ref SUM_WORKERS: Vec<Mutex<mpsc::Sender<SumJob>>> = (0..PARALLEL_SUM_THREADS)
+		.filter_map(|i| {
+			let (tx, rx) = mpsc::channel::<SumJob>();
+			thread::Builder::new()
+				.name(format!("commit_sum_{}", i))
+				.spawn(move || {
+					let secp = secp::Secp256k1::with_caps(secp::ContextFlag::Commit);
+					for (commits, range, done) in rx {
+						let _ = done.send(secp.commit_sum(commits[range].to_vec(), vec![]).ok());
+					}
+				})
+				.ok()
+				.map(|_| Mutex::new(tx))
+		})
+		.collect();
+}
 
 /// Errors from summing and verifying kernel excesses via committed trait.
 #[derive(Debug, Clone, PartialEq, Eq, Fail, Serialize, Deserialize)]
@@ -146,11 +185,47 @@ pub fn sum_commits(
 	let zero_commit = secp_static::commit_to_zero_value();
 	positive.retain(|x| *x != zero_commit);
 	negative.retain(|x| *x != zero_commit);
+	let positive = partial_sums(positive);
+	let negative = partial_sums(negative);
 	let secp = static_secp_instance();
 	let secp = secp.lock();
 	Ok(secp.commit_sum(positive, negative)?)
 }
 
+/// Reduce a large set of commitments (the full UTXO set or all kernels) to a
+/// few partial sums, one per chunk, each chunk summed by one of the shared
+/// sum workers. Small sets are returned as they are.
+/// A chunk that fails to sum (its sum being the point at infinity), or that
+/// no worker could take, is returned as is and summed again along with
+/// everything else.
+fn partial_sums(commits: Vec<Commitment>) -> Vec<Commitment> {
+	if commits.len() < PARALLEL_SUM_MIN || SUM_WORKERS.is_empty() {
+		return commits;
+	}
+	let commits = Arc::new(commits);
+	let chunk_size = (commits.len() + SUM_WORKERS.len() - 1) / SUM_WORKERS.len();
+	let pending = (0..commits.len())
+		.step_by(chunk_size)
+		.zip(SUM_WORKERS.iter())
+		.map(|(start, worker)| {
+			let range = start..cmp::min(start + chunk_size, commits.len());
+			// If the worker is gone the job, and the sender with it, are dropped.
+			let (tx, rx) = mpsc::sync_channel(1);
+			let _ = worker.lock().send((commits.clone(), range.clone(), tx));
+			(range, rx)
+		})
+		.collect::<Vec<_>>();
+
+	let mut sums = vec![];
+	for (range, rx) in pending {
+		match rx.recv() {
+			Ok(Some(sum)) => sums.push(sum),
+			_ => sums.extend_from_slice(&commits[range]),
+		}
+	}
+	sums
+}
+
 /// Utility function to take sets of positive and negative kernel offsets as
 /// blinding factors, convert them to private key filtering zero values and
 /// summing all of them. Useful to build blocks.
@@ -32,9 +32,13 @@
 //! )
 
 use crate::core::{Input, KernelFeatures, Output, OutputFeatures, Transaction, TxKernel};
-use crate::libtx::proof::{self, ProofBuild};
-use crate::libtx::{aggsig, Error};
-use keychain::{BlindSum, BlindingFactor, Identifier, Keychain, SwitchCommitmentType};
+use crate::libtx::proof::{self, ProofBuild, ProofBuilder};
+use crate::libtx::{aggsig, in_parallel, Error, ErrorKind};
+use blake2::blake2b::blake2b;
+use keychain::{
+	BlindSum, BlindingFactor, ExtKeychainPath, Identifier, Keychain, SwitchCommitmentType,
+};
+use util::secp::key::SecretKey;
 
 /// Context information available to transaction combinators.
 pub struct Context<'a, K, B>
@@ -143,6 +147,30 @@ where
 	)
 }
 
+/// Adds many outputs with the provided values and key identifiers from the
+/// keychain, their commitments and bulletproofs created in parallel (see
+/// proof::create_many). Bulletproofs are created with the regular proof
+/// builder rather than the one from the context.
+pub fn outputs<K, B>(outputs: Vec<(u64, Identifier)>) -> Box<Append<K, B>>
+where
+	K: Keychain + 'static,
+	B: ProofBuild,
+{
+	Box::new(
+		move |build, acc| -> Result<(Transaction, BlindSum), Error> {
+			let (mut tx, mut sum) = acc?;
+
+			let built = proof::create_many(build.keychain, outputs.clone())?;
+			for ((value, key_id), (commit, proof)) in outputs.iter().zip(built) {
+				tx = tx.with_output(Output::new(OutputFeatures::Plain, commit, proof));
+				sum = sum.add_key_id(key_id.to_value_path(*value));
+			}
+
+			Ok((tx, sum))
+		},
+	)
+}
+
 /// Adds a known excess value on the transaction being built. Usually used in
 /// combination with the initial_tx function when a new transaction is built
 /// by adding to a pre-existing one.
@@ -250,6 +278,90 @@ where
 	Ok(tx)
 }
 
+/// Builds one valid transaction per provided spendable output (value, key id
+/// and features), to stress the pool and block pipeline offline. Each
+/// transaction spends its output into two outputs and pays the provided fee.
+/// The new outputs and the kernel excess get key ids derived from the spent
+/// one (see `spending_key_id`), so the outputs of a generation of
+/// transactions can be spent by the next one without any key, or kernel,
+/// being reused. Signature nonces are derived from the excess key and the
+/// message, the same outputs always give the same transactions.
+/// Transactions are built in parallel.
+pub fn spending_transactions<K>(
+	keychain: &K,
+	spendable: Vec<(u64, Identifier, OutputFeatures)>,
+	account: u32,
+	fee: u32,
+) -> Result<Vec<Transaction>, Error>
+where
+	K: Keychain + 'static,
+{
+	let keychain = keychain.clone();
+	in_parallel(spendable, move |chunk| {
+		let builder = ProofBuilder::new(&keychain);
+		chunk
+			.into_iter()
+			.map(|spent| spending_transaction(&keychain, &builder, spent, account, fee))
+			.collect()
+	})
+}
+
+/// Key id of the n-th key of the transaction built by `spending_transactions`
+/// to spend the output at `spent`: 0 and 1 for its two outputs, 2 for its
+/// kernel excess. The path is m/account/a/b/n, with a and b taken from the
+/// hash of the spent key id.
+pub fn spending_key_id(spent: &Identifier, account: u32, n: u32) -> Identifier {
+	let hash = blake2b(8, &[], spent.as_ref());
+	let hash = hash.as_bytes();
+	let a = u32::from_be_bytes([hash[0], hash[1], hash[2], hash[3]]);
+	let b = u32::from_be_bytes([hash[4], hash[5], hash[6], hash[7]]);
+	ExtKeychainPath::new(4, account, a, b, n).to_identifier()
+}
+
+fn spending_transaction<K>(
+	keychain: &K,
+	builder: &ProofBuilder<'_, K>,
+	spent: (u64, Identifier, OutputFeatures),
+	account: u32,
+	fee: u32,
+) -> Result<Transaction, Error>
+where
+	K: Keychain,
+{
+	let (value, spent_key_id, features) = spent;
+	let change = value
+		.checked_sub(fee as u64)
+		.filter(|change| *change >= 2)
+		.ok_or_else(|| ErrorKind::Other(format!("cannot spend {} paying {}", value, fee)))?;
+	let key_id = |n| spending_key_id(&spent_key_id, account, n);
+
+	let mut kernel = TxKernel::with_features(KernelFeatures::Plain { fee: fee.into() });
+	let msg = kernel.msg_to_sign()?;
+
+	// Deterministic kernel excess. The signature nonce is derived from both the
+	// secret key and the message (as in RFC6979), never reused across messages.
+	let secp = keychain.secp();
+	let skey = keychain.derive_key(0, &key_id(2), SwitchCommitmentType::None)?;
+	let nonce = SecretKey::from_slice(secp, blake2b(32, &skey.0, &msg[..]).as_bytes())?;
+	let excess = BlindingFactor::from_secret_key(skey.clone());
+	kernel.excess = secp.commit(0, skey.clone())?;
+	let pubkey = kernel.excess.to_pubkey(secp)?;
+	kernel.excess_sig = aggsig::sign_single(secp, &msg, &skey, Some(&nonce), Some(&pubkey))?;
+	kernel.verify()?;
+
+	transaction_with_kernel(
+		&[
+			build_input(value, features, spent_key_id.clone()),
+			output(change / 2, key_id(0)),
+			output(change - change / 2, key_id(1)),
+		],
+		kernel,
+		excess,
+		keychain,
+		builder,
+	)
+}
+
 // Just a simple test, most exhaustive tests in the core.
 #[cfg(test)]
 mod test {
@@ -258,6 +370,7 @@ mod test {
 	use crate::global;
 	use crate::libtx::ProofBuilder;
 	use keychain::{ExtKeychain, ExtKeychainPath};
+	use std::collections::HashSet;
 
 	#[test]
 	fn blind_simple_tx() {
@@ -317,4 +430,95 @@ mod test {
 
 		tx.validate(Weighting::AsTransaction).unwrap();
 	}
+
+	#[test]
+	fn blind_tx_bulk_outputs() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let keychain = ExtKeychain::from_random_seed(false).unwrap();
+		let builder = ProofBuilder::new(&keychain);
+		let key_id1 = ExtKeychainPath::new(1, 1, 0, 0, 0).to_identifier();
+		let many = (0..10)
+			.map(|i| (5, ExtKeychainPath::new(2, 2, i, 0, 0).to_identifier()))
+			.collect();
+
+		let tx = transaction(
+			KernelFeatures::Plain { fee: 4.into() },
+			&[input(54, key_id1), outputs(many)],
+			&keychain,
+			&builder,
+		)
+		.unwrap();
+
+		assert_eq!(tx.outputs().len(), 10);
+		tx.validate(Weighting::AsTransaction).unwrap();
+	}
+
+	#[test]
+	fn bulk_spending_transactions() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let keychain = ExtKeychain::from_random_seed(false).unwrap();
+		let spendable = (0..9)
+			.map(|i| {
+				let key_id = ExtKeychainPath::new(1, i, 0, 0, 0).to_identifier();
+				(100 + i as u64, key_id, OutputFeatures::Plain)
+			})
+			.collect::<Vec<_>>();
+
+		let txs = spending_transactions(&keychain, spendable.clone(), 7, 4).unwrap();
+		assert_eq!(txs.len(), 9);
+		for tx in &txs {
+			tx.validate(Weighting::AsTransaction).unwrap();
+		}
+
+		// Same outputs, same transactions.
+		let again = spending_transactions(&keychain, spendable, 7, 4).unwrap();
+		assert_eq!(txs, again);
+
+		// Not enough to pay the fee.
+		let dust = vec![(
+			5,
+			ExtKeychainPath::new(1, 1, 0, 0, 0).to_identifier(),
+			OutputFeatures::Plain,
+		)];
+		assert!(spending_transactions(&keychain, dust, 7, 4).is_err());
+	}
+
+	// Spending the outputs of a generation of transactions never reuses a key,
+	// every kernel is different.
+	#[test]
+	fn chained_spending_transactions() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let keychain = ExtKeychain::from_random_seed(false).unwrap();
+		let mut spendable = (0..4)
+			.map(|i| {
+				let key_id = ExtKeychainPath::new(1, i, 0, 0, 0).to_identifier();
+				(1_000 + i as u64, key_id, OutputFeatures::Plain)
+			})
+			.collect::<Vec<_>>();
+
+		let mut kernels = HashSet::new();
+		for _ in 0..3 {
+			let txs = spending_transactions(&keychain, spendable.clone(), 7, 4).unwrap();
+			let mut next = vec![];
+			for (tx, (value, key_id, _)) in txs.iter().zip(spendable) {
+				tx.validate(Weighting::AsTransaction).unwrap();
+				for kernel in tx.kernels() {
+					assert!(kernels.insert(kernel.excess));
+				}
+
+				// The outputs are where spending_key_id says they are.
+				let change = value - 4;
+				for (n, value) in [change / 2, change - change / 2].iter().enumerate() {
+					let key_id = spending_key_id(&key_id, 7, n as u32);
+					let commit = keychain
+						.commit(*value, &key_id, SwitchCommitmentType::Regular)
+						.unwrap();
+					assert!(tx.outputs().iter().any(|o| o.commitment() == commit));
+					next.push((*value, key_id, OutputFeatures::Plain));
+				}
+			}
+			spendable = next;
+		}
+		assert_eq!(kernels.len(), 4 + 8 + 16);
+	}
 }
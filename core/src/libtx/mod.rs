@@ -30,10 +30,45 @@ pub mod secp_ser;
 
 use crate::core::Transaction;
 use crate::global::get_accept_fee_base;
+use std::thread;
 
 pub use self::proof::ProofBuilder;
 pub use crate::libtx::error::{Error, ErrorKind};
 
+/// Number of threads used by the bulk (many outputs) builders.
+const BULK_THREADS: usize = 4;
+
+/// Split the provided items in one chunk per thread and process each chunk
+/// on its own thread, so any per thread setup (keychain copy, secp context,
+/// proof builder) is done once per chunk. Results are in the order of the
+/// provided items.
+fn in_parallel<T, R, F>(items: Vec<T>, f: F) -> Result<Vec<R>, Error>
+where
+	T: Send + 'static,
+	R: Send + 'static,
+	F: Fn(Vec<T>) -> Result<Vec<R>, Error> + Clone + Send + 'static,
+{
+	let chunk_size = (items.len() + BULK_THREADS - 1) / BULK_THREADS;
+	let mut items = items;
+	let mut handles = vec![];
+	while !items.is_empty() {
+		let rest = items.split_off(chunk_size.min(items.len()));
+		let chunk = items;
+		items = rest;
+		let f = f.clone();
+		handles.push(thread::spawn(move || f(chunk)));
+	}
+
+	let mut res = vec![];
+	for handle in handles {
+		let chunk_res = handle
+			.join()
+			.map_err(|_| ErrorKind::Other("bulk builder thread failed".to_string()))??;
+		res.extend(chunk_res);
+	}
+	Ok(res)
+}
+
 /// Transaction fee calculation given numbers of inputs, outputs, and kernels
 pub fn tx_fee(input_len: usize, output_len: usize, kernel_len: usize) -> u64 {
 	Transaction::weight_by_iok(input_len as u64, output_len as u64, kernel_len as u64)
@@ -15,6 +15,7 @@
 //! Rangeproof library functions
 
 use crate::libtx::error::{Error, ErrorKind};
+use crate::libtx::in_parallel;
 use blake2::blake2b::blake2b;
 use keychain::extkey_bip32::BIP32GrinHasher;
 use keychain::{Identifier, Keychain, SwitchCommitmentType, ViewKey};
@@ -96,6 +97,56 @@ where
 	Ok(check.map(|(id, switch)| (amount, id, switch)))
 }
 
+/// Create bulletproofs (and commitments) for many outputs with the regular
+/// proof builder and switch commitments, split across threads. Each thread
+/// uses its own copy of the keychain (and secp context).
+/// Returns the commitments and proofs in the order of the provided outputs.
+pub fn create_many<K>(
+	keychain: &K,
+	outputs: Vec<(u64, Identifier)>,
+) -> Result<Vec<(Commitment, RangeProof)>, Error>
+where
+	K: Keychain + 'static,
+{
+	let keychain = keychain.clone();
+	in_parallel(outputs, move |chunk| {
+		let builder = ProofBuilder::new(&keychain);
+		let switch = SwitchCommitmentType::Regular;
+		chunk
+			.into_iter()
+			.map(
+				|(amount, key_id)| -> Result<(Commitment, RangeProof), Error> {
+					let commit = keychain.commit(amount, &key_id, switch)?;
+					let proof = create(&keychain, &builder, amount, &key_id, switch, commit, None)?;
+					Ok((commit, proof))
+				},
+			)
+			.collect()
+	})
+}
+
+/// Rewind a batch of rangeproofs with the regular proof builder, as rewind
+/// would for each of them, split across threads. Each thread uses its own copy
+/// of the keychain (and secp context) and derives the proof builder nonce
+/// hashes once for all its outputs.
+/// Returns the rewind results in the order of the provided outputs.
+pub fn rewind_many<K>(
+	keychain: &K,
+	outputs: Vec<(Commitment, RangeProof)>,
+) -> Result<Vec<Option<(u64, Identifier, SwitchCommitmentType)>>, Error>
+where
+	K: Keychain + 'static,
+{
+	let keychain = keychain.clone();
+	in_parallel(outputs, move |chunk| {
+		let builder = ProofBuilder::new(&keychain);
+		chunk
+			.into_iter()
+			.map(|(commit, proof)| rewind(keychain.secp(), &builder, commit, None, proof))
+			.collect()
+	})
+}
+
 /// Used for building proofs and checking if the output belongs to the wallet
 pub trait ProofBuild {
 	/// Create a BP nonce that will allow to rewind the derivation path and flags
@@ -494,6 +545,77 @@ mod tests {
 		assert_ne!(commit_a, commit_b);
 	}
 
+	fn proofs(keychain: &ExtKeychain, n: u32) -> Vec<(Commitment, RangeProof, u64, Identifier)> {
+		let builder = ProofBuilder::new(keychain);
+		let switch = SwitchCommitmentType::Regular;
+		(0..n)
+			.map(|i| {
+				let amount = 1_000 + i as u64;
+				let id = ExtKeychain::derive_key_id(3, 1, i % 5, i, 0);
+				let commit = keychain.commit(amount, &id, switch).unwrap();
+				let proof = create(keychain, &builder, amount, &id, switch, commit, None).unwrap();
+				(commit, proof, amount, id)
+			})
+			.collect()
+	}
+
+	#[test]
+	fn rewind_many_builder() {
+		let keychain = ExtKeychain::from_random_seed(false).unwrap();
+		let other = ExtKeychain::from_random_seed(false).unwrap();
+		let ours = proofs(&keychain, 10);
+		let theirs = proofs(&other, 5);
+
+		let outputs = ours
+			.iter()
+			.chain(theirs.iter())
+			.map(|(commit, proof, _, _)| (*commit, *proof))
+			.collect();
+		let rewound = rewind_many(&keychain, outputs).unwrap();
+		assert_eq!(rewound.len(), 15);
+		for ((_, _, amount, id), res) in ours.iter().zip(rewound.iter()) {
+			let (r_amount, r_id, r_switch) = res.clone().unwrap();
+			assert_eq!(r_amount, *amount);
+			assert_eq!(&r_id, id);
+			assert_eq!(r_switch, SwitchCommitmentType::Regular);
+		}
+		assert!(rewound[10..].iter().all(|res| res.is_none()));
+		assert!(rewind_many(&keychain, vec![]).unwrap().is_empty());
+	}
+
+	// Scanning 100k outputs, run with --ignored.
+	#[test]
+	#[ignore]
+	fn bench_rewind_many() {
+		let keychain = ExtKeychain::from_random_seed(false).unwrap();
+		let distinct = proofs(&keychain, 100);
+		let outputs: Vec<_> = (0..100_000)
+			.map(|i| {
+				let (commit, proof, _, _) = distinct[i % distinct.len()];
+				(commit, proof)
+			})
+			.collect();
+
+		// One output at a time, a proof builder per output.
+		let start = std::time::Instant::now();
+		for (commit, proof) in &outputs {
+			let builder = ProofBuilder::new(&keychain);
+			let res = rewind(keychain.secp(), &builder, *commit, None, *proof).unwrap();
+			assert!(res.is_some());
+		}
+		let single = start.elapsed();
+
+		let start = std::time::Instant::now();
+		let rewound = rewind_many(&keychain, outputs).unwrap();
+		assert!(rewound.iter().all(|res| res.is_some()));
+		println!(
+			"rewinding {} outputs: one at a time {:?}, rewind_many {:?}",
+			rewound.len(),
+			single,
+			start.elapsed()
+		);
+	}
+
 	#[test]
 	fn view_key() {
 		// TODO
@@ -502,7 +624,7 @@ mod tests {
 
 		let builder = ProofBuilder::new(&keychain);
 		let mut hasher = keychain.hasher();
-		let view_key = ViewKey::create(&keychain, keychain.master.clone(), &mut hasher, false).unwrap();
+		let view_key = ViewKey::create(&keychain, keychain.master().clone(), &mut hasher, false).unwrap();
 		assert_eq!(builder.rewind_hash, view_key.rewind_hash);
 
 		let amount = rng.gen();
@@ -534,7 +656,7 @@ mod tests {
 		let builder = ProofBuilder::new(&keychain);
 		let mut hasher = keychain.hasher();
 		let view_key =
-			ViewKey::create(&keychain, keychain.master.clone(), &mut hasher, false).unwrap();
+			ViewKey::create(&keychain, keychain.master().clone(), &mut hasher, false).unwrap();
 		assert_eq!(builder.rewind_hash, view_key.rewind_hash);
 
 		let amount = rng.gen();
@@ -570,7 +692,7 @@ mod tests {
 		let builder = ProofBuilder::new(&keychain);
 		let mut hasher = keychain.hasher();
 		let view_key =
-			ViewKey::create(&keychain, keychain.master.clone(), &mut hasher, false).unwrap();
+			ViewKey::create(&keychain, keychain.master().clone(), &mut hasher, false).unwrap();
 		assert_eq!(builder.rewind_hash, view_key.rewind_hash);
 
 		let amount = rng.gen();
@@ -602,7 +724,7 @@ mod tests {
 		let builder = ProofBuilder::new(&keychain);
 		let mut hasher = keychain.hasher();
 		let view_key =
-			ViewKey::create(&keychain, keychain.master.clone(), &mut hasher, false).unwrap();
+			ViewKey::create(&keychain, keychain.master().clone(), &mut hasher, false).unwrap();
 		assert_eq!(builder.rewind_hash, view_key.rewind_hash);
 
 		// Same child
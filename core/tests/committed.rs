@@ -0,0 +1,81 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Commitment sum tests
+
+use crate::core::core::committed::sum_commits;
+use grin_core as core;
+use std::time::Instant;
+use util::secp::key::SecretKey;
+use util::secp::pedersen::Commitment;
+use util::secp::{ContextFlag, Secp256k1};
+
+fn commits(secp: &Secp256k1, n: u64) -> Vec<Commitment> {
+	let mut rng = rand::thread_rng();
+	(0..n)
+		.map(|v| secp.commit(v, SecretKey::new(secp, &mut rng)).unwrap())
+		.collect()
+}
+
+// Large sums are split across threads, they must match a single sum.
+#[test]
+fn test_sum_commits_parallel() {
+	let secp = Secp256k1::with_caps(ContextFlag::Commit);
+	let positive = commits(&secp, 20_000);
+	let negative = commits(&secp, 12_000);
+
+	let expected = secp.commit_sum(positive.clone(), vec![]).unwrap();
+	assert_eq!(sum_commits(positive.clone(), vec![]).unwrap(), expected);
+
+	let expected = secp.commit_sum(positive.clone(), negative.clone()).unwrap();
+	assert_eq!(
+		sum_commits(positive.clone(), negative.clone()).unwrap(),
+		expected
+	);
+
+	// A whole chunk (the first of 4) summing to the point at infinity, the
+	// total does not.
+	let mut cancelling = positive[..2_500].to_vec();
+	for c in &positive[..2_500] {
+		cancelling.push(secp.commit_sum(vec![], vec![*c]).unwrap());
+	}
+	cancelling.extend_from_slice(&positive[2_500..17_500]);
+	let expected = secp
+		.commit_sum(positive[2_500..17_500].to_vec(), vec![])
+		.unwrap();
+	assert_eq!(sum_commits(cancelling, vec![]).unwrap(), expected);
+}
+
+// Mainnet sized UTXO set and kernel set, run with --ignored.
+#[test]
+#[ignore]
+fn bench_sum_commits() {
+	let secp = Secp256k1::with_caps(ContextFlag::Commit);
+	for n in &[150_000, 1_000_000] {
+		let commits = commits(&secp, *n);
+
+		let start = Instant::now();
+		let expected = secp.commit_sum(commits.clone(), vec![]).unwrap();
+		let single = start.elapsed();
+
+		let start = Instant::now();
+		assert_eq!(sum_commits(commits, vec![]).unwrap(), expected);
+		println!(
+			"sum of {} commitments: single thread {:?}, parallel {:?}",
+			n,
+			single,
+			start.elapsed()
+		);
+	}
+}
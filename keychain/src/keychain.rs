@@ -14,27 +14,64 @@
 
 /// Implementation of the Keychain trait based on an extended key derivation
 /// scheme.
+use lru_cache::LruCache;
 use rand::distributions::Alphanumeric;
 use rand::{thread_rng, Rng};
+use std::fmt;
 
 use crate::blake2::blake2b::blake2b;
 
-use crate::extkey_bip32::{BIP32GrinHasher, ExtendedPrivKey, ExtendedPubKey};
+use crate::extkey_bip32::{BIP32GrinHasher, ChildNumber, ExtendedPrivKey, ExtendedPubKey};
 use crate::types::{
 	BlindSum, BlindingFactor, Error, ExtKeychainPath, Identifier, Keychain, SwitchCommitmentType,
 };
 use crate::util::secp::key::{PublicKey, SecretKey};
 use crate::util::secp::pedersen::Commitment;
 use crate::util::secp::{self, Message, Secp256k1, Signature};
+use crate::util::Mutex;
+
+/// Number of intermediate extended keys kept by a keychain.
+const DERIVATION_CACHE_SIZE: usize = 1_000;
+
+/// Intermediate extended keys derived from the master key, by path prefix.
+/// Deriving many keys under the same parent then only derives the last step
+/// of each path. Not shared between clones of a keychain, as the master key
+/// of one of them can be masked.
+struct DerivationCache(Mutex<LruCache<Identifier, ExtendedPrivKey>>);
+
+impl DerivationCache {
+	fn new() -> DerivationCache {
+		DerivationCache(Mutex::new(LruCache::new(DERIVATION_CACHE_SIZE)))
+	}
+}
+
+impl Clone for DerivationCache {
+	fn clone(&self) -> DerivationCache {
+		DerivationCache::new()
+	}
+}
+
+impl fmt::Debug for DerivationCache {
+	fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+		write!(f, "DerivationCache")
+	}
+}
 
 #[derive(Clone, Debug)]
 pub struct ExtKeychain {
 	secp: Secp256k1,
-	pub master: ExtendedPrivKey,
+	master: ExtendedPrivKey,
 	hasher: BIP32GrinHasher,
+	cache: DerivationCache,
 }
 
 impl ExtKeychain {
+	/// The master key. Read only, derived keys are cached and would not
+	/// follow a change of the master key, see `mask_master_key`.
+	pub fn master(&self) -> &ExtendedPrivKey {
+		&self.master
+	}
+
 	pub fn pub_root_key(&mut self) -> ExtendedPubKey {
 		ExtendedPubKey::from_private(&self.secp, &self.master, &mut self.hasher)
 	}
@@ -42,6 +79,44 @@ impl ExtKeychain {
 	pub fn hasher(&self) -> BIP32GrinHasher {
 		self.hasher.clone()
 	}
+
+	/// Derive the extended key at the provided path, starting from the
+	/// deepest of its parents we have cached and caching the parents derived.
+	fn derive_ext_key(&self, p: &ExtKeychainPath) -> Result<ExtendedPrivKey, Error> {
+		let (mut depth, mut ext_key) = self.cached_parent(p);
+		let mut h = self.hasher.clone();
+		while depth < p.depth {
+			ext_key = ext_key.ckd_priv(&self.secp, &mut h, p.path[depth as usize])?;
+			depth += 1;
+			if depth < p.depth {
+				let mut cache = self.cache.0.lock();
+				cache.insert(path_prefix(p, depth), ext_key.clone());
+			}
+		}
+		Ok(ext_key)
+	}
+
+	fn cached_parent(&self, p: &ExtKeychainPath) -> (u8, ExtendedPrivKey) {
+		let mut cache = self.cache.0.lock();
+		for depth in (1..p.depth).rev() {
+			if let Some(ext_key) = cache.get_mut(&path_prefix(p, depth)) {
+				return (depth, ext_key.clone());
+			}
+		}
+		(0, self.master.clone())
+	}
+}
+
+// Identifier of the first depth steps of the provided path.
+fn path_prefix(p: &ExtKeychainPath, depth: u8) -> Identifier {
+	let mut prefix = ExtKeychainPath {
+		depth,
+		path: p.path,
+	};
+	for i in depth as usize..prefix.path.len() {
+		prefix.path[i] = ChildNumber::from(0);
+	}
+	prefix.to_identifier()
 }
 
 impl Keychain for ExtKeychain {
@@ -53,6 +128,7 @@ impl Keychain for ExtKeychain {
 			secp: secp,
 			master: master,
 			hasher: h,
+			cache: DerivationCache::new(),
 		};
 		Ok(keychain)
 	}
@@ -65,6 +141,7 @@ impl Keychain for ExtKeychain {
 			secp: secp,
 			master: master,
 			hasher: h,
+			cache: DerivationCache::new(),
 		};
 		Ok(keychain)
 	}
@@ -73,6 +150,7 @@ impl Keychain for ExtKeychain {
 		for i in 0..secp::constants::SECRET_KEY_SIZE {
 			self.master.secret_key.0[i] ^= mask.0[i];
 		}
+		self.cache = DerivationCache::new();
 		Ok(())
 	}
 
@@ -102,12 +180,7 @@ impl Keychain for ExtKeychain {
 		id: &Identifier,
 		switch: SwitchCommitmentType,
 	) -> Result<SecretKey, Error> {
-		let mut h = self.hasher.clone();
-		let p = id.to_path();
-		let mut ext_key = self.master.clone();
-		for i in 0..p.depth {
-			ext_key = ext_key.ckd_priv(&self.secp, &mut h, p.path[i as usize])?;
-		}
+		let ext_key = self.derive_ext_key(&id.to_path())?;
 
 		match switch {
 			SwitchCommitmentType::Regular => {
@@ -237,6 +310,36 @@ mod test {
 		secp.verify_from_commit(&msg, &sig, &commit).unwrap();
 	}
 
+	// Keys derived from cached parents match keys derived from the master key.
+	#[test]
+	fn test_cached_key_derivation() {
+		let keychain = ExtKeychain::from_random_seed(false).unwrap();
+		let switch = SwitchCommitmentType::Regular;
+		let ids = (0..20)
+			.map(|i| ExtKeychainPath::new(3, 1, i % 3, i, 0).to_identifier())
+			.collect::<Vec<_>>();
+		let keys = ids
+			.iter()
+			.map(|id| keychain.derive_key(5, id, switch).unwrap())
+			.collect::<Vec<_>>();
+
+		// A clone starts with an empty cache.
+		let uncached = keychain.clone();
+		for (id, key) in ids.iter().zip(keys.iter()).rev() {
+			assert_eq!(&uncached.derive_key(5, id, switch).unwrap(), key);
+			assert_eq!(&keychain.derive_key(5, id, switch).unwrap(), key);
+		}
+
+		// Masking the master key drops the cache.
+		let mut masked = keychain.clone();
+		masked.derive_key(5, &ids[0], switch).unwrap();
+		let mask = SecretKey::new(&masked.secp, &mut rand::thread_rng());
+		masked.mask_master_key(&mask).unwrap();
+		assert_ne!(masked.derive_key(5, &ids[0], switch).unwrap(), keys[0]);
+		masked.mask_master_key(&mask).unwrap();
+		assert_eq!(masked.derive_key(5, &ids[0], switch).unwrap(), keys[0]);
+	}
+
 	// We plan to "offset" the key used in the kernel commitment
 	// so we are going to be doing some key addition/subtraction.
 	// This test is mainly to demonstrate that idea that summing commitments
@@ -273,6 +273,12 @@ fn decode_message(
 		Type::RangeProofSegment => Message::RangeProofSegment(msg.body()?),
 		Type::GetKernelSegment => Message::GetKernelSegment(msg.body()?),
 		Type::KernelSegment => Message::KernelSegment(msg.body()?),
+		Type::TransactionKernels => Message::TransactionKernels(msg.body()?),
+		Type::GetTransactions => Message::GetTransactions(msg.body()?),
+		Type::TxReconRequest => Message::TxReconRequest(msg.body()?),
+		Type::TxSketch => Message::TxSketch(msg.body()?),
+		Type::TxReconDiff => Message::TxReconDiff(msg.body()?),
+		Type::GetHeadersByHeight => Message::GetHeadersByHeight(msg.body()?),
 		Type::Error | Type::Hand | Type::Shake | Type::Headers => {
 			return Err(Error::UnexpectedMessage)
 		}
@@ -22,25 +22,25 @@
 
 use crate::codec::{Codec, BODY_IO_TIMEOUT};
 use crate::core::ser::ProtocolVersion;
+use crate::dispatch::{Dispatcher, Lane};
 use crate::msg::{write_message, Consumed, Message, Msg};
-use crate::types::Error;
+use crate::send_queue::SendQueue;
+use crate::types::{Error, PeerAddr};
 use crate::util::{RateCounter, RwLock};
 use std::fs::File;
 use std::io::{self, Write};
 use std::net::{Shutdown, TcpStream};
 use std::sync::atomic::{AtomicBool, Ordering};
-use std::sync::mpsc::RecvTimeoutError;
-use std::sync::{mpsc, Arc};
+use std::sync::Arc;
 use std::thread::{self, JoinHandle};
 use std::time::Duration;
 
-pub const SEND_CHANNEL_CAP: usize = 100;
-
 const CHANNEL_TIMEOUT: Duration = Duration::from_millis(1000);
 
 /// A trait to be implemented in order to receive messages from the
 /// connection. Allows providing an optional response.
-pub trait MessageHandler: Send + 'static {
+/// Shared with the dispatcher workers handling messages off the read thread.
+pub trait MessageHandler: Send + Sync + 'static {
 	fn consume(&self, message: Message) -> Result<Consumed, Error>;
 }
 
@@ -108,29 +108,22 @@ impl StopHandle {
 
 #[derive(Clone)]
 pub struct ConnHandle {
-	/// Channel to allow sending data through the connection
-	pub send_channel: mpsc::SyncSender<Msg>,
+	/// Queue of msgs to send through the connection
+	send_queue: Arc<SendQueue>,
 }
 
 impl ConnHandle {
-	/// Send msg via the synchronous, bounded channel (sync_sender).
+	/// Queue msg on the send lane for its type.
 	/// Two possible failure cases -
-	/// * Disconnected: Propagate this up to the caller so the peer connection can be closed.
-	/// * Full: Our internal msg buffer is full. This is not a problem with the peer connection
-	/// and we do not want to close the connection. We drop the msg rather than blocking here.
-	/// If the buffer is full because there is an underlying issue with the peer
+	/// * Closed: Propagate this up to the caller so the peer connection can be closed.
+	/// * Full: The lane is over its byte limit. This is not a problem with the peer connection
+	/// and we do not want to close the connection. We drop a msg (per the lane's drop policy)
+	/// rather than blocking here, except for responses to requests which wait for space
+	/// (erroring, and so closing the connection, if the peer is not reading them).
+	/// If the lane is full because there is an underlying issue with the peer
 	/// and potentially the peer connection. We assume this will be handled at the peer level.
 	pub fn send(&self, msg: Msg) -> Result<(), Error> {
-		match self.send_channel.try_send(msg) {
-			Ok(()) => Ok(()),
-			Err(mpsc::TrySendError::Disconnected(_)) => {
-				Err(Error::Send("try_send disconnected".to_owned()))
-			}
-			Err(mpsc::TrySendError::Full(_)) => {
-				debug!("conn_handle: try_send but buffer is full, dropping msg");
-				Ok(())
-			}
-		}
+		self.send_queue.push(msg).map(|_| ())
 	}
 }
 
@@ -174,26 +167,30 @@ impl Tracker {
 pub fn listen<H>(
 	stream: TcpStream,
 	version: ProtocolVersion,
+	peer_addr: PeerAddr,
 	tracker: Arc<Tracker>,
 	handler: H,
+	dispatcher: Arc<Dispatcher>,
 ) -> io::Result<(ConnHandle, StopHandle)>
 where
 	H: MessageHandler,
 {
-	let (send_tx, send_rx) = mpsc::sync_channel(SEND_CHANNEL_CAP);
+	let send_queue = Arc::new(SendQueue::new());
 
 	let stopped = Arc::new(AtomicBool::new(false));
 
 	let conn_handle = ConnHandle {
-		send_channel: send_tx,
+		send_queue: send_queue.clone(),
 	};
 
 	let (reader_thread, writer_thread) = poll(
 		stream,
 		conn_handle.clone(),
 		version,
-		handler,
-		send_rx,
+		peer_addr,
+		Arc::new(handler),
+		dispatcher,
+		send_queue,
 		stopped.clone(),
 		tracker,
 	)?;
@@ -208,12 +205,48 @@ where
 	))
 }
 
+/// Handles a message on a dispatcher worker, sending any response and closing
+/// the connection on the same errors the read thread would.
+fn handle_dispatched<H>(
+	handler: &H,
+	message: Message,
+	conn_handle: &ConnHandle,
+	stopped: &AtomicBool,
+) where
+	H: MessageHandler,
+{
+	let res = match handler.consume(message) {
+		Ok(Consumed::Response(resp_msg)) => conn_handle.send(resp_msg),
+		Ok(Consumed::Responses(resp_msgs)) => resp_msgs
+			.into_iter()
+			.try_for_each(|resp_msg| conn_handle.send(resp_msg)),
+		// Only expected in response to a message handled on the read thread.
+		Ok(Consumed::Attachment(_, _)) => Err(Error::BadMessage),
+		Ok(Consumed::Disconnect) => Err(Error::ConnectionClose),
+		Ok(Consumed::None) => Ok(()),
+		Err(e) => Err(e),
+	};
+	match res {
+		Ok(())
+		| Err(Error::Store(_))
+		| Err(Error::Chain(_))
+		| Err(Error::Internal)
+		| Err(Error::NoDandelionRelay) => {}
+		Err(e) => {
+			debug!("handle_dispatched: closing the connection: {:?}", e);
+			stopped.store(true, Ordering::Relaxed);
+		}
+	}
+}
+
 fn poll<H>(
 	conn: TcpStream,
 	conn_handle: ConnHandle,
 	version: ProtocolVersion,
-	handler: H,
-	send_rx: mpsc::Receiver<Msg>,
+	peer: PeerAddr,
+	handler: Arc<H>,
+	dispatcher: Arc<Dispatcher>,
+	send_queue: Arc<SendQueue>,
 	stopped: Arc<AtomicBool>,
 	tracker: Arc<Tracker>,
 ) -> io::Result<(JoinHandle<()>, JoinHandle<()>)>
@@ -300,11 +333,36 @@ where
 					None => continue,
 				};
 
+				// Hand anything more than trivial off to the dispatcher so we keep reading.
+				if let Some(lane) = Lane::of(&message) {
+					let handler = handler.clone();
+					let conn_handle = conn_handle.clone();
+					let stopped = reader_stopped.clone();
+					let queued = dispatcher.dispatch(lane, peer, move || {
+						handle_dispatched(&*handler, message, &conn_handle, &stopped)
+					});
+					if dispatcher.is_stopped() {
+						break;
+					}
+					// Only tx relay can be dropped, a peer we can't keep up
+					// with on anything else is disconnected.
+					if !queued && !lane.droppable() {
+						debug!("{:?} lane stuck for {}, disconnecting", lane, peer);
+						break;
+					}
+					continue;
+				}
+
 				let consumed = try_break!(handler.consume(message)).unwrap_or(Consumed::None);
 				match consumed {
 					Consumed::Response(resp_msg) => {
 						try_break!(conn_handle.send(resp_msg));
 					}
+					Consumed::Responses(resp_msgs) => {
+						try_break!(resp_msgs
+							.into_iter()
+							.try_for_each(|resp_msg| conn_handle.send(resp_msg)));
+					}
 					Consumed::Attachment(meta, file) => {
 						// Start attachment
 						codec.expect_attachment(meta);
@@ -322,24 +380,24 @@ where
 	let writer_thread = thread::Builder::new()
 		.name("peer_write".to_string())
 		.spawn(move || {
-			let mut retry_send = Err(());
+			let mut retry_send = None;
 			let _ = writer.set_write_timeout(Some(BODY_IO_TIMEOUT));
 			loop {
-				let maybe_data = retry_send.or_else(|_| send_rx.recv_timeout(CHANNEL_TIMEOUT));
-				retry_send = Err(());
-				match maybe_data {
-					Ok(data) => {
-						let written =
-							try_break!(write_message(&mut writer, &data, writer_tracker.clone()));
-						if written.is_none() {
-							retry_send = Ok(data);
-						}
-					}
-					Err(RecvTimeoutError::Disconnected) => {
-						debug!("peer_write: mpsc channel disconnected during recv_timeout");
-						break;
+				// Only the writer holds the queue once all the conn handles are gone.
+				if Arc::strong_count(&send_queue) == 1 {
+					debug!("peer_write: all conn handles dropped");
+					break;
+				}
+
+				let maybe_data = retry_send
+					.take()
+					.or_else(|| send_queue.pop(CHANNEL_TIMEOUT));
+				if let Some(data) = maybe_data {
+					let written =
+						try_break!(write_message(&mut writer, &data, writer_tracker.clone()));
+					if written.is_none() {
+						retry_send = Some(data);
 					}
-					Err(RecvTimeoutError::Timeout) => {}
 				}
 
 				// check the close channel
@@ -347,6 +405,7 @@ where
 					break;
 				}
 			}
+			send_queue.close();
 
 			debug!(
 				"Shutting down writer connection with {}",
@@ -0,0 +1,551 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Dispatches inbound peer messages to bounded worker pools so that slow
+//! handlers (block and header validation, serving headers, writing a
+//! txhashset) do not stop us reading from the peer connection.
+//!
+//! Messages are routed into one of a few lanes based on their type, each lane
+//! having its own queue and workers. Messages from a given peer are handled in
+//! the order they were received within a lane (a peer is only ever handled by
+//! a single worker of a lane at a time). A peer filling up its share of a lane
+//! (or the lane itself) blocks its read thread, pushing back on that peer
+//! alone, except for tx relay where we drop the message instead. Messages on
+//! other lanes are never dropped, a peer still blocked after
+//! `DISPATCH_TIMEOUT` is disconnected.
+//!
+//! There is no ordering between lanes, so messages the protocol expects to be
+//! handled in order must share a lane:
+//! * headers (sync batches or relayed one by one), compact blocks and blocks
+//!   all go on the blocks lane, a header or block only being accepted once we
+//!   have its parent header,
+//! * the final txhashset attachment chunk is handled after all earlier chunks
+//!   (those are handled on the read thread itself).
+//!
+//! Tx relay is not ordered against blocks. The pool validates a tx against the
+//! chain head at the time it is handled, so a tx handled before the block
+//! including it is reconciled away once the block is processed, one handled
+//! after is rejected as already spent, and one spending outputs of a block not
+//! handled yet is rejected just as if the (droppable) tx lane had been full.
+
+use crate::msg::Message;
+use crate::types::PeerAddr;
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard};
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
+
+/// How long a peer read thread waits for space in a full lane before giving
+/// up on the peer (tx relay messages are dropped right away instead).
+const DISPATCH_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// How often idle workers and waiting read threads check for shutdown.
+const POLL_INTERVAL: Duration = Duration::from_millis(1000);
+
+/// The lanes inbound messages are dispatched to.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum Lane {
+	/// Txhashset download.
+	Sync,
+	/// Headers (header sync and relay), blocks and compact blocks.
+	Blocks,
+	/// Transactions and tx kernels relayed to us.
+	Txs,
+	/// Requests from peers for data we serve.
+	Serve,
+}
+
+impl Lane {
+	/// All lanes, in order of priority.
+	pub const ALL: [Lane; 4] = [Lane::Sync, Lane::Blocks, Lane::Txs, Lane::Serve];
+
+	/// The lane a message is handled on, None if it is cheap enough to be
+	/// handled directly on the peer read thread.
+	pub fn of(message: &Message) -> Option<Lane> {
+		match message {
+			// Only the final attachment chunk does any real work (writing the txhashset).
+			Message::Attachment(update, _) if update.left == 0 => Some(Lane::Sync),
+			Message::Headers(_)
+			| Message::Header(_)
+			| Message::Block(_)
+			| Message::CompactBlock(_) => Some(Lane::Blocks),
+			Message::Transaction(_)
+			| Message::StemTransaction(_)
+			| Message::TransactionKernel(_)
+			| Message::TransactionKernels(_)
+			| Message::TxReconRequest(_)
+			| Message::TxSketch(_)
+			| Message::TxReconDiff(_) => Some(Lane::Txs),
+			Message::GetHeaders(_)
+			| Message::GetHeadersByHeight(_)
+			| Message::GetBlock(_)
+			| Message::GetCompactBlock(_)
+			| Message::GetTransaction(_)
+			| Message::GetTransactions(_)
+			| Message::GetPeerAddrs(_)
+			| Message::TxHashSetRequest(_)
+			| Message::GetOutputBitmapSegment(_)
+			| Message::GetOutputSegment(_)
+			| Message::GetRangeProofSegment(_)
+			| Message::GetKernelSegment(_) => Some(Lane::Serve),
+			_ => None,
+		}
+	}
+
+	fn workers(self) -> usize {
+		match self {
+			Lane::Sync => 2,
+			Lane::Blocks => 2,
+			Lane::Txs => 2,
+			Lane::Serve => 4,
+		}
+	}
+
+	fn capacity(self) -> usize {
+		match self {
+			Lane::Sync => 64,
+			Lane::Blocks => 64,
+			Lane::Txs => 512,
+			Lane::Serve => 128,
+		}
+	}
+
+	/// Max number of messages from a single peer queued or being handled.
+	fn peer_capacity(self) -> usize {
+		match self {
+			Lane::Sync => 16,
+			Lane::Blocks => 16,
+			Lane::Txs => 64,
+			Lane::Serve => 8,
+		}
+	}
+
+	/// Whether we drop messages rather than wait for space in this lane.
+	pub fn droppable(self) -> bool {
+		self == Lane::Txs
+	}
+}
+
+/// Queue depth and handler latency for a lane.
+#[derive(Debug, Clone)]
+pub struct LaneStats {
+	pub lane: Lane,
+	/// Messages currently queued.
+	pub queued: usize,
+	/// Max messages queued at any one time.
+	pub max_queued: usize,
+	/// Messages handled.
+	pub handled: u64,
+	/// Messages not queued as the lane (or the peer's share of it) was full.
+	pub dropped: u64,
+	/// Total time messages spent queued, in ms.
+	pub total_wait_ms: u64,
+	/// Total time spent handling messages, in ms.
+	pub total_handle_ms: u64,
+	/// Longest time spent handling a single message, in ms.
+	pub max_handle_ms: u64,
+}
+
+impl LaneStats {
+	fn new(lane: Lane) -> LaneStats {
+		LaneStats {
+			lane,
+			queued: 0,
+			max_queued: 0,
+			handled: 0,
+			dropped: 0,
+			total_wait_ms: 0,
+			total_handle_ms: 0,
+			max_handle_ms: 0,
+		}
+	}
+
+	/// Average time spent handling a message, in ms.
+	pub fn avg_handle_ms(&self) -> u64 {
+		self.total_handle_ms.checked_div(self.handled).unwrap_or(0)
+	}
+}
+
+type Job = Box<dyn FnOnce() + Send>;
+
+struct Task {
+	peer: PeerAddr,
+	job: Job,
+	queued_at: Instant,
+}
+
+struct LaneState {
+	queue: VecDeque<Task>,
+	// peers currently being handled by a worker
+	busy: HashSet<PeerAddr>,
+	// number of messages per peer queued or being handled
+	in_flight: HashMap<PeerAddr, usize>,
+	stats: LaneStats,
+}
+
+struct LaneQueue {
+	lane: Lane,
+	state: Mutex<LaneState>,
+	// signalled when a task is queued or a peer is no longer busy
+	work: Condvar,
+	// signalled when a task is done, freeing up space
+	space: Condvar,
+}
+
+impl LaneQueue {
+	fn new(lane: Lane) -> LaneQueue {
+		LaneQueue {
+			lane,
+			state: Mutex::new(LaneState {
+				queue: VecDeque::new(),
+				busy: HashSet::new(),
+				in_flight: HashMap::new(),
+				stats: LaneStats::new(lane),
+			}),
+			work: Condvar::new(),
+			space: Condvar::new(),
+		}
+	}
+
+	fn lock(&self) -> MutexGuard<'_, LaneState> {
+		// Jobs never run with the lock held so it cannot be poisoned by a handler.
+		self.state.lock().unwrap_or_else(|e| e.into_inner())
+	}
+
+	fn is_full(&self, state: &LaneState, peer: &PeerAddr) -> bool {
+		state.queue.len() >= self.lane.capacity()
+			|| state.in_flight.get(peer).cloned().unwrap_or(0) >= self.lane.peer_capacity()
+	}
+
+	fn push(&self, peer: PeerAddr, job: Job, stopped: &AtomicBool) -> bool {
+		let start = Instant::now();
+		let mut state = self.lock();
+		while self.is_full(&state, &peer) {
+			if self.lane.droppable()
+				|| stopped.load(Ordering::Relaxed)
+				|| start.elapsed() > DISPATCH_TIMEOUT
+			{
+				state.stats.dropped += 1;
+				return false;
+			}
+			state = self
+				.space
+				.wait_timeout(state, POLL_INTERVAL)
+				.unwrap_or_else(|e| e.into_inner())
+				.0;
+		}
+
+		*state.in_flight.entry(peer).or_insert(0) += 1;
+		state.queue.push_back(Task {
+			peer,
+			job,
+			queued_at: Instant::now(),
+		});
+		state.stats.queued = state.queue.len();
+		state.stats.max_queued = state.stats.max_queued.max(state.queue.len());
+		drop(state);
+
+		self.work.notify_one();
+		true
+	}
+
+	// Next task for a peer not already being handled by another worker.
+	// Blocks until there is one, None if we are shutting down.
+	fn next(&self, stopped: &AtomicBool) -> Option<Task> {
+		let mut state = self.lock();
+		loop {
+			if stopped.load(Ordering::Relaxed) {
+				return None;
+			}
+			let next = {
+				let state = &mut *state;
+				let busy = &state.busy;
+				state.queue.iter().position(|t| !busy.contains(&t.peer))
+			};
+			if let Some(idx) = next {
+				let task = state.queue.remove(idx)?;
+				state.busy.insert(task.peer);
+				state.stats.queued = state.queue.len();
+				state.stats.total_wait_ms += task.queued_at.elapsed().as_millis() as u64;
+				return Some(task);
+			}
+			state = self
+				.work
+				.wait_timeout(state, POLL_INTERVAL)
+				.unwrap_or_else(|e| e.into_inner())
+				.0;
+		}
+	}
+
+	fn done(&self, peer: PeerAddr, elapsed: Duration) {
+		{
+			let mut state = self.lock();
+			state.busy.remove(&peer);
+			let left = match state.in_flight.get_mut(&peer) {
+				Some(count) => {
+					*count -= 1;
+					*count
+				}
+				None => 0,
+			};
+			if left == 0 {
+				state.in_flight.remove(&peer);
+			}
+
+			let elapsed = elapsed.as_millis() as u64;
+			state.stats.handled += 1;
+			state.stats.total_handle_ms += elapsed;
+			state.stats.max_handle_ms = state.stats.max_handle_ms.max(elapsed);
+		}
+		// Other workers may be waiting on this peer, read threads on space.
+		self.work.notify_all();
+		self.space.notify_all();
+	}
+}
+
+/// Worker pools handling inbound peer messages off the peer read threads.
+/// Shared by all peer connections.
+pub struct Dispatcher {
+	lanes: Vec<Arc<LaneQueue>>,
+	stopped: Arc<AtomicBool>,
+	workers: Mutex<Vec<JoinHandle<()>>>,
+}
+
+impl Dispatcher {
+	/// Create a new dispatcher and start its workers.
+	pub fn new() -> Dispatcher {
+		let stopped = Arc::new(AtomicBool::new(false));
+		let lanes: Vec<_> = Lane::ALL
+			.iter()
+			.map(|lane| Arc::new(LaneQueue::new(*lane)))
+			.collect();
+
+		let mut workers = vec![];
+		for queue in &lanes {
+			for n in 0..queue.lane.workers() {
+				let queue = queue.clone();
+				let stopped = stopped.clone();
+				let res = thread::Builder::new()
+					.name(format!("p2p_{:?}_{}", queue.lane, n).to_lowercase())
+					.spawn(move || {
+						while let Some(task) = queue.next(&stopped) {
+							let start = Instant::now();
+							if let Err(e) = panic::catch_unwind(AssertUnwindSafe(task.job)) {
+								error!(
+									"dispatch: {:?} handler for {} panicked: {:?}",
+									queue.lane, task.peer, e
+								);
+							}
+							queue.done(task.peer, start.elapsed());
+						}
+					});
+				match res {
+					Ok(handle) => workers.push(handle),
+					Err(e) => error!("dispatch: failed to start {:?} worker: {}", queue.lane, e),
+				}
+			}
+		}
+
+		Dispatcher {
+			lanes,
+			stopped,
+			workers: Mutex::new(workers),
+		}
+	}
+
+	/// Queue a job handling a message from the provided peer on the provided
+	/// lane. Blocks while the lane or the peer's share of it is full, up to
+	/// `DISPATCH_TIMEOUT`, except on droppable lanes.
+	/// Returns false if the job was not queued, the caller should disconnect
+	/// the peer unless the lane is droppable.
+	pub fn dispatch<F>(&self, lane: Lane, peer: PeerAddr, job: F) -> bool
+	where
+		F: FnOnce() + Send + 'static,
+	{
+		let queue = &self.lanes[lane as usize];
+		let queued = queue.push(peer, Box::new(job), &self.stopped);
+		if !queued {
+			if lane.droppable() {
+				debug!("dispatch: {:?} lane full for {}, dropping msg", lane, peer);
+			} else {
+				debug!("dispatch: {:?} lane full for {}, timed out", lane, peer);
+			}
+		}
+		queued
+	}
+
+	/// Queue depth and handler latency of each lane.
+	pub fn stats(&self) -> Vec<LaneStats> {
+		self.lanes
+			.iter()
+			.map(|queue| queue.lock().stats.clone())
+			.collect()
+	}
+
+	/// Whether we have been stopped.
+	pub fn is_stopped(&self) -> bool {
+		self.stopped.load(Ordering::Relaxed)
+	}
+
+	/// Stop the workers, dropping any queued jobs.
+	pub fn stop(&self) {
+		self.stopped.store(true, Ordering::Relaxed);
+		for queue in &self.lanes {
+			queue.work.notify_all();
+			queue.space.notify_all();
+		}
+		let workers: Vec<_> = self
+			.workers
+			.lock()
+			.unwrap_or_else(|e| e.into_inner())
+			.drain(..)
+			.collect();
+		for worker in workers {
+			if worker.thread().id() != thread::current().id() {
+				let _ = worker.join();
+			}
+		}
+	}
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+	use crate::msg::HeadersData;
+	use std::net::{IpAddr, Ipv4Addr, SocketAddr};
+	use std::sync::mpsc;
+
+	fn peer(n: u8) -> PeerAddr {
+		PeerAddr(SocketAddr::new(
+			IpAddr::V4(Ipv4Addr::new(10, 0, 0, n)),
+			3414,
+		))
+	}
+
+	#[test]
+	fn dispatch_in_order_per_peer() {
+		let dispatcher = Dispatcher::new();
+		let (tx, rx) = mpsc::channel();
+		for n in 0..20 {
+			for p in 1..=3 {
+				let tx = tx.clone();
+				assert!(dispatcher.dispatch(Lane::Sync, peer(p), move || {
+					thread::sleep(Duration::from_millis(1));
+					tx.send((p, n)).unwrap();
+				}));
+			}
+		}
+		drop(tx);
+
+		let mut last = HashMap::new();
+		for (p, n) in rx.iter() {
+			if let Some(prev) = last.insert(p, n) {
+				assert_eq!(prev + 1, n);
+			}
+		}
+		assert_eq!(last.len(), 3);
+
+		dispatcher.stop();
+		assert_eq!(dispatcher.stats()[Lane::Sync as usize].handled, 60);
+	}
+
+	#[test]
+	fn headers_ordered_with_blocks() {
+		let headers = Message::Headers(HeadersData {
+			headers: vec![],
+			remaining: 0,
+		});
+		assert_eq!(Lane::of(&headers), Some(Lane::Blocks));
+
+		// A header batch followed by the block relayed on top of it (and a
+		// slow batch ahead of both) is handled in the order received.
+		let dispatcher = Dispatcher::new();
+		let (tx, rx) = mpsc::channel();
+		for (n, delay) in [(0, 50), (1, 0), (2, 0)].iter().cloned() {
+			let tx = tx.clone();
+			let lane = if n == 2 {
+				Lane::Blocks
+			} else {
+				Lane::of(&headers).unwrap()
+			};
+			assert!(dispatcher.dispatch(lane, peer(1), move || {
+				thread::sleep(Duration::from_millis(delay));
+				tx.send(n).unwrap();
+			}));
+		}
+		drop(tx);
+		assert_eq!(rx.iter().collect::<Vec<_>>(), vec![0, 1, 2]);
+		dispatcher.stop();
+	}
+
+	#[test]
+	fn dispatch_drops_tx_relay_when_full() {
+		let dispatcher = Dispatcher::new();
+		let (tx, rx) = mpsc::channel::<()>();
+		let rx = Arc::new(Mutex::new(rx));
+
+		// Block the peer's first job until we are done filling its share of the lane.
+		let mut dropped = 0;
+		for _ in 0..(Lane::Txs.peer_capacity() + 10) {
+			let rx = rx.clone();
+			if !dispatcher.dispatch(Lane::Txs, peer(1), move || {
+				let _ = rx.lock().unwrap().recv();
+			}) {
+				dropped += 1;
+			}
+		}
+		assert_eq!(dropped, 10);
+
+		// Another peer is not affected.
+		assert!(dispatcher.dispatch(Lane::Txs, peer(2), || {}));
+
+		drop(tx);
+		dispatcher.stop();
+		assert_eq!(dispatcher.stats()[Lane::Txs as usize].dropped, 10);
+	}
+
+	#[test]
+	fn dispatch_waits_for_space_on_sync_lane() {
+		let dispatcher = Arc::new(Dispatcher::new());
+		let (tx, rx) = mpsc::channel::<()>();
+		let rx = Arc::new(Mutex::new(rx));
+
+		// Fill the peer's share of the lane with jobs blocked until we say so.
+		for _ in 0..Lane::Sync.peer_capacity() {
+			let rx = rx.clone();
+			assert!(dispatcher.dispatch(Lane::Sync, peer(1), move || {
+				let _ = rx.lock().unwrap().recv();
+			}));
+		}
+
+		// The next message waits for space rather than being dropped.
+		let (done_tx, done_rx) = mpsc::channel();
+		let waiting = {
+			let dispatcher = dispatcher.clone();
+			thread::spawn(move || {
+				let queued = dispatcher.dispatch(Lane::Sync, peer(1), || {});
+				done_tx.send(queued).unwrap();
+			})
+		};
+		assert!(done_rx.recv_timeout(Duration::from_millis(200)).is_err());
+
+		drop(tx);
+		assert_eq!(done_rx.recv_timeout(Duration::from_secs(10)), Ok(true));
+		waiting.join().unwrap();
+		dispatcher.stop();
+		assert_eq!(dispatcher.stats()[Lane::Sync as usize].dropped, 0);
+	}
+}
@@ -38,20 +38,23 @@ extern crate log;
 
 mod codec;
 mod conn;
+mod dispatch;
 pub mod handshake;
 pub mod msg;
 mod peer;
 mod peers;
 mod protocol;
+mod recon;
+mod send_queue;
 mod serv;
 mod store;
 pub mod types;
 
-pub use crate::conn::SEND_CHANNEL_CAP;
+pub use crate::dispatch::{Dispatcher, Lane, LaneStats};
 pub use crate::peer::Peer;
 pub use crate::peers::Peers;
 pub use crate::serv::{DummyAdapter, Server};
-pub use crate::store::{PeerData, State};
+pub use crate::store::{PeerData, PeerStore, State};
 pub use crate::types::{
 	Capabilities, ChainAdapter, Direction, Error, P2PConfig, PeerAddr, PeerInfo, ReasonForBan,
 	Seeding, TxHashSetRead, MAX_BLOCK_HEADERS, MAX_LOCATORS, MAX_PEER_ADDRS,
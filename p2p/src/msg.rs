@@ -17,6 +17,7 @@
 use crate::chain::txhashset::BitmapSegment;
 use crate::conn::Tracker;
 use crate::core::core::hash::Hash;
+use crate::core::core::id::{ShortId, SHORT_ID_SIZE};
 use crate::core::core::transaction::{OutputIdentifier, TxKernel};
 use crate::core::core::{
 	BlockHeader, Segment, SegmentIdentifier, Transaction, UntrustedBlock, UntrustedBlockHeader,
@@ -27,9 +28,10 @@ use crate::core::ser::{
 	self, ProtocolVersion, Readable, Reader, StreamingReader, Writeable, Writer,
 };
 use crate::core::{consensus, global};
+use crate::recon::{Sketch, MAX_SKETCH_CAPACITY};
 use crate::types::{
 	AttachmentMeta, AttachmentUpdate, Capabilities, Error, PeerAddr, ReasonForBan,
-	MAX_BLOCK_HEADERS, MAX_LOCATORS, MAX_PEER_ADDRS,
+	MAX_BLOCK_HEADERS, MAX_LOCATORS, MAX_PEER_ADDRS, MAX_TX_KERNEL_HASHES,
 };
 use crate::util::secp::pedersen::RangeProof;
 use bytes::Bytes;
@@ -82,6 +84,12 @@ enum_from_primitive! {
 		RangeProofSegment = 26,
 		GetKernelSegment = 27,
 		KernelSegment = 28,
+		TransactionKernels = 29,
+		GetTransactions = 30,
+		TxReconRequest = 31,
+		TxSketch = 32,
+		TxReconDiff = 33,
+		GetHeadersByHeight = 34,
 	}
 }
 
@@ -127,6 +135,12 @@ fn max_msg_size(msg_type: Type) -> u64 {
 		Type::RangeProofSegment => 2 * max_block_size(),
 		Type::GetKernelSegment => 41,
 		Type::KernelSegment => 2 * max_block_size(),
+		Type::TransactionKernels => 2 + 32 * MAX_TX_KERNEL_HASHES as u64,
+		Type::GetTransactions => 2 + 32 * MAX_TX_KERNEL_HASHES as u64,
+		Type::TxReconRequest => 12,
+		Type::TxSketch => 10 + 4 * MAX_SKETCH_CAPACITY as u64,
+		Type::TxReconDiff => 11 + SHORT_ID_SIZE as u64 * MAX_SKETCH_CAPACITY as u64,
+		Type::GetHeadersByHeight => 8,
 	}
 }
 
@@ -163,6 +177,16 @@ impl Msg {
 	pub fn add_attachment(&mut self, attachment: File) {
 		self.attachment = Some(attachment)
 	}
+
+	/// Type of the message.
+	pub fn msg_type(&self) -> Type {
+		self.header.msg_type
+	}
+
+	/// Size of the message in bytes (header and body, excluding any attachment).
+	pub fn size(&self) -> usize {
+		MsgHeader::LEN + self.body.len()
+	}
 }
 
 /// Read a header from the provided stream without blocking if the
@@ -621,6 +645,127 @@ impl Readable for Locator {
 	}
 }
 
+/// Batch of tx kernel hashes, either announcing txs we have or requesting
+/// txs we are missing.
+pub struct KernelHashes {
+	pub hashes: Vec<Hash>,
+}
+
+impl Writeable for KernelHashes {
+	fn write<W: Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		writer.write_u16(self.hashes.len() as u16)?;
+		for h in &self.hashes {
+			h.write(writer)?
+		}
+		Ok(())
+	}
+}
+
+impl Readable for KernelHashes {
+	fn read<R: Reader>(reader: &mut R) -> Result<KernelHashes, ser::Error> {
+		let len = reader.read_u16()?;
+		if len as u32 > MAX_TX_KERNEL_HASHES {
+			return Err(ser::Error::TooLargeReadErr);
+		}
+		let mut hashes = Vec::with_capacity(len as usize);
+		for _ in 0..len {
+			hashes.push(Hash::read(reader)?);
+		}
+		Ok(KernelHashes { hashes })
+	}
+}
+
+/// Starts a round of tx reconciliation, see the recon module.
+pub struct TxReconRequest {
+	/// Salt for the short ids of the round.
+	pub nonce: u64,
+	/// Number of txs in the initiator's set.
+	pub set_size: u32,
+}
+
+impl Writeable for TxReconRequest {
+	fn write<W: Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		writer.write_u64(self.nonce)?;
+		writer.write_u32(self.set_size)
+	}
+}
+
+impl Readable for TxReconRequest {
+	fn read<R: Reader>(reader: &mut R) -> Result<TxReconRequest, ser::Error> {
+		Ok(TxReconRequest {
+			nonce: reader.read_u64()?,
+			set_size: reader.read_u32()?,
+		})
+	}
+}
+
+/// Sketch of the responder's set of txs for a round of tx reconciliation.
+pub struct TxSketch {
+	pub nonce: u64,
+	pub sketch: Sketch,
+}
+
+impl Writeable for TxSketch {
+	fn write<W: Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		writer.write_u64(self.nonce)?;
+		self.sketch.write(writer)
+	}
+}
+
+impl Readable for TxSketch {
+	fn read<R: Reader>(reader: &mut R) -> Result<TxSketch, ser::Error> {
+		Ok(TxSketch {
+			nonce: reader.read_u64()?,
+			sketch: Sketch::read(reader)?,
+		})
+	}
+}
+
+/// Ends a round of tx reconciliation with the short ids of the txs the
+/// initiator is missing, or decoded false if the difference could not be
+/// decoded and the responder should announce its whole set.
+pub struct TxReconDiff {
+	pub nonce: u64,
+	pub decoded: bool,
+	pub short_ids: Vec<ShortId>,
+}
+
+impl Writeable for TxReconDiff {
+	fn write<W: Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		writer.write_u64(self.nonce)?;
+		writer.write_u8(self.decoded as u8)?;
+		writer.write_u16(self.short_ids.len() as u16)?;
+		for id in &self.short_ids {
+			id.write(writer)?;
+		}
+		Ok(())
+	}
+}
+
+impl Readable for TxReconDiff {
+	fn read<R: Reader>(reader: &mut R) -> Result<TxReconDiff, ser::Error> {
+		let nonce = reader.read_u64()?;
+		let decoded = match reader.read_u8()? {
+			0 => false,
+			1 => true,
+			_ => return Err(ser::Error::CorruptedData),
+		};
+		let len = reader.read_u16()? as usize;
+		if len > MAX_SKETCH_CAPACITY {
+			return Err(ser::Error::TooLargeReadErr);
+		}
+		let mut short_ids = Vec::with_capacity(len);
+		for _ in 0..len {
+			short_ids.push(ShortId::read(reader)?);
+		}
+		Ok(TxReconDiff {
+			nonce,
+			decoded,
+			short_ids,
+		})
+	}
+}
+
 /// Serializable wrapper for a list of block headers.
 pub struct Headers {
 	pub headers: Vec<BlockHeader>,
@@ -913,6 +1058,12 @@ pub enum Message {
 	RangeProofSegment(SegmentResponse<RangeProof>),
 	GetKernelSegment(SegmentRequest),
 	KernelSegment(SegmentResponse<TxKernel>),
+	TransactionKernels(KernelHashes),
+	GetTransactions(KernelHashes),
+	TxReconRequest(TxReconRequest),
+	TxSketch(TxSketch),
+	TxReconDiff(TxReconDiff),
+	GetHeadersByHeight(u64),
 }
 
 /// We receive 512 headers from a peer.
@@ -957,6 +1108,12 @@ impl fmt::Display for Message {
 			Message::RangeProofSegment(_) => write!(f, "range proof segment"),
 			Message::GetKernelSegment(_) => write!(f, "get kernel segment"),
 			Message::KernelSegment(_) => write!(f, "kernel segment"),
+			Message::TransactionKernels(_) => write!(f, "tx kernels"),
+			Message::GetTransactions(_) => write!(f, "get txs"),
+			Message::TxReconRequest(_) => write!(f, "tx recon request"),
+			Message::TxSketch(_) => write!(f, "tx sketch"),
+			Message::TxReconDiff(_) => write!(f, "tx recon diff"),
+			Message::GetHeadersByHeight(_) => write!(f, "get headers by height"),
 		}
 	}
 }
@@ -969,6 +1126,7 @@ impl fmt::Debug for Message {
 
 pub enum Consumed {
 	Response(Msg),
+	Responses(Vec<Msg>),
 	Attachment(Arc<AttachmentMeta>, File),
 	None,
 	Disconnect,
@@ -978,6 +1136,7 @@ impl fmt::Debug for Consumed {
 	fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
 		match self {
 			Consumed::Response(msg) => write!(f, "Consumed::Response({:?})", msg.header.msg_type),
+			Consumed::Responses(msgs) => write!(f, "Consumed::Responses({})", msgs.len()),
 			Consumed::Attachment(meta, _) => write!(f, "Consumed::Attachment({:?})", meta.size),
 			Consumed::None => write!(f, "Consumed::None"),
 			Consumed::Disconnect => write!(f, "Consumed::Disconnect"),
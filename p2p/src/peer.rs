@@ -15,12 +15,15 @@
 use crate::util::{Mutex, RwLock};
 use std::fmt;
 use std::fs::File;
+use std::mem;
 use std::net::{Shutdown, TcpStream};
 use std::path::PathBuf;
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Arc;
+use std::time::{Duration, Instant};
 
 use lru_cache::LruCache;
+use rand::{thread_rng, Rng};
 
 use crate::chain;
 use crate::chain::txhashset::BitmapChunk;
@@ -30,19 +33,31 @@ use crate::core::core::{OutputIdentifier, Segment, SegmentIdentifier, TxKernel};
 use crate::core::pow::Difficulty;
 use crate::core::ser::Writeable;
 use crate::core::{core, global};
+use crate::dispatch::Dispatcher;
 use crate::handshake::Handshake;
-use crate::msg::{self, BanReason, GetPeerAddrs, Locator, Msg, Ping, TxHashSetRequest, Type};
+use crate::msg::{
+	self, BanReason, GetPeerAddrs, KernelHashes, Locator, Msg, Ping, TxHashSetRequest, TxReconDiff,
+	TxReconRequest, TxSketch, Type,
+};
 use crate::protocol::Protocol;
+use crate::recon::TxRecon;
 use crate::types::{
 	Capabilities, ChainAdapter, Error, NetAdapter, P2PConfig, PeerAddr, PeerInfo, ReasonForBan,
-	TxHashSetRead,
+	TxHashSetRead, MAX_TX_KERNEL_HASHES,
 };
 use crate::util::secp::pedersen::RangeProof;
 use chrono::prelude::{DateTime, Utc};
 
-const MAX_TRACK_SIZE: usize = 30;
+/// Large enough to track every hash of a full tx kernel hash announcement.
+const MAX_TRACK_SIZE: usize = 2 * MAX_TX_KERNEL_HASHES as usize;
 const MAX_PEER_MSG_PER_MIN: u64 = 500;
 
+/// Range of the randomized delay before announcing queued tx kernel hashes
+/// to a peer, batching them up and making it harder to tell which peer a
+/// tx originated from.
+const TX_TRICKLE_MIN_MS: u64 = 100;
+const TX_TRICKLE_MAX_MS: u64 = 1_000;
+
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 /// Remind: don't mix up this 'State' with that 'State' in p2p/src/store.rs,
 ///   which has different 3 states: {Healthy, Banned, Defunct}.
@@ -65,6 +80,10 @@ pub struct Peer {
 	stop_handle: Mutex<conn::StopHandle>,
 	// Whether or not we requested a txhashset from this peer
 	state_sync_requested: Arc<AtomicBool>,
+	// Tx kernel hashes waiting to be announced and when to announce them
+	tx_announce: Mutex<(Vec<Hash>, Instant)>,
+	// Tx reconciliation state, if both we and the peer support it
+	tx_recon: Option<Mutex<TxRecon>>,
 }
 
 impl fmt::Debug for Peer {
@@ -75,7 +94,13 @@ impl fmt::Debug for Peer {
 
 impl Peer {
 	// Only accept and connect can be externally used to build a peer
-	fn new(info: PeerInfo, conn: TcpStream, adapter: Arc<dyn NetAdapter>) -> std::io::Result<Peer> {
+	fn new(
+		info: PeerInfo,
+		capab: Capabilities,
+		conn: TcpStream,
+		adapter: Arc<dyn NetAdapter>,
+		dispatcher: Arc<Dispatcher>,
+	) -> std::io::Result<Peer> {
 		let state = Arc::new(RwLock::new(State::Connected));
 		let state_sync_requested = Arc::new(AtomicBool::new(false));
 		let tracking_adapter = TrackingAdapter::new(adapter);
@@ -85,9 +110,23 @@ impl Peer {
 			state_sync_requested.clone(),
 		);
 		let tracker = Arc::new(conn::Tracker::new());
-		let (sendh, stoph) = conn::listen(conn, info.version, tracker.clone(), handler)?;
+		let (sendh, stoph) = conn::listen(
+			conn,
+			info.version,
+			info.addr,
+			tracker.clone(),
+			handler,
+			dispatcher,
+		)?;
 		let send_handle = Mutex::new(sendh);
 		let stop_handle = Mutex::new(stoph);
+		let tx_recon = if capab.contains(Capabilities::TX_RECONCILIATION)
+			&& info.capabilities.contains(Capabilities::TX_RECONCILIATION)
+		{
+			Some(Mutex::new(TxRecon::new(info.is_outbound())))
+		} else {
+			None
+		};
 		Ok(Peer {
 			info,
 			state,
@@ -96,6 +135,8 @@ impl Peer {
 			send_handle,
 			stop_handle,
 			state_sync_requested,
+			tx_announce: Mutex::new((vec![], Instant::now())),
+			tx_recon,
 		})
 	}
 
@@ -105,11 +146,12 @@ impl Peer {
 		total_difficulty: Difficulty,
 		hs: &Handshake,
 		adapter: Arc<dyn NetAdapter>,
+		dispatcher: Arc<Dispatcher>,
 	) -> Result<Peer, Error> {
 		debug!("accept: handshaking from {:?}", conn.peer_addr());
 		let info = hs.accept(capab, total_difficulty, &mut conn);
 		match info {
-			Ok(info) => Ok(Peer::new(info, conn, adapter)?),
+			Ok(info) => Ok(Peer::new(info, capab, conn, adapter, dispatcher)?),
 			Err(e) => {
 				debug!(
 					"accept: handshaking from {:?} failed with error: {:?}",
@@ -131,11 +173,12 @@ impl Peer {
 		self_addr: PeerAddr,
 		hs: &Handshake,
 		adapter: Arc<dyn NetAdapter>,
+		dispatcher: Arc<Dispatcher>,
 	) -> Result<Peer, Error> {
 		debug!("connect: handshaking with {:?}", conn.peer_addr());
 		let info = hs.initiate(capab, total_difficulty, self_addr, &mut conn);
 		match info {
-			Ok(info) => Ok(Peer::new(info, conn, adapter)?),
+			Ok(info) => Ok(Peer::new(info, capab, conn, adapter, dispatcher)?),
 			Err(e) => {
 				debug!(
 					"connect: handshaking with {:?} failed with error: {:?}",
@@ -285,13 +328,68 @@ impl Peer {
 		}
 	}
 
+	/// Queues the tx kernel hash to be announced to the peer in the next batch,
+	/// sending the batch right away if full.
+	fn announce_tx_kernel_hash(&self, h: Hash) -> Result<bool, Error> {
+		if self.tracking_adapter.has_recv(h) {
+			debug!(
+				"Not announcing tx kernel hash {} to {} (already seen)",
+				h, self.info.addr
+			);
+			return Ok(false);
+		}
+		let full = {
+			let mut announce = self.tx_announce.lock();
+			if announce.0.contains(&h) {
+				return Ok(false);
+			}
+			if announce.0.is_empty() {
+				let delay = thread_rng().gen_range(TX_TRICKLE_MIN_MS, TX_TRICKLE_MAX_MS);
+				announce.1 = Instant::now() + Duration::from_millis(delay);
+			}
+			announce.0.push(h);
+			announce.0.len() >= MAX_TX_KERNEL_HASHES as usize
+		};
+		if full {
+			self.flush_tx_announcements(true)?;
+		}
+		Ok(true)
+	}
+
+	/// Announces the queued tx kernel hashes to the peer in a single msg once
+	/// their randomized trickle delay has passed (or right away if forced).
+	pub fn flush_tx_announcements(&self, force: bool) -> Result<(), Error> {
+		let hashes = {
+			let mut announce = self.tx_announce.lock();
+			if announce.0.is_empty() || (!force && Instant::now() < announce.1) {
+				return Ok(());
+			}
+			mem::replace(&mut announce.0, vec![])
+		};
+		debug!(
+			"Send {} tx kernel hashes to {}",
+			hashes.len(),
+			self.info.addr
+		);
+		self.send(&KernelHashes { hashes }, msg::Type::TransactionKernels)
+	}
+
 	/// Sends the provided transaction to the remote peer. The request may be
 	/// dropped if the remote peer is known to already have the transaction.
 	/// We support broadcast of lightweight tx kernel hash
 	/// so track known txs by kernel hash.
+	/// Peers supporting it get the kernel hash in a batch announcement.
 	pub fn send_transaction(&self, tx: &core::Transaction) -> Result<bool, Error> {
 		let kernel = &tx.kernels()[0];
 
+		if self
+			.info
+			.capabilities
+			.contains(Capabilities::TX_KERNEL_HASH_BATCH)
+		{
+			return self.announce_tx_kernel_hash(kernel.hash());
+		}
+
 		if self
 			.info
 			.capabilities
@@ -314,6 +412,115 @@ impl Peer {
 		}
 	}
 
+	/// Whether we reconcile txs with this peer rather than announcing them.
+	pub fn reconciles_txs(&self) -> bool {
+		self.tx_recon.is_some()
+	}
+
+	/// Queues the provided transaction to be reconciled with the remote peer
+	/// in the next round. Falls back to announcing it if we do not reconcile
+	/// txs with the peer (or already have too many queued).
+	pub fn reconcile_transaction(&self, tx: &core::Transaction) -> Result<bool, Error> {
+		let h = tx.kernels()[0].hash();
+		if self.tracking_adapter.has_recv(h) {
+			return Ok(false);
+		}
+		if let Some(ref recon) = self.tx_recon {
+			if recon.lock().add(h) {
+				return Ok(true);
+			}
+		}
+		self.send_transaction(tx)
+	}
+
+	/// Starts a round of tx reconciliation if we are the one initiating them
+	/// with this peer and one is due.
+	pub fn start_tx_recon(&self) -> Result<(), Error> {
+		let req = match self.tx_recon {
+			Some(ref recon) => {
+				let tracking_adapter = &self.tracking_adapter;
+				recon.lock().start_round(|h| tracking_adapter.has_recv(*h))
+			}
+			None => None,
+		};
+		match req {
+			Some((req, collided)) => {
+				trace!(
+					"Start tx recon with {}, {} txs",
+					self.info.addr,
+					req.set_size
+				);
+				self.send_tx_kernel_hashes(collided)?;
+				self.send(req, msg::Type::TxReconRequest)
+			}
+			None => Ok(()),
+		}
+	}
+
+	/// Sketch of the txs we would have announced to the peer, for the round
+	/// of tx reconciliation it started.
+	/// None if we are the one initiating rounds with this peer.
+	pub fn tx_recon_sketch(&self, req: &TxReconRequest) -> Option<TxSketch> {
+		let recon = self.tx_recon.as_ref()?;
+		let tracking_adapter = &self.tracking_adapter;
+		let (sketch, collided) = recon
+			.lock()
+			.sketch(req, |h| tracking_adapter.has_recv(*h))?;
+		if let Err(e) = self.send_tx_kernel_hashes(collided) {
+			debug!(
+				"Tx recon with {}: failed to announce: {:?}",
+				self.info.addr, e
+			);
+		}
+		Some(sketch)
+	}
+
+	/// Completes the round of tx reconciliation we started with the sketch
+	/// sent by the peer, announcing the txs it is missing and asking for the
+	/// ones we are missing.
+	pub fn tx_sketch_received(&self, sketch: TxSketch) -> Result<(), Error> {
+		let res = match self.tx_recon {
+			Some(ref recon) => recon.lock().reconcile(sketch),
+			None => None,
+		};
+		if let Some((hashes, diff)) = res {
+			debug!(
+				"Tx recon with {}: announcing {}, missing {} (decoded: {})",
+				self.info.addr,
+				hashes.len(),
+				diff.short_ids.len(),
+				diff.decoded
+			);
+			self.send_tx_kernel_hashes(hashes)?;
+			self.send(diff, msg::Type::TxReconDiff)?;
+		}
+		Ok(())
+	}
+
+	/// Completes the round of tx reconciliation the peer started, announcing
+	/// the txs it asked for.
+	pub fn tx_recon_diff_received(&self, diff: TxReconDiff) -> Result<(), Error> {
+		let hashes = match self.tx_recon {
+			Some(ref recon) => recon.lock().diff_received(&diff),
+			None => vec![],
+		};
+		self.send_tx_kernel_hashes(hashes)
+	}
+
+	/// Announces the provided tx kernel hashes right away, in as few msgs as
+	/// possible.
+	fn send_tx_kernel_hashes(&self, hashes: Vec<Hash>) -> Result<(), Error> {
+		for chunk in hashes.chunks(MAX_TX_KERNEL_HASHES as usize) {
+			self.send(
+				&KernelHashes {
+					hashes: chunk.to_vec(),
+				},
+				msg::Type::TransactionKernels,
+			)?;
+		}
+		Ok(())
+	}
+
 	/// Sends the provided stem transaction to the remote peer.
 	/// Note: tracking adapter is ignored for stem transactions (while under
 	/// embargo).
@@ -327,6 +534,16 @@ impl Peer {
 		self.send(&Locator { hashes: locator }, msg::Type::GetHeaders)
 	}
 
+	/// Sends a request for the chunk of block headers starting at the provided
+	/// height.
+	pub fn send_headers_by_height_request(&self, height: u64) -> Result<(), Error> {
+		debug!(
+			"Requesting headers from height {} from peer {}.",
+			height, self.info.addr
+		);
+		self.send(&height, msg::Type::GetHeadersByHeight)
+	}
+
 	pub fn send_tx_request(&self, h: Hash) -> Result<(), Error> {
 		debug!(
 			"Requesting tx (kernel hash) {} from peer {}.",
@@ -335,6 +552,16 @@ impl Peer {
 		self.send(&h, msg::Type::GetTransaction)
 	}
 
+	/// Sends a request for multiple txs by kernel hash in a single msg.
+	pub fn send_txs_request(&self, hashes: Vec<Hash>) -> Result<(), Error> {
+		debug!(
+			"Requesting {} txs (kernel hashes) from peer {}.",
+			hashes.len(),
+			self.info.addr
+		);
+		self.send(&KernelHashes { hashes }, msg::Type::GetTransactions)
+	}
+
 	/// Sends a request for a specific block by hash.
 	/// Takes opts so we can track if this request was due to our node syncing or otherwise.
 	pub fn send_block_request(&self, h: Hash, opts: chain::Options) -> Result<(), Error> {
@@ -450,6 +677,26 @@ impl ChainAdapter for TrackingAdapter {
 		self.adapter.tx_kernel_received(kernel_hash, peer_info)
 	}
 
+	fn tx_kernels_received(
+		&self,
+		kernel_hashes: &[Hash],
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		// Skip any this peer has already announced or sent us.
+		let kernel_hashes: Vec<_> = kernel_hashes
+			.iter()
+			.filter(|h| !self.has_recv(**h))
+			.cloned()
+			.collect();
+		if kernel_hashes.is_empty() {
+			return Ok(true);
+		}
+		for h in &kernel_hashes {
+			self.push_recv(*h);
+		}
+		self.adapter.tx_kernels_received(&kernel_hashes, peer_info)
+	}
+
 	fn transaction_received(
 		&self,
 		tx: core::Transaction,
@@ -512,6 +759,10 @@ impl ChainAdapter for TrackingAdapter {
 		self.adapter.locate_headers(locator)
 	}
 
+	fn get_headers_by_height(&self, height: u64) -> Result<Vec<core::BlockHeader>, chain::Error> {
+		self.adapter.get_headers_by_height(height)
+	}
+
 	fn get_block(&self, h: Hash, peer_info: &PeerInfo) -> Option<core::Block> {
 		self.adapter.get_block(h, peer_info)
 	}
@@ -604,4 +855,16 @@ impl NetAdapter for TrackingAdapter {
 	fn is_banned(&self, addr: PeerAddr) -> bool {
 		self.adapter.is_banned(addr)
 	}
+
+	fn tx_recon_requested(&self, addr: PeerAddr, req: TxReconRequest) -> Option<TxSketch> {
+		self.adapter.tx_recon_requested(addr, req)
+	}
+
+	fn tx_sketch_received(&self, addr: PeerAddr, sketch: TxSketch) {
+		self.adapter.tx_sketch_received(addr, sketch)
+	}
+
+	fn tx_recon_diff_received(&self, addr: PeerAddr, diff: TxReconDiff) {
+		self.adapter.tx_recon_diff_received(addr, diff)
+	}
 }
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 use crate::util::RwLock;
+use std::cell::Cell;
 use std::collections::HashMap;
 use std::fs::File;
 use std::path::PathBuf;
@@ -27,7 +28,7 @@ use crate::core::core::hash::{Hash, Hashed};
 use crate::core::core::{OutputIdentifier, Segment, SegmentIdentifier, TxKernel};
 use crate::core::global;
 use crate::core::pow::Difficulty;
-use crate::msg::PeerAddrs;
+use crate::msg::{PeerAddrs, TxReconDiff, TxReconRequest, TxSketch};
 use crate::peer::Peer;
 use crate::store::{PeerData, PeerStore, State};
 use crate::types::{
@@ -40,6 +41,10 @@ use chrono::Duration;
 
 const LOCK_TIMEOUT: std::time::Duration = std::time::Duration::from_secs(2);
 
+/// Number of outbound peers we reconcile txs with that still get new txs
+/// announced right away, the others learn about them by reconciliation.
+const TX_FLOOD_OUTBOUND_PEERS: usize = 2;
+
 pub struct Peers {
 	pub adapter: Arc<dyn ChainAdapter>,
 	store: PeerStore,
@@ -238,8 +243,20 @@ impl Peers {
 	/// Broadcasts the provided transaction to all our connected peers.
 	/// A peer implementation may drop the broadcast request
 	/// if it knows the remote peer already has the transaction.
+	/// Peers we reconcile txs with only get it announced if they are among
+	/// the first few outbound ones, the others get it in the next round.
 	pub fn broadcast_transaction(&self, tx: &core::Transaction) {
-		let count = self.broadcast("transaction", |p| p.send_transaction(tx));
+		let flooded = Cell::new(0);
+		let count = self.broadcast("transaction", |p| {
+			if !p.reconciles_txs() {
+				p.send_transaction(tx)
+			} else if p.info.is_outbound() && flooded.get() < TX_FLOOD_OUTBOUND_PEERS {
+				flooded.set(flooded.get() + 1);
+				p.send_transaction(tx)
+			} else {
+				p.reconcile_transaction(tx)
+			}
+		});
 		debug!(
 			"broadcast_transaction: {} to {} peers, done.",
 			tx.hash(),
@@ -247,6 +264,29 @@ impl Peers {
 		);
 	}
 
+	/// Announce queued tx kernel hashes to any connected peers whose trickle
+	/// delay has passed.
+	pub fn flush_tx_announcements(&self) {
+		for p in self.iter().connected() {
+			if let Err(e) = p.flush_tx_announcements(false) {
+				debug!("Error announcing txs to peer {:?}: {:?}", &p.info.addr, e);
+			}
+		}
+	}
+
+	/// Start rounds of tx reconciliation with any connected peers we initiate
+	/// them with and that are due one.
+	pub fn reconcile_txs(&self) {
+		for p in self.iter().connected() {
+			if let Err(e) = p.start_tx_recon() {
+				debug!(
+					"Error reconciling txs with peer {:?}: {:?}",
+					&p.info.addr, e
+				);
+			}
+		}
+	}
+
 	/// Ping all our connected peers. Always automatically expects a pong back
 	/// or disconnects. This acts as a liveness test.
 	pub fn check_all(&self, total_difficulty: Difficulty, height: u64) {
@@ -289,6 +329,11 @@ impl Peers {
 		}
 	}
 
+	/// Number of peers in store in the provided state
+	pub fn count_peers(&self, state: State) -> usize {
+		self.store.count_peers(state)
+	}
+
 	/// Get peer in store by address
 	pub fn get_peer(&self, peer_addr: PeerAddr) -> Result<PeerData, Error> {
 		self.store.get_peer(peer_addr).map_err(From::from)
@@ -316,6 +361,11 @@ impl Peers {
 			.map_err(From::from)
 	}
 
+	/// Writes pending peer data changes to the db
+	pub fn flush_peer_data(&self) -> Result<(), Error> {
+		self.store.flush().map_err(From::from)
+	}
+
 	/// Iterate over the peer list and prune all peers we have
 	/// lost connection to or have been deemed problematic.
 	/// Also avoid connected peer count getting too high.
@@ -416,6 +466,9 @@ impl Peers {
 	}
 
 	pub fn stop(&self) {
+		if let Err(e) = self.flush_peer_data() {
+			error!("failed to save peers: {:?}", e);
+		}
 		let mut peers = self.peers.write();
 		for peer in peers.values() {
 			peer.stop();
@@ -478,6 +531,14 @@ impl ChainAdapter for Peers {
 		self.adapter.tx_kernel_received(kernel_hash, peer_info)
 	}
 
+	fn tx_kernels_received(
+		&self,
+		kernel_hashes: &[Hash],
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		self.adapter.tx_kernels_received(kernel_hashes, peer_info)
+	}
+
 	fn transaction_received(
 		&self,
 		tx: core::Transaction,
@@ -581,6 +642,10 @@ impl ChainAdapter for Peers {
 		self.adapter.locate_headers(hs)
 	}
 
+	fn get_headers_by_height(&self, height: u64) -> Result<Vec<core::BlockHeader>, chain::Error> {
+		self.adapter.get_headers_by_height(height)
+	}
+
 	fn get_block(&self, h: Hash, peer_info: &PeerInfo) -> Option<core::Block> {
 		self.adapter.get_block(h, peer_info)
 	}
@@ -719,6 +784,26 @@ impl NetAdapter for Peers {
 			false
 		}
 	}
+
+	fn tx_recon_requested(&self, addr: PeerAddr, req: TxReconRequest) -> Option<TxSketch> {
+		self.get_connected_peer(addr)?.tx_recon_sketch(&req)
+	}
+
+	fn tx_sketch_received(&self, addr: PeerAddr, sketch: TxSketch) {
+		if let Some(peer) = self.get_connected_peer(addr) {
+			if let Err(e) = peer.tx_sketch_received(sketch) {
+				debug!("Error reconciling txs with peer {:?}: {:?}", addr, e);
+			}
+		}
+	}
+
+	fn tx_recon_diff_received(&self, addr: PeerAddr, diff: TxReconDiff) {
+		if let Some(peer) = self.get_connected_peer(addr) {
+			if let Err(e) = peer.tx_recon_diff_received(diff) {
+				debug!("Error reconciling txs with peer {:?}: {:?}", addr, e);
+			}
+		}
+	}
 }
 
 pub struct PeersIter<I> {
@@ -17,8 +17,9 @@ use crate::conn::MessageHandler;
 use crate::core::core::{hash::Hashed, CompactBlock};
 
 use crate::msg::{
-	Consumed, Headers, Message, Msg, OutputBitmapSegmentResponse, OutputSegmentResponse, PeerAddrs,
-	Pong, SegmentRequest, SegmentResponse, TxHashSetArchive, Type,
+	Consumed, Headers, KernelHashes, Message, Msg, OutputBitmapSegmentResponse,
+	OutputSegmentResponse, PeerAddrs, Pong, SegmentRequest, SegmentResponse, TxHashSetArchive,
+	Type,
 };
 use crate::types::{AttachmentMeta, Error, NetAdapter, PeerInfo};
 use chrono::prelude::Utc;
@@ -123,6 +124,45 @@ impl MessageHandler for Protocol {
 				Consumed::None
 			}
 
+			Message::TransactionKernels(KernelHashes { hashes }) => {
+				debug!("handle_payload: received {} tx kernels", hashes.len());
+				adapter.tx_kernels_received(&hashes, &self.peer_info)?;
+				Consumed::None
+			}
+
+			Message::GetTransactions(KernelHashes { hashes }) => {
+				debug!("handle_payload: GetTransactions: {}", hashes.len());
+				let mut resp_msgs = vec![];
+				for h in hashes {
+					if let Some(tx) = adapter.get_transaction(h) {
+						resp_msgs.push(Msg::new(Type::Transaction, tx, self.peer_info.version)?);
+					}
+				}
+				Consumed::Responses(resp_msgs)
+			}
+
+			Message::TxReconRequest(req) => {
+				trace!("handle_payload: tx recon request: {}", req.set_size);
+				match adapter.tx_recon_requested(self.peer_info.addr, req) {
+					Some(sketch) => Consumed::Response(Msg::new(
+						Type::TxSketch,
+						sketch,
+						self.peer_info.version,
+					)?),
+					None => Consumed::None,
+				}
+			}
+
+			Message::TxSketch(sketch) => {
+				adapter.tx_sketch_received(self.peer_info.addr, sketch);
+				Consumed::None
+			}
+
+			Message::TxReconDiff(diff) => {
+				adapter.tx_recon_diff_received(self.peer_info.addr, diff);
+				Consumed::None
+			}
+
 			Message::GetTransaction(h) => {
 				debug!("handle_payload: GetTransaction: {}", h);
 				let tx = adapter.get_transaction(h);
@@ -192,6 +232,15 @@ impl MessageHandler for Protocol {
 				)?)
 			}
 
+			Message::GetHeadersByHeight(height) => {
+				let headers = adapter.get_headers_by_height(height)?;
+				Consumed::Response(Msg::new(
+					Type::Headers,
+					Headers { headers },
+					self.peer_info.version,
+				)?)
+			}
+
 			// "header first" block propagation - if we have not yet seen this block
 			// we can go request it from some of our peers
 			Message::Header(header) => {
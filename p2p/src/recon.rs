@@ -0,0 +1,681 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Set reconciliation of the txs relayed between two peers, in the spirit of
+//! Erlay. Rather than announcing every tx to every peer, each side collects
+//! the kernel hashes it would have announced to the peer and periodically
+//! the side that opened the connection starts a round:
+//!
+//! * initiator -> TxReconRequest (round nonce, size of its set)
+//! * responder -> TxSketch (sketch of the short ids of its set)
+//! * initiator decodes the difference between both sets, announces the txs
+//!   only it has and sends a TxReconDiff with the short ids it is missing
+//! * responder announces the txs the initiator asked for
+//!
+//! Txs both sides already know about cancel out in the sketch and cost
+//! nothing. If the difference cannot be decoded both sides fall back to
+//! announcing their whole set. Txs whose short ids collide within a set are
+//! left out of the round and announced directly.
+//!
+//! The sketch is a BCH based sketch (PinSketch, as in minisketch) of 32 bit
+//! short ids of the kernel hashes, salted with a random nonce for each round.
+//! Combining two sketches of capacity c gives the sketch of the symmetric
+//! difference of both sets, which can be decoded exactly as long as it has
+//! no more than c elements.
+
+use crate::core::core::hash::{Hash, ZERO_HASH};
+use crate::core::core::id::{ShortId, ShortIdentifiable};
+use crate::core::ser::{self, Readable, Reader, Writeable, Writer};
+use crate::msg::{TxReconDiff, TxReconRequest, TxSketch};
+use rand::{thread_rng, Rng};
+use std::collections::{HashMap, HashSet};
+use std::mem;
+use std::time::{Duration, Instant};
+
+/// Max capacity of a sketch, the largest difference we can decode in a
+/// single round. Bounds the cost of decoding (quadratic in the capacity).
+pub const MAX_SKETCH_CAPACITY: usize = 128;
+
+/// Max number of txs waiting to be reconciled with a peer, txs beyond that
+/// are announced directly.
+const MAX_RECON_SET_SIZE: usize = 2_000;
+
+/// How often the initiator starts a round with each peer.
+const RECON_INTERVAL: Duration = Duration::from_secs(2);
+
+/// How long the initiator waits for a sketch before starting a new round.
+const RECON_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// The 32 bit short id of a kernel hash for the round salted with the given
+/// nonce (never zero, which cannot be added to a sketch).
+fn short_id(h: &Hash, nonce: u64) -> u32 {
+	short_id_to_u32(&h.short_id(&ZERO_HASH, nonce)).max(1)
+}
+
+fn short_id_to_u32(id: &ShortId) -> u32 {
+	id.as_ref()[..4]
+		.iter()
+		.rev()
+		.fold(0, |acc, b| (acc << 8) | *b as u32)
+}
+
+fn u32_to_short_id(id: u32) -> ShortId {
+	ShortId::from_bytes(&id.to_le_bytes())
+}
+
+// Arithmetic in GF(2^32), defined by the irreducible polynomial
+// x^32 + x^7 + x^3 + x^2 + 1.
+const FIELD_MODULUS: u32 = 0x8d;
+
+fn clmul(a: u32, b: u32) -> u64 {
+	let a = a as u64;
+	let mut r = 0;
+	for i in 0..32 {
+		if (b >> i) & 1 == 1 {
+			r ^= a << i;
+		}
+	}
+	r
+}
+
+fn gf_mul(a: u32, b: u32) -> u32 {
+	let p = clmul(a, b);
+	let t = clmul((p >> 32) as u32, FIELD_MODULUS);
+	let u = clmul((t >> 32) as u32, FIELD_MODULUS);
+	(p as u32) ^ (t as u32) ^ (u as u32)
+}
+
+fn gf_sqr(a: u32) -> u32 {
+	gf_mul(a, a)
+}
+
+fn gf_inv(a: u32) -> u32 {
+	// a^(2^32 - 2)
+	let mut r = 1;
+	let mut x = a;
+	let mut e: u64 = (1 << 32) - 2;
+	while e > 0 {
+		if e & 1 == 1 {
+			r = gf_mul(r, x);
+		}
+		x = gf_sqr(x);
+		e >>= 1;
+	}
+	r
+}
+
+// Polynomials over GF(2^32), lowest degree coefficient first.
+type Poly = Vec<u32>;
+
+fn poly_trim(p: &mut Poly) {
+	while p.last() == Some(&0) {
+		p.pop();
+	}
+}
+
+fn poly_make_monic(p: &mut Poly) {
+	if let Some(lead) = p.last().cloned() {
+		if lead != 1 {
+			let inv = gf_inv(lead);
+			for c in p.iter_mut() {
+				*c = gf_mul(*c, inv);
+			}
+		}
+	}
+}
+
+fn poly_add(a: &mut Poly, b: &Poly) {
+	if a.len() < b.len() {
+		a.resize(b.len(), 0);
+	}
+	for (x, y) in a.iter_mut().zip(b.iter()) {
+		*x ^= *y;
+	}
+	poly_trim(a);
+}
+
+// a mod m, m monic
+fn poly_mod(a: &mut Poly, m: &Poly) {
+	let deg = m.len() - 1;
+	while a.len() > deg {
+		let lead = a.pop().unwrap_or(0);
+		if lead != 0 {
+			let offset = a.len() - deg;
+			for i in 0..deg {
+				a[offset + i] ^= gf_mul(lead, m[i]);
+			}
+		}
+	}
+	poly_trim(a);
+}
+
+// a^2 mod m, squaring is linear in characteristic 2
+fn poly_sqr_mod(a: &Poly, m: &Poly) -> Poly {
+	let mut r = vec![0; a.len() * 2];
+	for (i, c) in a.iter().enumerate() {
+		r[2 * i] = gf_sqr(*c);
+	}
+	poly_trim(&mut r);
+	poly_mod(&mut r, m);
+	r
+}
+
+fn poly_gcd(mut a: Poly, mut b: Poly) -> Poly {
+	poly_trim(&mut a);
+	poly_trim(&mut b);
+	while !b.is_empty() {
+		poly_make_monic(&mut b);
+		poly_mod(&mut a, &b);
+		mem::swap(&mut a, &mut b);
+	}
+	poly_make_monic(&mut a);
+	a
+}
+
+// Shortest linear recurrence (connection polynomial) generating the
+// sequence s.
+fn berlekamp_massey(s: &[u32]) -> Poly {
+	let mut c: Poly = vec![1];
+	let mut b: Poly = vec![1];
+	let mut len = 0;
+	let mut shift = 1;
+	let mut last_d = 1;
+	for n in 0..s.len() {
+		let mut d = s[n];
+		for i in 1..=len.min(c.len() - 1) {
+			d ^= gf_mul(c[i], s[n - i]);
+		}
+		if d == 0 {
+			shift += 1;
+			continue;
+		}
+		let coef = gf_mul(d, gf_inv(last_d));
+		let prev = c.clone();
+		if c.len() < b.len() + shift {
+			c.resize(b.len() + shift, 0);
+		}
+		for (i, bi) in b.iter().enumerate() {
+			c[i + shift] ^= gf_mul(coef, *bi);
+		}
+		if 2 * len <= n {
+			len = n + 1 - len;
+			b = prev;
+			last_d = d;
+			shift = 1;
+		} else {
+			shift += 1;
+		}
+	}
+	c.resize(len + 1, 0);
+	c
+}
+
+// Roots of the monic poly f, known to split into distinct linear factors,
+// splitting it with gcd(f, Tr(beta * x)) (Berlekamp's trace algorithm).
+fn find_roots(f: Poly, beta: u32, roots: &mut Vec<u32>) -> bool {
+	match f.len() {
+		0 | 1 => return true,
+		2 => {
+			roots.push(f[0]);
+			return true;
+		}
+		_ => (),
+	}
+	let mut beta = beta;
+	for _ in 0..64 {
+		let mut u = vec![0, beta];
+		poly_mod(&mut u, &f);
+		let mut trace = u.clone();
+		for _ in 1..32 {
+			u = poly_sqr_mod(&u, &f);
+			poly_add(&mut trace, &u);
+		}
+		let g = poly_gcd(f.clone(), trace.clone());
+		if g.len() > 1 && g.len() < f.len() {
+			poly_add(&mut trace, &vec![1]);
+			let h = poly_gcd(f.clone(), trace);
+			if g.len() + h.len() != f.len() + 1 {
+				return false;
+			}
+			let next = gf_mul(beta, 0x9e37_79b9) ^ 1;
+			return find_roots(g, next, roots) && find_roots(h, next, roots);
+		}
+		beta = gf_mul(beta, 0x9e37_79b9) ^ 0x5bd1_e995;
+	}
+	false
+}
+
+/// Sketch of a set of 32 bit ids, the odd power sums of its elements in
+/// GF(2^32). Merging the sketch of another set (of the same capacity) gives
+/// the sketch of the ids in one set but not the other, which can be decoded
+/// as long as there are no more of them than the capacity.
+#[derive(Clone, Debug, PartialEq)]
+pub struct Sketch {
+	syndromes: Vec<u32>,
+}
+
+impl Sketch {
+	/// Empty sketch able to decode a difference of up to the given size.
+	pub fn new(capacity: usize) -> Sketch {
+		Sketch {
+			syndromes: vec![0; capacity.max(1).min(MAX_SKETCH_CAPACITY)],
+		}
+	}
+
+	/// Max number of ids the sketch can decode.
+	pub fn capacity(&self) -> usize {
+		self.syndromes.len()
+	}
+
+	/// Adds (or removes, adding twice cancels out) a non zero id.
+	pub fn insert(&mut self, id: u32) {
+		let sqr = gf_sqr(id);
+		let mut pow = id;
+		for s in self.syndromes.iter_mut() {
+			*s ^= pow;
+			pow = gf_mul(pow, sqr);
+		}
+	}
+
+	/// Merges another sketch of the same capacity into this one.
+	pub fn merge(&mut self, other: &Sketch) -> bool {
+		if self.syndromes.len() != other.syndromes.len() {
+			return false;
+		}
+		for (a, b) in self.syndromes.iter_mut().zip(other.syndromes.iter()) {
+			*a ^= *b;
+		}
+		true
+	}
+
+	/// Recovers the ids in the sketch, None if there are more than it can
+	/// decode.
+	pub fn decode(&self) -> Option<Vec<u32>> {
+		let capacity = self.syndromes.len();
+
+		// All power sums s_1..s_2c, even ones from s_2i = s_i^2.
+		let mut sums = vec![0; 2 * capacity];
+		for i in 0..capacity {
+			sums[2 * i] = self.syndromes[i];
+		}
+		for i in 1..=capacity {
+			sums[2 * i - 1] = gf_sqr(sums[i - 1]);
+		}
+
+		// The ids are the roots of the reversed connection polynomial.
+		let conn = berlekamp_massey(&sums);
+		let deg = conn.len() - 1;
+		if deg == 0 {
+			return Some(vec![]);
+		}
+		if deg > capacity || conn[deg] == 0 {
+			return None;
+		}
+		let mut f: Poly = conn.into_iter().rev().collect();
+		poly_make_monic(&mut f);
+
+		// It only has distinct roots in the field if it divides x^(2^32) - x.
+		let mut x = vec![0, 1];
+		poly_mod(&mut x, &f);
+		let mut p = x.clone();
+		for _ in 0..32 {
+			p = poly_sqr_mod(&p, &f);
+		}
+		if p != x {
+			return None;
+		}
+
+		let mut roots = Vec::with_capacity(deg);
+		if !find_roots(f, 1, &mut roots) || roots.len() != deg {
+			return None;
+		}
+		Some(roots)
+	}
+}
+
+impl Writeable for Sketch {
+	fn write<W: Writer>(&self, writer: &mut W) -> Result<(), ser::Error> {
+		writer.write_u16(self.syndromes.len() as u16)?;
+		for s in &self.syndromes {
+			writer.write_u32(*s)?;
+		}
+		Ok(())
+	}
+}
+
+impl Readable for Sketch {
+	fn read<R: Reader>(reader: &mut R) -> Result<Sketch, ser::Error> {
+		let len = reader.read_u16()? as usize;
+		if len > MAX_SKETCH_CAPACITY {
+			return Err(ser::Error::TooLargeReadErr);
+		}
+		if len == 0 {
+			return Err(ser::Error::CorruptedData);
+		}
+		let mut syndromes = Vec::with_capacity(len);
+		for _ in 0..len {
+			syndromes.push(reader.read_u32()?);
+		}
+		Ok(Sketch { syndromes })
+	}
+}
+
+/// Estimate of the size of the difference between two sets, assuming up to
+/// a quarter of the smaller one may be missing from the other.
+fn estimate_diff(ours: usize, theirs: usize) -> usize {
+	let (min, max) = if ours < theirs {
+		(ours, theirs)
+	} else {
+		(theirs, ours)
+	};
+	max - min + min / 4 + 1
+}
+
+// The set being reconciled in the current round, by short id.
+struct Round {
+	nonce: u64,
+	started: Instant,
+	ids: HashMap<u32, Hash>,
+}
+
+/// Reconciliation state with a single peer.
+pub struct TxRecon {
+	initiator: bool,
+	// txs we would have announced to the peer since the last round
+	set: HashSet<Hash>,
+	round: Option<Round>,
+	next_round: Instant,
+}
+
+impl TxRecon {
+	/// The side that opened the connection initiates the rounds.
+	pub fn new(initiator: bool) -> TxRecon {
+		let offset = thread_rng().gen_range(0, RECON_INTERVAL.as_millis() as u64);
+		TxRecon {
+			initiator,
+			set: HashSet::new(),
+			round: None,
+			next_round: Instant::now() + Duration::from_millis(offset),
+		}
+	}
+
+	/// Adds a tx to be reconciled in the next round. Returns false if the
+	/// set is full and the tx should be announced directly.
+	pub fn add(&mut self, h: Hash) -> bool {
+		if self.set.len() >= MAX_RECON_SET_SIZE && !self.set.contains(&h) {
+			return false;
+		}
+		self.set.insert(h);
+		true
+	}
+
+	// Moves the current set into a new round, along with anything left from
+	// a round that never completed. Skips txs the peer is known to have.
+	// Returns the txs left out of the round as their short ids collide, to be
+	// announced directly.
+	fn snapshot<F>(&mut self, nonce: u64, known: F) -> Vec<Hash>
+	where
+		F: Fn(&Hash) -> bool,
+	{
+		if let Some(round) = self.round.take() {
+			self.set.extend(round.ids.values().cloned());
+		}
+		let mut ids = HashMap::new();
+		let mut collided_ids = HashSet::new();
+		let mut collided = vec![];
+		for h in self.set.drain() {
+			if known(&h) {
+				continue;
+			}
+			let id = short_id(&h, nonce);
+			if collided_ids.contains(&id) {
+				collided.push(h);
+			} else if let Some(prev) = ids.insert(id, h) {
+				ids.remove(&id);
+				collided_ids.insert(id);
+				collided.push(prev);
+				collided.push(h);
+			}
+		}
+		self.round = Some(Round {
+			nonce,
+			started: Instant::now(),
+			ids,
+		});
+		collided
+	}
+
+	fn round_size(&self) -> usize {
+		self.round.as_ref().map(|r| r.ids.len()).unwrap_or(0)
+	}
+
+	/// Starts a new round if we are the initiator and one is due. Also
+	/// returns the txs to announce directly, left out of the round.
+	pub fn start_round<F>(&mut self, known: F) -> Option<(TxReconRequest, Vec<Hash>)>
+	where
+		F: Fn(&Hash) -> bool,
+	{
+		let now = Instant::now();
+		if !self.initiator || now < self.next_round {
+			return None;
+		}
+		if let Some(ref round) = self.round {
+			if now < round.started + RECON_TIMEOUT {
+				return None;
+			}
+		}
+		self.next_round = now + RECON_INTERVAL;
+
+		let nonce = thread_rng().gen();
+		let collided = self.snapshot(nonce, known);
+		let req = TxReconRequest {
+			nonce,
+			set_size: self.round_size() as u32,
+		};
+		Some((req, collided))
+	}
+
+	/// Responder, sketch of our set for the round the peer started, along
+	/// with the txs to announce directly, left out of the round. None if we
+	/// are the initiator, a request from the peer would replace our own round.
+	pub fn sketch<F>(&mut self, req: &TxReconRequest, known: F) -> Option<(TxSketch, Vec<Hash>)>
+	where
+		F: Fn(&Hash) -> bool,
+	{
+		if self.initiator {
+			return None;
+		}
+		let collided = self.snapshot(req.nonce, known);
+		let round = self.round.as_ref()?;
+		let mut sketch = Sketch::new(estimate_diff(round.ids.len(), req.set_size as usize));
+		for id in round.ids.keys() {
+			sketch.insert(*id);
+		}
+		let sketch = TxSketch {
+			nonce: req.nonce,
+			sketch,
+		};
+		Some((sketch, collided))
+	}
+
+	/// Initiator, decodes the difference with the responder's sketch. Returns
+	/// the txs to announce to the peer and the short ids of the txs we want
+	/// it to announce to us. None if the sketch is not for our current round.
+	pub fn reconcile(&mut self, remote: TxSketch) -> Option<(Vec<Hash>, TxReconDiff)> {
+		match self.round {
+			Some(ref round) if self.initiator && round.nonce == remote.nonce => (),
+			_ => return None,
+		}
+		let round = self.round.take()?;
+
+		let mut sketch = Sketch::new(remote.sketch.capacity());
+		for id in round.ids.keys() {
+			sketch.insert(*id);
+		}
+		let decoded = if sketch.merge(&remote.sketch) {
+			sketch.decode()
+		} else {
+			None
+		};
+
+		// Anything in the difference we do not have is only in their set.
+		match decoded {
+			Some(diff) => {
+				let (ours, theirs): (Vec<_>, Vec<_>) =
+					diff.into_iter().partition(|id| round.ids.contains_key(id));
+				Some((
+					ours.iter()
+						.filter_map(|id| round.ids.get(id).cloned())
+						.collect(),
+					TxReconDiff {
+						nonce: round.nonce,
+						decoded: true,
+						short_ids: theirs.into_iter().map(u32_to_short_id).collect(),
+					},
+				))
+			}
+			None => Some((
+				round.ids.values().cloned().collect(),
+				TxReconDiff {
+					nonce: round.nonce,
+					decoded: false,
+					short_ids: vec![],
+				},
+			)),
+		}
+	}
+
+	/// Responder, the txs to announce to the initiator at the end of the
+	/// round, our whole set if it could not decode the difference.
+	pub fn diff_received(&mut self, diff: &TxReconDiff) -> Vec<Hash> {
+		match self.round {
+			Some(ref round) if !self.initiator && round.nonce == diff.nonce => (),
+			_ => return vec![],
+		}
+		let round = match self.round.take() {
+			Some(round) => round,
+			None => return vec![],
+		};
+		if diff.decoded {
+			diff.short_ids
+				.iter()
+				.filter_map(|id| round.ids.get(&short_id_to_u32(id)).cloned())
+				.collect()
+		} else {
+			round.ids.values().cloned().collect()
+		}
+	}
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+	use crate::core::core::hash::Hashed;
+
+	fn hashes(from: u64, to: u64) -> Vec<Hash> {
+		(from..to).map(|n| n.hash()).collect()
+	}
+
+	#[test]
+	fn sketch_decode() {
+		let mut ours = Sketch::new(20);
+		let mut theirs = Sketch::new(20);
+		for id in 1..100u32 {
+			ours.insert(id * 7_919);
+			theirs.insert(id * 7_919);
+		}
+		ours.insert(1_000);
+		ours.insert(1_001);
+		theirs.insert(2_000);
+
+		assert!(ours.merge(&theirs));
+		let mut diff = ours.decode().unwrap();
+		diff.sort();
+		assert_eq!(diff, vec![1_000, 1_001, 2_000]);
+
+		// Too large a difference for the sketch.
+		let mut ours = Sketch::new(4);
+		for id in 1..10u32 {
+			ours.insert(id);
+		}
+		assert!(ours.merge(&Sketch::new(4)));
+		assert!(ours.decode().is_none());
+		assert!(!ours.merge(&Sketch::new(5)));
+	}
+
+	#[test]
+	fn recon_round() {
+		let mut initiator = TxRecon::new(true);
+		let mut responder = TxRecon::new(false);
+		initiator.next_round = Instant::now();
+
+		let shared = hashes(0, 50);
+		let only_initiator = hashes(50, 55);
+		let only_responder = hashes(100, 103);
+		for h in shared.iter().chain(only_initiator.iter()) {
+			assert!(initiator.add(*h));
+		}
+		for h in shared.iter().chain(only_responder.iter()) {
+			assert!(responder.add(*h));
+		}
+
+		let (req, collided) = initiator.start_round(|_| false).unwrap();
+		assert_eq!(req.set_size, 55);
+		assert!(collided.is_empty());
+		assert!(initiator.start_round(|_| false).is_none());
+
+		// The initiator does not answer requests, its own round stays as is.
+		assert!(initiator.sketch(&req, |_| false).is_none());
+
+		let (sketch, collided) = responder.sketch(&req, |_| false).unwrap();
+		assert!(collided.is_empty());
+		let (mut announce, diff) = initiator.reconcile(sketch).unwrap();
+		announce.sort();
+		let mut expected = only_initiator.clone();
+		expected.sort();
+		assert_eq!(announce, expected);
+		assert!(diff.decoded);
+
+		let mut announce = responder.diff_received(&diff);
+		announce.sort();
+		let mut expected = only_responder.clone();
+		expected.sort();
+		assert_eq!(announce, expected);
+	}
+
+	#[test]
+	fn recon_short_id_collision() {
+		// Find two hashes with the same short id for the round nonce.
+		let nonce = 42;
+		let mut seen = HashMap::new();
+		let (a, b) = (0u64..)
+			.map(|n| n.hash())
+			.find_map(|h| seen.insert(short_id(&h, nonce), h).map(|prev| (prev, h)))
+			.unwrap();
+
+		let mut recon = TxRecon::new(false);
+		let others = hashes(1_000_000, 1_010);
+		for h in others.iter().chain(vec![a, b].iter()) {
+			assert!(recon.add(*h));
+		}
+
+		// Both are announced directly rather than one silently dropped.
+		let mut collided = recon.snapshot(nonce, |_| false);
+		collided.sort();
+		let mut expected = vec![a, b];
+		expected.sort();
+		assert_eq!(collided, expected);
+		assert_eq!(recon.round_size(), others.len());
+	}
+}
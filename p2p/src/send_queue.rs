@@ -0,0 +1,396 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Per connection queue of outbound messages, split into lanes by priority so
+//! pings and block announcements are not stuck behind blocks and segments we
+//! are serving to the peer.
+//!
+//! The writer always takes the next message from the highest priority lane
+//! with anything queued, except that a lane passed over too many times in a
+//! row is served next so bulk data still makes progress.
+//! Each lane is bounded by the bytes queued on it (a single message is always
+//! accepted on an empty lane), what happens when full depends on the lane.
+//! Responses to requests are never dropped, queuing one waits for space
+//! instead, pushing back on the requesting peer.
+
+use crate::msg::{Msg, Type};
+use crate::types::Error;
+use std::collections::VecDeque;
+use std::sync::{Condvar, Mutex, MutexGuard};
+use std::time::{Duration, Instant};
+
+/// How long to wait for space in a full lane that never drops, before giving
+/// up on the peer.
+const FULL_LANE_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// Number of times in a row a lane with messages queued may be passed over
+/// for a higher priority lane.
+const MAX_SKIPPED: usize = 8;
+
+/// The lanes outbound messages are queued on, in order of priority.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum SendLane {
+	/// Pings, peer addresses and our own requests.
+	Control,
+	/// New block announcements (headers and compact blocks).
+	Blocks,
+	/// Transaction relay.
+	Txs,
+	/// Blocks, headers, segments and txhashset archives requested from us,
+	/// never dropped.
+	Bulk,
+}
+
+/// What to do with a message that does not fit in its lane.
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum DropPolicy {
+	/// Drop the new message, keeping what is already queued.
+	DropNewest,
+	/// Drop the oldest queued messages to make room, more recent ones
+	/// being more relevant.
+	DropOldest,
+	/// Wait for the writer to make room (up to `FULL_LANE_TIMEOUT`).
+	Wait,
+}
+
+impl SendLane {
+	const ALL: [SendLane; 4] = [
+		SendLane::Control,
+		SendLane::Blocks,
+		SendLane::Txs,
+		SendLane::Bulk,
+	];
+
+	/// The lane a message of the provided type is sent on.
+	pub fn of(msg_type: Type) -> SendLane {
+		match msg_type {
+			Type::Header | Type::CompactBlock => SendLane::Blocks,
+			Type::Transaction
+			| Type::StemTransaction
+			| Type::TransactionKernel
+			| Type::TransactionKernels
+			| Type::TxSketch
+			| Type::TxReconDiff => SendLane::Txs,
+			Type::Block
+			| Type::Headers
+			| Type::TxHashSetArchive
+			| Type::OutputBitmapSegment
+			| Type::OutputSegment
+			| Type::RangeProofSegment
+			| Type::KernelSegment => SendLane::Bulk,
+			_ => SendLane::Control,
+		}
+	}
+
+	/// Max bytes queued on the lane.
+	fn max_bytes(self) -> usize {
+		match self {
+			SendLane::Control => 256 * 1024,
+			SendLane::Blocks => 2 * 1024 * 1024,
+			SendLane::Txs => 2 * 1024 * 1024,
+			SendLane::Bulk => 16 * 1024 * 1024,
+		}
+	}
+
+	fn drop_policy(self) -> DropPolicy {
+		match self {
+			SendLane::Blocks => DropPolicy::DropOldest,
+			SendLane::Control | SendLane::Txs => DropPolicy::DropNewest,
+			SendLane::Bulk => DropPolicy::Wait,
+		}
+	}
+}
+
+struct QueueState {
+	lanes: Vec<VecDeque<Msg>>,
+	bytes: Vec<usize>,
+	// times each lane has been passed over in a row while non-empty
+	skipped: Vec<usize>,
+	closed: bool,
+}
+
+impl QueueState {
+	fn next_lane(&mut self) -> Option<usize> {
+		let lanes = &self.lanes;
+		let skipped = &self.skipped;
+		let starved = (0..lanes.len())
+			.rev()
+			.find(|i| !lanes[*i].is_empty() && skipped[*i] >= MAX_SKIPPED);
+		let next = starved.or_else(|| (0..lanes.len()).find(|i| !lanes[*i].is_empty()))?;
+
+		for i in 0..self.lanes.len() {
+			if i == next || self.lanes[i].is_empty() {
+				self.skipped[i] = 0;
+			} else {
+				self.skipped[i] += 1;
+			}
+		}
+		Some(next)
+	}
+}
+
+/// Outbound message queue shared between a connection handle and its writer.
+pub struct SendQueue {
+	state: Mutex<QueueState>,
+	ready: Condvar,
+	space: Condvar,
+}
+
+impl SendQueue {
+	pub fn new() -> SendQueue {
+		let n = SendLane::ALL.len();
+		SendQueue {
+			state: Mutex::new(QueueState {
+				lanes: (0..n).map(|_| VecDeque::new()).collect(),
+				bytes: vec![0; n],
+				skipped: vec![0; n],
+				closed: false,
+			}),
+			ready: Condvar::new(),
+			space: Condvar::new(),
+		}
+	}
+
+	fn lock(&self) -> MutexGuard<'_, QueueState> {
+		self.state.lock().unwrap_or_else(|e| e.into_inner())
+	}
+
+	/// Queue a message on the lane for its type, only blocking on a full lane
+	/// that never drops.
+	/// Errors if the queue has been closed (the writer has gone away) or we
+	/// waited too long for space.
+	/// Returns false if a message was dropped as the lane was full.
+	pub fn push(&self, msg: Msg) -> Result<bool, Error> {
+		let lane = SendLane::of(msg.msg_type());
+		let idx = lane as usize;
+		let size = msg.size();
+
+		let mut state = self.lock();
+		if state.closed {
+			return Err(Error::Send("send queue closed".to_owned()));
+		}
+
+		if lane.drop_policy() == DropPolicy::Wait {
+			let deadline = Instant::now() + FULL_LANE_TIMEOUT;
+			while !state.closed
+				&& !state.lanes[idx].is_empty()
+				&& state.bytes[idx] + size > lane.max_bytes()
+			{
+				let now = Instant::now();
+				if now >= deadline {
+					return Err(Error::Send(format!("send queue {:?} lane full", lane)));
+				}
+				state = self
+					.space
+					.wait_timeout(state, deadline - now)
+					.unwrap_or_else(|e| e.into_inner())
+					.0;
+			}
+			if state.closed {
+				return Err(Error::Send("send queue closed".to_owned()));
+			}
+		}
+
+		let mut dropped = false;
+		while !state.lanes[idx].is_empty() && state.bytes[idx] + size > lane.max_bytes() {
+			dropped = true;
+			match lane.drop_policy() {
+				DropPolicy::DropNewest | DropPolicy::Wait => break,
+				DropPolicy::DropOldest => {
+					if let Some(old) = state.lanes[idx].pop_front() {
+						state.bytes[idx] -= old.size();
+					}
+				}
+			}
+		}
+		if dropped {
+			debug!("send_queue: {:?} lane full, dropping msg", lane);
+			if lane.drop_policy() == DropPolicy::DropNewest {
+				return Ok(false);
+			}
+		}
+
+		state.bytes[idx] += size;
+		state.lanes[idx].push_back(msg);
+		drop(state);
+
+		self.ready.notify_one();
+		Ok(!dropped)
+	}
+
+	/// Next message to send, waiting up to the provided timeout for one.
+	pub fn pop(&self, timeout: Duration) -> Option<Msg> {
+		let mut state = self.lock();
+		if state.lanes.iter().all(|l| l.is_empty()) {
+			state = self
+				.ready
+				.wait_timeout(state, timeout)
+				.unwrap_or_else(|e| e.into_inner())
+				.0;
+		}
+		let idx = state.next_lane()?;
+		let msg = state.lanes[idx].pop_front()?;
+		state.bytes[idx] -= msg.size();
+		drop(state);
+
+		self.space.notify_all();
+		Some(msg)
+	}
+
+	/// Close the queue, anything still queued is dropped and further
+	/// messages are rejected.
+	pub fn close(&self) {
+		let mut state = self.lock();
+		state.closed = true;
+		for lane in state.lanes.iter_mut() {
+			lane.clear();
+		}
+		for bytes in state.bytes.iter_mut() {
+			*bytes = 0;
+		}
+		drop(state);
+
+		self.space.notify_all();
+	}
+
+	/// Bytes currently queued on each lane.
+	pub fn queued_bytes(&self) -> Vec<(SendLane, usize)> {
+		let state = self.lock();
+		SendLane::ALL
+			.iter()
+			.map(|lane| (*lane, state.bytes[*lane as usize]))
+			.collect()
+	}
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+	use crate::core::ser::ProtocolVersion;
+	use std::sync::{mpsc, Arc};
+	use std::thread;
+
+	fn msg(msg_type: Type, len: usize) -> Msg {
+		Msg::new(msg_type, vec![0u8; len], ProtocolVersion(1)).unwrap()
+	}
+
+	fn pop_types(queue: &SendQueue, n: usize) -> Vec<Type> {
+		(0..n)
+			.map(|_| queue.pop(Duration::from_millis(0)).unwrap().msg_type())
+			.collect()
+	}
+
+	#[test]
+	fn send_queue_priority() {
+		let queue = SendQueue::new();
+		for _ in 0..3 {
+			queue.push(msg(Type::Block, 1_000)).unwrap();
+		}
+		queue.push(msg(Type::Transaction, 100)).unwrap();
+		queue.push(msg(Type::CompactBlock, 100)).unwrap();
+		queue.push(msg(Type::Pong, 10)).unwrap();
+
+		assert_eq!(
+			pop_types(&queue, 6),
+			vec![
+				Type::Pong,
+				Type::CompactBlock,
+				Type::Transaction,
+				Type::Block,
+				Type::Block,
+				Type::Block
+			]
+		);
+		assert!(queue.pop(Duration::from_millis(0)).is_none());
+	}
+
+	#[test]
+	fn send_queue_no_starvation() {
+		let queue = SendQueue::new();
+		queue.push(msg(Type::Block, 1_000)).unwrap();
+		for _ in 0..(MAX_SKIPPED * 2) {
+			queue.push(msg(Type::Ping, 10)).unwrap();
+		}
+
+		// The block goes out after at most MAX_SKIPPED pings.
+		let types = pop_types(&queue, MAX_SKIPPED + 1);
+		assert_eq!(types[MAX_SKIPPED], Type::Block);
+	}
+
+	#[test]
+	fn send_queue_drop_policies() {
+		let queue = SendQueue::new();
+
+		// Tx relay keeps what is queued, always accepting a message on an empty lane.
+		let big = SendLane::Txs.max_bytes();
+		assert!(queue.push(msg(Type::Transaction, big)).unwrap());
+		assert!(!queue.push(msg(Type::Transaction, 10)).unwrap());
+
+		// Block announcements drop the oldest to make room.
+		let half = SendLane::Blocks.max_bytes() / 2;
+		assert!(queue.push(msg(Type::Header, half)).unwrap());
+		assert!(queue.push(msg(Type::CompactBlock, half - 100)).unwrap());
+		assert!(!queue.push(msg(Type::Header, 1_000)).unwrap());
+
+		assert_eq!(
+			pop_types(&queue, 3),
+			vec![Type::CompactBlock, Type::Header, Type::Transaction]
+		);
+
+		queue.close();
+		assert!(queue.push(msg(Type::Ping, 10)).is_err());
+	}
+
+	#[test]
+	fn send_queue_never_drops_responses() {
+		let queue = Arc::new(SendQueue::new());
+		let big = SendLane::Bulk.max_bytes();
+		assert!(queue.push(msg(Type::Block, big)).unwrap());
+
+		// Headers requested from us wait for the writer rather than being dropped.
+		let (done_tx, done_rx) = mpsc::channel();
+		let pushing = {
+			let queue = queue.clone();
+			thread::spawn(move || {
+				let res = queue.push(msg(Type::Headers, 1_000));
+				done_tx.send(res.ok()).unwrap();
+			})
+		};
+		assert!(done_rx.recv_timeout(Duration::from_millis(200)).is_err());
+
+		assert_eq!(pop_types(&queue, 1), vec![Type::Block]);
+		assert_eq!(
+			done_rx.recv_timeout(Duration::from_secs(10)),
+			Ok(Some(true))
+		);
+		pushing.join().unwrap();
+		assert_eq!(pop_types(&queue, 1), vec![Type::Headers]);
+
+		// A push still waiting when the queue is closed gives up.
+		assert!(queue.push(msg(Type::Block, big)).unwrap());
+		let (done_tx, done_rx) = mpsc::channel();
+		let pushing = {
+			let queue = queue.clone();
+			thread::spawn(move || {
+				done_tx
+					.send(queue.push(msg(Type::Headers, 1_000)).is_err())
+					.unwrap();
+			})
+		};
+		assert!(done_rx.recv_timeout(Duration::from_millis(200)).is_err());
+		queue.close();
+		assert_eq!(done_rx.recv_timeout(Duration::from_secs(10)), Ok(true));
+		pushing.join().unwrap();
+	}
+}
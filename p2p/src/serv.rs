@@ -27,7 +27,9 @@ use crate::core::core::hash::Hash;
 use crate::core::core::{OutputIdentifier, Segment, SegmentIdentifier, TxKernel};
 use crate::core::global;
 use crate::core::pow::Difficulty;
+use crate::dispatch::{Dispatcher, LaneStats};
 use crate::handshake::Handshake;
+use crate::msg::{TxReconDiff, TxReconRequest, TxSketch};
 use crate::peer::Peer;
 use crate::peers::Peers;
 use crate::store::PeerStore;
@@ -39,6 +41,10 @@ use crate::util::secp::pedersen::RangeProof;
 use crate::util::StopState;
 use chrono::prelude::{DateTime, Utc};
 
+/// How often we check for txs due to be announced to (or reconciled with)
+/// our peers.
+const TX_TRICKLE_TICK: Duration = Duration::from_millis(50);
+
 /// P2P server implementation, handling bootstrapping to find and connect to
 /// peers, receiving connections from other peers and keep track of all of them.
 pub struct Server {
@@ -46,6 +52,7 @@ pub struct Server {
 	capabilities: Capabilities,
 	handshake: Arc<Handshake>,
 	pub peers: Arc<Peers>,
+	dispatcher: Arc<Dispatcher>,
 	stop_state: Arc<StopState>,
 }
 
@@ -60,11 +67,34 @@ impl Server {
 		genesis: Hash,
 		stop_state: Arc<StopState>,
 	) -> Result<Server, Error> {
+		let peers = Arc::new(Peers::new(
+			PeerStore::new(db_root)?,
+			adapter,
+			config.clone(),
+		));
+
+		// Announce txs to peers in batches, on a short randomized timer per peer,
+		// and start rounds of tx reconciliation with peers supporting it.
+		{
+			let peers = peers.clone();
+			let stop_state = stop_state.clone();
+			thread::Builder::new()
+				.name("p2p_tx_trickle".to_string())
+				.spawn(move || {
+					while !stop_state.is_stopped() {
+						peers.flush_tx_announcements();
+						peers.reconcile_txs();
+						thread::sleep(TX_TRICKLE_TICK);
+					}
+				})?;
+		}
+
 		Ok(Server {
 			config: config.clone(),
 			capabilities,
-			handshake: Arc::new(Handshake::new(genesis, config.clone())),
-			peers: Arc::new(Peers::new(PeerStore::new(db_root)?, adapter, config)),
+			handshake: Arc::new(Handshake::new(genesis, config)),
+			peers,
+			dispatcher: Arc::new(Dispatcher::new()),
 			stop_state,
 		})
 	}
@@ -186,6 +216,7 @@ impl Server {
 					PeerAddr(addr),
 					&self.handshake,
 					self.peers.clone(),
+					self.dispatcher.clone(),
 				)?;
 				let peer = Arc::new(peer);
 				self.peers.add_connected(peer.clone())?;
@@ -217,6 +248,7 @@ impl Server {
 			total_diff,
 			&self.handshake,
 			self.peers.clone(),
+			self.dispatcher.clone(),
 		)?;
 		self.peers.add_connected(Arc::new(peer))?;
 		Ok(())
@@ -268,9 +300,15 @@ impl Server {
 		false
 	}
 
+	/// Queue depth and handler latency of the inbound message dispatcher.
+	pub fn dispatch_stats(&self) -> Vec<LaneStats> {
+		self.dispatcher.stats()
+	}
+
 	pub fn stop(&self) {
 		self.stop_state.stop();
 		self.peers.stop();
+		self.dispatcher.stop();
 	}
 
 	/// Pause means: stop all the current peers connection, only for tests.
@@ -299,6 +337,13 @@ impl ChainAdapter for DummyAdapter {
 	fn tx_kernel_received(&self, _h: Hash, _peer_info: &PeerInfo) -> Result<bool, chain::Error> {
 		Ok(true)
 	}
+	fn tx_kernels_received(
+		&self,
+		_hashes: &[Hash],
+		_peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		Ok(true)
+	}
 	fn transaction_received(
 		&self,
 		_: core::Transaction,
@@ -338,6 +383,9 @@ impl ChainAdapter for DummyAdapter {
 	fn locate_headers(&self, _: &[Hash]) -> Result<Vec<core::BlockHeader>, chain::Error> {
 		Ok(vec![])
 	}
+	fn get_headers_by_height(&self, _: u64) -> Result<Vec<core::BlockHeader>, chain::Error> {
+		Ok(vec![])
+	}
 	fn get_block(&self, _: Hash, _: &PeerInfo) -> Option<core::Block> {
 		None
 	}
@@ -421,4 +469,9 @@ impl NetAdapter for DummyAdapter {
 	fn is_banned(&self, _: PeerAddr) -> bool {
 		false
 	}
+	fn tx_recon_requested(&self, _: PeerAddr, _: TxReconRequest) -> Option<TxSketch> {
+		None
+	}
+	fn tx_sketch_received(&self, _: PeerAddr, _: TxSketch) {}
+	fn tx_recon_diff_received(&self, _: PeerAddr, _: TxReconDiff) {}
 }
@@ -17,9 +17,12 @@
 use chrono::Utc;
 use num::FromPrimitive;
 use rand::prelude::*;
+use std::collections::{HashMap, HashSet};
+use std::time::{Duration, Instant};
 
 use crate::core::ser::{self, Readable, Reader, Writeable, Writer};
 use crate::types::{Capabilities, PeerAddr, ReasonForBan};
+use crate::util::{Mutex, RwLock};
 use grin_store::{self, option_to_not_found, to_key, Error};
 
 const DB_NAME: &str = "peer";
@@ -29,7 +32,7 @@ const PEER_PREFIX: u8 = b'P';
 
 // Types of messages
 enum_from_primitive! {
-	#[derive(Debug, Clone, Copy, PartialEq, Serialize, Deserialize)]
+	#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Serialize, Deserialize)]
 	pub enum State {
 		Healthy = 0,
 		Banned = 1,
@@ -107,51 +110,124 @@ impl Readable for PeerData {
 	}
 }
 
+/// Peers changed in memory are written to the db when this many are pending.
+const FLUSH_BATCH_SIZE: usize = 1_000;
+
+/// Peers changed in memory are written to the db at least this often, as
+/// long as there are further changes.
+const FLUSH_INTERVAL: Duration = Duration::from_secs(10);
+
+/// In-memory table of all known peers, indexed by state and capabilities.
+struct PeerTable {
+	peers: HashMap<PeerAddr, PeerData>,
+	index: HashMap<(State, Capabilities), HashSet<PeerAddr>>,
+	/// Peers updated (or deleted) since the last flush to the db.
+	dirty: HashSet<PeerAddr>,
+	last_flush: Instant,
+}
+
+impl PeerTable {
+	fn insert(&mut self, p: PeerData) {
+		self.dirty.insert(p.addr);
+		self.remove_from_index(p.addr);
+		self.index
+			.entry((p.flags, p.capabilities))
+			.or_insert_with(HashSet::new)
+			.insert(p.addr);
+		self.peers.insert(p.addr, p);
+	}
+
+	fn remove(&mut self, peer_addr: PeerAddr) {
+		self.remove_from_index(peer_addr);
+		if self.peers.remove(&peer_addr).is_some() {
+			self.dirty.insert(peer_addr);
+		}
+	}
+
+	fn remove_from_index(&mut self, peer_addr: PeerAddr) {
+		if let Some(p) = self.peers.get(&peer_addr) {
+			let key = (p.flags, p.capabilities);
+			if let Some(addrs) = self.index.get_mut(&key) {
+				addrs.remove(&peer_addr);
+				if addrs.is_empty() {
+					self.index.remove(&key);
+				}
+			}
+		}
+	}
+
+	fn needs_flush(&self) -> bool {
+		self.dirty.len() >= FLUSH_BATCH_SIZE
+			|| (!self.dirty.is_empty() && self.last_flush.elapsed() >= FLUSH_INTERVAL)
+	}
+}
+
 /// Storage facility for peer data.
+/// All peers are kept in memory and served from there, changes are written
+/// back to the db in batches (see `flush`).
 pub struct PeerStore {
 	db: grin_store::Store,
+	table: RwLock<PeerTable>,
+	flush_lock: Mutex<()>,
 }
 
 impl PeerStore {
 	/// Instantiates a new peer store under the provided root path.
 	pub fn new(db_root: &str) -> Result<PeerStore, Error> {
 		let db = grin_store::Store::new(db_root, Some(DB_NAME), Some(STORE_SUBPATH), None)?;
-		Ok(PeerStore { db: db })
+		let mut table = PeerTable {
+			peers: HashMap::new(),
+			index: HashMap::new(),
+			dirty: HashSet::new(),
+			last_flush: Instant::now(),
+		};
+		let key = to_key(PEER_PREFIX, "");
+		let protocol_version = db.protocol_version();
+		for p in db.iter(&key, move |_, mut v| {
+			ser::deserialize(&mut v, protocol_version).map_err(From::from)
+		})? {
+			table.insert(p);
+		}
+		table.dirty.clear();
+		Ok(PeerStore {
+			db: db,
+			table: RwLock::new(table),
+			flush_lock: Mutex::new(()),
+		})
 	}
 
 	pub fn save_peer(&self, p: &PeerData) -> Result<(), Error> {
 		debug!("save_peer: {:?} marked {:?}", p.addr, p.flags);
-
-		let batch = self.db.batch()?;
-		batch.put_ser(&peer_key(p.addr)[..], p)?;
-		batch.commit()
+		self.table.write().insert(p.clone());
+		self.maybe_flush()
 	}
 
 	pub fn save_peers(&self, p: Vec<PeerData>) -> Result<(), Error> {
-		let batch = self.db.batch()?;
-		for pd in p {
-			debug!("save_peers: {:?} marked {:?}", pd.addr, pd.flags);
-			batch.put_ser(&peer_key(pd.addr)[..], &pd)?;
+		{
+			let mut table = self.table.write();
+			for pd in p {
+				debug!("save_peers: {:?} marked {:?}", pd.addr, pd.flags);
+				table.insert(pd);
+			}
 		}
-		batch.commit()
+		self.maybe_flush()
 	}
 
 	pub fn get_peer(&self, peer_addr: PeerAddr) -> Result<PeerData, Error> {
-		option_to_not_found(self.db.get_ser(&peer_key(peer_addr)[..]), || {
+		option_to_not_found(Ok(self.table.read().peers.get(&peer_addr).cloned()), || {
 			format!("Peer at address: {}", peer_addr)
 		})
 	}
 
 	pub fn exists_peer(&self, peer_addr: PeerAddr) -> Result<bool, Error> {
-		self.db.exists(&peer_key(peer_addr)[..])
+		Ok(self.table.read().peers.contains_key(&peer_addr))
 	}
 
 	/// TODO - allow below added to avoid github issue reports
 	#[allow(dead_code)]
 	pub fn delete_peer(&self, peer_addr: PeerAddr) -> Result<(), Error> {
-		let batch = self.db.batch()?;
-		batch.delete(&peer_key(peer_addr)[..])?;
-		batch.commit()
+		self.table.write().remove(peer_addr);
+		self.maybe_flush()
 	}
 
 	/// Find some peers in our local db.
@@ -161,45 +237,57 @@ impl PeerStore {
 		cap: Capabilities,
 		count: usize,
 	) -> Result<Vec<PeerData>, Error> {
-		let peers = self
-			.peers_iter()?
-			.filter(|p| p.flags == state && p.capabilities.contains(cap))
-			.choose_multiple(&mut thread_rng(), count);
+		let table = self.table.read();
+		let peers = table
+			.index
+			.iter()
+			.filter(|((s, c), _)| *s == state && c.contains(cap))
+			.flat_map(|(_, addrs)| addrs.iter())
+			.choose_multiple(&mut thread_rng(), count)
+			.into_iter()
+			.filter_map(|addr| table.peers.get(addr).cloned())
+			.collect();
 		Ok(peers)
 	}
 
+	/// Number of known peers in the provided state.
+	pub fn count_peers(&self, state: State) -> usize {
+		self.table
+			.read()
+			.index
+			.iter()
+			.filter(|((s, _), _)| *s == state)
+			.map(|(_, addrs)| addrs.len())
+			.sum()
+	}
+
 	/// Iterator over all known peers.
 	pub fn peers_iter(&self) -> Result<impl Iterator<Item = PeerData>, Error> {
-		let key = to_key(PEER_PREFIX, "");
-		let protocol_version = self.db.protocol_version();
-		self.db.iter(&key, move |_, mut v| {
-			ser::deserialize(&mut v, protocol_version).map_err(From::from)
-		})
+		Ok(self.all_peers()?.into_iter())
 	}
 
 	/// List all known peers
 	/// Used for /v1/peers/all api endpoint
 	pub fn all_peers(&self) -> Result<Vec<PeerData>, Error> {
-		let peers: Vec<PeerData> = self.peers_iter()?.collect();
+		let peers: Vec<PeerData> = self.table.read().peers.values().cloned().collect();
 		Ok(peers)
 	}
 
 	/// Convenience method to load a peer data, update its status and save it
 	/// back. If new state is Banned its last banned time will be updated too.
 	pub fn update_state(&self, peer_addr: PeerAddr, new_state: State) -> Result<(), Error> {
-		let batch = self.db.batch()?;
-
-		let mut peer =
-			option_to_not_found(batch.get_ser::<PeerData>(&peer_key(peer_addr)[..]), || {
+		{
+			let mut table = self.table.write();
+			let mut peer = option_to_not_found(Ok(table.peers.get(&peer_addr).cloned()), || {
 				format!("Peer at address: {}", peer_addr)
 			})?;
-		peer.flags = new_state;
-		if new_state == State::Banned {
-			peer.last_banned = Utc::now().timestamp();
+			peer.flags = new_state;
+			if new_state == State::Banned {
+				peer.last_banned = Utc::now().timestamp();
+			}
+			table.insert(peer);
 		}
-
-		batch.put_ser(&peer_key(peer_addr)[..], &peer)?;
-		batch.commit()
+		self.maybe_flush()
 	}
 
 	/// Deletes peers from the storage that satisfy some condition `predicate`
@@ -207,26 +295,71 @@ impl PeerStore {
 	where
 		F: Fn(&PeerData) -> bool,
 	{
-		let mut to_remove = vec![];
-
-		for x in self.peers_iter()? {
-			if predicate(&x) {
-				to_remove.push(x)
+		{
+			let mut table = self.table.write();
+			let to_remove: Vec<PeerAddr> = table
+				.peers
+				.values()
+				.filter(|p| predicate(p))
+				.map(|p| p.addr)
+				.collect();
+			for addr in to_remove {
+				table.remove(addr);
 			}
 		}
+		self.maybe_flush()
+	}
 
-		// Delete peers in single batch
-		if !to_remove.is_empty() {
-			let batch = self.db.batch()?;
+	/// Writes all the peers changed since the last flush to the db, in a
+	/// single batch.
+	pub fn flush(&self) -> Result<(), Error> {
+		let _lock = self.flush_lock.lock();
+		let changes: Vec<(PeerAddr, Option<PeerData>)> = {
+			let mut table = self.table.write();
+			table.last_flush = Instant::now();
+			let dirty: Vec<PeerAddr> = table.dirty.drain().collect();
+			dirty
+				.into_iter()
+				.map(|addr| (addr, table.peers.get(&addr).cloned()))
+				.collect()
+		};
+		if changes.is_empty() {
+			return Ok(());
+		}
 
-			for peer in to_remove {
-				batch.delete(&peer_key(peer.addr)[..])?;
+		let res = self.db.batch().and_then(|batch| {
+			for (addr, peer) in &changes {
+				match peer {
+					Some(p) => batch.put_ser(&peer_key(*addr)[..], p)?,
+					None => batch.delete(&peer_key(*addr)[..])?,
+				}
 			}
+			batch.commit()
+		});
+		if res.is_err() {
+			// Try again on next flush.
+			self.table
+				.write()
+				.dirty
+				.extend(changes.into_iter().map(|(addr, _)| addr));
+		}
+		res
+	}
 
-			batch.commit()?;
+	fn maybe_flush(&self) -> Result<(), Error> {
+		if self.table.read().needs_flush() {
+			self.flush()
+		} else {
+			Ok(())
 		}
+	}
+}
 
-		Ok(())
+impl Drop for PeerStore {
+	fn drop(&mut self) {
+		if let Err(e) = self.flush() {
+			error!("Failed to save peers: {:?}", e);
+		}
 	}
 }
 
@@ -33,7 +33,7 @@ use crate::core::core::{OutputIdentifier, Segment, SegmentIdentifier, TxKernel};
 use crate::core::global;
 use crate::core::pow::Difficulty;
 use crate::core::ser::{self, ProtocolVersion, Readable, Reader, Writeable, Writer};
-use crate::msg::PeerAddrs;
+use crate::msg::{PeerAddrs, TxReconDiff, TxReconRequest, TxSketch};
 use crate::util::secp::pedersen::RangeProof;
 use crate::util::RwLock;
 
@@ -50,6 +50,9 @@ pub const MAX_PEER_ADDRS: u32 = 256;
 /// Maximum number of block header hashes to send as part of a locator
 pub const MAX_LOCATORS: u32 = 20;
 
+/// Maximum number of tx kernel hashes to announce or request in a single msg
+pub const MAX_TX_KERNEL_HASHES: u32 = 1_000;
+
 /// How long a banned peer should be banned for
 const BAN_WINDOW: i64 = 10800;
 
@@ -391,6 +394,14 @@ bitflags! {
 		const PIBD_HIST = 0b0001_0000;
 		/// Can provide historical blocks for archival sync.
 		const BLOCK_HIST = 0b0010_0000;
+		/// Can announce and request txs in batches of kernel hashes.
+		const TX_KERNEL_HASH_BATCH = 0b0100_0000;
+		/// Can reconcile recently relayed txs rather than announcing all of
+		/// them (optional, not part of the defaults).
+		const TX_RECONCILIATION = 0b1000_0000;
+		/// Can provide a chunk of headers starting at a given height, so
+		/// header sync can download from several peers in parallel.
+		const HEADERS_BY_HEIGHT = 0b1_0000_0000;
 	}
 }
 
@@ -402,6 +413,8 @@ impl Default for Capabilities {
 			| Capabilities::PEER_LIST
 			| Capabilities::TX_KERNEL_HASH
 			| Capabilities::PIBD_HIST
+			| Capabilities::TX_KERNEL_HASH_BATCH
+			| Capabilities::HEADERS_BY_HEIGHT
 	}
 }
 
@@ -563,6 +576,14 @@ pub trait ChainAdapter: Sync + Send {
 		peer_info: &PeerInfo,
 	) -> Result<bool, chain::Error>;
 
+	/// A batch of tx kernel hashes has been announced by one of our peers.
+	/// Any txs we do not have are requested from the peer in a single batch.
+	fn tx_kernels_received(
+		&self,
+		kernel_hashes: &[Hash],
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error>;
+
 	/// A block has been received from one of our peers. Returns true if the
 	/// block could be handled properly and is not deemed defective by the
 	/// chain. Returning false means the block will never be valid and
@@ -600,6 +621,10 @@ pub trait ChainAdapter: Sync + Send {
 	/// immediately.
 	fn locate_headers(&self, locator: &[Hash]) -> Result<Vec<core::BlockHeader>, chain::Error>;
 
+	/// Gets up to MAX_BLOCK_HEADERS headers of our header chain, starting at
+	/// the provided height.
+	fn get_headers_by_height(&self, height: u64) -> Result<Vec<core::BlockHeader>, chain::Error>;
+
 	/// Gets a full block by its hash.
 	/// Converts block to v2 compatibility if necessary (based on peer protocol version).
 	fn get_block(&self, h: Hash, peer_info: &PeerInfo) -> Option<core::Block>;
@@ -684,6 +709,16 @@ pub trait NetAdapter: ChainAdapter {
 
 	/// Is this peer currently banned?
 	fn is_banned(&self, addr: PeerAddr) -> bool;
+
+	/// A peer started a round of tx reconciliation, returns the sketch of
+	/// the txs we would have announced to it.
+	fn tx_recon_requested(&self, addr: PeerAddr, req: TxReconRequest) -> Option<TxSketch>;
+
+	/// Received the sketch for the round of tx reconciliation we started.
+	fn tx_sketch_received(&self, addr: PeerAddr, sketch: TxSketch);
+
+	/// A round of tx reconciliation the peer started is over.
+	fn tx_recon_diff_received(&self, addr: PeerAddr, diff: TxReconDiff);
 }
 
 #[derive(Clone, Debug)]
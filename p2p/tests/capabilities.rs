@@ -42,6 +42,8 @@ fn default_capabilities() {
 	assert!(x.contains(Capabilities::PEER_LIST));
 	assert!(x.contains(Capabilities::TX_KERNEL_HASH));
 	assert!(x.contains(Capabilities::PIBD_HIST));
+	assert!(x.contains(Capabilities::TX_KERNEL_HASH_BATCH));
+	assert!(x.contains(Capabilities::HEADERS_BY_HEIGHT));
 
 	assert_eq!(
 		x,
@@ -50,5 +52,7 @@ fn default_capabilities() {
 			| Capabilities::PEER_LIST
 			| Capabilities::TX_KERNEL_HASH
 			| Capabilities::PIBD_HIST
+			| Capabilities::TX_KERNEL_HASH_BATCH
+			| Capabilities::HEADERS_BY_HEIGHT
 	);
 }
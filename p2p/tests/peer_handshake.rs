@@ -85,6 +85,7 @@ fn peer_handshake() {
 		my_addr,
 		&p2p::handshake::Handshake::new(Hash::from_vec(&vec![]), p2p_config.clone()),
 		net_adapter,
+		Arc::new(p2p::Dispatcher::new()),
 	)
 	.unwrap();
 
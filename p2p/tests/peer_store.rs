@@ -0,0 +1,125 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use grin_p2p as p2p;
+use grin_util as util;
+
+use crate::p2p::types::{Capabilities, PeerAddr, ReasonForBan};
+use crate::p2p::{PeerData, PeerStore, State};
+use std::net::{IpAddr, Ipv4Addr, SocketAddr};
+use std::time::Instant;
+
+const PEER_COUNT: u32 = 100_000;
+
+fn peer(i: u32) -> PeerData {
+	let ip = Ipv4Addr::from(0x0a00_0000 + i);
+	PeerData {
+		addr: PeerAddr(SocketAddr::new(IpAddr::V4(ip), 3414)),
+		capabilities: if i % 2 == 0 {
+			Capabilities::UNKNOWN
+		} else {
+			Capabilities::PEER_LIST
+		},
+		user_agent: "MW/Grin 5.2.0".to_string(),
+		flags: match i % 10 {
+			0 => State::Banned,
+			1 | 2 => State::Defunct,
+			_ => State::Healthy,
+		},
+		last_banned: 0,
+		ban_reason: ReasonForBan::None,
+		last_connected: 0,
+	}
+}
+
+// Peer lookups of a seed monitor cycle with 100k known peers.
+#[test]
+fn test_peer_store_100k() {
+	util::init_test_logger();
+	let db_root = ".grin_peer_store";
+	let _ = std::fs::remove_dir_all(db_root);
+
+	{
+		let store = PeerStore::new(db_root).unwrap();
+		store
+			.save_peers((0..PEER_COUNT).map(peer).collect())
+			.unwrap();
+		store.flush().unwrap();
+	}
+
+	// Loading all peers from the db, which every monitor cycle used to do.
+	let start = Instant::now();
+	let store = PeerStore::new(db_root).unwrap();
+	let load = start.elapsed();
+
+	let start = Instant::now();
+	let cycles = 100;
+	for _ in 0..cycles {
+		let banned = store.count_peers(State::Banned);
+		assert_eq!(banned, PEER_COUNT as usize / 10);
+		assert_eq!(
+			store
+				.find_peers(State::Banned, Capabilities::UNKNOWN, banned)
+				.unwrap()
+				.len(),
+			banned
+		);
+		assert_eq!(store.count_peers(State::Defunct), PEER_COUNT as usize / 5);
+		let healthy = store
+			.find_peers(State::Healthy, Capabilities::UNKNOWN, 128)
+			.unwrap();
+		assert_eq!(healthy.len(), 128);
+		for p in healthy {
+			assert!(store.exists_peer(p.addr).unwrap());
+		}
+	}
+	println!(
+		"{} peers: loading from db {:?}, monitor cycle {:?}",
+		PEER_COUNT,
+		load,
+		start.elapsed() / cycles
+	);
+
+	// Capabilities index.
+	let peer_lists = store
+		.find_peers(State::Healthy, Capabilities::PEER_LIST, 1_000)
+		.unwrap();
+	assert_eq!(peer_lists.len(), 1_000);
+	assert!(peer_lists
+		.iter()
+		.all(|p| p.capabilities.contains(Capabilities::PEER_LIST)));
+
+	// Changes are served from memory right away and persisted on flush.
+	let addr = peer(3).addr;
+	store.update_state(addr, State::Banned).unwrap();
+	assert_eq!(store.get_peer(addr).unwrap().flags, State::Banned);
+	assert_eq!(
+		store.count_peers(State::Banned),
+		PEER_COUNT as usize / 10 + 1
+	);
+	store.delete_peers(|p| p.flags == State::Defunct).unwrap();
+	assert_eq!(store.count_peers(State::Defunct), 0);
+	drop(store);
+
+	let store = PeerStore::new(db_root).unwrap();
+	assert_eq!(store.get_peer(addr).unwrap().flags, State::Banned);
+	assert_eq!(store.count_peers(State::Defunct), 0);
+	assert_eq!(
+		store.all_peers().unwrap().len(),
+		PEER_COUNT as usize * 4 / 5
+	);
+	drop(store);
+
+	let _ = std::fs::remove_dir_all(db_root);
+}
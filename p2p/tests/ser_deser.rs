@@ -12,8 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+use grin_core as core;
 use grin_p2p as p2p;
 
+use self::core::global::{self, ChainTypes};
+use self::core::ser::{self, ProtocolVersion};
 use num::FromPrimitive;
 
 // Test that Healthy == 0.
@@ -49,28 +52,54 @@ fn test_capabilities() {
 		p2p::types::Capabilities::UNKNOWN
 	);
 	assert_eq!(
-		p2p::types::Capabilities::from_bits_truncate(0b10000000 as u32),
+		p2p::types::Capabilities::from_bits_truncate(0b10_0000_0000 as u32),
 		p2p::types::Capabilities::UNKNOWN
 	);
 
 	assert_eq!(
 		expected,
-		p2p::types::Capabilities::from_bits_truncate(0b11111 as u32),
+		p2p::types::Capabilities::from_bits_truncate(0b1_0101_1111 as u32),
 	);
 	assert_eq!(
 		expected,
-		p2p::types::Capabilities::from_bits_truncate(0b00011111 as u32),
+		p2p::types::Capabilities::from_bits_truncate(0b11_0101_1111 as u32),
 	);
 
 	assert_eq!(
 		expected,
-		p2p::types::Capabilities::from_bits_truncate(0b01011111 as u32),
+		p2p::types::Capabilities::from_bits_truncate(0b01_0101_1111 as u32),
 	);
 
-	assert!(p2p::types::Capabilities::from_bits_truncate(0b01011111 as u32).contains(expected));
+	assert!(p2p::types::Capabilities::from_bits_truncate(0b11_1101_1111 as u32).contains(expected));
 
 	assert!(
 		p2p::types::Capabilities::from_bits_truncate(0b00101111 as u32)
 			.contains(p2p::types::Capabilities::TX_KERNEL_HASH)
 	);
 }
+
+#[test]
+fn test_get_headers_by_height() {
+	global::set_local_chain_type(ChainTypes::AutomatedTesting);
+	let version = ProtocolVersion::local();
+	assert_eq!(
+		p2p::msg::Type::from_i32(34),
+		Some(p2p::msg::Type::GetHeadersByHeight)
+	);
+
+	let body = ser::ser_vec(&1025u64, version).unwrap();
+	let header = p2p::msg::MsgHeader::new(p2p::msg::Type::GetHeadersByHeight, body.len() as u64);
+	let mut bytes = ser::ser_vec(&header, version).unwrap();
+	bytes.extend_from_slice(&body);
+
+	let mut stream = &bytes[..];
+	match p2p::msg::read_header(&mut stream, version).unwrap() {
+		p2p::msg::MsgHeaderWrapper::Known(header) => {
+			assert_eq!(header.msg_type, p2p::msg::Type::GetHeadersByHeight);
+			assert_eq!(header.msg_len, 8);
+		}
+		p2p::msg::MsgHeaderWrapper::Unknown(..) => panic!("unknown msg type"),
+	}
+	let height: u64 = ser::deserialize(&mut stream, version).unwrap();
+	assert_eq!(height, 1025);
+}
@@ -0,0 +1,402 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use grin_chain as chain;
+use grin_core as core;
+use grin_p2p as p2p;
+
+use grin_util as util;
+use grin_util::{RwLock, StopState};
+
+use std::collections::HashMap;
+use std::fs::{self, File};
+use std::net::{SocketAddr, TcpListener};
+use std::path::PathBuf;
+use std::sync::{Arc, Weak};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use crate::chain::txhashset::BitmapChunk;
+use crate::core::core::hash::{Hash, Hashed};
+use crate::core::core::{
+	FeeFields, KernelFeatures, OutputIdentifier, Segment, SegmentIdentifier, Transaction, TxKernel,
+};
+use crate::core::global;
+use crate::core::pow::Difficulty;
+use crate::p2p::types::{PeerAddr, PeerInfo, TxHashSetRead};
+use crate::p2p::{Capabilities, ChainAdapter, DummyAdapter, Peers};
+use crate::util::secp::pedersen::RangeProof;
+use chrono::prelude::{DateTime, Utc};
+
+fn open_port() -> u16 {
+	let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+	listener.local_addr().unwrap().port()
+}
+
+/// Keeps the txs we have in a map by kernel hash, requesting any we are
+/// missing from the peer announcing them and relaying new ones.
+struct TxAdapter {
+	txs: RwLock<HashMap<Hash, Transaction>>,
+	peers: RwLock<Option<Weak<Peers>>>,
+	dummy: DummyAdapter,
+}
+
+impl TxAdapter {
+	fn new() -> TxAdapter {
+		TxAdapter {
+			txs: RwLock::new(HashMap::new()),
+			peers: RwLock::new(None),
+			dummy: DummyAdapter {},
+		}
+	}
+
+	fn add_tx(&self, tx: Transaction) {
+		self.txs.write().insert(tx.kernels()[0].hash(), tx);
+	}
+
+	fn tx_count(&self) -> usize {
+		self.txs.read().len()
+	}
+
+	fn peer(&self, peer_info: &PeerInfo) -> Option<Arc<p2p::Peer>> {
+		let peers = self.peers.read().as_ref().and_then(|p| p.upgrade())?;
+		peers.get_connected_peer(peer_info.addr)
+	}
+}
+
+impl ChainAdapter for TxAdapter {
+	fn total_difficulty(&self) -> Result<Difficulty, chain::Error> {
+		self.dummy.total_difficulty()
+	}
+	fn total_height(&self) -> Result<u64, chain::Error> {
+		self.dummy.total_height()
+	}
+	fn get_transaction(&self, h: Hash) -> Option<Transaction> {
+		self.txs.read().get(&h).cloned()
+	}
+	fn tx_kernel_received(&self, h: Hash, peer_info: &PeerInfo) -> Result<bool, chain::Error> {
+		if !self.txs.read().contains_key(&h) {
+			if let Some(peer) = self.peer(peer_info) {
+				let _ = peer.send_tx_request(h);
+			}
+		}
+		Ok(true)
+	}
+	fn tx_kernels_received(
+		&self,
+		hashes: &[Hash],
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		let missing: Vec<_> = {
+			let txs = self.txs.read();
+			hashes
+				.iter()
+				.filter(|h| !txs.contains_key(h))
+				.cloned()
+				.collect()
+		};
+		if missing.is_empty() {
+			return Ok(true);
+		}
+		if let Some(peer) = self.peer(peer_info) {
+			let _ = peer.send_txs_request(missing);
+		}
+		Ok(true)
+	}
+	fn transaction_received(&self, tx: Transaction, _stem: bool) -> Result<bool, chain::Error> {
+		if self.get_transaction(tx.kernels()[0].hash()).is_none() {
+			self.add_tx(tx.clone());
+			if let Some(peers) = self.peers.read().as_ref().and_then(|p| p.upgrade()) {
+				peers.broadcast_transaction(&tx);
+			}
+		}
+		Ok(true)
+	}
+	fn compact_block_received(
+		&self,
+		cb: core::core::CompactBlock,
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		self.dummy.compact_block_received(cb, peer_info)
+	}
+	fn header_received(
+		&self,
+		bh: core::core::BlockHeader,
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		self.dummy.header_received(bh, peer_info)
+	}
+	fn block_received(
+		&self,
+		b: core::core::Block,
+		peer_info: &PeerInfo,
+		opts: chain::Options,
+	) -> Result<bool, chain::Error> {
+		self.dummy.block_received(b, peer_info, opts)
+	}
+	fn headers_received(
+		&self,
+		bh: &[core::core::BlockHeader],
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		self.dummy.headers_received(bh, peer_info)
+	}
+	fn locate_headers(
+		&self,
+		locator: &[Hash],
+	) -> Result<Vec<core::core::BlockHeader>, chain::Error> {
+		self.dummy.locate_headers(locator)
+	}
+	fn get_headers_by_height(
+		&self,
+		height: u64,
+	) -> Result<Vec<core::core::BlockHeader>, chain::Error> {
+		self.dummy.get_headers_by_height(height)
+	}
+	fn get_block(&self, h: Hash, peer_info: &PeerInfo) -> Option<core::core::Block> {
+		self.dummy.get_block(h, peer_info)
+	}
+	fn txhashset_read(&self, h: Hash) -> Option<TxHashSetRead> {
+		self.dummy.txhashset_read(h)
+	}
+	fn txhashset_archive_header(&self) -> Result<core::core::BlockHeader, chain::Error> {
+		self.dummy.txhashset_archive_header()
+	}
+	fn txhashset_receive_ready(&self) -> bool {
+		self.dummy.txhashset_receive_ready()
+	}
+	fn txhashset_write(
+		&self,
+		h: Hash,
+		txhashset_data: File,
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		self.dummy.txhashset_write(h, txhashset_data, peer_info)
+	}
+	fn txhashset_download_update(
+		&self,
+		start_time: DateTime<Utc>,
+		downloaded_size: u64,
+		total_size: u64,
+	) -> bool {
+		self.dummy
+			.txhashset_download_update(start_time, downloaded_size, total_size)
+	}
+	fn get_tmp_dir(&self) -> PathBuf {
+		self.dummy.get_tmp_dir()
+	}
+	fn get_tmpfile_pathname(&self, tmpfile_name: String) -> PathBuf {
+		self.dummy.get_tmpfile_pathname(tmpfile_name)
+	}
+	fn get_kernel_segment(
+		&self,
+		hash: Hash,
+		id: SegmentIdentifier,
+	) -> Result<Segment<TxKernel>, chain::Error> {
+		self.dummy.get_kernel_segment(hash, id)
+	}
+	fn get_bitmap_segment(
+		&self,
+		hash: Hash,
+		id: SegmentIdentifier,
+	) -> Result<(Segment<BitmapChunk>, Hash), chain::Error> {
+		self.dummy.get_bitmap_segment(hash, id)
+	}
+	fn get_output_segment(
+		&self,
+		hash: Hash,
+		id: SegmentIdentifier,
+	) -> Result<(Segment<OutputIdentifier>, Hash), chain::Error> {
+		self.dummy.get_output_segment(hash, id)
+	}
+	fn get_rangeproof_segment(
+		&self,
+		hash: Hash,
+		id: SegmentIdentifier,
+	) -> Result<Segment<RangeProof>, chain::Error> {
+		self.dummy.get_rangeproof_segment(hash, id)
+	}
+}
+
+struct Node {
+	server: Arc<p2p::Server>,
+	adapter: Arc<TxAdapter>,
+	stop_state: Arc<StopState>,
+	addr: PeerAddr,
+	db_root: String,
+}
+
+fn start_node(db_root: &str, capabilities: Capabilities) -> Node {
+	let _ = fs::remove_dir_all(db_root);
+	let p2p_config = p2p::P2PConfig {
+		host: "127.0.0.1".parse().unwrap(),
+		port: open_port(),
+		peers_allow: None,
+		peers_deny: None,
+		..p2p::P2PConfig::default()
+	};
+	let adapter = Arc::new(TxAdapter::new());
+	let stop_state = Arc::new(StopState::new());
+	let server = Arc::new(
+		p2p::Server::new(
+			db_root,
+			capabilities,
+			p2p_config.clone(),
+			adapter.clone(),
+			Hash::from_vec(&vec![]),
+			stop_state.clone(),
+		)
+		.unwrap(),
+	);
+	*adapter.peers.write() = Some(Arc::downgrade(&server.peers));
+
+	let listener = server.clone();
+	let _ = thread::spawn(move || listener.listen());
+
+	Node {
+		server,
+		adapter,
+		stop_state,
+		addr: PeerAddr(SocketAddr::new(p2p_config.host, p2p_config.port)),
+		db_root: db_root.to_owned(),
+	}
+}
+
+fn test_tx(n: u32) -> Transaction {
+	let kernel = TxKernel::with_features(KernelFeatures::Plain {
+		fee: FeeFields::from(n + 1),
+	});
+	Transaction::empty().with_kernel(kernel)
+}
+
+// Starts the nodes, connecting the first one to all the others (or every
+// node to every other one), relays txs from the first one and returns the
+// number of msgs and bytes sent across all nodes.
+fn relay_txs(
+	name: &str,
+	num_nodes: usize,
+	full_mesh: bool,
+	capabilities: Capabilities,
+	num_txs: u32,
+) -> (u64, u64) {
+	let nodes: Vec<_> = (0..num_nodes)
+		.map(|n| start_node(&format!(".grin_tx_relay_{}_{}", name, n), capabilities))
+		.collect();
+	thread::sleep(Duration::from_millis(500));
+
+	for (i, node) in nodes.iter().enumerate() {
+		for other in nodes.iter().skip(i + 1) {
+			node.server.connect(other.addr).unwrap();
+		}
+		if !full_mesh {
+			break;
+		}
+	}
+	thread::sleep(Duration::from_millis(500));
+
+	let start = Instant::now();
+	let source = &nodes[0];
+	for n in 0..num_txs {
+		let tx = test_tx(n);
+		source.adapter.add_tx(tx.clone());
+		source.server.peers.broadcast_transaction(&tx);
+	}
+	while nodes
+		.iter()
+		.any(|node| node.adapter.tx_count() < num_txs as usize)
+	{
+		assert!(start.elapsed() < Duration::from_secs(30));
+		thread::sleep(Duration::from_millis(10));
+	}
+	let elapsed = start.elapsed();
+
+	let mut msgs = 0;
+	let mut bytes = 0;
+	let mut connections = 0;
+	for node in &nodes {
+		for peer in node.server.peers.iter().connected() {
+			let sent = peer.tracker().sent_bytes.read();
+			msgs += sent.count_per_min();
+			bytes += sent.bytes_per_min();
+			connections += 1;
+		}
+	}
+	println!(
+		"relaying {} txs over {} connections ({}): {} msgs, {} bytes ({} per tx), in {:?}",
+		num_txs,
+		connections / 2,
+		name,
+		msgs,
+		bytes,
+		bytes / num_txs as u64,
+		elapsed
+	);
+
+	for node in &nodes {
+		node.stop_state.stop();
+		node.server.stop();
+		let _ = fs::remove_dir_all(&node.db_root);
+	}
+	(msgs, bytes)
+}
+
+#[test]
+fn tx_relay_batched() {
+	global::init_global_chain_type(global::ChainTypes::AutomatedTesting);
+	util::init_test_logger();
+
+	let num_txs = 200;
+	let (single_msgs, single_bytes) =
+		relay_txs("single", 4, false, Capabilities::TX_KERNEL_HASH, num_txs);
+	let (batched_msgs, batched_bytes) =
+		relay_txs("batched", 4, false, Capabilities::default(), num_txs);
+
+	// Each tx is announced, requested and sent individually to each peer,
+	// batched we only send the txs individually.
+	assert!(single_msgs >= 3 * 3 * num_txs as u64);
+	assert!(batched_msgs < single_msgs / 2);
+	assert!(batched_bytes < single_bytes);
+}
+
+#[test]
+fn tx_relay_reconciliation() {
+	global::init_global_chain_type(global::ChainTypes::AutomatedTesting);
+	util::init_test_logger();
+
+	let num_txs = 100;
+	let recon = Capabilities::default() | Capabilities::TX_RECONCILIATION;
+	let mut bytes = vec![];
+	for num_nodes in &[3, 6] {
+		let (_, flood_bytes) = relay_txs(
+			&format!("flood_{}", num_nodes),
+			*num_nodes,
+			true,
+			Capabilities::default(),
+			num_txs,
+		);
+		let (_, recon_bytes) = relay_txs(
+			&format!("recon_{}", num_nodes),
+			*num_nodes,
+			true,
+			recon,
+			num_txs,
+		);
+		bytes.push((flood_bytes, recon_bytes));
+	}
+
+	// Flooding announces each tx over every connection, reconciling only
+	// costs anything where the peers' txs differ.
+	let (flood_bytes, recon_bytes) = bytes[bytes.len() - 1];
+	assert!(recon_bytes < flood_bytes);
+}
@@ -26,6 +26,7 @@ use grin_core as core;
 use grin_util as util;
 use std::cmp::Reverse;
 use std::collections::{HashMap, HashSet};
+use std::mem;
 use std::sync::Arc;
 use util::static_secp_instance;
 
@@ -319,26 +320,31 @@ where
 		})
 	}
 
+	/// Revalidate every entry against the chain state at the given header,
+	/// returning the entries that no longer fit and were dropped.
 	pub fn reconcile(
 		&mut self,
 		extra_tx: Option<Transaction>,
 		header: &BlockHeader,
-	) -> Result<(), PoolError> {
-		let existing_entries = self.entries.clone();
-		self.entries.clear();
+	) -> Result<Vec<PoolEntry>, PoolError> {
+		let existing_entries = mem::replace(&mut self.entries, vec![]);
+		let mut dropped = vec![];
 		for x in existing_entries {
-			let _ = self.add_to_pool(x, extra_tx.clone(), header);
+			if self.add_to_pool(x.clone(), extra_tx.clone(), header).is_err() {
+				dropped.push(x);
+			}
 		}
-		Ok(())
+		Ok(dropped)
 	}
 
 	// Use our bucket logic to identify the best transaction for eviction and evict it.
 	// We want to avoid evicting a transaction where another transaction depends on it.
 	// We want to evict a transaction with low fee_rate.
-	pub fn evict_transaction(&mut self) {
-		if let Some(evictable_transaction) = self.bucket_transactions(Weighting::NoLimit).last() {
-			self.entries.retain(|x| x.tx != *evictable_transaction);
-		};
+	// Returns the evicted transaction, if any.
+	pub fn evict_transaction(&mut self) -> Option<Transaction> {
+		let evictable_transaction = self.bucket_transactions(Weighting::NoLimit).pop()?;
+		self.entries.retain(|x| x.tx != evictable_transaction);
+		Some(evictable_transaction)
 	}
 
 	/// Buckets consist of a vec of txs and track the aggregate fee_rate.
@@ -464,17 +470,22 @@ where
 
 	/// Quick reconciliation step - we can evict any txs in the pool where
 	/// inputs or kernels intersect with the block.
-	pub fn reconcile_block(&mut self, block: &Block) {
+	/// Returns the entries removed from the pool.
+	pub fn reconcile_block(&mut self, block: &Block) -> Vec<PoolEntry> {
 		// Filter txs in the pool based on the latest block.
 		// Reject any txs where we see a matching tx kernel in the block.
 		// Also reject any txs where we see a conflicting tx,
 		// where an input is spent in a different tx.
 		let block_inputs: Vec<_> = block.inputs().into();
-		self.entries.retain(|x| {
-			let tx_inputs: Vec<_> = x.tx.inputs().into();
-			!x.tx.kernels().iter().any(|y| block.kernels().contains(y))
-				&& !tx_inputs.iter().any(|y| block_inputs.contains(y))
-		});
+		let (kept, removed): (Vec<_>, Vec<_>) = mem::replace(&mut self.entries, vec![])
+			.into_iter()
+			.partition(|x| {
+				let tx_inputs: Vec<_> = x.tx.inputs().into();
+				!x.tx.kernels().iter().any(|y| block.kernels().contains(y))
+					&& !tx_inputs.iter().any(|y| block_inputs.contains(y))
+			});
+		self.entries = kept;
+		removed
 	}
 
 	/// Size of the pool.
@@ -269,7 +269,9 @@ where
 	// Uses bucket logic to identify the "last" transaction.
 	// No other tx depends on it and it has low fee_rate
 	pub fn evict_from_txpool(&mut self) {
-		self.txpool.evict_transaction()
+		if let Some(tx) = self.txpool.evict_transaction() {
+			self.adapter.tx_evicted(&tx);
+		}
 	}
 
 	// Old txs will "age out" after 30 mins.
@@ -304,8 +306,23 @@ where
 	/// provided block.
 	pub fn reconcile_block(&mut self, block: &Block) -> Result<(), PoolError> {
 		// First reconcile the txpool.
-		self.txpool.reconcile_block(block);
-		self.txpool.reconcile(None, &block.header)?;
+		let removed = self.txpool.reconcile_block(block);
+		let dropped = self.txpool.reconcile(None, &block.header)?;
+
+		// Txs that were dropped but not mined in this block have been evicted.
+		for entry in removed {
+			if !entry
+				.tx
+				.kernels()
+				.iter()
+				.all(|k| block.kernels().contains(k))
+			{
+				self.adapter.tx_evicted(&entry.tx);
+			}
+		}
+		for entry in dropped {
+			self.adapter.tx_evicted(&entry.tx);
+		}
 
 		// Now reconcile our stempool, accounting for the updated txpool txs.
 		self.stempool.reconcile_block(block);
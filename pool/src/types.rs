@@ -315,6 +315,10 @@ pub trait PoolAdapter: Send + Sync {
 
 	/// The stem transaction pool has accepted this transactions as valid.
 	fn stem_tx_accepted(&self, entry: &PoolEntry) -> Result<(), PoolError>;
+
+	/// The transaction pool dropped this transaction without it being mined,
+	/// either to make room for a better one or because it is no longer valid.
+	fn tx_evicted(&self, _tx: &Transaction) {}
 }
 
 /// Dummy adapter used as a placeholder for real implementations
@@ -22,6 +22,7 @@ use std::sync::{Arc, Weak};
 use std::thread;
 use std::time::Instant;
 
+use crate::api;
 use crate::chain::txhashset::BitmapChunk;
 use crate::chain::{
 	self, BlockStatus, ChainAdapter, Options, SyncState, SyncStatus, TxHashsetDownloadStats,
@@ -37,11 +38,12 @@ use crate::core::core::{
 use crate::core::pow::Difficulty;
 use crate::core::ser::ProtocolVersion;
 use crate::core::{core, global};
+use crate::grin::sync::HeaderDownload;
 use crate::p2p;
 use crate::p2p::types::PeerInfo;
 use crate::pool::{self, BlockChain, PoolAdapter};
 use crate::util::secp::pedersen::RangeProof;
-use crate::util::OneTime;
+use crate::util::{OneTime, ToHex};
 use chrono::prelude::*;
 use chrono::Duration;
 use rand::prelude::*;
@@ -64,6 +66,7 @@ where
 	chain: Weak<chain::Chain>,
 	tx_pool: Arc<RwLock<pool::TransactionPool<B, P>>>,
 	peers: OneTime<Weak<p2p::Peers>>,
+	header_download: Arc<HeaderDownload>,
 	config: ServerConfig,
 	hooks: Vec<Box<dyn NetEvents + Send + Sync>>,
 }
@@ -103,6 +106,31 @@ where
 		Ok(true)
 	}
 
+	fn tx_kernels_received(
+		&self,
+		kernel_hashes: &[Hash],
+		peer_info: &PeerInfo,
+	) -> Result<bool, chain::Error> {
+		// nothing much we can do with new transactions while syncing
+		if self.sync_state.is_syncing() {
+			return Ok(true);
+		}
+
+		let missing: Vec<_> = {
+			let tx_pool = self.tx_pool.read();
+			kernel_hashes
+				.iter()
+				.filter(|h| tx_pool.retrieve_tx_by_kernel_hash(**h).is_none())
+				.cloned()
+				.collect()
+		};
+
+		if !missing.is_empty() {
+			self.request_transactions(missing, peer_info);
+		}
+		Ok(true)
+	}
+
 	fn transaction_received(
 		&self,
 		tx: core::Transaction,
@@ -333,6 +361,17 @@ where
 			}
 		};
 
+		// Headers requested by height from this peer are buffered until our
+		// sync_head reaches them.
+		if self
+			.header_download
+			.headers_received(bhs, peer_info.addr, &self.peers())
+		{
+			self.header_download
+				.process_ready(&self.chain(), &self.sync_state, &self.peers());
+			return Ok(true);
+		}
+
 		match self
 			.chain()
 			.sync_block_headers(bhs, sync_head, chain::Options::SYNC)
@@ -342,6 +381,12 @@ where
 				// then update our sync_state so we can request relevant headers in the next batch.
 				if let Some(sync_head) = sync_head {
 					self.sync_state.update_header_sync(sync_head);
+					// Which may let us apply some of the buffered headers.
+					self.header_download.process_ready(
+						&self.chain(),
+						&self.sync_state,
+						&self.peers(),
+					);
 				}
 				Ok(true)
 			}
@@ -359,38 +404,21 @@ where
 	fn locate_headers(&self, locator: &[Hash]) -> Result<Vec<core::BlockHeader>, chain::Error> {
 		debug!("locator: {:?}", locator);
 
-		let header = match self.find_common_header(locator) {
-			Some(header) => header,
-			None => return Ok(vec![]),
-		};
-
-		let max_height = self.chain().header_head()?.height;
-
-		let header_pmmr = self.chain().header_pmmr();
-		let header_pmmr = header_pmmr.read();
-
-		// looks like we know one, getting as many following headers as allowed
-		let hh = header.height;
-		let mut headers = vec![];
-		for h in (hh + 1)..=(hh + (p2p::MAX_BLOCK_HEADERS as u64)) {
-			if h > max_height {
-				break;
-			}
-
-			if let Ok(hash) = header_pmmr.get_header_hash_by_height(h) {
-				let header = self.chain().get_block_header(&hash)?;
-				headers.push(header);
-			} else {
-				error!("Failed to locate headers successfully.");
-				break;
-			}
-		}
+		// looks for the first one we know, getting as many following headers as allowed
+		let headers = self
+			.chain()
+			.locate_headers(locator, p2p::MAX_BLOCK_HEADERS as u64)?;
 
 		debug!("returning headers: {}", headers.len());
 
 		Ok(headers)
 	}
 
+	fn get_headers_by_height(&self, height: u64) -> Result<Vec<core::BlockHeader>, chain::Error> {
+		self.chain()
+			.headers_from_height(height, p2p::MAX_BLOCK_HEADERS as u64)
+	}
+
 	/// Gets a full block by its hash.
 	/// We only support v3 blocks since HF4.
 	/// If a peer is requesting a block and only appears to support v2
@@ -576,6 +604,7 @@ where
 		sync_state: Arc<SyncState>,
 		chain: Arc<chain::Chain>,
 		tx_pool: Arc<RwLock<pool::TransactionPool<B, P>>>,
+		header_download: Arc<HeaderDownload>,
 		config: ServerConfig,
 		hooks: Vec<Box<dyn NetEvents + Send + Sync>>,
 	) -> Self {
@@ -584,6 +613,7 @@ where
 			chain: Arc::downgrade(&chain),
 			tx_pool,
 			peers: OneTime::new(),
+			header_download,
 			config,
 			hooks,
 		}
@@ -608,25 +638,6 @@ where
 			.expect("Failed to upgrade weak ref to our chain.")
 	}
 
-	// Find the first locator hash that refers to a known header on our main chain.
-	fn find_common_header(&self, locator: &[Hash]) -> Option<BlockHeader> {
-		let header_pmmr = self.chain().header_pmmr();
-		let header_pmmr = header_pmmr.read();
-
-		for hash in locator {
-			if let Ok(header) = self.chain().get_block_header(&hash) {
-				if let Ok(hash_at_height) = header_pmmr.get_header_hash_by_height(header.height) {
-					if let Ok(header_at_height) = self.chain().get_block_header(&hash_at_height) {
-						if header.hash() == header_at_height.hash() {
-							return Some(header);
-						}
-					}
-				}
-			}
-		}
-		None
-	}
-
 	// pushing the new block through the chain pipeline
 	// remembering to reset the head if we have a bad block
 	fn process_block(
@@ -734,6 +745,20 @@ where
 		self.send_tx_request_to_peer(h, peer_info, |peer, h| peer.send_tx_request(h))
 	}
 
+	fn request_transactions(&self, hashes: Vec<Hash>, peer_info: &PeerInfo) {
+		match self.peers().get_connected_peer(peer_info.addr) {
+			None => debug!(
+				"request_transactions: can't send request to peer {:?}, not connected",
+				peer_info.addr
+			),
+			Some(peer) => {
+				if let Err(e) = peer.send_txs_request(hashes) {
+					error!("request_transactions: failed: {:?}", e)
+				}
+			}
+		}
+	}
+
 	// After receiving a compact block if we cannot successfully hydrate
 	// it into a full block then fallback to requesting the full block
 	// from the same peer that gave us the compact block
@@ -890,6 +915,7 @@ where
 pub struct PoolToNetAdapter {
 	peers: OneTime<Weak<p2p::Peers>>,
 	dandelion_epoch: Arc<RwLock<DandelionEpoch>>,
+	events: Arc<api::EventBus>,
 }
 
 /// Adapter between the Dandelion monitor and the current Dandelion "epoch".
@@ -921,6 +947,13 @@ impl DandelionAdapter for PoolToNetAdapter {
 impl pool::PoolAdapter for PoolToNetAdapter {
 	fn tx_accepted(&self, entry: &pool::PoolEntry) {
 		self.peers().broadcast_transaction(&entry.tx);
+		self.events
+			.publish(api::EventTopic::PoolAdd, &pool_event(&entry.tx));
+	}
+
+	fn tx_evicted(&self, tx: &Transaction) {
+		self.events
+			.publish(api::EventTopic::PoolEvict, &pool_event(tx));
 	}
 
 	fn stem_tx_accepted(&self, entry: &pool::PoolEntry) -> Result<(), pool::PoolError> {
@@ -956,11 +989,13 @@ impl pool::PoolAdapter for PoolToNetAdapter {
 }
 
 impl PoolToNetAdapter {
-	/// Create a new pool to net adapter
-	pub fn new(config: pool::DandelionConfig) -> PoolToNetAdapter {
+	/// Create a new pool to net adapter, publishing txpool changes to API
+	/// event subscribers.
+	pub fn new(config: pool::DandelionConfig, events: Arc<api::EventBus>) -> PoolToNetAdapter {
 		PoolToNetAdapter {
 			peers: OneTime::new(),
 			dandelion_epoch: Arc::new(RwLock::new(DandelionEpoch::new(config))),
+			events,
 		}
 	}
 
@@ -977,6 +1012,17 @@ impl PoolToNetAdapter {
 	}
 }
 
+// Payload of txpool events, kernel excesses being how wallets identify their
+// transactions.
+fn pool_event(tx: &Transaction) -> serde_json::Value {
+	serde_json::json!({
+		"hash": tx.hash().to_hex(),
+		"kernels": tx.kernels().iter().map(|k| k.excess.to_hex()).collect::<Vec<_>>(),
+		"fee": tx.fee(),
+		"weight": tx.weight(),
+	})
+}
+
 /// Implements the view of the  required by the TransactionPool to
 /// operate. Mostly needed to break any direct lifecycle or implementation
 /// dependency between the pool and the chain.
@@ -19,13 +19,13 @@ extern crate hyper;
 extern crate hyper_rustls;
 extern crate tokio;
 
+use crate::api::{EventBus, EventTopic, ResponseCache};
 use crate::chain::BlockStatus;
-use crate::common::types::{ServerConfig, WebHooksConfig};
+use crate::common::types::{ServerConfig, WebHookDropPolicy, WebHooksConfig};
 use crate::core::core;
 use crate::core::core::hash::Hashed;
 use crate::p2p::types::PeerAddr;
-use futures::TryFutureExt;
-use grin_util::ToHex;
+use grin_util::{Mutex, ToHex};
 use hyper::client::HttpConnector;
 use hyper::header::HeaderValue;
 use hyper::Client;
@@ -33,8 +33,11 @@ use hyper::{Body, Method, Request};
 use hyper_rustls::HttpsConnector;
 use serde::Serialize;
 use serde_json::{json, to_string};
-use std::time::Duration;
+use std::collections::{HashMap, VecDeque};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
 use tokio::runtime::{Builder, Runtime};
+use tokio::sync::Notify;
 
 /// Returns the list of event hooks that will be initialized for network events
 pub fn init_net_hooks(config: &ServerConfig) -> Vec<Box<dyn NetEvents + Send + Sync>> {
@@ -50,9 +53,15 @@ pub fn init_net_hooks(config: &ServerConfig) -> Vec<Box<dyn NetEvents + Send + S
 }
 
 /// Returns the list of event hooks that will be initialized for chain events
-pub fn init_chain_hooks(config: &ServerConfig) -> Vec<Box<dyn ChainEvents + Send + Sync>> {
+pub fn init_chain_hooks(
+	config: &ServerConfig,
+	api_cache: Arc<ResponseCache>,
+	api_events: Arc<EventBus>,
+) -> Vec<Box<dyn ChainEvents + Send + Sync>> {
 	let mut list: Vec<Box<dyn ChainEvents + Send + Sync>> = Vec::new();
 	list.push(Box::new(EventLogger));
+	list.push(Box::new(ApiCacheInvalidator { cache: api_cache }));
+	list.push(Box::new(ApiEventPublisher { events: api_events }));
 	if config.webhook_config.block_accepted_url.is_some() {
 		list.push(Box::new(WebHook::from_config(&config.webhook_config)));
 	}
@@ -167,6 +176,60 @@ impl ChainEvents for EventLogger {
 	}
 }
 
+/// Drops cached API responses as soon as the chain head moves.
+struct ApiCacheInvalidator {
+	cache: Arc<ResponseCache>,
+}
+
+impl ChainEvents for ApiCacheInvalidator {
+	fn on_block_accepted(&self, _block: &core::Block, status: BlockStatus) {
+		if status.is_next() || status.is_reorg() {
+			self.cache.invalidate(status.is_reorg());
+		}
+	}
+}
+
+/// Pushes new chain heads and reorgs to API event subscribers.
+struct ApiEventPublisher {
+	events: Arc<EventBus>,
+}
+
+impl ChainEvents for ApiEventPublisher {
+	fn on_block_accepted(&self, block: &core::Block, status: BlockStatus) {
+		let prev = match status {
+			BlockStatus::Next { prev } => prev,
+			BlockStatus::Reorg {
+				prev,
+				prev_head,
+				fork_point,
+			} => {
+				self.events.publish(
+					EventTopic::Reorg,
+					&json!({
+						"hash": block.hash().to_hex(),
+						"height": block.header.height,
+						"prev_head": prev_head.hash().to_hex(),
+						"fork_point": fork_point.hash().to_hex(),
+						"fork_point_height": fork_point.height,
+						"depth": prev_head.height.saturating_sub(fork_point.height),
+					}),
+				);
+				prev
+			}
+			BlockStatus::Fork { .. } => return,
+		};
+		self.events.publish(
+			EventTopic::Block,
+			&json!({
+				"hash": block.hash().to_hex(),
+				"height": block.header.height,
+				"prev": prev.hash().to_hex(),
+				"total_difficulty": block.header.total_difficulty().to_num(),
+			}),
+		);
+	}
+}
+
 fn parse_url(value: &Option<String>) -> Option<hyper::Uri> {
 	match value {
 		Some(url) => {
@@ -187,56 +250,275 @@ fn parse_url(value: &Option<String>) -> Option<hyper::Uri> {
 	}
 }
 
+/// Delay before retrying a failed webhook request, doubled on each retry.
+const RETRY_DELAY: Duration = Duration::from_millis(100);
+
+/// Max delay between two attempts of a webhook request.
+const MAX_RETRY_DELAY: Duration = Duration::from_secs(10);
+
+/// Interval between two logs of the delivery stats of a webhook url.
+const STATS_LOG_INTERVAL: Duration = Duration::from_secs(60);
+
+/// Dropped events are logged once every so many drops.
+const DROP_LOG_INTERVAL: u64 = 1_000;
+
+/// An event waiting to be delivered.
+struct PendingEvent {
+	payload: String,
+	queued_at: Instant,
+}
+
+/// Delivery stats of a webhook url.
+#[derive(Debug, Clone, Default)]
+struct DeliveryStats {
+	/// Events waiting to be delivered
+	queued: usize,
+	/// Events delivered
+	delivered: u64,
+	/// Events dropped because the queue was full
+	dropped: u64,
+	/// Events dropped after exhausting all retries
+	failed: u64,
+	/// Retried requests
+	retries: u64,
+	/// Time between queuing and delivery of the last delivered event
+	last_lag: Duration,
+	/// Max time between queuing and delivery of an event
+	max_lag: Duration,
+}
+
+enum DeliveryError {
+	/// Connection error, timeout or server error, worth retrying.
+	Transient(String),
+	/// The receiver doesn't want this request.
+	Rejected(hyper::StatusCode),
+}
+
+/// Bounded queue of the events to POST to a webhook url. A single task per
+/// url delivers them in order, in batches of up to `batch_size` events, so a
+/// slow receiver only ever holds one request in flight and the events piling
+/// up are dropped according to the drop policy.
+struct DeliveryQueue {
+	url: hyper::Uri,
+	capacity: usize,
+	batch_size: usize,
+	max_retries: u16,
+	timeout: Duration,
+	drop_policy: WebHookDropPolicy,
+	state: Mutex<(VecDeque<PendingEvent>, DeliveryStats)>,
+	notify: Notify,
+}
+
+impl DeliveryQueue {
+	fn new(url: hyper::Uri, config: &WebHooksConfig) -> DeliveryQueue {
+		DeliveryQueue {
+			url,
+			capacity: config.queue_size.max(1),
+			batch_size: config.batch_size.max(1),
+			max_retries: config.max_retries,
+			timeout: Duration::from_secs(config.timeout as u64),
+			drop_policy: config.drop_policy,
+			state: Mutex::new((VecDeque::new(), DeliveryStats::default())),
+			notify: Notify::new(),
+		}
+	}
+
+	/// Queue an event for delivery, never blocks.
+	fn push(&self, payload: String) {
+		{
+			let mut state = self.state.lock();
+			let (events, stats) = &mut *state;
+			if events.len() >= self.capacity {
+				stats.dropped += 1;
+				if stats.dropped % DROP_LOG_INTERVAL == 1 {
+					warn!(
+						"Webhook queue for {} is full, {} events dropped so far",
+						self.url, stats.dropped
+					);
+				}
+				match self.drop_policy {
+					WebHookDropPolicy::DropNewest => return,
+					WebHookDropPolicy::DropOldest => {
+						events.pop_front();
+					}
+				}
+			}
+			events.push_back(PendingEvent {
+				payload,
+				queued_at: Instant::now(),
+			});
+		}
+		self.notify.notify();
+	}
+
+	fn stats(&self) -> DeliveryStats {
+		let state = self.state.lock();
+		DeliveryStats {
+			queued: state.0.len(),
+			..state.1.clone()
+		}
+	}
+
+	fn next_batch(&self) -> Vec<PendingEvent> {
+		let mut state = self.state.lock();
+		let n = state.0.len().min(self.batch_size);
+		state.0.drain(..n).collect()
+	}
+
+	/// Delivers the queued events, forever.
+	async fn run(self: Arc<Self>, client: Client<HttpsConnector<HttpConnector>>) {
+		let mut last_log = Instant::now();
+		loop {
+			let batch = self.next_batch();
+			if batch.is_empty() {
+				self.notify.notified().await;
+				continue;
+			}
+			let body = if self.batch_size == 1 {
+				batch[0].payload.clone()
+			} else {
+				let payloads: Vec<&str> = batch.iter().map(|e| e.payload.as_str()).collect();
+				format!("[{}]", payloads.join(","))
+			};
+
+			let mut attempt = 0;
+			let res = loop {
+				let res = self.post(&client, body.clone()).await;
+				match res {
+					Err(DeliveryError::Transient(_)) if attempt < self.max_retries => {
+						attempt += 1;
+						self.state.lock().1.retries += 1;
+						let delay = RETRY_DELAY * 2u32.pow((attempt as u32 - 1).min(16));
+						tokio::time::delay_for(delay.min(MAX_RETRY_DELAY)).await;
+					}
+					_ => break res,
+				}
+			};
+
+			{
+				let mut state = self.state.lock();
+				let stats = &mut state.1;
+				match res {
+					Ok(()) => {
+						// Events are queued in order, the first one waited the longest.
+						let lag = batch[0].queued_at.elapsed();
+						stats.delivered += batch.len() as u64;
+						stats.last_lag = lag;
+						stats.max_lag = stats.max_lag.max(lag);
+					}
+					Err(e) => {
+						stats.failed += batch.len() as u64;
+						let reason = match e {
+							DeliveryError::Transient(e) => e,
+							DeliveryError::Rejected(status) => format!("status {}", status),
+						};
+						warn!(
+							"Failed to deliver {} webhook events to {}: {}",
+							batch.len(),
+							self.url,
+							reason
+						);
+					}
+				}
+			}
+
+			if last_log.elapsed() >= STATS_LOG_INTERVAL {
+				info!("Webhook delivery to {}: {:?}", self.url, self.stats());
+				last_log = Instant::now();
+			}
+		}
+	}
+
+	async fn post(
+		&self,
+		client: &Client<HttpsConnector<HttpConnector>>,
+		body: String,
+	) -> Result<(), DeliveryError> {
+		let mut req = Request::new(Body::from(body));
+		*req.method_mut() = Method::POST;
+		*req.uri_mut() = self.url.clone();
+		req.headers_mut().insert(
+			hyper::header::CONTENT_TYPE,
+			HeaderValue::from_static("application/json"),
+		);
+
+		let res = tokio::time::timeout(self.timeout, client.request(req))
+			.await
+			.map_err(|_| DeliveryError::Transient("timeout".to_owned()))?
+			.map_err(|e| DeliveryError::Transient(format!("{}", e)))?;
+		let status = res.status();
+		if status.is_success() {
+			Ok(())
+		} else if status.is_server_error() || status == hyper::StatusCode::TOO_MANY_REQUESTS {
+			Err(DeliveryError::Transient(format!("status {}", status)))
+		} else {
+			Err(DeliveryError::Rejected(status))
+		}
+	}
+}
+
 /// A struct that holds the hyper/tokio runtime.
 struct WebHook {
-	/// url to POST transaction data when a new transaction arrives from a peer
-	tx_received_url: Option<hyper::Uri>,
-	/// url to POST header data when a new header arrives from a peer
-	header_received_url: Option<hyper::Uri>,
-	/// url to POST block data when a new block arrives from a peer
-	block_received_url: Option<hyper::Uri>,
-	/// url to POST block data when a new block is accepted by our node (might be a reorg or a fork)
-	block_accepted_url: Option<hyper::Uri>,
-	/// The hyper client to be used for all requests
-	client: Client<HttpsConnector<HttpConnector>>,
-	/// The tokio event loop
-	runtime: Runtime,
+	/// queue of the url to POST transaction data when a new transaction arrives from a peer
+	tx_received: Option<Arc<DeliveryQueue>>,
+	/// queue of the url to POST header data when a new header arrives from a peer
+	header_received: Option<Arc<DeliveryQueue>>,
+	/// queue of the url to POST block data when a new block arrives from a peer
+	block_received: Option<Arc<DeliveryQueue>>,
+	/// queue of the url to POST block data when a new block is accepted by our node (might be a reorg or a fork)
+	block_accepted: Option<Arc<DeliveryQueue>>,
+	/// The tokio event loop, running the delivery of each queue
+	_runtime: Runtime,
 }
 
 impl WebHook {
-	/// Instantiates a Webhook struct
+	/// Instantiates a Webhook struct, with a delivery queue per url
 	fn new(
 		tx_received_url: Option<hyper::Uri>,
 		header_received_url: Option<hyper::Uri>,
 		block_received_url: Option<hyper::Uri>,
 		block_accepted_url: Option<hyper::Uri>,
-		nthreads: u16,
-		timeout: u16,
+		config: &WebHooksConfig,
 	) -> WebHook {
-		let keep_alive = Duration::from_secs(timeout as u64);
+		let keep_alive = Duration::from_secs(config.timeout as u64);
 
 		info!(
-			"Spawning {} threads for webhooks (timeout set to {} secs)",
-			nthreads, timeout
+			"Spawning {} threads for webhooks (timeout set to {} secs, queue size {}, batch size {})",
+			config.nthreads, config.timeout, config.queue_size, config.batch_size
 		);
 
 		let https = HttpsConnector::new();
 		let client = Client::builder()
 			.pool_idle_timeout(keep_alive)
 			.build::<_, hyper::Body>(https);
+		let runtime = Builder::new()
+			.threaded_scheduler()
+			.enable_all()
+			.core_threads(config.nthreads as usize)
+			.build()
+			.unwrap();
+
+		// Hooks posting to the same url share its queue.
+		let mut queues: HashMap<String, Arc<DeliveryQueue>> = HashMap::new();
+		let mut queue = |url: Option<hyper::Uri>| {
+			url.map(|url| {
+				queues
+					.entry(url.to_string())
+					.or_insert_with(|| {
+						let queue = Arc::new(DeliveryQueue::new(url, config));
+						runtime.spawn(queue.clone().run(client.clone()));
+						queue
+					})
+					.clone()
+			})
+		};
 
 		WebHook {
-			tx_received_url,
-			block_received_url,
-			header_received_url,
-			block_accepted_url,
-			client,
-			runtime: Builder::new()
-				.threaded_scheduler()
-				.enable_all()
-				.core_threads(nthreads as usize)
-				.build()
-				.unwrap(),
+			tx_received: queue(tx_received_url),
+			header_received: queue(header_received_url),
+			block_received: queue(block_received_url),
+			block_accepted: queue(block_accepted_url),
+			_runtime: runtime,
 		}
 	}
 
@@ -247,35 +529,19 @@ impl WebHook {
 			parse_url(&config.header_received_url),
 			parse_url(&config.block_received_url),
 			parse_url(&config.block_accepted_url),
-			config.nthreads,
-			config.timeout,
+			config,
 		)
 	}
 
-	fn post(&self, url: hyper::Uri, data: String) {
-		let mut req = Request::new(Body::from(data));
-		*req.method_mut() = Method::POST;
-		*req.uri_mut() = url.clone();
-		req.headers_mut().insert(
-			hyper::header::CONTENT_TYPE,
-			HeaderValue::from_static("application/json"),
-		);
-
-		let future = self.client.request(req).map_err(move |_res| {
-			warn!("Error sending POST request to {}", url);
-		});
-
-		self.runtime.spawn(future);
-	}
-	fn make_request<T: Serialize>(&self, payload: &T, uri: &Option<hyper::Uri>) -> bool {
-		if let Some(url) = uri {
+	fn make_request<T: Serialize>(&self, payload: &T, queue: &Option<Arc<DeliveryQueue>>) -> bool {
+		if let Some(queue) = queue {
 			let payload = match to_string(payload) {
 				Ok(serialized) => serialized,
 				Err(_) => {
 					return false; // print error message
 				}
 			};
-			self.post(url.clone(), payload);
+			queue.push(payload);
 		}
 		true
 	}
@@ -311,7 +577,7 @@ impl ChainEvents for WebHook {
 			})
 		};
 
-		if !self.make_request(&payload, &self.block_accepted_url) {
+		if !self.make_request(&payload, &self.block_accepted) {
 			error!(
 				"Failed to serialize block {} at height {}",
 				block.hash(),
@@ -328,7 +594,7 @@ impl NetEvents for WebHook {
 			"hash": tx.hash().to_hex(),
 			"data": tx
 		});
-		if !self.make_request(&payload, &self.tx_received_url) {
+		if !self.make_request(&payload, &self.tx_received) {
 			error!("Failed to serialize transaction {}", tx.hash());
 		}
 	}
@@ -340,7 +606,7 @@ impl NetEvents for WebHook {
 			"peer": addr,
 			"data": block
 		});
-		if !self.make_request(&payload, &self.block_received_url) {
+		if !self.make_request(&payload, &self.block_received) {
 			error!(
 				"Failed to serialize block {} at height {}",
 				block.hash().to_hex(),
@@ -356,7 +622,7 @@ impl NetEvents for WebHook {
 			"peer": addr,
 			"data": header
 		});
-		if !self.make_request(&payload, &self.header_received_url) {
+		if !self.make_request(&payload, &self.header_received) {
 			error!(
 				"Failed to serialize header {} at height {}",
 				header.hash(),
@@ -365,3 +631,90 @@ impl NetEvents for WebHook {
 		}
 	}
 }
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use hyper::service::{make_service_fn, service_fn};
+	use hyper::{Response, Server, StatusCode};
+	use std::net::SocketAddr;
+	use std::sync::atomic::{AtomicUsize, Ordering};
+
+	// A flood of events against a receiver taking 20ms per request and
+	// failing one request in 5.
+	#[test]
+	fn webhook_throttled_receiver() {
+		let received = Arc::new(Mutex::new(vec![]));
+		let requests = Arc::new(AtomicUsize::new(0));
+		let runtime = Builder::new()
+			.threaded_scheduler()
+			.enable_all()
+			.build()
+			.unwrap();
+
+		let addr: SocketAddr = "127.0.0.1:14440".parse().unwrap();
+		let (r, q) = (received.clone(), requests.clone());
+		let make_svc = make_service_fn(move |_| {
+			let (r, q) = (r.clone(), q.clone());
+			async move {
+				Ok::<_, hyper::Error>(service_fn(move |req: Request<Body>| {
+					let (r, q) = (r.clone(), q.clone());
+					async move {
+						tokio::time::delay_for(Duration::from_millis(20)).await;
+						if q.fetch_add(1, Ordering::SeqCst) % 5 == 4 {
+							let mut res = Response::new(Body::empty());
+							*res.status_mut() = StatusCode::SERVICE_UNAVAILABLE;
+							return Ok::<_, hyper::Error>(res);
+						}
+						let body = hyper::body::to_bytes(req.into_body()).await?;
+						let events: Vec<u64> = serde_json::from_slice(&body).unwrap();
+						r.lock().extend(events);
+						Ok(Response::new(Body::empty()))
+					}
+				}))
+			}
+		});
+		runtime.spawn(async move { Server::bind(&addr).serve(make_svc).await });
+		std::thread::sleep(Duration::from_millis(200));
+
+		let config = WebHooksConfig {
+			queue_size: 100,
+			batch_size: 10,
+			..WebHooksConfig::default()
+		};
+		let queue = Arc::new(DeliveryQueue::new(
+			format!("http://{}/", addr).parse().unwrap(),
+			&config,
+		));
+		let client = Client::builder().build::<_, hyper::Body>(HttpsConnector::new());
+		runtime.spawn(queue.clone().run(client));
+
+		let start = Instant::now();
+		for i in 0..1_000u64 {
+			queue.push(i.to_string());
+			assert!(queue.stats().queued <= 100);
+		}
+		// Pushing never waits on the receiver.
+		assert!(start.elapsed() < Duration::from_millis(500));
+
+		let stats = loop {
+			let stats = queue.stats();
+			if stats.delivered + stats.dropped + stats.failed == 1_000 {
+				break stats;
+			}
+			assert!(start.elapsed() < Duration::from_secs(30));
+			std::thread::sleep(Duration::from_millis(10));
+		};
+		println!("{:?}, {} requests", stats, requests.load(Ordering::SeqCst));
+
+		assert!(stats.dropped > 0);
+		assert!(stats.retries > 0);
+		assert_eq!(stats.failed, 0);
+		assert!(stats.max_lag >= stats.last_lag);
+		let received = received.lock();
+		assert_eq!(received.len() as u64, stats.delivered);
+		// Delivered in order, the newest events being kept.
+		assert!(received.windows(2).all(|w| w[0] < w[1]));
+		assert_eq!(received.last(), Some(&999));
+	}
+}
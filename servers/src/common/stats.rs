@@ -24,6 +24,7 @@ use crate::core::ser::ProtocolVersion;
 
 use chrono::prelude::*;
 
+use crate::api;
 use crate::chain::SyncStatus;
 use crate::p2p;
 use crate::p2p::Capabilities;
@@ -60,6 +61,10 @@ pub struct ServerStats {
 	pub stratum_stats: StratumStats,
 	/// Peer stats
 	pub peer_stats: Vec<PeerStats>,
+	/// Inbound message queue depth and handler latency, per lane
+	pub dispatch_stats: Vec<p2p::LaneStats>,
+	/// Foreign API response cache hits and misses
+	pub api_cache_stats: api::CacheStats,
 	/// Difficulty calculation statistics
 	pub diff_stats: DiffStats,
 	/// Transaction pool statistics
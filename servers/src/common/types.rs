@@ -151,6 +151,10 @@ pub struct ServerConfig {
 	/// Location of secret for basic auth on v2 Foreign API server.
 	pub foreign_api_secret_path: Option<String>,
 
+	/// Max number of calls in a single JSON-RPC batch request.
+	#[serde(default = "default_api_max_batch_size")]
+	pub api_max_batch_size: usize,
+
 	/// TLS certificate file
 	pub tls_certificate_file: Option<String>,
 	/// TLS certificate private key file
@@ -171,6 +175,10 @@ pub struct ServerConfig {
 	/// Whether this node is a full archival node or a fast-sync, pruned node
 	pub archive_mode: Option<bool>,
 
+	/// Whether to reconcile relayed txs with peers supporting it, rather than
+	/// announcing every tx to every peer
+	pub tx_reconciliation: Option<bool>,
+
 	/// Whether to skip the sync timeout on startup
 	/// (To assist testing on solo chains)
 	pub skip_sync_wait: Option<bool>,
@@ -209,6 +217,10 @@ fn default_future_time_limit() -> u64 {
 	DEFAULT_FUTURE_TIME_LIMIT
 }
 
+fn default_api_max_batch_size() -> usize {
+	api::DEFAULT_MAX_BATCH_SIZE
+}
+
 impl Default for ServerConfig {
 	fn default() -> ServerConfig {
 		ServerConfig {
@@ -216,6 +228,7 @@ impl Default for ServerConfig {
 			api_http_addr: "127.0.0.1:3413".to_string(),
 			api_secret_path: Some(".api_secret".to_string()),
 			foreign_api_secret_path: Some(".foreign_api_secret".to_string()),
+			api_max_batch_size: default_api_max_batch_size(),
 			tls_certificate_file: None,
 			tls_certificate_key: None,
 			p2p_config: p2p::P2PConfig::default(),
@@ -224,6 +237,7 @@ impl Default for ServerConfig {
 			chain_type: ChainTypes::default(),
 			future_time_limit: default_future_time_limit(),
 			archive_mode: Some(false),
+			tx_reconciliation: Some(false),
 			chain_validation_mode: ChainValidationMode::default(),
 			pool_config: pool::PoolConfig::default(),
 			skip_sync_wait: Some(false),
@@ -290,6 +304,34 @@ pub struct WebHooksConfig {
 	/// timeout in seconds for the http request
 	#[serde(default = "default_timeout")]
 	pub timeout: u16,
+	/// max number of events waiting to be delivered, per url
+	#[serde(default = "default_queue_size")]
+	pub queue_size: usize,
+	/// max number of events sent in a single request, as a JSON array
+	/// (events are sent one by one, without array, when set to 1)
+	#[serde(default = "default_batch_size")]
+	pub batch_size: usize,
+	/// number of times a failed request is retried before dropping its events
+	#[serde(default = "default_max_retries")]
+	pub max_retries: u16,
+	/// which events to drop when the queue of a url is full
+	#[serde(default)]
+	pub drop_policy: WebHookDropPolicy,
+}
+
+/// Events dropped when a webhook delivery queue is full.
+#[derive(Debug, Clone, Copy, Serialize, Deserialize, PartialEq)]
+pub enum WebHookDropPolicy {
+	/// Drop the oldest queued event to make room for the new one.
+	DropOldest,
+	/// Drop the new event.
+	DropNewest,
+}
+
+impl Default for WebHookDropPolicy {
+	fn default() -> WebHookDropPolicy {
+		WebHookDropPolicy::DropOldest
+	}
 }
 
 fn default_timeout() -> u16 {
@@ -300,6 +342,18 @@ fn default_nthreads() -> u16 {
 	4
 }
 
+fn default_queue_size() -> usize {
+	1_000
+}
+
+fn default_batch_size() -> usize {
+	1
+}
+
+fn default_max_retries() -> u16 {
+	3
+}
+
 impl Default for WebHooksConfig {
 	fn default() -> WebHooksConfig {
 		WebHooksConfig {
@@ -309,6 +363,10 @@ impl Default for WebHooksConfig {
 			block_accepted_url: None,
 			nthreads: default_nthreads(),
 			timeout: default_timeout(),
+			queue_size: default_queue_size(),
+			batch_size: default_batch_size(),
+			max_retries: default_max_retries(),
+			drop_policy: WebHookDropPolicy::default(),
 		}
 	}
 }
@@ -20,7 +20,6 @@
 use chrono::prelude::{DateTime, Utc};
 use chrono::{Duration, MIN_DATE};
 use p2p::{msg::PeerAddrs, P2PConfig};
-use rand::prelude::*;
 use std::collections::HashMap;
 use std::net::ToSocketAddrs;
 use std::sync::{mpsc, Arc};
@@ -129,33 +128,29 @@ pub fn connect_and_monitor(
 fn monitor_peers(peers: Arc<p2p::Peers>, config: p2p::P2PConfig, tx: mpsc::Sender<PeerAddr>) {
 	// regularly check if we need to acquire more peers and if so, gets
 	// them from db
-	let mut total_count = 0;
-	let mut healthy_count = 0;
-	let mut banned_count = 0;
-	let mut defuncts = vec![];
-
-	for x in peers.all_peer_data().into_iter() {
-		match x.flags {
-			p2p::State::Banned => {
-				let interval = Utc::now().timestamp() - x.last_banned;
-				// Unban peer
-				if interval >= config.ban_window() {
-					if let Err(e) = peers.unban_peer(x.addr) {
-						error!("failed to unban peer {}: {:?}", x.addr, e);
-					}
-					debug!(
-						"monitor_peers: unbanned {} after {} seconds",
-						x.addr, interval
-					);
-				} else {
-					banned_count += 1;
-				}
+	if let Err(e) = peers.flush_peer_data() {
+		error!("monitor_peers: failed to save peers: {:?}", e);
+	}
+
+	let mut banned_count = peers.count_peers(p2p::State::Banned);
+	let banned = peers.find_peers(p2p::State::Banned, p2p::Capabilities::UNKNOWN, banned_count);
+	for x in banned {
+		let interval = Utc::now().timestamp() - x.last_banned;
+		// Unban peer
+		if interval >= config.ban_window() {
+			if let Err(e) = peers.unban_peer(x.addr) {
+				error!("failed to unban peer {}: {:?}", x.addr, e);
 			}
-			p2p::State::Healthy => healthy_count += 1,
-			p2p::State::Defunct => defuncts.push(x),
+			debug!(
+				"monitor_peers: unbanned {} after {} seconds",
+				x.addr, interval
+			);
+			banned_count -= 1;
 		}
-		total_count += 1;
 	}
+	let healthy_count = peers.count_peers(p2p::State::Healthy);
+	let defunct_count = peers.count_peers(p2p::State::Defunct);
+	let total_count = healthy_count + banned_count + defunct_count;
 
 	let peers_iter = || peers.iter().connected();
 	let peers_count = peers_iter().count();
@@ -172,7 +167,7 @@ fn monitor_peers(peers: Arc<p2p::Peers>, config: p2p::P2PConfig, tx: mpsc::Sende
 		total_count,
 		healthy_count,
 		banned_count,
-		defuncts.len(),
+		defunct_count,
 	);
 
 	// maintenance step first, clean up p2p server peers
@@ -218,7 +213,8 @@ fn monitor_peers(peers: Arc<p2p::Peers>, config: p2p::P2PConfig, tx: mpsc::Sende
 
 	// take a random defunct peer and mark it healthy: over a long enough period any
 	// peer will see another as defunct eventually, gives us a chance to retry
-	if let Some(peer) = defuncts.into_iter().choose(&mut thread_rng()) {
+	let defunct = peers.find_peers(p2p::State::Defunct, p2p::Capabilities::UNKNOWN, 1);
+	if let Some(peer) = defunct.first() {
 		let _ = peers.update_state(peer.addr, p2p::State::Healthy);
 	}
 
@@ -70,6 +70,8 @@ pub struct Server {
 	pub sync_state: Arc<SyncState>,
 	/// To be passed around to collect stats and info
 	state_info: ServerStateInfo,
+	/// Foreign API response cache, for its stats
+	api_cache: Arc<api::ResponseCache>,
 	/// Stop flag
 	pub stop_state: Arc<StopState>,
 	/// Maintain a lock_file so we do not run multiple Grin nodes from same dir.
@@ -159,7 +161,11 @@ impl Server {
 		let stop_state = Arc::new(StopState::new());
 
 		let pool_adapter = Arc::new(PoolToChainAdapter::new());
-		let pool_net_adapter = Arc::new(PoolToNetAdapter::new(config.dandelion_config.clone()));
+		let api_events = Arc::new(api::EventBus::new());
+		let pool_net_adapter = Arc::new(PoolToNetAdapter::new(
+			config.dandelion_config.clone(),
+			api_events.clone(),
+		));
 		let tx_pool = Arc::new(RwLock::new(pool::TransactionPool::new(
 			config.pool_config.clone(),
 			pool_adapter.clone(),
@@ -168,9 +174,11 @@ impl Server {
 
 		let sync_state = Arc::new(SyncState::new());
 
+		let api_cache = Arc::new(api::ResponseCache::new());
+
 		let chain_adapter = Arc::new(ChainToPoolAndNetAdapter::new(
 			tx_pool.clone(),
-			init_chain_hooks(&config),
+			init_chain_hooks(&config, api_cache.clone(), api_events.clone()),
 		));
 
 		let genesis = match config.chain_type {
@@ -192,21 +200,27 @@ impl Server {
 
 		pool_adapter.set_chain(shared_chain.clone());
 
+		let header_download = Arc::new(sync::HeaderDownload::new());
+
 		let net_adapter = Arc::new(NetToChainAdapter::new(
 			sync_state.clone(),
 			shared_chain.clone(),
 			tx_pool.clone(),
+			header_download.clone(),
 			config.clone(),
 			init_net_hooks(&config),
 		));
 
 		// Initialize our capabilities.
-		// Currently either "default" or with optional "archive_mode" (block history) support enabled.
-		let capabilities = if let Some(true) = config.archive_mode {
-			Capabilities::default() | Capabilities::BLOCK_HIST
-		} else {
-			Capabilities::default()
-		};
+		// Currently "default" with optional "archive_mode" (block history) and
+		// "tx_reconciliation" support enabled.
+		let mut capabilities = Capabilities::default();
+		if let Some(true) = config.archive_mode {
+			capabilities |= Capabilities::BLOCK_HIST;
+		}
+		if let Some(true) = config.tx_reconciliation {
+			capabilities |= Capabilities::TX_RECONCILIATION;
+		}
 		debug!("Capabilities: {:?}", capabilities);
 
 		let p2p_server = Arc::new(p2p::Server::new(
@@ -260,6 +274,7 @@ impl Server {
 			sync_state.clone(),
 			p2p_server.peers.clone(),
 			shared_chain.clone(),
+			header_download,
 			stop_state.clone(),
 		)?;
 
@@ -299,6 +314,9 @@ impl Server {
 			api_secret,
 			foreign_api_secret,
 			tls_conf,
+			api_cache.clone(),
+			api_events,
+			config.api_max_batch_size,
 		)?;
 
 		info!("Starting dandelion monitor: {}", &config.api_http_addr);
@@ -319,6 +337,7 @@ impl Server {
 			state_info: ServerStateInfo {
 				..Default::default()
 			},
+			api_cache,
 			stop_state,
 			lock_file,
 			connect_thread,
@@ -530,6 +549,8 @@ impl Server {
 			disk_usage_gb: disk_usage_gb,
 			stratum_stats: stratum_stats,
 			peer_stats: peer_stats,
+			dispatch_stats: self.p2p.dispatch_stats(),
+			api_cache_stats: self.api_cache.stats(),
 			diff_stats: diff_stats,
 			tx_stats: tx_stats,
 		})
@@ -15,8 +15,10 @@
 //! Syncing of the chain with the rest of the network
 
 mod body_sync;
+mod header_download;
 mod header_sync;
 mod state_sync;
 mod syncer;
 
+pub use self::header_download::HeaderDownload;
 pub use self::syncer::run_sync;
@@ -130,7 +130,7 @@ impl BodySync {
 		// also if the chain is already saturated with orphans, throttle
 		let block_count = cmp::min(
 			cmp::min(100, peers.len() * 10),
-			chain::MAX_ORPHAN_SIZE.saturating_sub(self.chain.orphans_len()) + 1,
+			self.chain.orphans_room().saturating_add(1),
 		);
 
 		let hashes = self.block_hashes_to_sync(&fork_point, &header_head, block_count as u64)?;
@@ -0,0 +1,604 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Parallel download of block headers from several peers during header sync.
+//!
+//! The locator based request to our sync peer only ever gets us the next
+//! MAX_BLOCK_HEADERS headers above our sync_head. Alongside it we split the
+//! heights further up (to the height claimed by our peers) into chunks aligned
+//! on multiples of MAX_BLOCK_HEADERS and request these by height from several
+//! peers concurrently. Completed chunks are buffered until our sync_head
+//! reaches them and are then applied in order through sync_block_headers,
+//! which validates each header (including its prev_root against our header
+//! MMR), so a chunk is only ever applied on top of the chain we already have.
+
+use chrono::prelude::{DateTime, Utc};
+use chrono::Duration;
+use rand::prelude::*;
+use std::collections::{BTreeMap, HashMap};
+use std::sync::Arc;
+
+use crate::chain::{self, SyncState, SyncStatus, Tip};
+use crate::core::core::hash::Hashed;
+use crate::core::core::BlockHeader;
+use crate::p2p::{self, types::ReasonForBan, Capabilities, Peer, PeerAddr};
+use crate::util::Mutex;
+
+/// Number of headers in a chunk, the most a peer sends us in one go.
+const CHUNK_SIZE: u64 = p2p::MAX_BLOCK_HEADERS as u64;
+
+/// Max number of chunks requested or buffered at any one time.
+const MAX_CHUNKS: usize = 16;
+
+/// Max number of chunks requested from a single peer at any one time.
+const MAX_CHUNKS_PER_PEER: usize = 2;
+
+/// Seconds after which a chunk we have not fully received is requested from
+/// another peer.
+const CHUNK_TIMEOUT_SECS: i64 = 10;
+
+/// Seconds a peer that sent us a chunk of headers not linking up with each
+/// other is left out of the parallel download.
+const EXCLUDE_SECS: i64 = 600;
+
+struct Chunk {
+	peer: PeerAddr,
+	requested: DateTime<Utc>,
+	headers: Vec<BlockHeader>,
+	// peers the chunk was requested from before, having timed out
+	prev_peers: Vec<PeerAddr>,
+}
+
+impl Chunk {
+	fn is_complete(&self) -> bool {
+		self.headers.len() as u64 == CHUNK_SIZE
+	}
+}
+
+/// What became of a batch of headers received from a peer.
+#[derive(Debug, PartialEq)]
+enum Received {
+	/// Not part of a chunk we requested from the peer.
+	NotRequested,
+	/// Added to its chunk.
+	Buffered,
+	/// Part of a chunk since requested from another peer, ignored.
+	Late,
+	/// Headers not forming a chain, or too many of them.
+	Inconsistent,
+	/// Headers not following on from the ones already in the chunk.
+	Unlinked,
+}
+
+/// A complete chunk taken off the buffer once our sync_head reaches it.
+#[derive(Debug, PartialEq)]
+enum Ready {
+	/// The chunk's headers above our sync_head, following on from it.
+	Follows(PeerAddr, Vec<BlockHeader>),
+	/// The first header above our sync_head does not follow on from it.
+	NotFollowing(PeerAddr, BlockHeader),
+	/// Nothing above our sync_head.
+	Empty,
+}
+
+struct DownloadState {
+	// chunks requested or buffered, by start height
+	chunks: BTreeMap<u64, Chunk>,
+	// peers left out of the download, until the given time
+	excluded: HashMap<PeerAddr, DateTime<Utc>>,
+}
+
+impl DownloadState {
+	fn new() -> DownloadState {
+		DownloadState {
+			chunks: BTreeMap::new(),
+			excluded: HashMap::new(),
+		}
+	}
+
+	// Request (again) the chunk at the provided height from the peer,
+	// remembering who it was requested from before.
+	fn assign(&mut self, start: u64, peer: PeerAddr, now: DateTime<Utc>) {
+		let prev_peers = match self.chunks.remove(&start) {
+			Some(chunk) => {
+				let mut prev_peers = chunk.prev_peers;
+				prev_peers.push(chunk.peer);
+				prev_peers
+			}
+			None => vec![],
+		};
+		self.chunks.insert(
+			start,
+			Chunk {
+				peer,
+				requested: now,
+				headers: vec![],
+				prev_peers,
+			},
+		);
+	}
+
+	// Adds a batch of headers from the peer to its chunk, if it is the next
+	// part of it. Inconsistent or unlinked batches drop the chunk and leave
+	// the peer out.
+	fn receive(&mut self, bhs: &[BlockHeader], addr: PeerAddr) -> Received {
+		let first = match bhs.first() {
+			Some(header) => header,
+			None => return Received::NotRequested,
+		};
+		let start = chunk_start(first.height);
+
+		let (consistent, linked) = match self.chunks.get(&start) {
+			Some(chunk)
+				if chunk.peer == addr && start + chunk.headers.len() as u64 == first.height =>
+			{
+				let consistent = bhs.len() as u64 <= CHUNK_SIZE - chunk.headers.len() as u64
+					&& bhs
+						.windows(2)
+						.all(|w| w[1].height == w[0].height + 1 && w[1].prev_hash == w[0].hash());
+				let linked = chunk
+					.headers
+					.last()
+					.map(|last| first.prev_hash == last.hash())
+					.unwrap_or(true);
+				(consistent, linked)
+			}
+			Some(chunk) if chunk.prev_peers.contains(&addr) => return Received::Late,
+			_ => return Received::NotRequested,
+		};
+
+		if !consistent {
+			self.chunks.remove(&start);
+			self.exclude(addr);
+			Received::Inconsistent
+		} else if !linked {
+			self.chunks.remove(&start);
+			self.exclude(addr);
+			Received::Unlinked
+		} else {
+			if let Some(chunk) = self.chunks.get_mut(&start) {
+				chunk.headers.extend_from_slice(bhs);
+			}
+			Received::Buffered
+		}
+	}
+
+	// Take the next complete chunk if our sync_head has reached it.
+	fn take_ready(&mut self, sync_head: &Tip) -> Option<Ready> {
+		self.prune(sync_head.height);
+		let start = match self.chunks.iter().next() {
+			Some((start, chunk)) if *start <= sync_head.height + 1 && chunk.is_complete() => *start,
+			_ => return None,
+		};
+		let chunk = self.chunks.remove(&start)?;
+
+		let headers: Vec<BlockHeader> = chunk
+			.headers
+			.into_iter()
+			.filter(|h| h.height > sync_head.height)
+			.collect();
+		let ready = match headers.first() {
+			Some(header) if header.prev_hash == sync_head.last_block_h => {
+				Ready::Follows(chunk.peer, headers)
+			}
+			Some(header) => Ready::NotFollowing(chunk.peer, header.clone()),
+			None => Ready::Empty,
+		};
+		Some(ready)
+	}
+
+	// Forget the chunks entirely at or below the provided height.
+	fn prune(&mut self, height: u64) {
+		self.chunks = self.chunks.split_off(&chunk_start(height + 1));
+	}
+
+	fn chunks_of(&self, addr: PeerAddr) -> usize {
+		self.chunks.values().filter(|c| c.peer == addr).count()
+	}
+
+	// Leave the peer out for a while, dropping what it has not sent us yet
+	// so it gets requested from someone else.
+	fn exclude(&mut self, addr: PeerAddr) {
+		self.excluded
+			.insert(addr, Utc::now() + Duration::seconds(EXCLUDE_SECS));
+		let incomplete: Vec<u64> = self
+			.chunks
+			.iter()
+			.filter(|(_, c)| c.peer == addr && !c.is_complete())
+			.map(|(start, _)| *start)
+			.collect();
+		for start in incomplete {
+			self.chunks.remove(&start);
+		}
+	}
+}
+
+/// Schedules and reassembles chunks of headers requested by height from
+/// several peers. Shared between the sync thread (scheduling requests) and
+/// the net adapter (receiving headers).
+pub struct HeaderDownload {
+	state: Mutex<DownloadState>,
+	// only one thread applies buffered chunks to the chain at a time
+	processing: Mutex<()>,
+}
+
+impl HeaderDownload {
+	pub fn new() -> HeaderDownload {
+		HeaderDownload {
+			state: Mutex::new(DownloadState::new()),
+			processing: Mutex::new(()),
+		}
+	}
+
+	/// Drop everything requested or buffered, once header sync is done.
+	pub fn reset(&self) {
+		self.state.lock().chunks.clear();
+	}
+
+	/// Requests chunks above the range covered by the locator request from
+	/// our sync_head, and requests again any chunk taking too long from
+	/// another peer. Returns the number of requests sent.
+	pub fn schedule(&self, sync_head: &Tip, peers: &p2p::Peers) -> usize {
+		let now = Utc::now();
+		let mut state = self.state.lock();
+		state.excluded.retain(|_, until| *until > now);
+		state.prune(sync_head.height);
+
+		let mut candidates: Vec<Arc<Peer>> = peers
+			.iter()
+			.with_capabilities(Capabilities::HEADER_HIST | Capabilities::HEADERS_BY_HEIGHT)
+			.with_difficulty(|x| x > sync_head.total_difficulty)
+			.connected()
+			.into_iter()
+			.filter(|p| !state.excluded.contains_key(&p.info.addr))
+			.collect();
+		if candidates.is_empty() {
+			return 0;
+		}
+		candidates.shuffle(&mut thread_rng());
+
+		// Least busy peer claiming at least the end of the chunk.
+		let choose = |state: &DownloadState, start: u64, not: &[PeerAddr]| {
+			candidates
+				.iter()
+				.filter(|p| !not.contains(&p.info.addr))
+				.filter(|p| p.info.height() >= start + CHUNK_SIZE - 1)
+				.map(|p| (state.chunks_of(p.info.addr), p))
+				.filter(|(n, _)| *n < MAX_CHUNKS_PER_PEER)
+				.min_by_key(|(n, _)| *n)
+				.map(|(_, p)| p.clone())
+		};
+
+		let mut sent = 0;
+
+		// Reassign stragglers.
+		let timeout = now - Duration::seconds(CHUNK_TIMEOUT_SECS);
+		let stalled: Vec<(u64, PeerAddr, Vec<PeerAddr>)> = state
+			.chunks
+			.iter()
+			.filter(|(_, c)| !c.is_complete() && c.requested < timeout)
+			.map(|(start, c)| {
+				let mut asked = c.prev_peers.clone();
+				asked.push(c.peer);
+				(*start, c.peer, asked)
+			})
+			.collect();
+		for (start, prev_peer, asked) in stalled {
+			if let Some(peer) = choose(&state, start, &asked) {
+				debug!(
+					"header_download: chunk at {} from {} timed out, asking {}",
+					start, prev_peer, peer.info.addr
+				);
+				state.assign(start, peer.info.addr, now);
+				if peer.send_headers_by_height_request(start).is_ok() {
+					sent += 1;
+				}
+			}
+		}
+
+		// Request new chunks, starting above what the locator request covers.
+		let max_height = candidates
+			.iter()
+			.map(|p| p.info.height())
+			.max()
+			.unwrap_or(0);
+		let mut start = chunk_start_after(sync_head.height + CHUNK_SIZE);
+		while state.chunks.len() < MAX_CHUNKS && start + CHUNK_SIZE - 1 <= max_height {
+			if !state.chunks.contains_key(&start) {
+				let peer = match choose(&state, start, &[]) {
+					Some(peer) => peer,
+					None => break,
+				};
+				state.assign(start, peer.info.addr, now);
+				if peer.send_headers_by_height_request(start).is_ok() {
+					sent += 1;
+				}
+			}
+			start += CHUNK_SIZE;
+		}
+		sent
+	}
+
+	/// Buffers a batch of headers if it is the next part of a chunk we
+	/// requested from this peer. Returns false if the batch is not part of
+	/// the parallel download, to be processed as usual.
+	pub fn headers_received(
+		&self,
+		bhs: &[BlockHeader],
+		addr: PeerAddr,
+		peers: &p2p::Peers,
+	) -> bool {
+		let received = self.state.lock().receive(bhs, addr);
+		match received {
+			Received::NotRequested => return false,
+			Received::Buffered => (),
+			Received::Late => debug!(
+				"header_download: late headers from {} for a reassigned chunk, ignoring",
+				addr
+			),
+			Received::Inconsistent => {
+				info!(
+					"header_download: inconsistent headers from {}, banning",
+					addr
+				);
+				if let Err(e) = peers.ban_peer(addr, ReasonForBan::BadBlockHeader) {
+					error!("header_download: failed to ban peer {}: {:?}", addr, e);
+				}
+			}
+			Received::Unlinked => debug!(
+				"header_download: headers from {} do not follow on, dropping chunk",
+				addr
+			),
+		}
+		true
+	}
+
+	/// Applies buffered chunks to the chain, in order, as long as the next
+	/// one follows on from our current sync_head.
+	pub fn process_ready(&self, chain: &chain::Chain, sync_state: &SyncState, peers: &p2p::Peers) {
+		let _processing = self.processing.lock();
+		loop {
+			let sync_head = match sync_state.status() {
+				SyncStatus::HeaderSync { sync_head, .. } => sync_head,
+				_ => return,
+			};
+
+			let ready = self.state.lock().take_ready(&sync_head);
+			let (addr, headers) = match ready {
+				Some(Ready::Follows(addr, headers)) => (addr, headers),
+				Some(Ready::NotFollowing(addr, header)) => {
+					// Not on our chain, we may be on a fork or the peer is. We
+					// cannot tell which, so only drop the chunk, leaving these
+					// heights to the locator request (which deals with forks)
+					// rather than excluding a peer that may well be honest.
+					debug!(
+						"header_download: header {} at {} from {} does not follow sync_head {}",
+						header.hash(),
+						header.height,
+						addr,
+						sync_head.last_block_h
+					);
+					continue;
+				}
+				Some(Ready::Empty) => continue,
+				None => return,
+			};
+
+			match chain.sync_block_headers(&headers, sync_head, chain::Options::SYNC) {
+				Ok(sync_head) => {
+					if let Some(sync_head) = sync_head {
+						sync_state.update_header_sync(sync_head);
+					}
+				}
+				Err(e) => {
+					debug!(
+						"header_download: headers from {} refused by chain: {:?}",
+						addr, e
+					);
+					if e.is_bad_data() {
+						self.state.lock().exclude(addr);
+						if let Err(e) = peers.ban_peer(addr, ReasonForBan::BadBlockHeader) {
+							error!("header_download: failed to ban peer {}: {:?}", addr, e);
+						}
+					} else {
+						return;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Start of the chunk containing the provided height.
+fn chunk_start(height: u64) -> u64 {
+	if height == 0 {
+		return 0;
+	}
+	(height - 1) / CHUNK_SIZE * CHUNK_SIZE + 1
+}
+
+// Start of the first chunk entirely above the provided height.
+fn chunk_start_after(height: u64) -> u64 {
+	(height + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE + 1
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+	use crate::core::global;
+	use std::net::{IpAddr, Ipv4Addr, SocketAddr};
+
+	fn peer(n: u8) -> PeerAddr {
+		PeerAddr(SocketAddr::new(
+			IpAddr::V4(Ipv4Addr::new(10, 0, 0, n)),
+			3414,
+		))
+	}
+
+	// A chain of headers at heights [from, to).
+	fn headers(from: u64, to: u64) -> Vec<BlockHeader> {
+		let mut prev = BlockHeader::default();
+		prev.height = from - 1;
+		let mut res = vec![];
+		for height in from..to {
+			let mut header = BlockHeader::default();
+			header.height = height;
+			header.prev_hash = prev.hash();
+			res.push(header.clone());
+			prev = header;
+		}
+		res
+	}
+
+	#[test]
+	fn test_receive_out_of_order() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let mut state = DownloadState::new();
+		state.assign(1, peer(1), Utc::now());
+		state.assign(513, peer(2), Utc::now());
+		let first = headers(1, 513);
+		let second = headers(513, 1025);
+
+		// The second chunk completes first, its batches in any order across
+		// chunks.
+		assert_eq!(state.receive(&second[..256], peer(2)), Received::Buffered);
+		assert_eq!(state.receive(&first[..100], peer(1)), Received::Buffered);
+		assert_eq!(state.receive(&second[256..], peer(2)), Received::Buffered);
+		assert!(state.chunks[&513].is_complete());
+		assert!(!state.chunks[&1].is_complete());
+		assert_eq!(state.receive(&first[100..], peer(1)), Received::Buffered);
+		assert!(state.chunks[&1].is_complete());
+
+		// Not a chunk we asked this peer for.
+		assert_eq!(state.receive(&second, peer(1)), Received::NotRequested);
+		assert_eq!(
+			state.receive(&headers(1025, 1100), peer(1)),
+			Received::NotRequested
+		);
+	}
+
+	#[test]
+	fn test_receive_inconsistent() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let mut state = DownloadState::new();
+		state.assign(1, peer(1), Utc::now());
+		state.assign(513, peer(1), Utc::now());
+		state.assign(1025, peer(2), Utc::now());
+
+		let mut bhs = headers(1, 100);
+		bhs.remove(50);
+		assert_eq!(state.receive(&bhs, peer(1)), Received::Inconsistent);
+
+		// Everything incomplete from the peer is dropped, the peer left out.
+		assert_eq!(state.chunks.keys().collect::<Vec<_>>(), vec![&1025]);
+		assert!(state.excluded.contains_key(&peer(1)));
+		assert!(!state.excluded.contains_key(&peer(2)));
+	}
+
+	#[test]
+	fn test_receive_unlinked() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let mut state = DownloadState::new();
+		state.assign(1, peer(1), Utc::now());
+
+		let bhs = headers(1, 100);
+		assert_eq!(state.receive(&bhs[..50], peer(1)), Received::Buffered);
+		// Right heights but from another chain.
+		let other = headers(51, 100);
+		assert_eq!(state.receive(&other, peer(1)), Received::Unlinked);
+		assert!(state.chunks.is_empty());
+		assert!(state.excluded.contains_key(&peer(1)));
+	}
+
+	#[test]
+	fn test_receive_reassigned() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let mut state = DownloadState::new();
+		state.assign(1, peer(1), Utc::now());
+		let bhs = headers(1, 513);
+		assert_eq!(state.receive(&bhs[..100], peer(1)), Received::Buffered);
+
+		// Timed out, now asked from another peer from scratch.
+		state.assign(1, peer(2), Utc::now());
+		assert!(state.chunks[&1].headers.is_empty());
+		assert_eq!(state.chunks_of(peer(1)), 0);
+
+		// Late replies from the first peer are quietly ignored.
+		assert_eq!(state.receive(&bhs[100..200], peer(1)), Received::Late);
+		assert_eq!(state.receive(&bhs[..100], peer(1)), Received::Late);
+		assert!(state.excluded.is_empty());
+
+		assert_eq!(state.receive(&bhs, peer(2)), Received::Buffered);
+		assert!(state.chunks[&1].is_complete());
+	}
+
+	#[test]
+	fn test_take_ready() {
+		global::set_local_chain_type(global::ChainTypes::AutomatedTesting);
+		let mut state = DownloadState::new();
+		state.assign(1, peer(1), Utc::now());
+		state.assign(513, peer(2), Utc::now());
+		let bhs = headers(1, 513);
+		assert_eq!(state.receive(&bhs[..100], peer(1)), Received::Buffered);
+
+		let genesis = BlockHeader::default();
+		let mut fork = genesis.clone();
+		fork.output_mmr_size = 1;
+
+		// Nothing until the chunk is complete.
+		assert_eq!(state.take_ready(&Tip::from_header(&genesis)), None);
+		assert_eq!(state.receive(&bhs[100..], peer(1)), Received::Buffered);
+
+		// Not following on from our sync_head (we may well be the ones on a
+		// fork), the chunk is dropped but the peer not left out.
+		assert_eq!(
+			state.take_ready(&Tip::from_header(&fork)),
+			Some(Ready::NotFollowing(peer(1), bhs[0].clone()))
+		);
+		assert_eq!(state.chunks.keys().collect::<Vec<_>>(), vec![&513]);
+		assert!(state.excluded.is_empty());
+
+		// Only the headers above our sync_head are applied.
+		state.assign(1, peer(1), Utc::now());
+		assert_eq!(state.receive(&bhs, peer(1)), Received::Buffered);
+		assert_eq!(
+			state.take_ready(&Tip::from_header(&bhs[99])),
+			Some(Ready::Follows(peer(1), bhs[100..].to_vec()))
+		);
+		assert_eq!(state.take_ready(&Tip::from_header(&bhs[511])), None);
+	}
+
+	#[test]
+	fn test_chunk_start() {
+		assert_eq!(chunk_start(0), 0);
+		assert_eq!(chunk_start(1), 1);
+		assert_eq!(chunk_start(512), 1);
+		assert_eq!(chunk_start(513), 513);
+		assert_eq!(chunk_start(1500), 1025);
+
+		assert_eq!(chunk_start_after(0), 1);
+		assert_eq!(chunk_start_after(1), 513);
+		assert_eq!(chunk_start_after(512), 513);
+		assert_eq!(chunk_start_after(513), 1025);
+		assert_eq!(chunk_start_after(1000 + CHUNK_SIZE), 1537);
+
+		// a chunk is always above the height we ask for the next one after
+		for height in 0..3000 {
+			let start = chunk_start_after(height);
+			assert!(start > height);
+			assert!(start - height <= CHUNK_SIZE);
+			assert_eq!(chunk_start(start), start);
+		}
+	}
+}
@@ -20,12 +20,14 @@ use crate::chain::{self, SyncState, SyncStatus};
 use crate::common::types::Error;
 use crate::core::core::hash::Hash;
 use crate::core::pow::Difficulty;
+use crate::grin::sync::header_download::HeaderDownload;
 use crate::p2p::{self, types::ReasonForBan, Capabilities, Peer};
 
 pub struct HeaderSync {
 	sync_state: Arc<SyncState>,
 	peers: Arc<p2p::Peers>,
 	chain: Arc<chain::Chain>,
+	header_download: Arc<HeaderDownload>,
 	prev_header_sync: (DateTime<Utc>, u64, u64),
 	syncing_peer: Option<Arc<Peer>>,
 	stalling_ts: Option<DateTime<Utc>>,
@@ -36,11 +38,13 @@ impl HeaderSync {
 		sync_state: Arc<SyncState>,
 		peers: Arc<p2p::Peers>,
 		chain: Arc<chain::Chain>,
+		header_download: Arc<HeaderDownload>,
 	) -> HeaderSync {
 		HeaderSync {
 			sync_state,
 			peers,
 			chain,
+			header_download,
 			prev_header_sync: (Utc::now(), 0, 0),
 			syncing_peer: None,
 			stalling_ts: None,
@@ -74,9 +78,25 @@ impl HeaderSync {
 
 			// Quick check - nothing to sync if we are caught up with the peer.
 			if peer_diff <= sync_head.total_difficulty {
+				self.header_download.reset();
 				return Ok(false);
 			}
 
+			// Keep the parallel download from other peers going in between
+			// locator requests to our sync peer.
+			// Note: applying buffered headers may move our sync_head on.
+			if let SyncStatus::HeaderSync { .. } = self.sync_state.status() {
+				self.header_download
+					.process_ready(&self.chain, &self.sync_state, &self.peers);
+			}
+			let sync_head = match self.sync_state.status() {
+				SyncStatus::HeaderSync { sync_head, .. } => {
+					self.header_download.schedule(&sync_head, &self.peers);
+					sync_head
+				}
+				_ => sync_head,
+			};
+
 			if !self.header_sync_due(sync_head) {
 				return Ok(false);
 			}
@@ -20,6 +20,7 @@ use crate::chain::{self, SyncState, SyncStatus};
 use crate::core::global;
 use crate::core::pow::Difficulty;
 use crate::grin::sync::body_sync::BodySync;
+use crate::grin::sync::header_download::HeaderDownload;
 use crate::grin::sync::header_sync::HeaderSync;
 use crate::grin::sync::state_sync::StateSync;
 use crate::p2p;
@@ -29,12 +30,13 @@ pub fn run_sync(
 	sync_state: Arc<SyncState>,
 	peers: Arc<p2p::Peers>,
 	chain: Arc<chain::Chain>,
+	header_download: Arc<HeaderDownload>,
 	stop_state: Arc<StopState>,
 ) -> std::io::Result<std::thread::JoinHandle<()>> {
 	thread::Builder::new()
 		.name("sync".to_string())
 		.spawn(move || {
-			let runner = SyncRunner::new(sync_state, peers, chain, stop_state);
+			let runner = SyncRunner::new(sync_state, peers, chain, header_download, stop_state);
 			runner.sync_loop();
 		})
 }
@@ -43,6 +45,7 @@ pub struct SyncRunner {
 	sync_state: Arc<SyncState>,
 	peers: Arc<p2p::Peers>,
 	chain: Arc<chain::Chain>,
+	header_download: Arc<HeaderDownload>,
 	stop_state: Arc<StopState>,
 }
 
@@ -51,12 +54,14 @@ impl SyncRunner {
 		sync_state: Arc<SyncState>,
 		peers: Arc<p2p::Peers>,
 		chain: Arc<chain::Chain>,
+		header_download: Arc<HeaderDownload>,
 		stop_state: Arc<StopState>,
 	) -> SyncRunner {
 		SyncRunner {
 			sync_state,
 			peers,
 			chain,
+			header_download,
 			stop_state,
 		}
 	}
@@ -132,6 +137,7 @@ impl SyncRunner {
 			self.sync_state.clone(),
 			self.peers.clone(),
 			self.chain.clone(),
+			self.header_download.clone(),
 		);
 		let mut body_sync = BodySync::new(
 			self.sync_state.clone(),
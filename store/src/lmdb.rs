@@ -284,6 +284,29 @@ impl Store {
 		})
 	}
 
+	/// Gets multiple `Readable` values from the db, provided their keys.
+	/// Note: Reads all values within a single read transaction so they are
+	/// consistent with one another (and will *not* see any uncommitted data).
+	pub fn get_ser_many<T: ser::Readable>(
+		&self,
+		keys: &[Vec<u8>],
+	) -> Result<Vec<Option<T>>, Error> {
+		let lock = self.db.read();
+		let db = lock
+			.as_ref()
+			.ok_or_else(|| Error::NotFoundErr("chain db is None".to_string()))?;
+		let txn = lmdb::ReadTransaction::new(self.env.clone())?;
+		let access = txn.access();
+
+		keys.iter()
+			.map(|key| {
+				self.get_with(key, &access, &db, |_, mut data| {
+					ser::deserialize(&mut data, self.protocol_version()).map_err(From::from)
+				})
+			})
+			.collect()
+	}
+
 	/// Whether the provided key exists
 	pub fn exists(&self, key: &[u8]) -> Result<bool, Error> {
 		let lock = self.db.read();
@@ -18,6 +18,7 @@ use std::ops::Deref;
 use backtrace::Backtrace;
 use std::{panic, thread};
 
+use chrono::{DateTime, Local, SecondsFormat, Utc};
 use log::{Level, Record};
 use log4rs::append::console::ConsoleAppender;
 use log4rs::append::file::FileAppender;
@@ -31,10 +32,17 @@ use log4rs::config::{Appender, Config, Root};
 use log4rs::encode::pattern::PatternEncoder;
 use log4rs::encode::writer::simple::SimpleWriter;
 use log4rs::encode::Encode;
+use log4rs::encode::Write;
 use log4rs::filter::{threshold::ThresholdFilter, Filter, Response};
+use std::cell::RefCell;
 use std::error::Error;
+use std::fmt::Write as _;
+use std::io::Write as _;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
 use std::sync::mpsc;
 use std::sync::mpsc::SyncSender;
+use std::sync::Arc;
+use std::time::Duration;
 
 lazy_static! {
 	/// Flag to observe whether logging was explicitly initialised (don't output otherwise)
@@ -51,6 +59,19 @@ const LOGGING_PATTERN: &str = "{d(%Y%m%d %H:%M:%S%.3f)} {h({l})} {M} - {m}{n}";
 /// 32 log files to rotate over by default
 const DEFAULT_ROTATE_LOG_FILES: u32 = 32 as u32;
 
+/// Max number of records waiting to be written by the async file appender,
+/// records logged while it is full are dropped.
+const ASYNC_LOG_BUFFER_SIZE: usize = 16_384;
+
+/// Format of the log file
+#[derive(Debug, Clone, Copy, Serialize, Deserialize, PartialEq)]
+pub enum LogFormat {
+	/// Same layout as stdout
+	Text,
+	/// One JSON object per line
+	Json,
+}
+
 /// Log Entry
 #[derive(Clone, Serialize, Debug)]
 pub struct LogEntry {
@@ -81,6 +102,10 @@ pub struct LoggingConfig {
 	pub log_max_files: Option<u32>,
 	/// Whether the tui is running (optional)
 	pub tui_running: Option<bool>,
+	/// Whether to write the log file on a dedicated thread (optional)
+	pub log_file_async: Option<bool>,
+	/// Format of the log file (optional)
+	pub log_file_format: Option<LogFormat>,
 }
 
 impl Default for LoggingConfig {
@@ -95,6 +120,8 @@ impl Default for LoggingConfig {
 			log_max_size: Some(1024 * 1024 * 16), // 16 megabytes default
 			log_max_files: Some(DEFAULT_ROTATE_LOG_FILES),
 			tui_running: None,
+			log_file_async: Some(false),
+			log_file_format: Some(LogFormat::Text),
 		}
 	}
 }
@@ -140,6 +167,233 @@ impl Append for ChannelAppender {
 	fn flush(&self) {}
 }
 
+/// Name of the async appender's writer thread.
+const WRITER_THREAD_NAME: &str = "log_writer";
+
+/// How long a flush waits for the writer thread to catch up.
+const FLUSH_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// Log record captured on the logging thread, to be formatted and written by
+/// the log writer thread.
+struct AsyncRecord {
+	time: DateTime<Utc>,
+	level: Level,
+	module: String,
+	message: String,
+}
+
+enum AsyncMsg {
+	Record(AsyncRecord),
+	Flush(SyncSender<()>),
+}
+
+/// Ids of async appenders, to tell them apart in the per thread sender cache.
+static NEXT_APPENDER_ID: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+	/// Each logging thread keeps its own clone of the sender of the last
+	/// async appender it logged to, so log calls don't contend on a lock.
+	static THREAD_SENDER: RefCell<Option<(usize, SyncSender<AsyncMsg>)>> = RefCell::new(None);
+}
+
+/// Appender handing records over to a dedicated writer thread through a
+/// bounded buffer, so logging never waits on the disk. Records logged while
+/// the buffer is full are dropped, the writer reports how many in the log.
+///
+/// The sender behind the lock is only used to give each logging thread its
+/// own clone on its first log call. Those clones keep the buffer open, the
+/// writer thread of a replaced appender exits once every thread that logged
+/// to it has moved on to another appender or ended.
+#[derive(Debug)]
+pub struct AsyncAppender {
+	id: usize,
+	buffer: Mutex<SyncSender<AsyncMsg>>,
+	dropped: Arc<AtomicU64>,
+}
+
+impl AsyncAppender {
+	/// Starts the writer thread, writing lines formatted as `format` through
+	/// the `inner` appender. Lines are complete, `inner` should be configured
+	/// to only encode the message ("{m}{n}").
+	pub fn new(inner: Box<dyn Append>, format: LogFormat, capacity: usize) -> AsyncAppender {
+		let (tx, rx) = mpsc::sync_channel(capacity);
+		let dropped = Arc::new(AtomicU64::new(0));
+		let total_dropped = dropped.clone();
+		thread::Builder::new()
+			.name(WRITER_THREAD_NAME.to_string())
+			.spawn(move || {
+				let mut reported = 0;
+				for msg in rx {
+					match msg {
+						AsyncMsg::Record(record) => {
+							let dropped = total_dropped.load(Ordering::Relaxed);
+							if dropped > reported {
+								let notice = AsyncRecord {
+									time: Utc::now(),
+									level: Level::Warn,
+									module: module_path!().to_owned(),
+									message: format!(
+										"{} log records dropped, log buffer full",
+										dropped - reported
+									),
+								};
+								write_record(inner.as_ref(), format, &notice);
+								reported = dropped;
+							}
+							write_record(inner.as_ref(), format, &record);
+						}
+						AsyncMsg::Flush(done) => {
+							inner.flush();
+							let _ = done.send(());
+						}
+					}
+				}
+				inner.flush();
+			})
+			.expect("failed to start log writer thread");
+		AsyncAppender {
+			id: NEXT_APPENDER_ID.fetch_add(1, Ordering::Relaxed),
+			buffer: Mutex::new(tx),
+			dropped,
+		}
+	}
+
+	/// Total number of records dropped because the buffer was full.
+	pub fn dropped(&self) -> u64 {
+		self.dropped.load(Ordering::Relaxed)
+	}
+
+	/// Sends `msg` through the calling thread's sender, waiting for room in
+	/// the buffer if `wait` is set. Falls back to the shared sender while the
+	/// thread is being torn down.
+	fn send(&self, msg: AsyncMsg, wait: bool) -> bool {
+		let deliver = |tx: &SyncSender<AsyncMsg>, msg: AsyncMsg| {
+			if wait {
+				tx.send(msg).is_ok()
+			} else {
+				tx.try_send(msg).is_ok()
+			}
+		};
+		let mut msg = Some(msg);
+		let sent = THREAD_SENDER.try_with(|cached| {
+			let mut cached = cached.borrow_mut();
+			match *cached {
+				Some((id, _)) if id == self.id => {}
+				_ => *cached = Some((self.id, self.buffer.lock().clone())),
+			}
+			let (_, tx) = cached.as_ref().expect("sender just cached");
+			deliver(tx, msg.take().expect("message not sent yet"))
+		});
+		match sent {
+			Ok(sent) => sent,
+			Err(_) => deliver(
+				&self.buffer.lock(),
+				msg.take().expect("message not sent yet"),
+			),
+		}
+	}
+}
+
+impl Append for AsyncAppender {
+	fn append(&self, record: &Record) -> Result<(), Box<dyn Error + Sync + Send>> {
+		let msg = AsyncMsg::Record(AsyncRecord {
+			time: Utc::now(),
+			level: record.level(),
+			module: record.module_path().unwrap_or("").to_owned(),
+			message: format!("{}", record.args()),
+		});
+		if !self.send(msg, false) {
+			self.dropped.fetch_add(1, Ordering::Relaxed);
+		}
+		Ok(())
+	}
+
+	/// Waits (up to `FLUSH_TIMEOUT`) for all the records logged so far to be
+	/// written. A no-op on the writer thread itself, which would otherwise
+	/// wait on itself, e.g. when flushing from the panic hook.
+	fn flush(&self) {
+		if thread::current().name() == Some(WRITER_THREAD_NAME) {
+			return;
+		}
+		let (tx, rx) = mpsc::sync_channel(1);
+		if self.send(AsyncMsg::Flush(tx), true) {
+			let _ = rx.recv_timeout(FLUSH_TIMEOUT);
+		}
+	}
+}
+
+fn write_record(inner: &dyn Append, format: LogFormat, r: &AsyncRecord) {
+	let line = match format {
+		LogFormat::Text => format!(
+			"{} {} {} - {}",
+			r.time.with_timezone(&Local).format("%Y%m%d %H:%M:%S%.3f"),
+			r.level,
+			r.module,
+			r.message
+		),
+		LogFormat::Json => json_line(&r.time, r.level, &r.module, &r.message),
+	};
+	let _ = inner.append(
+		&Record::builder()
+			.args(format_args!("{}", line))
+			.level(r.level)
+			.module_path(Some(&*r.module))
+			.build(),
+	);
+}
+
+fn json_line(time: &DateTime<Utc>, level: Level, module: &str, message: &str) -> String {
+	let mut line = String::with_capacity(message.len() + module.len() + 64);
+	line.push_str("{\"ts\":\"");
+	line.push_str(&time.to_rfc3339_opts(SecondsFormat::Millis, true));
+	let _ = write!(line, "\",\"level\":\"{}\",\"module\":", level);
+	json_string(&mut line, module);
+	line.push_str(",\"msg\":");
+	json_string(&mut line, message);
+	line.push('}');
+	line
+}
+
+fn json_string(out: &mut String, s: &str) {
+	out.push('"');
+	for c in s.chars() {
+		match c {
+			'"' => out.push_str("\\\""),
+			'\\' => out.push_str("\\\\"),
+			'\n' => out.push_str("\\n"),
+			'\r' => out.push_str("\\r"),
+			'\t' => out.push_str("\\t"),
+			c if (c as u32) < 0x20 => {
+				let _ = write!(out, "\\u{:04x}", c as u32);
+			}
+			c => out.push(c),
+		}
+	}
+	out.push('"');
+}
+
+/// Encodes records as JSON lines, for the synchronous file appender.
+#[derive(Debug)]
+struct JsonEncoder;
+
+impl Encode for JsonEncoder {
+	fn encode(
+		&self,
+		w: &mut dyn Write,
+		record: &Record,
+	) -> Result<(), Box<dyn Error + Sync + Send>> {
+		let line = json_line(
+			&Utc::now(),
+			record.level(),
+			record.module_path().unwrap_or(""),
+			&format!("{}", record.args()),
+		);
+		w.write_all(line.as_bytes())?;
+		w.write_all(b"\n")?;
+		Ok(())
+	}
+}
+
 /// Initialize the logger with the given configuration
 pub fn init_logger(config: Option<LoggingConfig>, logs_tx: Option<mpsc::SyncSender<LogEntry>>) {
 	if let Some(c) = config {
@@ -201,6 +455,16 @@ pub fn init_logger(config: Option<LoggingConfig>, logs_tx: Option<mpsc::SyncSend
 			// If maximum log size is specified, use rolling file appender
 			// or use basic one otherwise
 			let filter = Box::new(ThresholdFilter::new(level_file));
+			let log_async = c.log_file_async.unwrap_or(false);
+			let format = c.log_file_format.unwrap_or(LogFormat::Text);
+			// The async appender formats whole lines itself.
+			let encoder = || -> Box<dyn Encode> {
+				match (log_async, format) {
+					(true, _) => Box::new(PatternEncoder::new("{m}{n}")),
+					(false, LogFormat::Text) => Box::new(PatternEncoder::new(&LOGGING_PATTERN)),
+					(false, LogFormat::Json) => Box::new(JsonEncoder),
+				}
+			};
 			let file: Box<dyn Append> = {
 				if let Some(size) = c.log_max_size {
 					let count = c.log_max_files.unwrap_or_else(|| DEFAULT_ROTATE_LOG_FILES);
@@ -214,7 +478,7 @@ pub fn init_logger(config: Option<LoggingConfig>, logs_tx: Option<mpsc::SyncSend
 					Box::new(
 						RollingFileAppender::builder()
 							.append(c.log_file_append)
-							.encoder(Box::new(PatternEncoder::new(&LOGGING_PATTERN)))
+							.encoder(encoder())
 							.build(c.log_file_path, Box::new(policy))
 							.expect("Failed to create logfile"),
 					)
@@ -222,12 +486,17 @@ pub fn init_logger(config: Option<LoggingConfig>, logs_tx: Option<mpsc::SyncSend
 					Box::new(
 						FileAppender::builder()
 							.append(c.log_file_append)
-							.encoder(Box::new(PatternEncoder::new(&LOGGING_PATTERN)))
+							.encoder(encoder())
 							.build(c.log_file_path)
 							.expect("Failed to create logfile"),
 					)
 				}
 			};
+			let file: Box<dyn Append> = if log_async {
+				Box::new(AsyncAppender::new(file, format, ASYNC_LOG_BUFFER_SIZE))
+			} else {
+				file
+			};
 
 			appenders.push(
 				Appender::builder()
@@ -339,6 +608,8 @@ fn send_panic_to_log() {
 			}
 			None => error!("thread '{}' panicked at '{}'{:?}", thread, msg, backtrace),
 		}
+		// make sure the panic makes it to the log file before we go down
+		log::logger().flush();
 		//also print to stderr
 		let tui_running = *TUI_RUNNING.lock();
 		if !tui_running {
@@ -0,0 +1,218 @@
+// Copyright 2021 The Grin Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use grin_util as util;
+
+use self::util::logger::{AsyncAppender, LogFormat};
+use self::util::Mutex;
+use log::{Level, Record};
+use log4rs::append::file::FileAppender;
+use log4rs::append::Append;
+use log4rs::encode::pattern::PatternEncoder;
+use std::error::Error;
+use std::fs;
+use std::path::Path;
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+const RECORDS: u32 = 100_000;
+
+fn log_hot_loop(appender: &dyn Append) -> Duration {
+	let start = Instant::now();
+	for i in 0..RECORDS {
+		appender
+			.append(
+				&Record::builder()
+					.args(format_args!("hot loop record {} of {}", i, RECORDS))
+					.level(Level::Debug)
+					.module_path(Some("grin_util::logger_test"))
+					.build(),
+			)
+			.unwrap();
+	}
+	start.elapsed()
+}
+
+fn file_appender(path: &Path, pattern: &str) -> Box<dyn Append> {
+	Box::new(
+		FileAppender::builder()
+			.append(false)
+			.encoder(Box::new(PatternEncoder::new(pattern)))
+			.build(path)
+			.unwrap(),
+	)
+}
+
+// Overhead of a log call on a hot loop, writing the file on the calling
+// thread and through the async appender.
+#[test]
+fn async_log_overhead() {
+	let root = Path::new("./target/tmp_logger");
+	fs::create_dir_all(root).unwrap();
+
+	let sync_path = root.join("sync.log");
+	let sync = file_appender(&sync_path, "{d(%Y%m%d %H:%M:%S%.3f)} {l} {M} - {m}{n}");
+	let sync_time = log_hot_loop(sync.as_ref());
+
+	let async_path = root.join("async.log");
+	let appender = AsyncAppender::new(
+		file_appender(&async_path, "{m}{n}"),
+		LogFormat::Json,
+		16_384,
+	);
+	let async_time = log_hot_loop(&appender);
+	appender.flush();
+
+	println!(
+		"{} records: sync file appender {:?}/call, async appender {:?}/call, {} dropped",
+		RECORDS,
+		sync_time / RECORDS,
+		async_time / RECORDS,
+		appender.dropped()
+	);
+
+	let written = fs::read_to_string(&async_path).unwrap();
+	let records: Vec<&str> = written
+		.lines()
+		.filter(|l| l.contains("hot loop record"))
+		.collect();
+	assert_eq!(records.len() as u64, RECORDS as u64 - appender.dropped());
+	assert!(records[0].starts_with("{\"ts\":\""));
+	assert!(records[0].contains("\"level\":\"DEBUG\",\"module\":\"grin_util::logger_test\""));
+	assert!(records[0].ends_with(&format!(" of {}\"}}", RECORDS)));
+
+	fs::remove_dir_all(root).unwrap();
+}
+
+#[derive(Debug)]
+struct SlowAppender {
+	lines: Arc<Mutex<Vec<String>>>,
+}
+
+impl Append for SlowAppender {
+	fn append(&self, record: &Record) -> Result<(), Box<dyn Error + Sync + Send>> {
+		thread::sleep(Duration::from_millis(1));
+		self.lines.lock().push(format!("{}", record.args()));
+		Ok(())
+	}
+
+	fn flush(&self) {}
+}
+
+// A stalled disk drops records instead of blocking the logging thread.
+#[test]
+fn async_log_overflow() {
+	let lines = Arc::new(Mutex::new(vec![]));
+	let appender = AsyncAppender::new(
+		Box::new(SlowAppender {
+			lines: lines.clone(),
+		}),
+		LogFormat::Text,
+		10,
+	);
+
+	let start = Instant::now();
+	for i in 0..1_000 {
+		appender
+			.append(
+				&Record::builder()
+					.args(format_args!("record {}", i))
+					.level(Level::Info)
+					.module_path(Some("grin_util::logger_test"))
+					.build(),
+			)
+			.unwrap();
+	}
+	assert!(start.elapsed() < Duration::from_millis(500));
+	assert!(appender.dropped() > 0);
+
+	// Next record reports the drops.
+	thread::sleep(Duration::from_millis(100));
+	appender
+		.append(
+			&Record::builder()
+				.args(format_args!("last record"))
+				.level(Level::Info)
+				.build(),
+		)
+		.unwrap();
+	appender.flush();
+
+	let lines = lines.lock();
+	assert!(lines
+		.iter()
+		.any(|l| l.ends_with("log records dropped, log buffer full")));
+	assert!(lines[0].contains(" INFO grin_util::logger_test - record 0"));
+}
+
+#[derive(Debug)]
+struct MemAppender {
+	lines: Arc<Mutex<Vec<String>>>,
+}
+
+impl Append for MemAppender {
+	fn append(&self, record: &Record) -> Result<(), Box<dyn Error + Sync + Send>> {
+		self.lines.lock().push(format!("{}", record.args()));
+		Ok(())
+	}
+
+	fn flush(&self) {}
+}
+
+// Threads logging at the same time each go through their own sender, every
+// record still makes it to the writer.
+#[test]
+fn async_log_many_threads() {
+	let lines = Arc::new(Mutex::new(vec![]));
+	let appender = Arc::new(AsyncAppender::new(
+		Box::new(MemAppender {
+			lines: lines.clone(),
+		}),
+		LogFormat::Text,
+		100_000,
+	));
+
+	let threads: Vec<_> = (0..8)
+		.map(|t| {
+			let appender = appender.clone();
+			thread::spawn(move || {
+				for i in 0..1_000 {
+					appender
+						.append(
+							&Record::builder()
+								.args(format_args!("thread {} record {}", t, i))
+								.level(Level::Info)
+								.build(),
+						)
+						.unwrap();
+				}
+				appender.flush();
+			})
+		})
+		.collect();
+	for t in threads {
+		t.join().unwrap();
+	}
+	appender.flush();
+
+	assert_eq!(appender.dropped(), 0);
+	let lines = lines.lock();
+	assert_eq!(lines.len(), 8_000);
+	for t in 0..8 {
+		assert!(lines
+			.iter()
+			.any(|l| l.ends_with(&format!("thread {} record 999", t))));
+	}
+}